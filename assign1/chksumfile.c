@@ -11,6 +11,7 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "snapshot.h"
 #include <openssl/sha.h>
 
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
@@ -31,18 +32,28 @@ int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
     return -1;
   }
 
+  // Resolve all the block locations (and indirect blocks) up front, or take
+  // them from the snapshot.
+  struct inode_blockmap map;
+  err = fs->snap ? snapshot_blockmap(fs->snap, inumber, &map) : inode_blockmap(fs, &in, &map);
+  if (err < 0) {
+    return -1;
+  }
+
   int size = inode_getsize(&in);
   for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
     char buf[DISKIMG_SECTOR_SIZE];
+    const void *data;
     int bno = offset/DISKIMG_SECTOR_SIZE;
 
-    int bytesMoved = file_getblock(fs, inumber, bno, buf);
-    if (bytesMoved < 0)
-      return -1;
-
-    if (!SHA1_Update(&shactx, buf, bytesMoved))
+    // Hash straight out of the image mapping when there is one.
+    int bytesMoved = file_getblock_bymap(fs, &map, bno, buf, &data);
+    if ((bytesMoved < 0) || !SHA1_Update(&shactx, data, bytesMoved)) {
+      inode_blockmap_free(&map);
       return -1;
+    }
   }
+  inode_blockmap_free(&map);
 
   if (!SHA1_Final(chksum, &shactx))
     return -1;
@@ -0,0 +1,148 @@
+/* Header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "dcache.h"
+
+/*
+ * A cached name. Prefix entries use parent 0, which is never a valid inumber.
+ */
+struct dcache_entry {
+    int parent;
+    int inumber;
+    int len;
+    struct dcache_entry *hashnext;   /* Next entry in the same bucket */
+    struct dcache_entry *lruprev;    /* More recently used neighbour */
+    struct dcache_entry *lrunext;    /* Less recently used neighbour */
+    char name[];                     /* len bytes, not NUL terminated */
+};
+
+static inline uint32_t hash_key(int parent, const char *name, int len) {
+    uint32_t hash = 2166136261u ^ (uint32_t) parent;
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void lru_unlink(struct dcache *dc, struct dcache_entry *e) {
+    if (e->lruprev) e->lruprev->lrunext = e->lrunext;
+    else dc->lru = e->lrunext;
+    if (e->lrunext) e->lrunext->lruprev = e->lruprev;
+    else dc->lrutail = e->lruprev;
+}
+
+static void lru_push_front(struct dcache *dc, struct dcache_entry *e) {
+    e->lruprev = NULL;
+    e->lrunext = dc->lru;
+    if (dc->lru) dc->lru->lruprev = e;
+    dc->lru = e;
+    if (dc->lrutail == NULL) dc->lrutail = e;
+}
+
+static struct dcache_entry **find_link(struct dcache *dc, int parent, const char *name, int len) {
+    struct dcache_entry **link = &dc->buckets[hash_key(parent, name, len) & dc->mask];
+    while (*link) {
+        struct dcache_entry *e = *link;
+        if ((e->parent == parent) && (e->len == len) && (memcmp(e->name, name, len) == 0))
+            break;
+        link = &e->hashnext;
+    }
+    return link;
+}
+
+static void remove_entry(struct dcache *dc, struct dcache_entry *e) {
+    struct dcache_entry **link = find_link(dc, e->parent, e->name, e->len);
+    *link = e->hashnext;
+    lru_unlink(dc, e);
+    dc->count--;
+    free(e);
+}
+
+struct dcache *dcache_create(int maxEntries) {
+    if (maxEntries <= 0)
+        return NULL;
+    struct dcache *dc = calloc(1, sizeof(struct dcache));
+    if (dc == NULL)
+        return NULL;
+    int numbuckets = 1;
+    while (numbuckets < maxEntries)
+        numbuckets *= 2;
+    dc->capacity = maxEntries;
+    dc->mask = numbuckets - 1;
+    dc->buckets = calloc(numbuckets, sizeof(struct dcache_entry *));
+    if (dc->buckets == NULL) {
+        free(dc);
+        return NULL;
+    }
+    return dc;
+}
+
+int dcache_get(struct dcache *dc, int parent, const char *name, int len) {
+    struct dcache_entry *e = *find_link(dc, parent, name, len);
+    if (e == NULL)
+        return -1;
+    lru_unlink(dc, e);
+    lru_push_front(dc, e);
+    return e->inumber;
+}
+
+void dcache_put(struct dcache *dc, int parent, const char *name, int len, int inumber) {
+    struct dcache_entry **link = find_link(dc, parent, name, len);
+    if (*link) {
+        (*link)->inumber = inumber;
+        return;
+    }
+    if (dc->count >= dc->capacity) {
+        remove_entry(dc, dc->lrutail);
+        dc->evictions++;
+        // The eviction may have unlinked the chain we were about to append to.
+        link = find_link(dc, parent, name, len);
+    }
+    struct dcache_entry *e = malloc(sizeof(struct dcache_entry) + len);
+    if (e == NULL)
+        return;
+    e->parent = parent;
+    e->inumber = inumber;
+    e->len = len;
+    memcpy(e->name, name, len);
+    e->hashnext = NULL;
+    *link = e;
+    lru_push_front(dc, e);
+    dc->count++;
+}
+
+int dcache_longest_prefix(struct dcache *dc, const char *path, int *prefixlen) {
+    // Try the cut points at each '/' from the end of the path backwards.
+    for (int len = strlen(path) - 1; len > 0; len--) {
+        if ((path[len] != '/') || (path[len - 1] == '/'))
+            continue;
+        int inumber = dcache_get(dc, 0, path, len);
+        if (inumber >= 0) {
+            *prefixlen = len;
+            return inumber;
+        }
+    }
+    return -1;
+}
+
+void dcache_flush(struct dcache *dc) {
+    while (dc->lru)
+        remove_entry(dc, dc->lru);
+}
+
+void dcache_dumpstats(struct dcache *dc, FILE *file) {
+    fprintf(file, "Dcache: %d entries, %"PRIu64" lookups, %"PRIu64" prefixhits, %"PRIu64" hits, "
+            "%"PRIu64" misses, %"PRIu64" evictions\n",
+            dc->count, dc->lookups, dc->prefixhits, dc->hits, dc->misses, dc->evictions);
+}
+
+void dcache_free(struct dcache *dc) {
+    if (dc == NULL)
+        return;
+    dcache_flush(dc);
+    free(dc->buckets);
+    free(dc);
+}
@@ -0,0 +1,62 @@
+#ifndef _DCACHE_H_
+#define _DCACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Bounded cache of name lookups for pathname_lookup().  It holds two kinds
+ * of entries in one LRU ordered table:
+ *   (parent inumber, component) -> inumber    a single directory entry
+ *   (0, absolute directory prefix) -> inumber  a resolved path prefix
+ * so a lookup can start from the longest cached prefix of its path and
+ * only walk the remaining components.
+ */
+struct dcache {
+  int capacity;                   // Maximum number of entries
+  int count;                      // Entries currently cached
+  int mask;                       // Number of buckets - 1
+  struct dcache_entry **buckets;  // Hash chains
+  struct dcache_entry *lru;       // Most recently used entry (list head)
+  struct dcache_entry *lrutail;   // Least recently used entry
+  uint64_t lookups;               // pathname_lookup calls through the cache
+  uint64_t prefixhits;            // Lookups that started from a cached prefix
+  uint64_t hits;                  // Components resolved from the cache
+  uint64_t misses;                // Components resolved from the directory
+  uint64_t evictions;             // Entries dropped to stay within capacity
+};
+
+/**
+ * Allocates a cache of at most maxEntries entries.  Returns NULL on error.
+ */
+struct dcache *dcache_create(int maxEntries);
+
+/**
+ * Returns the inumber cached for (parent, the first len bytes of name), or
+ * -1 if not cached.
+ */
+int dcache_get(struct dcache *dc, int parent, const char *name, int len);
+
+/**
+ * Caches inumber for (parent, the first len bytes of name), evicting the
+ * least recently used entry if the cache is full.
+ */
+void dcache_put(struct dcache *dc, int parent, const char *name, int len, int inumber);
+
+/**
+ * Finds the longest cached directory prefix of the absolute path.  Returns
+ * its inumber and stores the prefix length in *prefixlen, or returns -1 if
+ * no prefix is cached.
+ */
+int dcache_longest_prefix(struct dcache *dc, const char *path, int *prefixlen);
+
+/**
+ * Drops every cached entry (e.g. after the directory tree was modified).
+ */
+void dcache_flush(struct dcache *dc);
+
+void dcache_dumpstats(struct dcache *dc, FILE *file);
+
+void dcache_free(struct dcache *dc);
+
+#endif // _DCACHE_H_
@@ -2,6 +2,8 @@
 #include "inode.h"
 #include "diskimg.h"
 #include "file.h"
+#include "dirindex.h"
+#include "snapshot.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -72,21 +74,36 @@ int directory_findname(struct unixfilesystem *fs, const char *name,
         strncpy((char *)&key.d_name, name, sizeof(key.d_name) - 1);
         // Appending NULL at the last spot - Just in case the name was 13 character long
         key.d_name[sizeof(key.d_name) - 1] = '\0';
+        // A loaded snapshot holds every directory as a sorted name table.
+        if (fs->snap)
+            return snapshot_findname(fs->snap, dirinumber, &key, dirEnt);
         size_t dir_entry_size = sizeof(key);
         int size = inode_getsize(&dirin);
+        // Directories spanning several blocks are searched through a hashed
+        // index of their names rather than block by block.
+        if (size > DISKIMG_SECTOR_SIZE) {
+            struct direntv6 entry = key;
+            int ret = dirindex_findname(fs, dirinumber, &dirin, &entry);
+            if (ret != DIRINDEX_UNAVAILABLE) {
+                if (ret == SUCCESS)
+                    *dirEnt = entry;
+                return ret;
+            }
+        }
         // Loop till we have perused every block in this inode
         for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-            // Preparing directory entry data structure
-            struct direntv6 entries[NUM_DIR_ENTRIES_IN_BLOCK];
+            // Scratch space, only used when the image is not memory-mapped
+            struct direntv6 scratch[NUM_DIR_ENTRIES_IN_BLOCK];
+            const void *entries;
             // Inode block indexes spill over for ever DISKIMG_SECTOR_SIZE bytes */
             int blockNum = offset / DISKIMG_SECTOR_SIZE;
-            int valid_bytes = file_getblock(fs, dirinumber, blockNum, entries);
+            int valid_bytes = file_getblock_ptr(fs, dirinumber, blockNum, scratch, &entries);
             if (valid_bytes < 0)
                 return FAILURE;
             // Calculate number of entries
             size_t num_entries = valid_bytes / dir_entry_size;
             // Using lfind utility to quickly search for the key.
-            struct direntv6 * found = lfind(&key, entries, &num_entries, dir_entry_size, cmp_dir_entries);
+            const struct direntv6 * found = lfind(&key, entries, &num_entries, dir_entry_size, cmp_dir_entries);
             if ((found)) {
                 // Copy the found directory entry and return
                 memcpy(dirEnt, found, dir_entry_size);
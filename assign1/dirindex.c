@@ -0,0 +1,210 @@
+/* Header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "dirindex.h"
+#include "inode.h"
+#include "file.h"
+#include "diskimg.h"
+
+/*
+ * Macros
+ */
+#define DIRINDEX_DIR_BUCKETS 64    /* Buckets for the table of indexed directories */
+#define EMPTY_SLOT -1
+#define NAME_SIZE sizeof(((struct direntv6 *)0)->d_name)
+
+/*
+ * Index of a single directory
+ */
+struct dirindex_dir {
+    int dirinumber;
+    int size;                     /* Directory size when the index was built */
+    uint16_t mtime[2];            /* Directory mtime when the index was built */
+    int numentries;
+    struct direntv6 *entries;     /* Copy of the directory entries */
+    int mask;                     /* Number of slots - 1, slots is a power of 2 */
+    int *slots;                   /* Open addressing table of entry indexes */
+    struct dirindex_dir *next;    /* Chain of directories in the same bucket */
+};
+
+/*
+ * FNV-1a hash of the full 14 byte name, matching the memcmp based comparison
+ * directory_findname does.
+ */
+static inline uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < NAME_SIZE; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void free_dir(struct dirindex_dir *dir) {
+    free(dir->entries);
+    free(dir->slots);
+    free(dir);
+}
+
+/*
+ * Reads all the entries of the directory and hashes them.
+ * Returns NULL on error.
+ */
+static struct dirindex_dir *build_dir(struct unixfilesystem *fs, int dirinumber, struct inode *dirinp) {
+    struct inode_blockmap map;
+    if (inode_blockmap(fs, dirinp, &map) < 0)
+        return NULL;
+
+    struct dirindex_dir *dir = calloc(1, sizeof(struct dirindex_dir));
+    int size = inode_getsize(dirinp);
+    int maxentries = size / sizeof(struct direntv6);
+    int numslots = 2;
+    while (numslots < 2 * maxentries)
+        numslots *= 2;
+    if (dir) {
+        dir->entries = malloc((maxentries ? maxentries : 1) * sizeof(struct direntv6));
+        dir->slots = malloc(numslots * sizeof(int));
+    }
+    if (!(dir) || !(dir->entries) || !(dir->slots))
+        goto error;
+
+    dir->dirinumber = dirinumber;
+    dir->size = size;
+    dir->mtime[0] = dirinp->i_mtime[0];
+    dir->mtime[1] = dirinp->i_mtime[1];
+    dir->mask = numslots - 1;
+    memset(dir->slots, EMPTY_SLOT, numslots * sizeof(int));
+
+    for (int blockNum = 0; blockNum < map.numBlocks; blockNum++) {
+        char scratch[DISKIMG_SECTOR_SIZE];
+        const void *data;
+        int valid_bytes = file_getblock_bymap(fs, &map, blockNum, scratch, &data);
+        if (valid_bytes < 0)
+            goto error;
+        int numentries = valid_bytes / sizeof(struct direntv6);
+        memcpy(&dir->entries[dir->numentries], data, numentries * sizeof(struct direntv6));
+        dir->numentries += numentries;
+    }
+
+    for (int index = 0; index < dir->numentries; index++) {
+        const char *name = dir->entries[index].d_name;
+        int slot = hash_name(name) & dir->mask;
+        while (dir->slots[slot] != EMPTY_SLOT) {
+            // Like a linear search, the first of duplicate names wins
+            if (memcmp(dir->entries[dir->slots[slot]].d_name, name, NAME_SIZE) == 0)
+                break;
+            slot = (slot + 1) & dir->mask;
+        }
+        if (dir->slots[slot] == EMPTY_SLOT)
+            dir->slots[slot] = index;
+    }
+    inode_blockmap_free(&map);
+    return dir;
+
+error:
+    inode_blockmap_free(&map);
+    if (dir)
+        free_dir(dir);
+    return NULL;
+}
+
+/*
+ * Function : dirindex_findname
+ * Usage : int ret = dirindex_findname(fs, dirinumber, &dirin, &dirEnt);
+ * --------------------------------------------------------------------------
+ * Looks up dirEnt->d_name through the hashed index of the directory, building
+ * (or rebuilding a stale) index first if needed.
+ * Returns 0/SUCCESS if found, -1/FAILURE if not, DIRINDEX_UNAVAILABLE on error.
+ */
+int dirindex_findname(struct unixfilesystem *fs, int dirinumber, struct inode *dirinp,
+                      struct direntv6 *dirEnt) {
+    if (fs->dindex == NULL) {
+        struct dirindex *index = calloc(1, sizeof(struct dirindex));
+        if (index == NULL)
+            return DIRINDEX_UNAVAILABLE;
+        index->numbuckets = DIRINDEX_DIR_BUCKETS;
+        index->dirs = calloc(index->numbuckets, sizeof(struct dirindex_dir *));
+        if (index->dirs == NULL) {
+            free(index);
+            return DIRINDEX_UNAVAILABLE;
+        }
+        fs->dindex = index;
+    }
+
+    struct dirindex *index = fs->dindex;
+    struct dirindex_dir **link = &index->dirs[dirinumber % index->numbuckets];
+    struct dirindex_dir *dir = *link;
+    while ((dir) && (dir->dirinumber != dirinumber))
+        dir = dir->next;
+
+    if ((dir) && ((dir->size != inode_getsize(dirinp)) ||
+                  (dir->mtime[0] != dirinp->i_mtime[0]) || (dir->mtime[1] != dirinp->i_mtime[1]))) {
+        // Directory changed since it was indexed
+        dirindex_invalidate(fs, dirinumber);
+        dir = NULL;
+    }
+
+    if (dir == NULL) {
+        dir = build_dir(fs, dirinumber, dirinp);
+        if (dir == NULL)
+            return DIRINDEX_UNAVAILABLE;
+        index->builds++;
+        dir->next = *link;
+        *link = dir;
+    }
+
+    index->lookups++;
+    int slot = hash_name(dirEnt->d_name) & dir->mask;
+    while (dir->slots[slot] != EMPTY_SLOT) {
+        const struct direntv6 *entry = &dir->entries[dir->slots[slot]];
+        if (memcmp(entry->d_name, dirEnt->d_name, NAME_SIZE) == 0) {
+            *dirEnt = *entry;
+            return SUCCESS;
+        }
+        slot = (slot + 1) & dir->mask;
+    }
+    return FAILURE;
+}
+
+/*
+ * Function : dirindex_invalidate
+ * Usage : dirindex_invalidate(fs, dirinumber);
+ * ------------------------------------------------
+ * Drops the cached index of the directory so the next lookup rebuilds it.
+ */
+void dirindex_invalidate(struct unixfilesystem *fs, int dirinumber) {
+    if ((fs == NULL) || (fs->dindex == NULL))
+        return;
+    struct dirindex_dir **link = &fs->dindex->dirs[dirinumber % fs->dindex->numbuckets];
+    while (*link) {
+        if ((*link)->dirinumber == dirinumber) {
+            struct dirindex_dir *dir = *link;
+            *link = dir->next;
+            free_dir(dir);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+void dirindex_dumpstats(struct dirindex *index, FILE *file) {
+    fprintf(file, "Dirindex: %"PRIu64" directories indexed, %"PRIu64" lookups\n",
+            index->builds, index->lookups);
+}
+
+void dirindex_free(struct dirindex *index) {
+    if (index == NULL)
+        return;
+    for (int bucket = 0; bucket < index->numbuckets; bucket++) {
+        struct dirindex_dir *dir = index->dirs[bucket];
+        while (dir) {
+            struct dirindex_dir *next = dir->next;
+            free_dir(dir);
+            dir = next;
+        }
+    }
+    free(index->dirs);
+    free(index);
+}
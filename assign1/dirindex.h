@@ -0,0 +1,47 @@
+#ifndef _DIRINDEX_H_
+#define _DIRINDEX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "unixfilesystem.h"
+#include "direntv6.h"
+
+#define DIRINDEX_UNAVAILABLE -2  // Index could not be built, search linearly
+
+/**
+ * Per-directory name indexes, cached in the filesystem handle.  Each indexed
+ * directory maps the 14 byte d_name of its entries to the entry through an
+ * open addressing hash table.  Indexes are built lazily on the first lookup
+ * in a directory.
+ */
+struct dirindex {
+  int numbuckets;               // Buckets in the directory table
+  struct dirindex_dir **dirs;   // Indexed directories, chained by inumber
+  uint64_t builds;              // Directory indexes built
+  uint64_t lookups;             // Names looked up through an index
+};
+
+/**
+ * Looks up the name in dirEnt->d_name (already padded/terminated the way
+ * directory_findname compares it) in the directory dirinumber, whose inode
+ * is dirinp.  Builds the index of the directory first if needed.  Returns 0
+ * and fills in dirEnt if found, -1 if not found, or DIRINDEX_UNAVAILABLE if
+ * the index could not be built.
+ */
+int dirindex_findname(struct unixfilesystem *fs, int dirinumber, struct inode *dirinp,
+                      struct direntv6 *dirEnt);
+
+/**
+ * Drops the cached index of the specified directory, if any.  Indexes are
+ * also rebuilt automatically when the directory's size or mtime changes.
+ */
+void dirindex_invalidate(struct unixfilesystem *fs, int dirinumber);
+
+/**
+ * Prints how many directory indexes were built and names looked up.
+ */
+void dirindex_dumpstats(struct dirindex *index, FILE *file);
+
+void dirindex_free(struct dirindex *index);
+
+#endif // _DIRINDEX_H_
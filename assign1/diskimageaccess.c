@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "diskimg.h"
 #include "unixfilesystem.h"
@@ -12,20 +13,61 @@
 #include "directory.h"
 #include "pathname.h"
 #include "chksumfile.h"
+#include "inodecache.h"
+#include "dcache.h"
+#include "dirindex.h"
+#include "inodescan.h"
+#include "snapshot.h"
 
 int quietFlag = 0; 
 int idumpFlag = 0;
 int pdumpFlag = 0;
+int mmapFlag = 0;
+int icacheSize = 0;
+int dcacheSize = 0;
+int numWorkers = 1;
+char *snapshotOut = NULL;
+char *snapshotIn = NULL;
+
+/**
+ * One checksum computed by the parallel mode.  The main thread queues the
+ * jobs in the order the sequential dump would visit them; workers fill in
+ * the results, which are then printed in queue order so the output is the
+ * same as with one worker.
+ */
+struct chksumjob {
+  int inumber;
+  char *pathname;                 // NULL for an inode checksum job
+  int mode;
+  int size;
+  int status;                     // 0 on success, -1 if the checksum failed
+  int mismatch;                   // pathname and inode checksums differ
+  int done;                       // computed while queueing, workers skip it
+  char chksum[CHKSUMFILE_SIZE];
+};
+
+struct chksumqueue {
+  struct unixfilesystem *fs;
+  struct chksumjob *jobs;
+  int numjobs;
+  int maxjobs;
+  int nextjob;                    // next job a worker will claim
+  pthread_mutex_t lock;
+};
 
 static void PrintDirectory(struct unixfilesystem *fs,  char *pathname);
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f);
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f);
 static void PrintUsageAndExit(char *progname);
+static void RunChksumQueue(struct chksumqueue *queue);
+static void FreeChksumQueue(struct chksumqueue *queue);
+static int QueueChksumJob(struct chksumqueue *queue, int inumber, const char *pathname, struct inode *inp);
+static void ComputeChksumJob(struct unixfilesystem *fs, struct chksumjob *job);
 static int GetDirEntries(struct unixfilesystem *fs, int inumber, struct direntv6 *entries, int maxNumEntries);
 
 int main(int argc, char *argv[]) {
   int opt;
-  while ((opt = getopt(argc, argv, "iqp")) != -1) {
+  while ((opt = getopt(argc, argv, "iqpmc:n:t:s:S:")) != -1) {
     switch (opt) {
     case 'q':
       quietFlag = 1;
@@ -36,6 +78,25 @@ int main(int argc, char *argv[]) {
     case 'p':
       pdumpFlag = 1;
       break;
+    case 'm':
+      mmapFlag = 1;
+      break;
+    case 'c':
+      icacheSize = atoi(optarg);
+      break;
+    case 'n':
+      dcacheSize = atoi(optarg);
+      break;
+    case 't':
+      numWorkers = atoi(optarg);
+      if (numWorkers < 1) PrintUsageAndExit(argv[0]);
+      break;
+    case 's':
+      snapshotIn = optarg;
+      break;
+    case 'S':
+      snapshotOut = optarg;
+      break;
     default: 
       PrintUsageAndExit(argv[0]);
     } 
@@ -53,12 +114,30 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  struct unixfilesystem *fs = unixfilesystem_init(fd);
+  if (mmapFlag && diskimg_map(fd) < 0) {
+    fprintf(stderr, "Can't memory-map diskimagePath %s\n", diskpath);
+    exit(EXIT_FAILURE);
+  }
+
+  struct unixfilesystem *fs = unixfilesystem_init_icache(fd, icacheSize);
   if (!fs) {
     fprintf(stderr, "Failed to initialize unix filesystem\n");
     exit(EXIT_FAILURE);
   }
 
+  if (dcacheSize > 0 && (fs->dcache = dcache_create(dcacheSize)) == NULL) {
+    fprintf(stderr, "Can't allocate dentry cache\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (snapshotOut && snapshot_write(fs, snapshotOut) < 0) {
+    fprintf(stderr, "Can't write snapshot %s\n", snapshotOut);
+    exit(EXIT_FAILURE);
+  }
+
+  // A stale or damaged snapshot is reported and the image is used directly.
+  if (snapshotIn) fs->snap = snapshot_open(fs, snapshotIn);
+
   if (!quietFlag) {  
     int disksize = diskimg_getsize(fd);
     if (disksize < 0) {
@@ -66,7 +145,7 @@ int main(int argc, char *argv[]) {
       // Cast the result of diskimg_close to void so the compiler doesn't
       // complain that we're ignoring its return value.
       (void) diskimg_close(fd);
-      free(fs);
+      unixfilesystem_free(fs);
       exit(EXIT_FAILURE);
     }
     printf("Disk %s is %d bytes (%d KB)\n", argv[1],  disksize, disksize/1024);
@@ -79,9 +158,14 @@ int main(int argc, char *argv[]) {
   if (idumpFlag) DumpInodeChecksum(fs, stdout);
   if (pdumpFlag) DumpPathnameChecksum(fs, stdout);
 
+  // Stats go to stderr so the dump output can still be diffed.
+  if (fs->icache) inodecache_dumpstats(fs->icache, stderr);
+  if (fs->dcache) dcache_dumpstats(fs->dcache, stderr);
+  if (fs->dindex) dirindex_dumpstats(fs->dindex, stderr);
+
   int err = diskimg_close(fd);
   if (err < 0) fprintf(stderr, "Error closing %s\n", argv[1]);
-  free(fs);
+  unixfilesystem_free(fs);
   exit(EXIT_SUCCESS);
   return 0;
 }
@@ -93,14 +177,22 @@ int main(int argc, char *argv[]) {
  * format.
  */
 static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f) {
-  for (int inumber = 1; inumber < fs->superblock.s_isize*16; inumber++) {
-    struct inode in;
-    if (inode_iget(fs, inumber, &in) < 0) {
-      fprintf(stderr,"Can't read inode %d \n", inumber);
-      return;
-    }
-    if ((in.i_mode & IALLOC) == 0) {
-      // Skip this inode if it's not allocated.
+  struct chksumqueue queue = { .fs = fs };
+
+  // Sweep the inode region sequentially; the scan skips unallocated inodes.
+  struct inode_scan scan;
+  if (inode_scan_init(&scan, fs, 0, 2) < 0) {
+    fprintf(stderr, "Can't scan the inodes\n");
+    return;
+  }
+
+  int inumber, ret;
+  struct inode in;
+  while ((ret = inode_scan_next(&scan, &inumber, &in)) > 0) {
+    if (inumber >= fs->superblock.s_isize*16) break;
+
+    if (numWorkers > 1) {
+      if (QueueChksumJob(&queue, inumber, NULL, &in) < 0) break;
       continue;
     }
 
@@ -116,44 +208,86 @@ static void DumpInodeChecksum(struct unixfilesystem *fs, FILE *f) {
     int size = inode_getsize(&in);
     fprintf(f, "Inode %d mode 0x%x size %d checksum %s\n",inumber,in.i_mode, size, chksumstring);
   }
+  if (ret < 0) {
+    fprintf(stderr,"Can't read inode %d \n", scan.nextInumber);
+  }
+  inode_scan_close(&scan);
+
+  if (numWorkers <= 1) return;
+
+  RunChksumQueue(&queue);
+  for (int i = 0; i < queue.numjobs; i++) {
+    struct chksumjob *job = &queue.jobs[i];
+    if (job->status < 0) {
+      fprintf(stderr, "Inode %d can't compute chksum\n", job->inumber);
+      continue;
+    }
+    char chksumstring[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string(job->chksum, chksumstring);
+    fprintf(f, "Inode %d mode 0x%x size %d checksum %s\n",job->inumber,job->mode, job->size, chksumstring);
+  }
+  FreeChksumQueue(&queue);
 }
 
 /**
- * Output to the specified file the checksum of the specified pathname and
- * inode as well as all its children if it is a directory.
- *
- * This is used by the grading script, so be careful not to change its output
- * format.
+ * Output to the specified file the checksum of the specified pathname after
+ * checking it against the checksum of its inode.  Returns -1 if either can't
+ * be computed or they differ, 0 otherwise.
  */
-static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname, int inumber, FILE *f) {
-  struct inode in;
-  if (inode_iget(fs, inumber, &in) < 0) {
-    fprintf(stderr,"Can't read inode %d \n", inumber);
-    return;
-  }
-  assert(in.i_mode & IALLOC);
-
+static int PrintPathChecksum(struct unixfilesystem *fs, const char *pathname, int inumber, struct inode *inp, FILE *f) {
   char chksum1[CHKSUMFILE_SIZE];
   if (chksumfile_byinumber(fs, inumber, chksum1) < 0) {
     fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
-    return;
+    return -1;
   }
 
   char chksum2[CHKSUMFILE_SIZE];
   if (chksumfile_bypathname(fs, pathname, chksum2) < 0) {
     fprintf(stderr,"Can't checksum inode %d path %s\n", inumber, pathname);
-    return;
+    return -1;
   }
 
   if (!chksumfile_compare(chksum1, chksum2)) {
     fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", pathname, inumber);
-    return;
+    return -1;
   }
 
   char chksumstring[CHKSUMFILE_STRINGSIZE];
   chksumfile_cvt2string(chksum2, chksumstring);
-  int size = inode_getsize(&in);
-  fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n",pathname,inumber,in.i_mode, size, chksumstring);
+  int size = inode_getsize(inp);
+  fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n",pathname,inumber,inp->i_mode, size, chksumstring);
+  return 0;
+}
+
+/**
+ * Output to the specified file the checksum of the specified pathname and
+ * inode as well as all its children if it is a directory.  With a queue the
+ * checksums are only queued for the worker threads.
+ *
+ * This is used by the grading script, so be careful not to change its output
+ * format.
+ */
+static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname, int inumber, FILE *f, struct chksumqueue *queue) {
+  struct inode in;
+  if (inode_iget(fs, inumber, &in) < 0) {
+    fprintf(stderr,"Can't read inode %d \n", inumber);
+    return;
+  }
+  assert(in.i_mode & IALLOC);
+
+  if (queue) {
+    if (QueueChksumJob(queue, inumber, pathname, &in) < 0) return;
+    if ((in.i_mode & IFMT) == IFDIR) {
+      // Whether to descend depends on the directory's checksum, as below,
+      // so it can't wait for the workers.
+      struct chksumjob *job = &queue->jobs[queue->numjobs-1];
+      ComputeChksumJob(fs, job);
+      job->done = 1;
+      if (job->status < 0 || job->mismatch) return;
+    }
+  } else if (PrintPathChecksum(fs, pathname, inumber, &in, f) < 0) {
+    return;
+  }
 
   if (pathname[1] == 0) {
     /* pathame == "/" */
@@ -179,7 +313,7 @@ static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname,
 
         char nextpath[MAXPATH];
         sprintf(nextpath, "%s/%s",pathname, direntries[i].d_name);
-        DumpPathAndChildren(fs, nextpath,  direntries[i].d_inumber, f);
+        DumpPathAndChildren(fs, nextpath,  direntries[i].d_inumber, f, queue);
       }
   }
 }
@@ -190,7 +324,139 @@ static void DumpPathAndChildren(struct unixfilesystem *fs, const char *pathname,
  * Note this is used by the grading script so don't alter output format. 
  */
 static void DumpPathnameChecksum(struct unixfilesystem *fs, FILE *f) {
-  DumpPathAndChildren(fs, "/", ROOT_INUMBER, f);
+  if (numWorkers <= 1) {
+    DumpPathAndChildren(fs, "/", ROOT_INUMBER, f, NULL);
+    return;
+  }
+
+  struct chksumqueue queue = { .fs = fs };
+  DumpPathAndChildren(fs, "/", ROOT_INUMBER, f, &queue);
+  RunChksumQueue(&queue);
+  for (int i = 0; i < queue.numjobs; i++) {
+    struct chksumjob *job = &queue.jobs[i];
+    if (job->status < 0) {
+      fprintf(stderr,"Can't checksum inode %d path %s\n", job->inumber, job->pathname);
+      continue;
+    }
+    if (job->mismatch) {
+      fprintf(stderr,"Pathname checksum of %s differs from inode %d\n", job->pathname, job->inumber);
+      continue;
+    }
+    char chksumstring[CHKSUMFILE_STRINGSIZE];
+    chksumfile_cvt2string(job->chksum, chksumstring);
+    fprintf(f, "Path %s %d mode 0x%x size %d checksum %s\n",job->pathname,job->inumber,job->mode, job->size, chksumstring);
+  }
+  FreeChksumQueue(&queue);
+}
+
+/**
+ * Appends a checksum job for the specified inode (and pathname, for the
+ * pathname dump) to the queue.  Returns 0 on success, -1 if out of memory.
+ */
+static int QueueChksumJob(struct chksumqueue *queue, int inumber, const char *pathname, struct inode *inp) {
+  if (queue->numjobs == queue->maxjobs) {
+    int maxjobs = queue->maxjobs ? 2 * queue->maxjobs : 1024;
+    struct chksumjob *jobs = realloc(queue->jobs, maxjobs * sizeof(struct chksumjob));
+    if (jobs == NULL) {
+      fprintf(stderr, "Out of memory queueing checksum of inode %d\n", inumber);
+      return -1;
+    }
+    queue->jobs = jobs;
+    queue->maxjobs = maxjobs;
+  }
+
+  struct chksumjob *job = &queue->jobs[queue->numjobs];
+  memset(job, 0, sizeof(*job));
+  job->inumber = inumber;
+  job->mode = inp->i_mode;
+  job->size = inode_getsize(inp);
+  if (pathname && (job->pathname = strdup(pathname)) == NULL) {
+    fprintf(stderr, "Out of memory queueing checksum of %s\n", pathname);
+    return -1;
+  }
+  queue->numjobs++;
+  return 0;
+}
+
+/**
+ * Computes the checksum of a job into it, and for a pathname job compares
+ * it with the checksum of the inode found by the pathname.
+ */
+static void ComputeChksumJob(struct unixfilesystem *fs, struct chksumjob *job) {
+  if (chksumfile_byinumber(fs, job->inumber, job->chksum) < 0) {
+    job->status = -1;
+    return;
+  }
+  if (job->pathname) {
+    char chksum2[CHKSUMFILE_SIZE];
+    if (chksumfile_bypathname(fs, job->pathname, chksum2) < 0) {
+      job->status = -1;
+      return;
+    }
+    job->mismatch = !chksumfile_compare(job->chksum, chksum2);
+  }
+}
+
+/**
+ * Worker thread body: claims jobs off the queue until it is drained.  Each
+ * worker uses its own copy of the filesystem handle without the inode,
+ * directory index and dentry caches, since those aren't thread-safe; the
+ * sector reads underneath are.
+ */
+static void *ChksumWorker(void *arg) {
+  struct chksumqueue *queue = arg;
+  struct unixfilesystem fs = *queue->fs;
+  fs.icache = NULL;
+  fs.dindex = NULL;
+  fs.dcache = NULL;
+
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    int i = queue->nextjob++;
+    pthread_mutex_unlock(&queue->lock);
+    if (i >= queue->numjobs) break;
+
+    struct chksumjob *job = &queue->jobs[i];
+    if (!job->done) ComputeChksumJob(&fs, job);
+  }
+
+  // Only the directory index may have been built lazily on our copy.
+  dirindex_free(fs.dindex);
+  return NULL;
+}
+
+/**
+ * Computes the checksums of all queued jobs with numWorkers threads.
+ */
+static void RunChksumQueue(struct chksumqueue *queue) {
+  pthread_t *workers = malloc(numWorkers * sizeof(pthread_t));
+  int started = 0;
+
+  pthread_mutex_init(&queue->lock, NULL);
+  queue->nextjob = 0;
+  if (workers) {
+    for (; started < numWorkers; started++) {
+      if (pthread_create(&workers[started], NULL, ChksumWorker, queue) != 0) break;
+    }
+  }
+  if (started == 0) {
+    // Couldn't start any threads, do the work here.
+    ChksumWorker(queue);
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  pthread_mutex_destroy(&queue->lock);
+  free(workers);
+}
+
+static void FreeChksumQueue(struct chksumqueue *queue) {
+  for (int i = 0; i < queue->numjobs; i++) {
+    free(queue->jobs[i].pathname);
+  }
+  free(queue->jobs);
+  queue->jobs = NULL;
+  queue->numjobs = queue->maxjobs = 0;
 }
 
 /**
@@ -262,5 +528,11 @@ static void PrintUsageAndExit(char *progname) {
   fprintf(stderr, "-q     don't print extra info\n"); 
   fprintf(stderr, "-i     print all inode checksums\n"); 
   fprintf(stderr, "-p     print all pathname checksums\n");  
+  fprintf(stderr, "-m     memory-map the disk image instead of reading sectors\n");
+  fprintf(stderr, "-c N   cache up to N decoded inodes in memory\n");
+  fprintf(stderr, "-n N   cache up to N pathname lookup entries (dentries)\n");
+  fprintf(stderr, "-t N   compute checksums with N worker threads\n");
+  fprintf(stderr, "-S F   compile a metadata snapshot of the image to file F\n");
+  fprintf(stderr, "-s F   answer inode, directory and block map queries from snapshot F\n");
   exit(EXIT_FAILURE);
 }
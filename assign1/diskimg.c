@@ -1,21 +1,128 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <string.h>
+#include <stdint.h>
 
 #include "diskimg.h"
 
+#define MAX_MAPPED_IMAGES 16
+
+/**
+ * Table of memory-mapped disk images, keyed by file descriptor.
+ */
+static struct {
+  int fd;           // descriptor the mapping belongs to, -1 if slot is unused
+  char *base;       // start of the mapping
+  off_t size;       // length of the mapping in bytes
+} mappedImages[MAX_MAPPED_IMAGES] = {
+  [0 ... MAX_MAPPED_IMAGES - 1] = { -1, NULL, 0 }
+};
+
+/**
+ * Counters behind diskimg_getstats().  Updated with relaxed atomics since
+ * sectors may be read from several threads.
+ */
+static uint64_t numsectorreads;
+static uint64_t numbytescopied;
+
+static inline void count_reads(int sectors, size_t copied) {
+  __atomic_fetch_add(&numsectorreads, (uint64_t) sectors, __ATOMIC_RELAXED);
+  if (copied) __atomic_fetch_add(&numbytescopied, (uint64_t) copied, __ATOMIC_RELAXED);
+}
+
+static int find_mapping(int fd) {
+  for (int i = 0; i < MAX_MAPPED_IMAGES; i++) {
+    if (mappedImages[i].fd == fd) return i;
+  }
+  return -1;
+}
+
 int diskimg_open(char *pathname, int readOnly) {
   return open(pathname, readOnly ? O_RDONLY : O_RDWR);
 }
 
+int diskimg_map(int fd) {
+  if (find_mapping(fd) >= 0) return 0;  // Already mapped
+
+  int slot = find_mapping(-1);
+  if (slot < 0) return -1;  // No free mapping slots
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) return -1;
+
+  // MAP_SHARED keeps the mapping coherent with diskimg_writesector().
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) return -1;
+
+  mappedImages[slot].fd = fd;
+  mappedImages[slot].base = base;
+  mappedImages[slot].size = st.st_size;
+  return 0;
+}
+
 int diskimg_getsize(int fd) {
   return lseek(fd, 0, SEEK_END);
 }
 
 int diskimg_readsector(int fd, int sectorNum,  void *buf) {
-  if (lseek(fd, sectorNum * DISKIMG_SECTOR_SIZE, SEEK_SET) == (off_t) -1) return -1;  
-  return read(fd, buf, DISKIMG_SECTOR_SIZE);
+  const void *sector = diskimg_getsector_ptr(fd, sectorNum, buf);
+  if (sector == NULL) return -1;
+  if (sector != buf) {
+    memcpy(buf, sector, DISKIMG_SECTOR_SIZE);
+    diskimg_countcopy(DISKIMG_SECTOR_SIZE);
+  }
+  return DISKIMG_SECTOR_SIZE;
+}
+
+int diskimg_readsectors(int fd, int firstSector, int count, const struct iovec *iov) {
+  off_t offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  int slot = find_mapping(fd);
+  if (slot >= 0) {
+    int bytes = 0;
+    for (int i = 0; i < count; i++) {
+      if (offset + bytes + (off_t) iov[i].iov_len > mappedImages[slot].size) return -1;
+      memcpy(iov[i].iov_base, mappedImages[slot].base + offset + bytes, iov[i].iov_len);
+      bytes += iov[i].iov_len;
+    }
+    count_reads(count, bytes);
+    return bytes;
+  }
+  int bytes = preadv(fd, iov, count, offset);
+  if (bytes > 0) count_reads(count, bytes);
+  return bytes;
+}
+
+int diskimg_readahead(int fd, int firstSector, int count) {
+  off_t offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  off_t length = (off_t) count * DISKIMG_SECTOR_SIZE;
+  int slot = find_mapping(fd);
+  if (slot >= 0) {
+    if (offset >= mappedImages[slot].size) return 0;
+    if (offset + length > mappedImages[slot].size) length = mappedImages[slot].size - offset;
+    // madvise() wants a page aligned start.
+    off_t aligned = offset & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+    return madvise(mappedImages[slot].base + aligned, length + (offset - aligned), MADV_WILLNEED);
+  }
+  return posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED) == 0 ? 0 : -1;
+}
+
+const void *diskimg_getsector_ptr(int fd, int sectorNum, void *buf) {
+  int slot = find_mapping(fd);
+  off_t offset = (off_t) sectorNum * DISKIMG_SECTOR_SIZE;
+  if (slot >= 0) {
+    if ((sectorNum < 0) || (offset + DISKIMG_SECTOR_SIZE > mappedImages[slot].size)) return NULL;
+    count_reads(1, 0);
+    return mappedImages[slot].base + offset;
+  }
+
+  // pread() leaves the shared file offset alone, so threads can read
+  // sectors of the same descriptor concurrently.
+  if (pread(fd, buf, DISKIMG_SECTOR_SIZE, offset) != DISKIMG_SECTOR_SIZE) return NULL;
+  count_reads(1, DISKIMG_SECTOR_SIZE);
+  return buf;
 }
 
 int diskimg_writesector(int fd, int sectorNum,  void *buf) {
@@ -26,6 +133,22 @@ int diskimg_writesector(int fd, int sectorNum,  void *buf) {
   return write(fd, buf, DISKIMG_SECTOR_SIZE);
 }
 
+void diskimg_countcopy(size_t bytes) {
+  __atomic_fetch_add(&numbytescopied, (uint64_t) bytes, __ATOMIC_RELAXED);
+}
+
+void diskimg_getstats(struct diskimg_stats *stats) {
+  stats->sectorreads = __atomic_load_n(&numsectorreads, __ATOMIC_RELAXED);
+  stats->bytescopied = __atomic_load_n(&numbytescopied, __ATOMIC_RELAXED);
+}
+
 int diskimg_close(int fd) {
+  int slot = find_mapping(fd);
+  if (slot >= 0) {
+    munmap(mappedImages[slot].base, mappedImages[slot].size);
+    mappedImages[slot].fd = -1;
+    mappedImages[slot].base = NULL;
+    mappedImages[slot].size = 0;
+  }
   return close(fd);
 }
@@ -2,6 +2,8 @@
 #define _DISKIMG_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
 
 // Size of a disk sector (e.g. block) in bytes.
 #define DISKIMG_SECTOR_SIZE 512
@@ -12,6 +14,13 @@
  */
 int diskimg_open(char *pathname, int readOnly);
 
+/**
+ * Memory-maps (read-only) a disk image previously opened with diskimg_open().
+ * Once mapped, sector reads on fd are served out of the mapping instead of
+ * lseek/read system calls.  Returns 0 on success, or -1 on error.
+ */
+int diskimg_map(int fd);
+
 /**
  * Returns the size of the disk imgage in bytes, or -1 if unsuccessful.
  */
@@ -23,12 +32,52 @@ int diskimg_getsize(int fd);
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Reads count consecutive sectors starting at firstSector with a single
+ * vectored read, sector firstSector + i going to iov[i] (each iov_len should
+ * be DISKIMG_SECTOR_SIZE).  Returns the number of bytes read, or -1 on error.
+ */
+int diskimg_readsectors(int fd, int firstSector, int count, const struct iovec *iov);
+
+/**
+ * Hints that count sectors starting at firstSector will be read soon, so the
+ * OS can start fetching them in the background.  Purely advisory; returns 0
+ * on success, or -1 on error.
+ */
+int diskimg_readahead(int fd, int firstSector, int count);
+
+/**
+ * Returns a pointer to the contents of the specified sector.  If the image is
+ * mapped the pointer addresses the mapping directly and buf is left untouched,
+ * otherwise the sector is read into buf (DISKIMG_SECTOR_SIZE bytes) and buf is
+ * returned.  Returns NULL on error.  The data must be treated as read-only.
+ * Safe to call from several threads at once on the same descriptor.
+ */
+const void *diskimg_getsector_ptr(int fd, int sectorNum, void *buf);
+
 /**
  * Writes the specified sector from the disk.  Returns the number of bytes
  * written, or -1 on error.
  */
 int diskimg_writesector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Running totals of the sector reads served (from the file or the mapping)
+ * and of the bytes copied into caller buffers, including the kernel copy of
+ * a read().
+ */
+struct diskimg_stats {
+  uint64_t sectorreads;
+  uint64_t bytescopied;
+};
+
+void diskimg_getstats(struct diskimg_stats *stats);
+
+/**
+ * Accounts for a copy of sector data made by a layer above diskimg.
+ */
+void diskimg_countcopy(size_t bytes);
+
 /**
  * Clean up from a previous diskimg_open() call.  Returns 0 on success, or -1 on
  * error.
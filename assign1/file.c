@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 #include "file.h"
 #include "inode.h"
 #include "diskimg.h"
+#include "snapshot.h"
+
+// Upper bound on the sectors coalesced into one vectored read.
+#define MAX_BLOCKS_PER_IO 64
 
 /*
  * Helper Functions
@@ -27,16 +32,18 @@ static inline int validate_file_getblock(struct unixfilesystem *fs, int inumber,
 }
 
 /*
- * Function : file_getblock
- * Usage : int valid_bytes = file_getblock(fs, dirinumber, blockNum, entries);
- * -----------------------------------------------------------------------------
- *  This function fetches the specified disk block from the specified inode.
+ * Function : file_getblock_ptr
+ * Usage : int valid_bytes = file_getblock_ptr(fs, dirinumber, blockNum, scratch, &data);
+ * ------------------------------------------------------------------------------------
+ *  This function locates the specified disk block of the specified inode and
+ *  points *datap at its contents. On a memory-mapped image *datap addresses
+ *  the mapping and scratch is untouched, otherwise the block is read into scratch.
  *  Returns the number of valid bytes in the block, FAILURE/-1 on error.
  */
-int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *buf) {
-    if ((validate_file_getblock(fs, inumber, blockNum, buf)) == SUCCESS) {
+int file_getblock_ptr(struct unixfilesystem *fs, int inumber, int blockNum, void *scratch, const void **datap) {
+    if (((validate_file_getblock(fs, inumber, blockNum, scratch)) == SUCCESS) && (datap)) {
         struct inode in;
-        int read_bytes;
+        int read_bytes = DISKIMG_SECTOR_SIZE;
 
         //Fetching inode from inumber
         int err = inode_iget(fs, inumber, &in);
@@ -44,12 +51,14 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *bu
             return FAILURE;
         }
 
-        // Getting disk block
-        int disk_block = inode_indexlookup(fs, &in, blockNum);
+        // Getting disk block, from the snapshot's extents when it covers it
+        int disk_block = (fs->snap) ? snapshot_lookupblock(fs->snap, inumber, blockNum) : FAILURE;
+        if (disk_block < 0)
+            disk_block = inode_indexlookup(fs, &in, blockNum);
 
-        // Reading from the disk
-        if ((read_bytes = diskimg_readsector(fs->dfd, disk_block, buf)) != DISKIMG_SECTOR_SIZE) {
-            fprintf(stderr, " Disk read failed, fs 0x%p disk_block %d inp 0x%p blockNum %d buf 0x%p, returning -1\n", fs, disk_block, &in, blockNum, buf);
+        // Reading from the disk (or the mapping)
+        if ((*datap = diskimg_getsector_ptr(fs->dfd, disk_block, scratch)) == NULL) {
+            fprintf(stderr, " Disk read failed, fs 0x%p disk_block %d inp 0x%p blockNum %d buf 0x%p, returning -1\n", fs, disk_block, &in, blockNum, scratch);
             return FAILURE;
         }
         int size = inode_getsize(&in);
@@ -59,7 +68,131 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *bu
             read_bytes = size % DISKIMG_SECTOR_SIZE;
         return read_bytes;
     } else {
-        fprintf(stderr, "file_getblock(inumber = %d, blockNum = %d, fs = 0x%p, buf 0x%p) validation failed. returning -1\n", inumber, blockNum, fs, buf);
-        return FAILURE;  
+        fprintf(stderr, "file_getblock_ptr(inumber = %d, blockNum = %d, fs = 0x%p, scratch 0x%p) validation failed. returning -1\n", inumber, blockNum, fs, scratch);
+        return FAILURE;
+    }
+}
+
+/*
+ * Function : file_getblock_bymap
+ * Usage : int valid_bytes = file_getblock_bymap(fs, &map, blockNum, scratch, &data);
+ * ------------------------------------------------------------------------------------
+ *  Same as file_getblock_ptr but locates the disk block through a block map
+ *  built by inode_blockmap, so no inode or indirect block is read.
+ *  Returns the number of valid bytes in the block, FAILURE/-1 on error.
+ */
+int file_getblock_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int blockNum, void *scratch, const void **datap) {
+    int disk_block = inode_blockmap_lookup(map, blockNum);
+    if ((fs) && (scratch) && (datap) && (disk_block >= 0)) {
+        if ((*datap = diskimg_getsector_ptr(fs->dfd, disk_block, scratch)) == NULL) {
+            fprintf(stderr, " Disk read failed, fs 0x%p disk_block %d blockNum %d buf 0x%p, returning -1\n", fs, disk_block, blockNum, scratch);
+            return FAILURE;
+        }
+        // The last block of the file may be partially valid.
+        if (map->size < ((blockNum + 1) * DISKIMG_SECTOR_SIZE))
+            return map->size % DISKIMG_SECTOR_SIZE;
+        return DISKIMG_SECTOR_SIZE;
+    } else {
+        fprintf(stderr, "file_getblock_bymap(blockNum = %d, fs = 0x%p, map = 0x%p, scratch 0x%p) validation failed. returning -1\n", blockNum, fs, (const void *) map, scratch);
+        return FAILURE;
+    }
+}
+
+/*
+ * Function : file_getblock
+ * Usage : int valid_bytes = file_getblock(fs, dirinumber, blockNum, entries);
+ * -----------------------------------------------------------------------------
+ *  This function fetches the specified disk block from the specified inode.
+ *  Returns the number of valid bytes in the block, FAILURE/-1 on error.
+ */
+int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *buf) {
+    const void *data;
+    int read_bytes = file_getblock_ptr(fs, inumber, blockNum, buf, &data);
+    if ((read_bytes >= 0) && (data != buf)) {
+        memcpy(buf, data, DISKIMG_SECTOR_SIZE);
+        diskimg_countcopy(DISKIMG_SECTOR_SIZE);
     }
+    return read_bytes;
+}
+
+/*
+ * Function : file_getblocks_bymap
+ * Usage : int valid_bytes = file_getblocks_bymap(fs, &map, firstBlock, nBlocks, buf);
+ * ------------------------------------------------------------------------------------
+ *  This function reads nBlocks consecutive file blocks starting at firstBlock
+ *  into buf, which must hold nBlocks * DISKIMG_SECTOR_SIZE bytes. Runs of
+ *  blocks that are contiguous on disk are fetched with a single vectored read
+ *  of up to MAX_BLOCKS_PER_IO sectors. Blocks past the end of the file are
+ *  not read.
+ *  Returns the number of valid bytes placed in buf, FAILURE/-1 on error.
+ */
+int file_getblocks_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int firstBlock, int nBlocks, void *buf) {
+    if (!(fs) || !(map) || !(buf) || (firstBlock < 0) || (nBlocks < 0)) {
+        fprintf(stderr, "file_getblocks_bymap(firstBlock = %d, nBlocks = %d, fs = 0x%p, map = 0x%p, buf = 0x%p) validation failed. returning -1\n", firstBlock, nBlocks, fs, (const void *) map, buf);
+        return FAILURE;
+    }
+
+    int lastBlock = firstBlock + nBlocks;
+    if (lastBlock > map->numBlocks)
+        lastBlock = map->numBlocks;
+    if (firstBlock >= lastBlock)
+        return 0;
+
+    char *dst = buf;
+    for (int blockNum = firstBlock; blockNum < lastBlock; ) {
+        int disk_block = inode_blockmap_lookup(map, blockNum);
+        if (disk_block < 0)
+            return FAILURE;
+
+        // Extend the run while the next file block is the next disk sector.
+        int run = 1;
+        while ((run < MAX_BLOCKS_PER_IO) && ((blockNum + run) < lastBlock) &&
+               (inode_blockmap_lookup(map, blockNum + run) == (disk_block + run)))
+            run++;
+
+        struct iovec iov[MAX_BLOCKS_PER_IO];
+        for (int i = 0; i < run; i++) {
+            iov[i].iov_base = dst + (i * DISKIMG_SECTOR_SIZE);
+            iov[i].iov_len = DISKIMG_SECTOR_SIZE;
+        }
+        if (diskimg_readsectors(fs->dfd, disk_block, run, iov) != (run * DISKIMG_SECTOR_SIZE)) {
+            fprintf(stderr, " Disk read failed, fs 0x%p disk_block %d run %d blockNum %d, returning -1\n", fs, disk_block, run, blockNum);
+            return FAILURE;
+        }
+        dst += run * DISKIMG_SECTOR_SIZE;
+        blockNum += run;
+    }
+
+    // The last block of the file may be partially valid.
+    int end = lastBlock * DISKIMG_SECTOR_SIZE;
+    if (end > map->size)
+        end = map->size;
+    return end - (firstBlock * DISKIMG_SECTOR_SIZE);
+}
+
+/*
+ * Function : file_getblocks
+ * Usage : int valid_bytes = file_getblocks(fs, inumber, firstBlock, nBlocks, buf);
+ * -------------------------------------------------------------------------------
+ *  Same as file_getblocks_bymap but resolves the block map of the inode first.
+ *  Returns the number of valid bytes placed in buf, FAILURE/-1 on error.
+ */
+int file_getblocks(struct unixfilesystem *fs, int inumber, int firstBlock, int nBlocks, void *buf) {
+    if (((validate_file_getblock(fs, inumber, firstBlock, buf)) != SUCCESS) || (nBlocks < 0)) {
+        fprintf(stderr, "file_getblocks(inumber = %d, firstBlock = %d, nBlocks = %d, fs = 0x%p, buf 0x%p) validation failed. returning -1\n", inumber, firstBlock, nBlocks, fs, buf);
+        return FAILURE;
+    }
+
+    struct inode in;
+    if (inode_iget(fs, inumber, &in) < 0)
+        return FAILURE;
+
+    struct inode_blockmap map;
+    int err = (fs->snap) ? snapshot_blockmap(fs->snap, inumber, &map) : inode_blockmap(fs, &in, &map);
+    if (err < 0)
+        return FAILURE;
+
+    int read_bytes = file_getblocks_bymap(fs, &map, firstBlock, nBlocks, buf);
+    inode_blockmap_free(&map);
+    return read_bytes;
 }
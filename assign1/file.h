@@ -2,6 +2,7 @@
 #define _FILE_H_
 
 #include "unixfilesystem.h"
+#include "inode.h"
 
 /**
  * Fetches the specified file block from the specified inode.
@@ -9,4 +10,32 @@
  */
 int file_getblock(struct unixfilesystem *fs, int inumber, int blockNo, void *buf); 
 
+/**
+ * Like file_getblock() but avoids the copy into the caller's buffer: *datap is
+ * pointed at the block contents, which live in the image mapping when the
+ * image is memory-mapped and in scratch otherwise.  The contents must be
+ * treated as read-only.  Returns the number of valid bytes, -1 on error.
+ */
+int file_getblock_ptr(struct unixfilesystem *fs, int inumber, int blockNo, void *scratch, const void **datap);
+
+/**
+ * Like file_getblock_ptr() but takes a block map built by inode_blockmap()
+ * instead of an inumber, so sequential readers resolve the indirect blocks
+ * once per file rather than once per block.
+ */
+int file_getblock_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int blockNo, void *scratch, const void **datap);
+
+/**
+ * Reads nBlocks consecutive file blocks starting at firstBlock into buf, which
+ * must hold nBlocks * DISKIMG_SECTOR_SIZE bytes.  Blocks that are contiguous
+ * on disk are fetched with one vectored read.  Returns the number of valid
+ * bytes placed in buf (short at the end of the file), -1 on error.
+ */
+int file_getblocks(struct unixfilesystem *fs, int inumber, int firstBlock, int nBlocks, void *buf);
+
+/**
+ * Like file_getblocks() but takes a block map built by inode_blockmap().
+ */
+int file_getblocks_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int firstBlock, int nBlocks, void *buf);
+
 #endif // _FILE_H_
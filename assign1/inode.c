@@ -2,8 +2,11 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
 #include "inode.h"
 #include "diskimg.h"
+#include "inodecache.h"
+#include "snapshot.h"
 
 /*
  * Helper functions
@@ -12,7 +15,7 @@ static inline unsigned int calculate_sector_index_from_inumber(int inumber);
 static inline unsigned int calculate_inode_offset_in_sector(int inumber);
 static inline int validate_indexlookup(struct unixfilesystem *fs, struct inode *inp, int   blockNum);
 static int find_disk_block_for_small_files(struct inode *inp, int blockNum);
-static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int    blockNum, uint16_t *double_indirection_block);
+static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int    blockNum, const uint16_t *double_indirection_block);
 static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct inode *inp,   int blockNum);
 
 /*
@@ -63,14 +66,20 @@ static inline int validate_indexlookup(struct unixfilesystem *fs, struct inode *
  */
 int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
     if (!(validate_iget(fs, inumber, inp))) {
+        if (fs->snap)
+            return snapshot_iget(fs->snap, inumber, inp);
+        if (fs->icache)
+            return inodecache_iget(fs, inumber, inp);
         unsigned int sector_index = calculate_sector_index_from_inumber(inumber);
-        struct inode inode_sector[INODES_IN_SECTOR];
-        if (diskimg_readsector(fs->dfd, sector_index, inode_sector) != DISKIMG_SECTOR_SIZE) {
+        // Scratch space, only used when the image is not memory-mapped
+        struct inode scratch[INODES_IN_SECTOR];
+        const struct inode *inode_sector = diskimg_getsector_ptr(fs->dfd, sector_index, scratch);
+        if (inode_sector == NULL) {
             fprintf(stderr, "Disk read failed, fs 0x%p sector index %u inumber=%d , returning -1\n", fs, sector_index, inumber);
             return FAILURE;
         }
         unsigned int inode_offset = calculate_inode_offset_in_sector(inumber);
-        memcpy(inp, (const void *)&inode_sector[inode_offset], sizeof(struct inode));
+        *inp = inode_sector[inode_offset];
         return SUCCESS;
     }
     return FAILURE;  
@@ -88,11 +97,12 @@ static inline int find_disk_block_for_small_files(struct inode *inp, int blockNu
 /*
  * Fetches disk sector block by dereferencing from a double indirection block
  */
-static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int blockNum, uint16_t *double_indirection_block) {
+static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int blockNum, const uint16_t *double_indirection_block) {
     int double_indirection_index = (blockNum / MAX_DISK_BLOCK_INDEXES_IN_BLOCK) - NUM_SINGLE_INDIRECTION_INDEXES;
     int dereferenced_disk_block = double_indirection_block[double_indirection_index];
-    uint16_t single_indirection_block[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
-    if (diskimg_readsector(fs->dfd, dereferenced_disk_block, single_indirection_block) != DISKIMG_SECTOR_SIZE) {
+    uint16_t scratch[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+    const uint16_t *single_indirection_block = diskimg_getsector_ptr(fs->dfd, dereferenced_disk_block, scratch);
+    if (single_indirection_block == NULL) {
         fprintf(stderr, "Disk read failed, fs 0x%p dereferenced_disk_block %u  blockNum %d, returning -1\n", fs, dereferenced_disk_block, blockNum);
         return FAILURE;
     }
@@ -108,12 +118,14 @@ static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct ino
     int block_index;
     int disk_block;
     int dereferenced_disk_block;
-    uint16_t block_content[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+    uint16_t scratch[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+    const uint16_t *block_content;
     if (blockNum < STARTING_BLOCKNUM_IN_DOUBLY_INDIRECT_BLOCK) {
         // Single indirection blocks
         block_index = blockNum / MAX_DISK_BLOCK_INDEXES_IN_BLOCK; 
         dereferenced_disk_block = inp->i_addr[block_index];
-        if (diskimg_readsector(fs->dfd, dereferenced_disk_block, block_content) != DISKIMG_SECTOR_SIZE) {
+        block_content = diskimg_getsector_ptr(fs->dfd, dereferenced_disk_block, scratch);
+        if (block_content == NULL) {
             fprintf(stderr, "Disk read failed, fs 0x%p dereferenced_disk_block %u inp 0x%p blockNum %d, returning -1\n", fs, dereferenced_disk_block, inp, blockNum);
             return FAILURE;
         }
@@ -123,7 +135,8 @@ static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct ino
         // Handling double indirection block
         block_index = DOUBLY_INDIRECT_DISK_BLOCK_INDEX;
         dereferenced_disk_block = inp->i_addr[block_index];
-        if (diskimg_readsector(fs->dfd, dereferenced_disk_block, block_content) != DISKIMG_SECTOR_SIZE) {
+        block_content = diskimg_getsector_ptr(fs->dfd, dereferenced_disk_block, scratch);
+        if (block_content == NULL) {
             fprintf(stderr, "Disk read failed, fs 0x%p dereferenced_disk_block %u inp 0x%p blockNum %d, returning -1\n", fs, dereferenced_disk_block, inp, blockNum);
             return FAILURE;
         }
@@ -156,3 +169,127 @@ int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum
 int inode_getsize(struct inode *inp) {
     return ((inp->i_size0 << 16) | inp->i_size1); 
 }
+
+/*
+ * Appends a disk block to the block map, extending the last extent when the
+ * block is physically contiguous with it.
+ */
+static void blockmap_append(struct inode_blockmap *map, int disk_block) {
+    struct inode_extent *last = map->numExtents ? &map->extents[map->numExtents - 1] : NULL;
+    if ((last) && (last->diskBlock + last->numBlocks == disk_block)) {
+        last->numBlocks++;
+    } else {
+        struct inode_extent *extent = &map->extents[map->numExtents++];
+        extent->fileBlock = map->numBlocks;
+        extent->diskBlock = disk_block;
+        extent->numBlocks = 1;
+    }
+    map->numBlocks++;
+}
+
+/*
+ * Appends the first count disk blocks listed in an indirect block.
+ */
+static int blockmap_append_indirect(struct unixfilesystem *fs, struct inode_blockmap *map, int indirect_block, int count) {
+    uint16_t scratch[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+    const uint16_t *block_content = diskimg_getsector_ptr(fs->dfd, indirect_block, scratch);
+    if (block_content == NULL) {
+        fprintf(stderr, "Disk read failed, fs 0x%p indirect_block %d, returning -1\n", fs, indirect_block);
+        return FAILURE;
+    }
+    for (int index = 0; index < count; index++)
+        blockmap_append(map, block_content[index]);
+    return SUCCESS;
+}
+
+/*
+ * Function : inode_blockmap
+ * Usage : if (inode_blockmap(fs, &in, &map) == SUCCESS)
+ * ----------------------------------------------------------
+ * Resolves the disk block of every file block of the inode, reading each
+ * singly and doubly indirect block only once, and records the result as a
+ * list of extents. Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int inode_blockmap(struct unixfilesystem *fs, struct inode *inp, struct inode_blockmap *map) {
+    if (!(fs) || !(inp) || !(map))
+        return FAILURE;
+    int size = inode_getsize(inp);
+    int num_blocks = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    map->size = size;
+    map->numBlocks = 0;
+    map->numExtents = 0;
+    /* Worst case every block is its own extent */
+    map->extents = malloc((num_blocks ? num_blocks : 1) * sizeof(struct inode_extent));
+    if (map->extents == NULL)
+        return FAILURE;
+
+    if (!(inp->i_mode & ILARG)) {
+        if (num_blocks > MAX_DIRECT_DISK_BLOCK_INDEXES_IN_INODE)
+            goto error;
+        for (int index = 0; index < num_blocks; index++)
+            blockmap_append(map, inp->i_addr[index]);
+        return SUCCESS;
+    }
+
+    // Single indirection blocks
+    for (int index = 0; (index < NUM_SINGLE_INDIRECTION_INDEXES) && (map->numBlocks < num_blocks); index++) {
+        int count = num_blocks - map->numBlocks;
+        if (count > MAX_DISK_BLOCK_INDEXES_IN_BLOCK)
+            count = MAX_DISK_BLOCK_INDEXES_IN_BLOCK;
+        if (blockmap_append_indirect(fs, map, inp->i_addr[index], count) < 0)
+            goto error;
+    }
+
+    // Double indirection block
+    if (map->numBlocks < num_blocks) {
+        uint16_t scratch[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+        const uint16_t *double_indirection_block = diskimg_getsector_ptr(fs->dfd, inp->i_addr[DOUBLY_INDIRECT_DISK_BLOCK_INDEX], scratch);
+        if (double_indirection_block == NULL) {
+            fprintf(stderr, "Disk read failed, fs 0x%p inp 0x%p double indirection block, returning -1\n", fs, inp);
+            goto error;
+        }
+        for (int index = 0; (index < MAX_DISK_BLOCK_INDEXES_IN_BLOCK) && (map->numBlocks < num_blocks); index++) {
+            int count = num_blocks - map->numBlocks;
+            if (count > MAX_DISK_BLOCK_INDEXES_IN_BLOCK)
+                count = MAX_DISK_BLOCK_INDEXES_IN_BLOCK;
+            if (blockmap_append_indirect(fs, map, double_indirection_block[index], count) < 0)
+                goto error;
+        }
+    }
+    return SUCCESS;
+
+error:
+    inode_blockmap_free(map);
+    return FAILURE;
+}
+
+/*
+ * Function : inode_blockmap_lookup
+ * Usage : int disk_block = inode_blockmap_lookup(&map, blockNum);
+ * ------------------------------------------------------------------
+ * Binary searches the extents for the one covering blockNum.
+ * Returns the disk block number on success, -1/FAILURE on error.
+ */
+int inode_blockmap_lookup(const struct inode_blockmap *map, int blockNum) {
+    if (!(map) || (blockNum < 0) || (blockNum >= map->numBlocks))
+        return FAILURE;
+    int low = 0, high = map->numExtents - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (map->extents[mid].fileBlock <= blockNum)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    const struct inode_extent *extent = &map->extents[low];
+    return extent->diskBlock + (blockNum - extent->fileBlock);
+}
+
+void inode_blockmap_free(struct inode_blockmap *map) {
+    if (!(map))
+        return;
+    free(map->extents);
+    map->extents = NULL;
+    map->numExtents = 0;
+    map->numBlocks = 0;
+}
@@ -0,0 +1,75 @@
+/* Header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "inodecache.h"
+#include "inode.h"
+#include "diskimg.h"
+
+/*
+ * Function : inodecache_create
+ * Usage : fs->icache = inodecache_create(maxInodes);
+ * ------------------------------------------------------
+ * Allocates a direct mapped table of inode sectors big enough for maxInodes
+ * inodes. Returns NULL on error.
+ */
+struct inodecache *inodecache_create(int maxInodes) {
+    if (maxInodes <= 0)
+        return NULL;
+    struct inodecache *cache = calloc(1, sizeof(struct inodecache));
+    if (cache == NULL)
+        return NULL;
+    cache->numlines = (maxInodes + INODES_IN_SECTOR - 1) / INODES_IN_SECTOR;
+    /* Sector 0 is the bootblock, so 0 doubles as the empty line marker */
+    cache->sectors = calloc(cache->numlines, sizeof(int));
+    cache->inodes = malloc((size_t) cache->numlines * INODES_IN_SECTOR * sizeof(struct inode));
+    if ((cache->sectors == NULL) || (cache->inodes == NULL)) {
+        inodecache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/*
+ * Function : inodecache_iget
+ * Usage : int err = inodecache_iget(fs, inumber, &in);
+ * -------------------------------------------------------
+ * Fetches the specified inode out of the table, loading all the inodes of
+ * its sector with a single read on a miss. The inumber is assumed to have
+ * been validated by inode_iget. Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int inodecache_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
+    struct inodecache *cache = fs->icache;
+    /* As inumbers start with 1 */
+    unsigned int inumber_offset = (unsigned int) (inumber - ROOT_INUMBER);
+    int sector_index = INODE_START_SECTOR + (inumber_offset / INODES_IN_SECTOR);
+    int line = sector_index % cache->numlines;
+    struct inode *inode_sector = &cache->inodes[line * INODES_IN_SECTOR];
+
+    if (cache->sectors[line] == sector_index) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        if (diskimg_readsector(fs->dfd, sector_index, inode_sector) != DISKIMG_SECTOR_SIZE) {
+            cache->sectors[line] = 0;
+            fprintf(stderr, "Disk read failed, fs 0x%p sector index %d inumber=%d , returning -1\n", fs, sector_index, inumber);
+            return FAILURE;
+        }
+        cache->sectors[line] = sector_index;
+    }
+    *inp = inode_sector[inumber_offset % INODES_IN_SECTOR];
+    return SUCCESS;
+}
+
+void inodecache_dumpstats(struct inodecache *cache, FILE *file) {
+    fprintf(file, "Inodecache: %d lines, %"PRIu64" hits, %"PRIu64" misses\n",
+            cache->numlines, cache->hits, cache->misses);
+}
+
+void inodecache_free(struct inodecache *cache) {
+    if (cache == NULL)
+        return;
+    free(cache->sectors);
+    free(cache->inodes);
+    free(cache);
+}
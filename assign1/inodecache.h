@@ -0,0 +1,39 @@
+#ifndef _INODECACHE_H_
+#define _INODECACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "unixfilesystem.h"
+
+/**
+ * Bounded in-memory table of decoded inodes, keyed by inumber.  Inodes are
+ * loaded a whole inode sector (INODES_IN_SECTOR inodes) at a time.
+ */
+struct inodecache {
+  int numlines;             // Number of inode sectors the table can hold
+  int *sectors;             // Inode sector held by each line, 0 if empty
+  struct inode *inodes;     // numlines * INODES_IN_SECTOR decoded inodes
+  uint64_t hits;            // inode_iget calls served from the table
+  uint64_t misses;          // inode_iget calls that had to read a sector
+};
+
+/**
+ * Allocates a table able to hold at least maxInodes inodes.  Returns NULL
+ * on error.
+ */
+struct inodecache *inodecache_create(int maxInodes);
+
+/**
+ * Fetches the specified inode through the table of fs, loading its whole
+ * inode sector on a miss.  Returns 0 on success, -1 on error.
+ */
+int inodecache_iget(struct unixfilesystem *fs, int inumber, struct inode *inp);
+
+/**
+ * Prints the hit/miss counters of the table.
+ */
+void inodecache_dumpstats(struct inodecache *cache, FILE *file);
+
+void inodecache_free(struct inodecache *cache);
+
+#endif // _INODECACHE_H_
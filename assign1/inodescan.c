@@ -0,0 +1,161 @@
+/* Header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "inodescan.h"
+#include "inode.h"
+#include "diskimg.h"
+
+/* Readahead used by inode_scan_foreach */
+#define INODE_SCAN_DEFAULT_READAHEAD 2
+
+/*
+ * Function : inode_scan_init
+ * Usage : if (inode_scan_init(&scan, fs, 0, 2) == SUCCESS)
+ * -----------------------------------------------------------
+ * Sets up an iterator positioned before the root inode.
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int inode_scan_init(struct inode_scan *scan, struct unixfilesystem *fs, int chunkSectors, int readaheadChunks) {
+    if (!(scan) || !(fs) || (chunkSectors < 0) || (readaheadChunks < 0))
+        return FAILURE;
+    memset(scan, 0, sizeof(*scan));
+    if (chunkSectors == 0)
+        chunkSectors = INODE_SCAN_DEFAULT_CHUNK;
+    scan->fs = fs;
+    scan->chunkSectors = chunkSectors;
+    scan->readaheadChunks = readaheadChunks;
+    scan->lastInumber = fs->superblock.s_isize * INODES_IN_SECTOR;
+    scan->nextInumber = ROOT_INUMBER;
+    scan->buf = malloc((size_t) chunkSectors * INODES_IN_SECTOR * sizeof(struct inode));
+    if (scan->buf == NULL)
+        return FAILURE;
+    return SUCCESS;
+}
+
+/*
+ * Function : fill_chunk
+ * Usage : if (fill_chunk(scan) == SUCCESS)
+ * -------------------------------------------
+ * Reads the chunk of inode sectors holding scan->nextInumber with a single
+ * vectored read and hints the chunks after it as readahead.
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+static int fill_chunk(struct inode_scan *scan) {
+    int first = scan->nextInumber;
+    int sector = INODE_START_SECTOR + ((first - ROOT_INUMBER) / INODES_IN_SECTOR);
+    int lastSector = INODE_START_SECTOR + ((scan->lastInumber - ROOT_INUMBER) / INODES_IN_SECTOR);
+    int count = lastSector - sector + 1;
+    if (count > scan->chunkSectors)
+        count = scan->chunkSectors;
+
+    struct iovec *iov = malloc(count * sizeof(struct iovec));
+    if (iov == NULL)
+        return FAILURE;
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = &scan->buf[i * INODES_IN_SECTOR];
+        iov[i].iov_len = DISKIMG_SECTOR_SIZE;
+    }
+    int bytes = diskimg_readsectors(scan->fs->dfd, sector, count, iov);
+    free(iov);
+    if (bytes != count * DISKIMG_SECTOR_SIZE) {
+        fprintf(stderr, "Disk read failed, fs 0x%p inode sectors %d-%d, returning -1\n", scan->fs, sector, sector + count - 1);
+        return FAILURE;
+    }
+    scan->chunkreads++;
+    scan->sectorreads += count;
+
+    // Chunks start on a sector boundary, the first inode of a sector is
+    // (sector - INODE_START_SECTOR) * INODES_IN_SECTOR + 1
+    scan->bufFirstInumber = ((sector - INODE_START_SECTOR) * INODES_IN_SECTOR) + ROOT_INUMBER;
+    scan->bufCount = count * INODES_IN_SECTOR;
+
+    int next = sector + count;
+    if ((scan->readaheadChunks > 0) && (next <= lastSector)) {
+        int ahead = scan->readaheadChunks * scan->chunkSectors;
+        if (next + ahead > lastSector + 1)
+            ahead = lastSector + 1 - next;
+        (void) diskimg_readahead(scan->fs->dfd, next, ahead);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Function : inode_scan_next
+ * Usage : while ((ret = inode_scan_next(&scan, &inumber, &in)) > 0)
+ * --------------------------------------------------------------------
+ * Yields the next allocated inode of the region.
+ * Returns 1 if an inode was yielded, 0 at the end, -1/FAILURE on error.
+ */
+int inode_scan_next(struct inode_scan *scan, int *inumber, struct inode *inp) {
+    if (!(scan) || !(scan->buf) || !(inumber) || !(inp))
+        return FAILURE;
+    while (scan->nextInumber <= scan->lastInumber) {
+        int index = scan->nextInumber - scan->bufFirstInumber;
+        if ((scan->bufCount == 0) || (index < 0) || (index >= scan->bufCount)) {
+            if (fill_chunk(scan) != SUCCESS)
+                return FAILURE;
+            index = scan->nextInumber - scan->bufFirstInumber;
+        }
+        struct inode *candidate = &scan->buf[index];
+        int current = scan->nextInumber++;
+        if (candidate->i_mode & IALLOC) {
+            *inumber = current;
+            *inp = *candidate;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function : inode_scan_batch
+ * Usage : int n = inode_scan_batch(&scan, inumbers, inodes, max);
+ * -----------------------------------------------------------------
+ * Yields up to max allocated inodes at once.
+ * Returns the number yielded, 0 at the end, -1/FAILURE on error.
+ */
+int inode_scan_batch(struct inode_scan *scan, int *inumbers, struct inode *inodes, int max) {
+    int count = 0;
+    while (count < max) {
+        int ret = inode_scan_next(scan, &inumbers[count], &inodes[count]);
+        if (ret < 0)
+            return (count > 0) ? count : FAILURE;
+        if (ret == 0)
+            break;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Function : inode_scan_foreach
+ * Usage : int err = inode_scan_foreach(fs, 0, callback, arg);
+ * --------------------------------------------------------------
+ * Calls fn for every allocated inode in inumber order, stopping early if
+ * fn returns non-zero.
+ * Returns 0 after a full scan, fn's value if it stopped, -1/FAILURE on error.
+ */
+int inode_scan_foreach(struct unixfilesystem *fs, int chunkSectors, inode_scan_fn fn, void *arg) {
+    struct inode_scan scan;
+    if ((fn == NULL) || (inode_scan_init(&scan, fs, chunkSectors, INODE_SCAN_DEFAULT_READAHEAD) != SUCCESS))
+        return FAILURE;
+
+    int inumber, ret;
+    struct inode in;
+    while ((ret = inode_scan_next(&scan, &inumber, &in)) > 0) {
+        if ((ret = fn(arg, inumber, &in)) != 0)
+            break;
+    }
+    inode_scan_close(&scan);
+    return ret;
+}
+
+void inode_scan_close(struct inode_scan *scan) {
+    if (!(scan))
+        return;
+    free(scan->buf);
+    scan->buf = NULL;
+    scan->bufCount = 0;
+}
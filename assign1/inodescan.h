@@ -0,0 +1,64 @@
+#ifndef _INODESCAN_H_
+#define _INODESCAN_H_
+
+#include <stdint.h>
+#include "unixfilesystem.h"
+
+// Inode sectors read per sequential chunk when the caller passes 0.
+#define INODE_SCAN_DEFAULT_CHUNK 32
+
+/**
+ * Iterator over the allocated inodes of a filesystem in inumber order.  The
+ * inode region is read from INODE_START_SECTOR in chunks of chunkSectors
+ * sectors with one vectored read each, and the following chunks are hinted
+ * to the OS as readahead while the current one is being consumed.
+ */
+struct inode_scan {
+  struct unixfilesystem *fs;
+  int chunkSectors;         // Inode sectors read per chunk
+  int readaheadChunks;      // Chunks past the current one hinted as readahead
+  int lastInumber;          // Last inumber of the inode region
+  int nextInumber;          // Next inumber to examine
+  int bufFirstInumber;      // Inumber of buf[0]
+  int bufCount;             // Inodes held in buf
+  struct inode *buf;        // chunkSectors * INODES_IN_SECTOR inodes
+  uint64_t chunkreads;      // Chunks read from the disk image
+  uint64_t sectorreads;     // Inode sectors read from the disk image
+};
+
+/**
+ * Called by inode_scan_foreach() for every allocated inode.  A non-zero
+ * return stops the scan and is passed back to the caller.
+ */
+typedef int (*inode_scan_fn)(void *arg, int inumber, struct inode *inp);
+
+/**
+ * Prepares scan to walk fs, reading chunkSectors inode sectors at a time
+ * (0 picks INODE_SCAN_DEFAULT_CHUNK) and hinting readaheadChunks chunks
+ * ahead.  Returns 0 on success, -1 on error.
+ */
+int inode_scan_init(struct inode_scan *scan, struct unixfilesystem *fs, int chunkSectors, int readaheadChunks);
+
+/**
+ * Yields the next allocated inode.  Returns 1 with *inumber and *inp set,
+ * 0 once the inode region is exhausted, -1 on a read error (scan->nextInumber
+ * is then the first inode that couldn't be read).
+ */
+int inode_scan_next(struct inode_scan *scan, int *inumber, struct inode *inp);
+
+/**
+ * Yields up to max allocated inodes into the inumbers and inodes arrays.
+ * Returns the number yielded, 0 at the end of the region, -1 on error.
+ */
+int inode_scan_batch(struct inode_scan *scan, int *inumbers, struct inode *inodes, int max);
+
+/**
+ * Runs fn over every allocated inode of fs in one sequential sweep.  Returns
+ * 0 when the whole region was scanned, the non-zero value fn returned if it
+ * stopped the scan, or -1 on error.
+ */
+int inode_scan_foreach(struct unixfilesystem *fs, int chunkSectors, inode_scan_fn fn, void *arg);
+
+void inode_scan_close(struct inode_scan *scan);
+
+#endif // _INODESCAN_H_
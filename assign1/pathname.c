@@ -3,6 +3,7 @@
 #include "directory.h"
 #include "inode.h"
 #include "diskimg.h"
+#include "dcache.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -32,6 +33,53 @@ static inline int validate_pathname_lookup(struct unixfilesystem *fs, const char
     return FAILURE;
 }
 
+/*
+ * Function : pathname_lookup_cached
+ * Usage : int inumber = pathname_lookup_cached(fs, pathname, path)
+ * --------------------------------------------------------------------
+ * pathname_lookup through the dentry cache: resolution starts from the longest
+ * cached directory prefix of the pathname and every component resolved on the
+ * way is cached, both as (parent inumber, name) and as a pathname prefix.
+ * path is a modifiable copy of the validated pathname.
+ */
+static int pathname_lookup_cached(struct unixfilesystem *fs, const char *pathname, char *path) {
+    struct dcache *dc = fs->dcache;
+    dc->lookups++;
+    int prefixlen = 0;
+    int inumber = dcache_longest_prefix(dc, pathname, &prefixlen);
+    if (inumber >= 0) {
+        dc->prefixhits++;
+    } else {
+        inumber = ROOT_INUMBER;
+        prefixlen = 0;
+    }
+
+    char *saveptr;
+    char *sub_path = strtok_r(path + prefixlen, "/", &saveptr);
+    while (sub_path != NULL) {
+        int len = strlen(sub_path);
+        int child = dcache_get(dc, inumber, sub_path, len);
+        if (child >= 0) {
+            dc->hits++;
+        } else {
+            struct direntv6 member;
+            dc->misses++;
+            if ((directory_findname(fs, sub_path, inumber, &member)) != SUCCESS)
+                return FAILURE;
+            child = member.d_inumber;
+            dcache_put(dc, inumber, sub_path, len, child);
+        }
+        inumber = child;
+        int prefix_end = (sub_path - path) + len;
+        sub_path = strtok_r(NULL, "/", &saveptr);
+        // Remember every directory prefix so later lookups can skip it.
+        // The copy has been cut up by strtok_r, so key on the original.
+        if (sub_path != NULL)
+            dcache_put(dc, 0, pathname, prefix_end, inumber);
+    }
+    return inumber;
+}
+
 /*
  * Function : pathname_lookup
  * Usage : int inumber = pathname_lookup(fs, pathname)
@@ -42,12 +90,19 @@ static inline int validate_pathname_lookup(struct unixfilesystem *fs, const char
 int pathname_lookup(struct unixfilesystem *fs, const char *pathname) {
     if ((validate_pathname_lookup(fs, pathname) == SUCCESS)) {
         char *path = strdup(pathname);
+        if (fs->dcache) {
+            int inumber = pathname_lookup_cached(fs, pathname, path);
+            free(path);
+            return inumber;
+        }
         // We are starting with an absolute path.
         // The root inumber is well known.
         int inumber = ROOT_INUMBER;
         // Extracts the immediate member of root directory
-        // from absolute path
-        char *sub_path = strtok(path, "/");
+        // from absolute path. strtok_r keeps lookups from several
+        // threads independent.
+        char *saveptr;
+        char *sub_path = strtok_r(path, "/", &saveptr);
         while (sub_path != NULL) {
             struct direntv6 member;
             // If member exists, extract inumber which will be used 
@@ -60,7 +115,7 @@ int pathname_lookup(struct unixfilesystem *fs, const char *pathname) {
             }
             // Extracts the immediate member of the current directory
             // from absolute path.
-            sub_path = strtok(NULL, "/");
+            sub_path = strtok_r(NULL, "/", &saveptr);
         }
         if ((path))
             free(path);
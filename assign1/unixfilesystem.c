@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include "unixfilesystem.h"
 #include "diskimg.h" 
+#include "inodecache.h"
+#include "dirindex.h"
+#include "dcache.h"
+#include "snapshot.h"
 
 /**
  * Allocates and initializes a struct unixfilesystem given a filedescriptor to 
@@ -10,6 +14,16 @@
  */
 
 struct unixfilesystem *unixfilesystem_init(int dfd) {
+  return unixfilesystem_init_icache(dfd, 0);
+}
+
+/**
+ * Same as unixfilesystem_init() with an optional decoded inode table of up to
+ * maxInodes inodes (0 for none).
+ * Return NULL on error.
+ */
+
+struct unixfilesystem *unixfilesystem_init_icache(int dfd, int maxInodes) {
   // Validate the bootblock.  This will catch the situation where something 
   // other than a descriptor to a valid diskimg is passed in.
   uint16_t bootblock[256];
@@ -35,11 +49,33 @@ struct unixfilesystem *unixfilesystem_init(int dfd) {
   }
 
   fs->dfd = dfd;  
+  fs->icache = NULL;
+  fs->dindex = NULL;
+  fs->dcache = NULL;
+  fs->snap = NULL;
   if (diskimg_readsector(dfd, SUPERBLOCK_SECTOR, &fs->superblock) != DISKIMG_SECTOR_SIZE) {
     fprintf(stderr, "Error reading superblock\n");
     free(fs);
     return NULL;
   }
 
+  if (maxInodes > 0) {
+    fs->icache = inodecache_create(maxInodes);
+    if (fs->icache == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      free(fs);
+      return NULL;
+    }
+  }
+
   return fs;
 }
+
+void unixfilesystem_free(struct unixfilesystem *fs) {
+  if (fs == NULL) return;
+  inodecache_free(fs->icache);
+  dirindex_free(fs->dindex);
+  dcache_free(fs->dcache);
+  snapshot_close(fs->snap);
+  free(fs);
+}
@@ -25,11 +25,33 @@
 #define ROOT_INUMBER        1
 #define BOOTBLOCK_MAGIC_NUM 0407
 
+struct inodecache;
+struct dirindex;
+struct dcache;
+struct snapshot;
+
 struct unixfilesystem {
   int dfd; // Handle from the diskimg module to read the diskimg.
   struct filsys superblock;  // The superblock read from the diskimage.
+  struct inodecache *icache; // Decoded inode table, NULL if not enabled.
+  struct dirindex *dindex;   // Hashed directory name indexes, built lazily.
+  struct dcache *dcache;     // Dentry cache for pathname_lookup, NULL if not enabled.
+  struct snapshot *snap;     // Precompiled metadata snapshot, NULL if not loaded.
 };
 
 struct unixfilesystem *unixfilesystem_init(int fd);
 
+/**
+ * Like unixfilesystem_init() but also sets up an in-memory table holding up
+ * to maxInodes decoded inodes that inode_iget() is served from.  A
+ * maxInodes of 0 disables the table.
+ */
+struct unixfilesystem *unixfilesystem_init_icache(int fd, int maxInodes);
+
+/**
+ * Releases a struct unixfilesystem and any tables attached to it.  The disk
+ * image descriptor is left open.
+ */
+void unixfilesystem_free(struct unixfilesystem *fs);
+
 #endif // _UNIXFILESYSTEM_H_
@@ -0,0 +1,353 @@
+/**
+ * v6bench - Microbenchmarks for the V6 filesystem primitives.
+ *
+ * For every disk image on the command line the hot paths (inode_iget,
+ * inode_indexlookup, file_getblock, directory_findname and pathname_lookup)
+ * are run over a workload derived from the image itself: every inode, every
+ * block of every file, every name of every directory and every pathname.
+ * Each call is timed on its own so percentiles can be reported, and the
+ * diskimg counters give the sector reads and bytes copied per call.  The
+ * results are printed as JSON so runs can be saved and diffed.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "diskimg.h"
+#include "unixfilesystem.h"
+#include "inode.h"
+#include "file.h"
+#include "directory.h"
+#include "pathname.h"
+#include "inodescan.h"
+#include "dcache.h"
+#include "snapshot.h"
+
+#define MAXPATH 1024
+#define DEFAULT_MIN_OPS 100000
+
+int mmapFlag = 0;
+int icacheSize = 0;
+int dcacheSize = 0;
+int minOps = DEFAULT_MIN_OPS;
+int snapshotFlag = 0;
+
+/**
+ * One call of a primitive.  The fields used depend on the benchmark.
+ */
+struct benchop {
+  int inumber;
+  int blockNum;
+  char *name;                 // Directory entry name or pathname
+  struct inode in;            // Inode of inumber, for inode_indexlookup
+};
+
+struct oplist {
+  struct benchop *ops;
+  int numops;
+  int maxops;
+};
+
+typedef int (*benchfn)(struct unixfilesystem *fs, struct benchop *op);
+
+static void PrintUsageAndExit(char *progname);
+static void BenchImage(char *diskpath, FILE *out, int first);
+
+static int64_t NowNanosecs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * (int64_t) 1000000000) + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  char *outpath = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "mc:n:o:r:s")) != -1) {
+    switch (opt) {
+    case 'm':
+      mmapFlag = 1;
+      break;
+    case 'c':
+      icacheSize = atoi(optarg);
+      break;
+    case 'n':
+      dcacheSize = atoi(optarg);
+      break;
+    case 's':
+      snapshotFlag = 1;
+      break;
+    case 'o':
+      outpath = optarg;
+      break;
+    case 'r':
+      minOps = atoi(optarg);
+      if (minOps < 1) PrintUsageAndExit(argv[0]);
+      break;
+    default:
+      PrintUsageAndExit(argv[0]);
+    }
+  }
+
+  if (optind >= argc) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  FILE *out = stdout;
+  if (outpath && (out = fopen(outpath, "w")) == NULL) {
+    perror(outpath);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(out, "{\n  \"config\": {\"mmap\": %s, \"icache\": %d, \"dcache\": %d, \"snapshot\": %s, \"min_ops\": %d},\n",
+          mmapFlag ? "true" : "false", icacheSize, dcacheSize, snapshotFlag ? "true" : "false", minOps);
+  fprintf(out, "  \"images\": [");
+  for (int i = optind; i < argc; i++) {
+    BenchImage(argv[i], out, i == optind);
+  }
+  fprintf(out, "\n  ]\n}\n");
+
+  if (out != stdout) fclose(out);
+  exit(EXIT_SUCCESS);
+  return 0;
+}
+
+static int AddOp(struct oplist *list, int inumber, int blockNum, const char *name, struct inode *inp) {
+  if (list->numops == list->maxops) {
+    int maxops = list->maxops ? 2 * list->maxops : 1024;
+    struct benchop *ops = realloc(list->ops, maxops * sizeof(struct benchop));
+    if (ops == NULL) return -1;
+    list->ops = ops;
+    list->maxops = maxops;
+  }
+  struct benchop *op = &list->ops[list->numops];
+  op->inumber = inumber;
+  op->blockNum = blockNum;
+  op->name = name ? strdup(name) : NULL;
+  if (inp) op->in = *inp;
+  if (name && op->name == NULL) return -1;
+  list->numops++;
+  return 0;
+}
+
+static void FreeOps(struct oplist *list) {
+  for (int i = 0; i < list->numops; i++) {
+    free(list->ops[i].name);
+  }
+  free(list->ops);
+  memset(list, 0, sizeof(*list));
+}
+
+/*
+ * The primitives under test, wrapped to a common signature.
+ */
+static int BenchIget(struct unixfilesystem *fs, struct benchop *op) {
+  struct inode in;
+  return inode_iget(fs, op->inumber, &in);
+}
+
+static int BenchIndexlookup(struct unixfilesystem *fs, struct benchop *op) {
+  // The inode was fetched when the workload was built.
+  return inode_indexlookup(fs, &op->in, op->blockNum);
+}
+
+static int BenchGetblock(struct unixfilesystem *fs, struct benchop *op) {
+  char buf[DISKIMG_SECTOR_SIZE];
+  return file_getblock(fs, op->inumber, op->blockNum, buf);
+}
+
+static int BenchFindname(struct unixfilesystem *fs, struct benchop *op) {
+  struct direntv6 entry;
+  return directory_findname(fs, op->name, op->inumber, &entry);
+}
+
+static int BenchPathname(struct unixfilesystem *fs, struct benchop *op) {
+  return pathname_lookup(fs, op->name);
+}
+
+/*
+ * Builds the workloads: all inodes, all (file, block) pairs, all
+ * (directory, name) pairs and all pathnames reachable from the root.
+ */
+struct workload {
+  struct oplist inodes;
+  struct oplist blocks;
+  struct oplist names;
+  struct oplist paths;
+};
+
+static void WalkTree(struct unixfilesystem *fs, const char *pathname, int inumber, struct workload *w, int depth) {
+  struct inode in;
+  if (depth > 64 || inode_iget(fs, inumber, &in) < 0) return;
+  if ((in.i_mode & IFMT) != IFDIR) return;
+
+  int size = inode_getsize(&in);
+  int numBlocks = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  for (int bno = 0; bno < numBlocks; bno++) {
+    struct direntv6 entries[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
+    int bytes = file_getblock(fs, inumber, bno, entries);
+    if (bytes < 0) return;
+    for (unsigned int i = 0; i < bytes / sizeof(struct direntv6); i++) {
+      char name[sizeof(entries[i].d_name) + 1];
+      memcpy(name, entries[i].d_name, sizeof(entries[i].d_name));
+      name[sizeof(entries[i].d_name)] = '\0';
+      if (name[0] == '\0') continue;
+      AddOp(&w->names, inumber, 0, name, NULL);
+      if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+
+      char child[MAXPATH];
+      if (snprintf(child, sizeof(child), "%s/%s", pathname[1] ? pathname : "", name) >= (int) sizeof(child))
+        continue;
+      AddOp(&w->paths, 0, 0, child, NULL);
+      WalkTree(fs, child, entries[i].d_inumber, w, depth + 1);
+    }
+  }
+}
+
+static int AddInode(void *arg, int inumber, struct inode *inp) {
+  struct workload *w = arg;
+  AddOp(&w->inodes, inumber, 0, NULL, NULL);
+  int numBlocks = (inode_getsize(inp) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  for (int bno = 0; bno < numBlocks; bno++) {
+    AddOp(&w->blocks, inumber, bno, NULL, inp);
+  }
+  return 0;
+}
+
+static int CompareInt64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Prints s as a JSON string, quotes and backslashes escaped and control
+ * characters written as \u escapes.
+ */
+static void PrintJSONString(FILE *out, const char *s) {
+  putc('"', out);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char) *s;
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c < 0x20) fprintf(out, "\\u%04x", c);
+    else putc(c, out);
+  }
+  putc('"', out);
+}
+
+/*
+ * Runs fn over the ops, repeating the list until at least minOps calls have
+ * been timed, and prints one JSON result object.
+ */
+static void RunBench(struct unixfilesystem *fs, const char *name, benchfn fn, struct oplist *list, FILE *out, int first) {
+  fprintf(out, "%s\n        {\"name\": \"%s\", ", first ? "" : ",", name);
+  if (list->numops == 0) {
+    fprintf(out, "\"ops\": 0}");
+    return;
+  }
+
+  int passes = (minOps + list->numops - 1) / list->numops;
+  int total = passes * list->numops;
+  int64_t *samples = malloc(total * sizeof(int64_t));
+  if (samples == NULL) {
+    fprintf(out, "\"ops\": 0, \"error\": \"out of memory\"}");
+    return;
+  }
+
+  struct diskimg_stats before, after;
+  int errors = 0;
+  int64_t sum = 0;
+  diskimg_getstats(&before);
+  for (int pass = 0, k = 0; pass < passes; pass++) {
+    for (int i = 0; i < list->numops; i++, k++) {
+      int64_t start = NowNanosecs();
+      if (fn(fs, &list->ops[i]) < 0) errors++;
+      samples[k] = NowNanosecs() - start;
+    }
+  }
+  diskimg_getstats(&after);
+  uint64_t sectorreads = after.sectorreads - before.sectorreads;
+  uint64_t bytescopied = after.bytescopied - before.bytescopied;
+
+  for (int k = 0; k < total; k++) sum += samples[k];
+  qsort(samples, total, sizeof(int64_t), CompareInt64);
+
+  fprintf(out, "\"ops\": %d, \"errors\": %d, \"ns_per_op\": %.1f, \"p50_ns\": %"PRId64", \"p99_ns\": %"PRId64", "
+          "\"sector_reads_per_op\": %.3f, \"bytes_copied_per_op\": %.1f}",
+          total, errors, (double) sum / total, samples[total / 2], samples[(int) (total * 0.99)],
+          (double) sectorreads / total, (double) bytescopied / total);
+  free(samples);
+}
+
+static void BenchImage(char *diskpath, FILE *out, int first) {
+  fprintf(out, "%s\n    {\"image\": ", first ? "" : ",");
+  PrintJSONString(out, diskpath);
+  fprintf(out, ", ");
+
+  int fd = diskimg_open(diskpath, 1);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open diskimagePath %s\n", diskpath);
+    fprintf(out, "\"error\": \"can't open\"}");
+    return;
+  }
+  if (mmapFlag && diskimg_map(fd) < 0) {
+    fprintf(stderr, "Can't memory-map diskimagePath %s\n", diskpath);
+  }
+  struct unixfilesystem *fs = unixfilesystem_init_icache(fd, icacheSize);
+  if (fs == NULL) {
+    fprintf(out, "\"error\": \"bad filesystem\"}");
+    diskimg_close(fd);
+    return;
+  }
+  if (dcacheSize > 0) fs->dcache = dcache_create(dcacheSize);
+  if (snapshotFlag) {
+    // Compile the snapshot to a temporary file, not next to the image, and
+    // serve the run from it.  Its mapping outlives the file.
+    const char *tmpdir = getenv("TMPDIR");
+    char snappath[MAXPATH];
+    snprintf(snappath, sizeof(snappath), "%s/v6bench.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int snapfd = mkstemp(snappath);
+    if (snapfd >= 0) {
+      close(snapfd);
+      if (snapshot_write(fs, snappath) == 0) fs->snap = snapshot_open(fs, snappath);
+      unlink(snappath);
+    }
+    if (fs->snap == NULL) fprintf(stderr, "Can't use a snapshot of %s\n", diskpath);
+  }
+
+  struct workload w;
+  memset(&w, 0, sizeof(w));
+  inode_scan_foreach(fs, 0, AddInode, &w);
+  WalkTree(fs, "/", ROOT_INUMBER, &w, 0);
+
+  fprintf(out, "\"benchmarks\": [");
+  RunBench(fs, "inode_iget", BenchIget, &w.inodes, out, 1);
+  RunBench(fs, "inode_indexlookup", BenchIndexlookup, &w.blocks, out, 0);
+  RunBench(fs, "file_getblock", BenchGetblock, &w.blocks, out, 0);
+  RunBench(fs, "directory_findname", BenchFindname, &w.names, out, 0);
+  RunBench(fs, "pathname_lookup", BenchPathname, &w.paths, out, 0);
+  fprintf(out, "\n      ]}");
+
+  FreeOps(&w.inodes);
+  FreeOps(&w.blocks);
+  FreeOps(&w.names);
+  FreeOps(&w.paths);
+  unixfilesystem_free(fs);
+  diskimg_close(fd);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options> diskimagePath...\n", progname);
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-m     memory-map the disk images instead of reading sectors\n");
+  fprintf(stderr, "-c N   cache up to N decoded inodes in memory\n");
+  fprintf(stderr, "-n N   cache up to N pathname lookup entries (dentries)\n");
+  fprintf(stderr, "-s     compile a metadata snapshot to a temporary file and run from it\n");
+  fprintf(stderr, "-r N   time at least N calls of each primitive (default %d)\n", DEFAULT_MIN_OPS);
+  fprintf(stderr, "-o F   write the JSON results to file F\n");
+  exit(EXIT_FAILURE);
+}
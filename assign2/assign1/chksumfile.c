@@ -9,10 +9,14 @@
 #include "inode.h"
 #include "file.h"
 #include "directory.h"
+#include "snapshot.h"
 #include "pathname.h"
 #include "chksumfile.h"
 #include <openssl/sha.h>
 
+// File blocks hashed per (vectored) read.
+#define CHKSUM_READ_BLOCKS 16
+
 int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
   SHA_CTX shactx;
   if (!SHA1_Init(&shactx)) {
@@ -31,18 +35,25 @@ int chksumfile_byinumber(struct unixfilesystem *fs, int inumber, void *chksum) {
     return -1;
   }
 
+  // Resolve all the block locations (and indirect blocks) up front.
+  struct inode_blockmap map;
+  err = fs->snap ? snapshot_blockmap(fs->snap, inumber, &map) : inode_blockmap(fs, &in, &map);
+  if (err < 0) {
+    return -1;
+  }
+
   int size = inode_getsize(&in);
-  for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-    char buf[DISKIMG_SECTOR_SIZE];
+  for (int offset = 0; offset < size; offset += CHKSUM_READ_BLOCKS * DISKIMG_SECTOR_SIZE) {
+    char buf[CHKSUM_READ_BLOCKS * DISKIMG_SECTOR_SIZE];
     int bno = offset/DISKIMG_SECTOR_SIZE;
 
-    int bytesMoved = file_getblock(fs, inumber, bno, buf);
-    if (bytesMoved < 0)
-      return -1;
-
-    if (!SHA1_Update(&shactx, buf, bytesMoved))
+    int bytesMoved = file_getblocks_bymap(fs, &map, bno, CHKSUM_READ_BLOCKS, buf);
+    if ((bytesMoved < 0) || !SHA1_Update(&shactx, buf, bytesMoved)) {
+      inode_blockmap_free(&map);
       return -1;
+    }
   }
+  inode_blockmap_free(&map);
 
   if (!SHA1_Final(chksum, &shactx))
     return -1;
@@ -65,18 +76,23 @@ int optimized_chksumfile_byinode(struct unixfilesystem *fs, void *chksum, struct
         return -1;
     }
 
+    // Resolve all the block locations (and indirect blocks) up front.
+    struct inode_blockmap map;
+    if (inode_blockmap(fs, inp, &map) < 0)
+        return -1;
+
     int size = inode_getsize(inp);
-    for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
-        char buf[DISKIMG_SECTOR_SIZE];
+    for (int offset = 0; offset < size; offset += CHKSUM_READ_BLOCKS * DISKIMG_SECTOR_SIZE) {
+        char buf[CHKSUM_READ_BLOCKS * DISKIMG_SECTOR_SIZE];
         int bno = offset/DISKIMG_SECTOR_SIZE;
 
-        int bytesMoved = file_getblock_optimized(fs, bno, buf, inp, inode_iget_ret);
-        if (bytesMoved < 0)
-            return -1;
-
-        if (!SHA1_Update(&shactx, buf, bytesMoved))
+        int bytesMoved = file_getblocks_bymap(fs, &map, bno, CHKSUM_READ_BLOCKS, buf);
+        if ((bytesMoved < 0) || !SHA1_Update(&shactx, buf, bytesMoved)) {
+            inode_blockmap_free(&map);
             return -1;
+        }
     }
+    inode_blockmap_free(&map);
 
     if (!SHA1_Final(chksum, &shactx))
         return -1;
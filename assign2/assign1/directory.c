@@ -2,6 +2,7 @@
 #include "inode.h"
 #include "diskimg.h"
 #include "file.h"
+#include "snapshot.h"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -72,6 +73,9 @@ int directory_findname(struct unixfilesystem *fs, const char *name,
         strncpy((char *)&key.d_name, name, sizeof(key.d_name) - 1);
         // Appending NULL at the last spot - Just in case the name was 13 character long
         key.d_name[sizeof(key.d_name) - 1] = '\0';
+        // A loaded snapshot holds every directory as a sorted name table.
+        if (fs->snap)
+            return snapshot_findname(fs->snap, dirinumber, &key, dirEnt);
         size_t dir_entry_size = sizeof(key);
         int size = inode_getsize(&dirin);
         // Loop till we have perused every block in this inode
@@ -80,7 +84,7 @@ int directory_findname(struct unixfilesystem *fs, const char *name,
             struct direntv6 entries[NUM_DIR_ENTRIES_IN_BLOCK];
             // Inode block indexes spill over for ever DISKIMG_SECTOR_SIZE bytes */
             int blockNum = offset / DISKIMG_SECTOR_SIZE;
-            int valid_bytes = file_getblock_optimized(fs, blockNum, entries, &dirin, inode_iget_ret);
+            int valid_bytes = file_getblock_optimized(fs, blockNum, entries, dirinumber, &dirin, inode_iget_ret);
             if (valid_bytes < 0)
                 return FAILURE;
             // Calculate number of entries
@@ -116,7 +120,7 @@ static inline int validate_directory_findname_optimized(struct unixfilesystem *f
     return FAILURE;
 }
 
-int directory_findname_optimized(struct unixfilesystem *fs, const char *name, struct inode *dirinp, int inode_iget_ret, struct direntv6 *dirEnt) {
+int directory_findname_optimized(struct unixfilesystem *fs, const char *name, int dirinumber, struct inode *dirinp, int inode_iget_ret, struct direntv6 *dirEnt) {
     if (validate_directory_findname_optimized(fs, name, dirinp, dirEnt) == SUCCESS) {
         if (inode_iget_ret < 0)
             return FAILURE;
@@ -138,7 +142,7 @@ int directory_findname_optimized(struct unixfilesystem *fs, const char *name, st
             struct direntv6 entries[NUM_DIR_ENTRIES_IN_BLOCK];
             // Inode block indexes spill over for ever DISKIMG_SECTOR_SIZE bytes */
             int blockNum = offset / DISKIMG_SECTOR_SIZE;
-            int valid_bytes = file_getblock_optimized(fs, blockNum, entries, dirinp, inode_iget_ret);
+            int valid_bytes = file_getblock_optimized(fs, blockNum, entries, dirinumber, dirinp, inode_iget_ret);
             if (valid_bytes < 0)
                 return FAILURE;
             // Calculate number of entries
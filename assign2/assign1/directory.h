@@ -12,6 +12,6 @@
  */
 int directory_findname(struct unixfilesystem *fs, const char *name,
                        int dirinumber, struct direntv6 *dirEnt);
-int directory_findname_optimized(struct unixfilesystem *fs, const char *name, struct inode *dirinp, int inode_iget_ret, struct direntv6 *dirEnt);
+int directory_findname_optimized(struct unixfilesystem *fs, const char *name, int dirinumber, struct inode *dirinp, int inode_iget_ret, struct direntv6 *dirEnt);
 
 #endif // _DIECTORY_H_
@@ -30,6 +30,6 @@ int diskimg_close(int fd) {
   return close(fd);
 }
 
-int diskimg_readsector_inode(int fd, int sectorNum, void *buf, void *inp) {
+int diskimg_readsector_inode(int fd, int sectorNum, void *buf, int inumber, int indirection) {
     return 1;
 }
@@ -2,6 +2,7 @@
 #define _DISKIMG_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 // Size of a disk sector (e.g. block) in bytes.
 #define DISKIMG_SECTOR_SIZE 512
@@ -23,6 +24,13 @@ int diskimg_getsize(int fd);
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf); 
 
+/**
+ * Reads count consecutive sectors starting at firstSector with a single
+ * vectored read, sector firstSector + i going to iov[i] (each iov_len should
+ * be DISKIMG_SECTOR_SIZE).  Returns the number of bytes read, or -1 on error.
+ */
+int diskimg_readsectors(int fd, int firstSector, int count, const struct iovec *iov);
+
 /**
  * Writes the specified sector from the disk.  Returns the number of bytes
  * written, or -1 on error.
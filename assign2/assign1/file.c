@@ -1,9 +1,17 @@
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 #include "file.h"
 #include "inode.h"
 #include "diskimg.h"
 #include "../cachemem.h"
+#include "../diskimg.h"
+#include "snapshot.h"
+
+// Upper bound on the sectors coalesced into one vectored read.
+#define MAX_BLOCKS_PER_IO 64
+// Contiguous runs read concurrently by file_getblocks_bymap.
+#define MAX_RUNS_IN_FLIGHT 16
 
 /*
  * Helper Functions
@@ -44,12 +52,12 @@ static inline int validate_file_getblock_optimized(struct unixfilesystem *fs, in
 
 /*
  * Function : file_getblock_optimized
- * Usage : int valid_bytes = file_getblock(fs, dirinumber, blockNum, entries, inp, inode_iget_ret);
- * --------------------------------------------------------------------------------------------------
+ * Usage : int valid_bytes = file_getblock_optimized(fs, blockNum, entries, dirinumber, inp, inode_iget_ret);
+ * ------------------------------------------------------------------------------------------------------------
  *  This function fetches the specified disk block from the specified inode passed as argument.
  *  Returns the number of valid bytes in the block, FAILURE/-1 on error.
  */
-int file_getblock_optimized(struct unixfilesystem *fs, int blockNum, void *buf, struct inode *inp, int inode_iget_ret) {
+int file_getblock_optimized(struct unixfilesystem *fs, int blockNum, void *buf, int inumber, struct inode *inp, int inode_iget_ret) {
     if ((validate_file_getblock_optimized(fs, blockNum, buf, inp)) == SUCCESS) {
         if (inode_iget_ret < 0)
             return FAILURE;
@@ -57,7 +65,7 @@ int file_getblock_optimized(struct unixfilesystem *fs, int blockNum, void *buf,
         int read_bytes;
 
         // Reading from the disk
-        int disk_block = inode_indexlookup(fs, inp, blockNum);
+        int disk_block = inode_indexlookup_optimized(fs, inumber, inp, blockNum);
         if ((read_bytes = diskimg_readsector(fs->dfd, disk_block, buf)) != DISKIMG_SECTOR_SIZE) {
             fprintf(stderr, " Disk read failed, fs 0x%p disk_block %d inp 0x%p blockNum %d buf 0x%p inode_iget_ret %d, returning -1\n", fs, disk_block, inp, blockNum, buf, inode_iget_ret);
             return FAILURE;
@@ -78,6 +86,31 @@ int file_getblock_optimized(struct unixfilesystem *fs, int blockNum, void *buf,
 
 
 
+/*
+ * Function : file_getblock_bymap
+ * Usage : int valid_bytes = file_getblock_bymap(fs, &map, blockNum, buf);
+ * --------------------------------------------------------------------------
+ *  This function fetches the specified file block, locating it through a
+ *  block map built by inode_blockmap so no inode or indirect block is read.
+ *  Returns the number of valid bytes in the block, FAILURE/-1 on error.
+ */
+int file_getblock_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int blockNum, void *buf) {
+    int disk_block = inode_blockmap_lookup(map, blockNum);
+    if ((fs) && (buf) && (disk_block >= 0)) {
+        if (diskimg_readsector(fs->dfd, disk_block, buf) != DISKIMG_SECTOR_SIZE) {
+            fprintf(stderr, " Disk read failed, fs 0x%p disk_block %d blockNum %d buf 0x%p, returning -1\n", fs, disk_block, blockNum, buf);
+            return FAILURE;
+        }
+        // The last block of the file may be partially valid.
+        if (map->size < ((blockNum + 1) * DISKIMG_SECTOR_SIZE))
+            return map->size % DISKIMG_SECTOR_SIZE;
+        return DISKIMG_SECTOR_SIZE;
+    } else {
+        fprintf(stderr, "file_getblock_bymap(blockNum = %d, fs = 0x%p, map = 0x%p, buf = 0x%p) validation failed. returning -1\n", blockNum, fs, (const void *) map, buf);
+        return FAILURE;
+    }
+}
+
 /*
  * Function : file_getblock
  * Usage : int valid_bytes = file_getblock(fs, dirinumber, blockNum, entries);
@@ -97,7 +130,7 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *bu
         }
 
         // Getting disk block
-        int disk_block = inode_indexlookup(fs, &in, blockNum);
+        int disk_block = inode_indexlookup_optimized(fs, inumber, &in, blockNum);
 
         // Reading from the disk
         if ((read_bytes = diskimg_readsector(fs->dfd, disk_block, buf)) != DISKIMG_SECTOR_SIZE) {
@@ -115,3 +148,93 @@ int file_getblock(struct unixfilesystem *fs, int inumber, int blockNum, void *bu
         return FAILURE;  
     }
 }
+
+/*
+ * Function : file_getblocks_bymap
+ * Usage : int valid_bytes = file_getblocks_bymap(fs, &map, firstBlock, nBlocks, buf);
+ * ------------------------------------------------------------------------------------
+ *  This function reads nBlocks consecutive file blocks starting at firstBlock
+ *  into buf, which must hold nBlocks * DISKIMG_SECTOR_SIZE bytes. Runs of
+ *  blocks that are contiguous on disk are fetched with a single read request
+ *  of up to MAX_BLOCKS_PER_IO sectors, and the requests for separate runs are
+ *  submitted together so they overlap when asynchronous I/O is enabled.
+ *  Blocks past the end of the file are not read.
+ *  Returns the number of valid bytes placed in buf, FAILURE/-1 on error.
+ */
+int file_getblocks_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int firstBlock, int nBlocks, void *buf) {
+    if (!(fs) || !(map) || !(buf) || (firstBlock < 0) || (nBlocks < 0)) {
+        fprintf(stderr, "file_getblocks_bymap(firstBlock = %d, nBlocks = %d, fs = 0x%p, map = 0x%p, buf = 0x%p) validation failed. returning -1\n", firstBlock, nBlocks, fs, (const void *) map, buf);
+        return FAILURE;
+    }
+
+    int lastBlock = firstBlock + nBlocks;
+    if (lastBlock > map->numBlocks)
+        lastBlock = map->numBlocks;
+    if (firstBlock >= lastBlock)
+        return 0;
+
+    // Every physically contiguous run becomes one request, and up to
+    // MAX_RUNS_IN_FLIGHT of them are outstanding together.
+    char *dst = buf;
+    for (int blockNum = firstBlock; blockNum < lastBlock; ) {
+        struct diskimg_request reqs[MAX_RUNS_IN_FLIGHT];
+        struct diskimg_request *batch[MAX_RUNS_IN_FLIGHT];
+        int numreqs = 0;
+        for (; (numreqs < MAX_RUNS_IN_FLIGHT) && (blockNum < lastBlock); numreqs++) {
+            int disk_block = inode_blockmap_lookup(map, blockNum);
+            if (disk_block < 0)
+                return FAILURE;
+
+            // Extend the run while the next file block is the next disk sector.
+            int run = 1;
+            while ((run < MAX_BLOCKS_PER_IO) && ((blockNum + run) < lastBlock) &&
+                   (inode_blockmap_lookup(map, blockNum + run) == (disk_block + run)))
+                run++;
+
+            memset(&reqs[numreqs], 0, sizeof(reqs[numreqs]));
+            reqs[numreqs].sectorNum = disk_block;
+            reqs[numreqs].count = run;
+            reqs[numreqs].buf = dst;
+            batch[numreqs] = &reqs[numreqs];
+            dst += run * DISKIMG_SECTOR_SIZE;
+            blockNum += run;
+        }
+        if (diskimg_readbatch(fs->dfd, batch, numreqs) < 0) {
+            fprintf(stderr, " Disk read failed, fs 0x%p first disk_block %d runs %d, returning -1\n", fs, reqs[0].sectorNum, numreqs);
+            return FAILURE;
+        }
+    }
+
+    // The last block of the file may be partially valid.
+    int end = lastBlock * DISKIMG_SECTOR_SIZE;
+    if (end > map->size)
+        end = map->size;
+    return end - (firstBlock * DISKIMG_SECTOR_SIZE);
+}
+
+/*
+ * Function : file_getblocks
+ * Usage : int valid_bytes = file_getblocks(fs, inumber, firstBlock, nBlocks, buf);
+ * -------------------------------------------------------------------------------
+ *  Same as file_getblocks_bymap but resolves the block map of the inode first.
+ *  Returns the number of valid bytes placed in buf, FAILURE/-1 on error.
+ */
+int file_getblocks(struct unixfilesystem *fs, int inumber, int firstBlock, int nBlocks, void *buf) {
+    if (((validate_file_getblock(fs, inumber, firstBlock, buf)) != SUCCESS) || (nBlocks < 0)) {
+        fprintf(stderr, "file_getblocks(inumber = %d, firstBlock = %d, nBlocks = %d, fs = 0x%p, buf 0x%p) validation failed. returning -1\n", inumber, firstBlock, nBlocks, fs, buf);
+        return FAILURE;
+    }
+
+    struct inode in;
+    if (inode_iget(fs, inumber, &in) < 0)
+        return FAILURE;
+
+    struct inode_blockmap map;
+    int err = (fs->snap) ? snapshot_blockmap(fs->snap, inumber, &map) : inode_blockmap(fs, &in, &map);
+    if (err < 0)
+        return FAILURE;
+
+    int read_bytes = file_getblocks_bymap(fs, &map, firstBlock, nBlocks, buf);
+    inode_blockmap_free(&map);
+    return read_bytes;
+}
@@ -9,6 +9,26 @@
  * Returns the number of valid bytes in the block, -1 on error.
  */
 int file_getblock(struct unixfilesystem *fs, int inumber, int blockNo, void *buf); 
-int file_getblock_optimized(struct unixfilesystem *fs, int blockNum, void *buf, struct inode *inp, int inode_iget_ret); 
+int file_getblock_optimized(struct unixfilesystem *fs, int blockNum, void *buf, int inumber, struct inode *inp, int inode_iget_ret); 
+
+/**
+ * Fetches the specified file block using a block map built by
+ * inode_blockmap() instead of re-reading the inode and indirect blocks.
+ * Returns the number of valid bytes in the block, -1 on error.
+ */
+int file_getblock_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int blockNo, void *buf);
+
+/**
+ * Reads nBlocks consecutive file blocks starting at firstBlock into buf, which
+ * must hold nBlocks * DISKIMG_SECTOR_SIZE bytes.  Blocks that are contiguous
+ * on disk are fetched with one vectored read.  Returns the number of valid
+ * bytes placed in buf (short at the end of the file), -1 on error.
+ */
+int file_getblocks(struct unixfilesystem *fs, int inumber, int firstBlock, int nBlocks, void *buf);
+
+/**
+ * Like file_getblocks() but takes a block map built by inode_blockmap().
+ */
+int file_getblocks_bymap(struct unixfilesystem *fs, const struct inode_blockmap *map, int firstBlock, int nBlocks, void *buf);
 
 #endif // _FILE_H_
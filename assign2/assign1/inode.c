@@ -2,8 +2,10 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
 #include "inode.h"
 #include "../diskimg.h"
+#include "snapshot.h"
 
 /*
  * Helper functions
@@ -12,8 +14,8 @@ static inline unsigned int calculate_sector_index_from_inumber(int inumber);
 static inline unsigned int calculate_inode_offset_in_sector(int inumber);
 static inline int validate_indexlookup(struct unixfilesystem *fs, struct inode *inp, int   blockNum);
 static int find_disk_block_for_small_files(struct inode *inp, int blockNum);
-static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int    blockNum, uint16_t *double_indirection_block, struct inode *inp);
-static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct inode *inp,   int blockNum);
+static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int    blockNum, uint16_t *double_indirection_block, int inumber, struct inode *inp);
+static int find_disk_block_for_large_files(struct unixfilesystem *fs, int inumber, struct inode *inp,   int blockNum);
 
 /*
  * Simple function to calculate sector index
@@ -63,6 +65,8 @@ static inline int validate_indexlookup(struct unixfilesystem *fs, struct inode *
  */
 int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp) {
     if (!(validate_iget(fs, inumber, inp))) {
+        if (fs->snap)
+            return snapshot_iget(fs->snap, inumber, inp);
         unsigned int sector_index = calculate_sector_index_from_inumber(inumber);
         struct inode inode_sector[INODES_IN_SECTOR];
         if (diskimg_readsector(fs->dfd, sector_index, inode_sector) != DISKIMG_SECTOR_SIZE) {
@@ -89,12 +93,12 @@ static inline int find_disk_block_for_small_files(struct inode *inp, int blockNu
 /*
  * Fetches disk sector block by dereferencing from a double indirection block
  */
-static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int blockNum, uint16_t *double_indirection_block, struct inode *inp) {
+static int find_disk_block_from_double_indirection_block(struct unixfilesystem *fs, int blockNum, uint16_t *double_indirection_block, int inumber, struct inode *inp) {
     int double_indirection_index = (blockNum / MAX_DISK_BLOCK_INDEXES_IN_BLOCK) - NUM_SINGLE_INDIRECTION_INDEXES;
     int dereferenced_disk_block = double_indirection_block[double_indirection_index];
     uint16_t single_indirection_block[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
     int typeandindirection = (((inp->i_mode & IFMT) == IFDIR) << 16) | 1;
-    if (diskimg_readsector_inode(fs->dfd, dereferenced_disk_block, single_indirection_block, inp, typeandindirection) != DISKIMG_SECTOR_SIZE) {
+    if (diskimg_readsector_inode(fs->dfd, dereferenced_disk_block, single_indirection_block, inumber, typeandindirection) != DISKIMG_SECTOR_SIZE) {
         fprintf(stderr, "Disk read failed, fs 0x%p dereferenced_disk_block %u  blockNum %d, returning -1\n", fs, dereferenced_disk_block, blockNum);
         return FAILURE;
     }
@@ -106,7 +110,7 @@ static int find_disk_block_from_double_indirection_block(struct unixfilesystem *
  * Finds the disk sector block for large files which can have single and double
  * indirection block
  */
-static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct inode *inp, int blockNum) {
+static int find_disk_block_for_large_files(struct unixfilesystem *fs, int inumber, struct inode *inp, int blockNum) {
     int block_index;
     int disk_block;
     int dereferenced_disk_block;
@@ -116,7 +120,7 @@ static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct ino
         block_index = blockNum / MAX_DISK_BLOCK_INDEXES_IN_BLOCK; 
         dereferenced_disk_block = inp->i_addr[block_index];
         int typeandindirection = (((inp->i_mode & IFMT) == IFDIR) << 16) | 1;
-        if (diskimg_readsector_inode(fs->dfd, dereferenced_disk_block, block_content, inp, typeandindirection) != DISKIMG_SECTOR_SIZE) {
+        if (diskimg_readsector_inode(fs->dfd, dereferenced_disk_block, block_content, inumber, typeandindirection) != DISKIMG_SECTOR_SIZE) {
             fprintf(stderr, "Disk read failed, fs 0x%p dereferenced_disk_block %u inp 0x%p blockNum %d, returning -1\n", fs, dereferenced_disk_block, inp, blockNum);
             return FAILURE;
         }
@@ -127,11 +131,11 @@ static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct ino
         block_index = DOUBLY_INDIRECT_DISK_BLOCK_INDEX;
         dereferenced_disk_block = inp->i_addr[block_index];
         int typeandindirection = (((inp->i_mode & IFMT) == IFDIR) << 16) | 2;
-        if (diskimg_readsector_inode(fs->dfd, dereferenced_disk_block, block_content, inp, typeandindirection) != DISKIMG_SECTOR_SIZE) {
+        if (diskimg_readsector_inode(fs->dfd, dereferenced_disk_block, block_content, inumber, typeandindirection) != DISKIMG_SECTOR_SIZE) {
             fprintf(stderr, "Disk read failed, fs 0x%p dereferenced_disk_block %u inp 0x%p blockNum %d, returning -1\n", fs, dereferenced_disk_block, inp, blockNum);
             return FAILURE;
         }
-        disk_block = find_disk_block_from_double_indirection_block(fs, blockNum, block_content, inp);
+        disk_block = find_disk_block_from_double_indirection_block(fs, blockNum, block_content, inumber, inp);
     }
     return disk_block;
 }
@@ -144,11 +148,23 @@ static int find_disk_block_for_large_files(struct unixfilesystem *fs, struct ino
  * Returns the disk block number on success, -1/ERROR on error
  */
 int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum) {
+    return inode_indexlookup_optimized(fs, 0, inp, blockNum);
+}
+
+/*
+ * Function : inode_indexlookup_optimized
+ * Usage : int disk_block = inode_indexlookup_optimized(fs, inumber, &in, blockNum);
+ * ----------------------------------------------------------------------------------
+ * Same as inode_indexlookup, but the indirect blocks read on the way are kept
+ * in the protected inode cache under inumber. 0 for inumber keeps them out.
+ * Returns the disk block number on success, -1/ERROR on error
+ */
+int inode_indexlookup_optimized(struct unixfilesystem *fs, int inumber, struct inode *inp, int blockNum) {
     if (!(validate_indexlookup(fs, inp, blockNum))) {
         int disk_block_num;
         // Check if the inode has indirection.
         if ((inp->i_mode & ILARG)) {
-            disk_block_num = find_disk_block_for_large_files(fs, inp, blockNum);
+            disk_block_num = find_disk_block_for_large_files(fs, inumber, inp, blockNum);
         } else {
             disk_block_num = find_disk_block_for_small_files(inp, blockNum);
         }
@@ -160,3 +176,124 @@ int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum
 int inode_getsize(struct inode *inp) {
     return ((inp->i_size0 << 16) | inp->i_size1); 
 }
+/*
+ * Appends a disk block to the block map, extending the last extent when the
+ * block is physically contiguous with it.
+ */
+static void blockmap_append(struct inode_blockmap *map, int disk_block) {
+    struct inode_extent *last = map->numExtents ? &map->extents[map->numExtents - 1] : NULL;
+    if ((last) && (last->diskBlock + last->numBlocks == disk_block)) {
+        last->numBlocks++;
+    } else {
+        struct inode_extent *extent = &map->extents[map->numExtents++];
+        extent->fileBlock = map->numBlocks;
+        extent->diskBlock = disk_block;
+        extent->numBlocks = 1;
+    }
+    map->numBlocks++;
+}
+
+/*
+ * Appends the first count disk blocks listed in an indirect block.
+ */
+static int blockmap_append_indirect(struct unixfilesystem *fs, struct inode_blockmap *map, int indirect_block, int count) {
+    uint16_t block_content[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+    if (diskimg_readsector(fs->dfd, indirect_block, block_content) != DISKIMG_SECTOR_SIZE) {
+        fprintf(stderr, "Disk read failed, fs 0x%p indirect_block %d, returning -1\n", fs, indirect_block);
+        return FAILURE;
+    }
+    for (int index = 0; index < count; index++)
+        blockmap_append(map, block_content[index]);
+    return SUCCESS;
+}
+
+/*
+ * Function : inode_blockmap
+ * Usage : if (inode_blockmap(fs, &in, &map) == SUCCESS)
+ * ----------------------------------------------------------
+ * Resolves the disk block of every file block of the inode, reading each
+ * singly and doubly indirect block only once, and records the result as a
+ * list of extents. Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int inode_blockmap(struct unixfilesystem *fs, struct inode *inp, struct inode_blockmap *map) {
+    if (!(fs) || !(inp) || !(map))
+        return FAILURE;
+    int size = inode_getsize(inp);
+    int num_blocks = (size + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+    map->size = size;
+    map->numBlocks = 0;
+    map->numExtents = 0;
+    /* Worst case every block is its own extent */
+    map->extents = malloc((num_blocks ? num_blocks : 1) * sizeof(struct inode_extent));
+    if (map->extents == NULL)
+        return FAILURE;
+
+    if (!(inp->i_mode & ILARG)) {
+        if (num_blocks > MAX_DIRECT_DISK_BLOCK_INDEXES_IN_INODE)
+            goto error;
+        for (int index = 0; index < num_blocks; index++)
+            blockmap_append(map, inp->i_addr[index]);
+        return SUCCESS;
+    }
+
+    // Single indirection blocks
+    for (int index = 0; (index < NUM_SINGLE_INDIRECTION_INDEXES) && (map->numBlocks < num_blocks); index++) {
+        int count = num_blocks - map->numBlocks;
+        if (count > MAX_DISK_BLOCK_INDEXES_IN_BLOCK)
+            count = MAX_DISK_BLOCK_INDEXES_IN_BLOCK;
+        if (blockmap_append_indirect(fs, map, inp->i_addr[index], count) < 0)
+            goto error;
+    }
+
+    // Double indirection block
+    if (map->numBlocks < num_blocks) {
+        uint16_t double_indirection_block[MAX_DISK_BLOCK_INDEXES_IN_BLOCK];
+        if (diskimg_readsector(fs->dfd, inp->i_addr[DOUBLY_INDIRECT_DISK_BLOCK_INDEX], double_indirection_block) != DISKIMG_SECTOR_SIZE) {
+            fprintf(stderr, "Disk read failed, fs 0x%p inp 0x%p double indirection block, returning -1\n", fs, inp);
+            goto error;
+        }
+        for (int index = 0; (index < MAX_DISK_BLOCK_INDEXES_IN_BLOCK) && (map->numBlocks < num_blocks); index++) {
+            int count = num_blocks - map->numBlocks;
+            if (count > MAX_DISK_BLOCK_INDEXES_IN_BLOCK)
+                count = MAX_DISK_BLOCK_INDEXES_IN_BLOCK;
+            if (blockmap_append_indirect(fs, map, double_indirection_block[index], count) < 0)
+                goto error;
+        }
+    }
+    return SUCCESS;
+
+error:
+    inode_blockmap_free(map);
+    return FAILURE;
+}
+
+/*
+ * Function : inode_blockmap_lookup
+ * Usage : int disk_block = inode_blockmap_lookup(&map, blockNum);
+ * ------------------------------------------------------------------
+ * Binary searches the extents for the one covering blockNum.
+ * Returns the disk block number on success, -1/FAILURE on error.
+ */
+int inode_blockmap_lookup(const struct inode_blockmap *map, int blockNum) {
+    if (!(map) || (blockNum < 0) || (blockNum >= map->numBlocks))
+        return FAILURE;
+    int low = 0, high = map->numExtents - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (map->extents[mid].fileBlock <= blockNum)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    const struct inode_extent *extent = &map->extents[low];
+    return extent->diskBlock + (blockNum - extent->fileBlock);
+}
+
+void inode_blockmap_free(struct inode_blockmap *map) {
+    if (!(map))
+        return;
+    free(map->extents);
+    map->extents = NULL;
+    map->numExtents = 0;
+    map->numBlocks = 0;
+}
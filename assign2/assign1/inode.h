@@ -40,9 +40,51 @@ int inode_iget(struct unixfilesystem *fs, int inumber, struct inode *inp);
  */
 int inode_indexlookup(struct unixfilesystem *fs, struct inode *inp, int blockNum);
 
+/**
+ * Same as inode_indexlookup for the inode numbered inumber, whose indirect
+ * blocks are kept in the protected inode cache.
+ */
+int inode_indexlookup_optimized(struct unixfilesystem *fs, int inumber, struct inode *inp, int blockNum);
+
 /**
  * Computes the size of an inode from its size0 and size1 fields.
  */
 int inode_getsize(struct inode *inp);
 
+/**
+ * A run of physically contiguous disk blocks backing consecutive file blocks.
+ */
+struct inode_extent {
+  int fileBlock;   // First file block of the run
+  int diskBlock;   // Disk block holding fileBlock
+  int numBlocks;   // Length of the run in blocks
+};
+
+/**
+ * The whole file block -> disk block mapping of an inode, stored as a
+ * run-length list of extents in file block order.
+ */
+struct inode_blockmap {
+  int size;                      // File size in bytes
+  int numBlocks;                 // Number of file blocks mapped
+  int numExtents;
+  struct inode_extent *extents;
+};
+
+/**
+ * Resolves the disk location of every block of the specified inode in one
+ * pass, reading each indirect block exactly once.  The extents are allocated
+ * and must be released with inode_blockmap_free().  Returns 0 on success,
+ * -1 on error.
+ */
+int inode_blockmap(struct unixfilesystem *fs, struct inode *inp, struct inode_blockmap *map);
+
+/**
+ * Gets the disk block holding the specified file block from a block map.
+ * Returns the disk block number on success, -1 on error.
+ */
+int inode_blockmap_lookup(const struct inode_blockmap *map, int blockNum);
+
+void inode_blockmap_free(struct inode_blockmap *map);
+
 #endif // _INODE_
@@ -86,12 +86,12 @@ static inline int validate_pathname_lookup_optimized(struct unixfilesystem *fs,
 }
 
 
-int pathname_lookup_optimized(struct unixfilesystem *fs, const char *subpath, struct inode *parentinode, int inode_iget_ret) {
+int pathname_lookup_optimized(struct unixfilesystem *fs, const char *subpath, int parentinumber, struct inode *parentinode, int inode_iget_ret) {
     if ((validate_pathname_lookup_optimized(fs, subpath, parentinode) == SUCCESS)) {
         struct direntv6 member;
         char *membername = strdup(subpath);
         int inumber = FAILURE;
-        if ((directory_findname_optimized(fs, membername, parentinode, inode_iget_ret, &member)) == SUCCESS)
+        if ((directory_findname_optimized(fs, membername, parentinumber, parentinode, inode_iget_ret, &member)) == SUCCESS)
             inumber = member.d_inumber;
 
         if ((membername))
@@ -10,6 +10,6 @@
  * encountered.
  */
 int pathname_lookup(struct unixfilesystem *fs, const char *pathname);
-int pathname_lookup_optimized(struct unixfilesystem *fs, const char *subpath, struct inode *parentinode, int inode_iget_ret);
+int pathname_lookup_optimized(struct unixfilesystem *fs, const char *subpath, int parentinumber, struct inode *parentinode, int inode_iget_ret);
 
 #endif // _PATHNAME_H_
@@ -0,0 +1,504 @@
+/* Header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "inode.h"
+#include "file.h"
+#include "diskimg.h"
+
+/*
+ * Macros
+ */
+#define SNAPSHOT_MAGIC   0x56365350 /* "PS6V" */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN   8
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+/*
+ * Layout of a snapshot file: this header followed by the sections it
+ * points at, each starting on an 8 byte boundary.
+ *
+ *   inodes     struct inode[numinodes]
+ *   extindex   uint32_t[numinodes + 1], extents of inumber i are
+ *              extents[extindex[i - 1] .. extindex[i] - 1]
+ *   extents    struct inode_extent[numextents]
+ *   nameindex  uint32_t[numinodes + 1], same scheme for names
+ *   names      struct direntv6[numnames], every entry of every allocated
+ *              directory, sorted by d_name within the directory
+ *
+ * The file is only meaningful on the machine that wrote it.
+ */
+struct snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t s_time;              /* Superblock s_time of the image */
+    uint32_t numinodes;
+    uint32_t numextents;
+    uint32_t numnames;
+    uint64_t superblockchecksum;  /* Checksum of the image superblock */
+    uint64_t bodychecksum;        /* Checksum of everything after the header */
+    uint64_t inodesoff;
+    uint64_t extindexoff;
+    uint64_t extentsoff;
+    uint64_t nameindexoff;
+    uint64_t namesoff;
+    uint64_t size;                /* Length of the whole file */
+};
+
+/*
+ * Names of one directory being sorted, with their position in the
+ * directory to keep the sort stable.
+ */
+struct sortname {
+    struct direntv6 entry;
+    uint32_t position;
+};
+
+/*
+ * Simple functions computing a 64 bit FNV-1a checksum
+ */
+static uint64_t checksum_update(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t checksum(const void *data, size_t len) {
+    return checksum_update(FNV_OFFSET_BASIS, data, len);
+}
+
+static uint32_t superblock_time(const struct filsys *superblock) {
+    return ((uint32_t) superblock->s_time[0] << 16) | superblock->s_time[1];
+}
+
+static uint64_t align(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t) (SNAPSHOT_ALIGN - 1);
+}
+
+static int cmp_sortnames(const void *addr1, const void *addr2) {
+    const struct sortname *name1 = addr1;
+    const struct sortname *name2 = addr2;
+    int cmp = memcmp(name1->entry.d_name, name2->entry.d_name, sizeof(name1->entry.d_name));
+    if (cmp != 0)
+        return cmp;
+    return (name1->position > name2->position) - (name1->position < name2->position);
+}
+
+/*
+ * Simple function to grow an array to hold at least count elements
+ */
+static int reserve(void **array, uint32_t *capacity, uint32_t count, size_t elemsize) {
+    if (count <= *capacity)
+        return SUCCESS;
+    uint32_t newcapacity = *capacity ? *capacity : 1024;
+    while (newcapacity < count)
+        newcapacity *= 2;
+    void *grown = realloc(*array, (size_t) newcapacity * elemsize);
+    if (grown == NULL)
+        return FAILURE;
+    *array = grown;
+    *capacity = newcapacity;
+    return SUCCESS;
+}
+
+/*
+ * Function : compile_directory
+ * Usage : if (compile_directory(fs, inumber, &in, &names, &numnames, &maxnames) == SUCCESS)
+ * ----------------------------------------------------------------------------------------
+ * Appends every entry of the directory to names, sorted by name.
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+static int compile_directory(struct unixfilesystem *fs, int inumber, struct inode *inp,
+                             struct direntv6 **names, uint32_t *numnames, uint32_t *maxnames) {
+    int size = inode_getsize(inp);
+    uint32_t count = size / sizeof(struct direntv6);
+    struct sortname *sorted = malloc((count ? count : 1) * sizeof(struct sortname));
+    if (sorted == NULL)
+        return FAILURE;
+
+    uint32_t position = 0;
+    for (int offset = 0; offset < size; offset += DISKIMG_SECTOR_SIZE) {
+        struct direntv6 entries[DISKIMG_SECTOR_SIZE / sizeof(struct direntv6)];
+        int valid_bytes = file_getblock(fs, inumber, offset / DISKIMG_SECTOR_SIZE, entries);
+        if (valid_bytes < 0) {
+            free(sorted);
+            return FAILURE;
+        }
+        for (unsigned int i = 0; (i < valid_bytes / sizeof(struct direntv6)) && (position < count); i++) {
+            sorted[position].entry = entries[i];
+            sorted[position].position = position;
+            position++;
+        }
+    }
+    qsort(sorted, position, sizeof(struct sortname), cmp_sortnames);
+
+    if (reserve((void **) names, maxnames, *numnames + position, sizeof(struct direntv6)) != SUCCESS) {
+        free(sorted);
+        return FAILURE;
+    }
+    for (uint32_t i = 0; i < position; i++)
+        (*names)[(*numnames)++] = sorted[i].entry;
+    free(sorted);
+    return SUCCESS;
+}
+
+/*
+ * Function : write_section
+ * Usage : if (write_section(file, &offset, data, len, &bodychecksum) == SUCCESS)
+ * ------------------------------------------------------------------------------
+ * Pads the file to the next section boundary, writes len bytes and folds
+ * them (and the padding) into the running body checksum.
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+static int write_section(FILE *file, uint64_t *offset, const void *data, size_t len, uint64_t *hash) {
+    static const unsigned char zeros[SNAPSHOT_ALIGN];
+    size_t pad = align(*offset) - *offset;
+    *hash = checksum_update(*hash, zeros, pad);
+    *hash = checksum_update(*hash, data, len);
+    if ((pad && (fwrite(zeros, 1, pad, file) != pad)) || (len && (fwrite(data, 1, len, file) != len)))
+        return FAILURE;
+    *offset += pad + len;
+    return SUCCESS;
+}
+
+/*
+ * Function : snapshot_write
+ * Usage : if (snapshot_write(fs, "disk.img.snap") == SUCCESS)
+ * --------------------------------------------------------------
+ * Reads every inode, resolves the block map of every allocated inode and
+ * the entries of every allocated directory, and writes them out as a
+ * snapshot file. Any error reading the image fails the whole compile so a
+ * snapshot never answers differently than the image would.
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int snapshot_write(struct unixfilesystem *fs, const char *path) {
+    if (!(fs) || !(path))
+        return FAILURE;
+
+    // Compile from the image itself, not from a snapshot already in use.
+    struct snapshot *active = fs->snap;
+    fs->snap = NULL;
+
+    int ret = FAILURE;
+    FILE *file = NULL;
+    uint32_t numinodes = fs->superblock.s_isize * INODES_IN_SECTOR;
+    uint32_t numextents = 0, maxextents = 0, numnames = 0, maxnames = 0;
+    struct inode_extent *extents = NULL;
+    struct direntv6 *names = NULL;
+    struct inode *inodes = malloc((numinodes ? numinodes : 1) * sizeof(struct inode));
+    uint32_t *extindex = malloc((numinodes + 1) * sizeof(uint32_t));
+    uint32_t *nameindex = malloc((numinodes + 1) * sizeof(uint32_t));
+    if (!(inodes) || !(extindex) || !(nameindex)) {
+        fprintf(stderr, "Out of memory.\n");
+        goto done;
+    }
+
+    for (int sector = 0; sector < fs->superblock.s_isize; sector++) {
+        if (diskimg_readsector(fs->dfd, INODE_START_SECTOR + sector, &inodes[sector * INODES_IN_SECTOR]) != DISKIMG_SECTOR_SIZE) {
+            fprintf(stderr, "Disk read failed, fs 0x%p inode sector %d, can't compile snapshot\n", fs, INODE_START_SECTOR + sector);
+            goto done;
+        }
+    }
+
+    extindex[0] = 0;
+    nameindex[0] = 0;
+    for (uint32_t index = 0; index < numinodes; index++) {
+        struct inode *inp = &inodes[index];
+        int inumber = index + ROOT_INUMBER;
+        if (inp->i_mode & IALLOC) {
+            struct inode_blockmap map;
+            if (inode_blockmap(fs, inp, &map) != SUCCESS) {
+                fprintf(stderr, "Can't resolve the blocks of inumber %d, can't compile snapshot\n", inumber);
+                goto done;
+            }
+            if (reserve((void **) &extents, &maxextents, numextents + map.numExtents, sizeof(struct inode_extent)) != SUCCESS) {
+                inode_blockmap_free(&map);
+                fprintf(stderr, "Out of memory.\n");
+                goto done;
+            }
+            memcpy(&extents[numextents], map.extents, map.numExtents * sizeof(struct inode_extent));
+            numextents += map.numExtents;
+            inode_blockmap_free(&map);
+
+            if (((inp->i_mode & IFMT) == IFDIR) &&
+                (compile_directory(fs, inumber, inp, &names, &numnames, &maxnames) != SUCCESS)) {
+                fprintf(stderr, "Can't read directory inumber %d, can't compile snapshot\n", inumber);
+                goto done;
+            }
+        }
+        extindex[index + 1] = numextents;
+        nameindex[index + 1] = numnames;
+    }
+
+    if ((file = fopen(path, "wb")) == NULL) {
+        perror(path);
+        goto done;
+    }
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.s_time = superblock_time(&fs->superblock);
+    header.numinodes = numinodes;
+    header.numextents = numextents;
+    header.numnames = numnames;
+    header.superblockchecksum = checksum(&fs->superblock, sizeof(fs->superblock));
+    header.bodychecksum = FNV_OFFSET_BASIS;
+
+    // The header is rewritten once the offsets and the checksum are known.
+    uint64_t offset = sizeof(header);
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        goto writefailed;
+    header.inodesoff = align(offset);
+    if (write_section(file, &offset, inodes, (size_t) numinodes * sizeof(struct inode), &header.bodychecksum) != SUCCESS)
+        goto writefailed;
+    header.extindexoff = align(offset);
+    if (write_section(file, &offset, extindex, (size_t) (numinodes + 1) * sizeof(uint32_t), &header.bodychecksum) != SUCCESS)
+        goto writefailed;
+    header.extentsoff = align(offset);
+    if (write_section(file, &offset, extents, (size_t) numextents * sizeof(struct inode_extent), &header.bodychecksum) != SUCCESS)
+        goto writefailed;
+    header.nameindexoff = align(offset);
+    if (write_section(file, &offset, nameindex, (size_t) (numinodes + 1) * sizeof(uint32_t), &header.bodychecksum) != SUCCESS)
+        goto writefailed;
+    header.namesoff = align(offset);
+    if (write_section(file, &offset, names, (size_t) numnames * sizeof(struct direntv6), &header.bodychecksum) != SUCCESS)
+        goto writefailed;
+    header.size = offset;
+    if ((fseek(file, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, file) != 1))
+        goto writefailed;
+    if (fclose(file) != 0) {
+        file = NULL;
+        goto writefailed;
+    }
+    file = NULL;
+    ret = SUCCESS;
+    goto done;
+
+writefailed:
+    perror(path);
+done:
+    if (file)
+        fclose(file);
+    free(inodes);
+    free(extindex);
+    free(nameindex);
+    free(extents);
+    free(names);
+    fs->snap = active;
+    return ret;
+}
+
+/*
+ * Function : validate_index
+ * Usage : if (validate_index(index, numinodes, total) == SUCCESS)
+ * -----------------------------------------------------------------
+ * Checks that a prefix sum index is non-decreasing and ends at total so
+ * lookups never leave their section.
+ */
+static int validate_index(const uint32_t *index, uint32_t numinodes, uint32_t total) {
+    if (index[0] != 0)
+        return FAILURE;
+    for (uint32_t i = 0; i < numinodes; i++) {
+        if (index[i + 1] < index[i])
+            return FAILURE;
+    }
+    return (index[numinodes] == total) ? SUCCESS : FAILURE;
+}
+
+static int validate_section(const struct snapshot_header *header, uint64_t offset, uint64_t len) {
+    if ((offset % SNAPSHOT_ALIGN) || (offset < sizeof(*header)) || (offset > header->size) || (len > header->size - offset))
+        return FAILURE;
+    return SUCCESS;
+}
+
+/*
+ * Function : snapshot_open
+ * Usage : fs->snap = snapshot_open(fs, "disk.img.snap");
+ * ---------------------------------------------------------
+ * Maps a snapshot file read-only and checks its layout, that it was
+ * compiled from an image with the superblock of fs, and its checksum.
+ * Returns the snapshot, NULL if it can't be used.
+ */
+struct snapshot *snapshot_open(struct unixfilesystem *fs, const char *path) {
+    if (!(fs) || !(path))
+        return NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (st.st_size < (off_t) sizeof(struct snapshot_header))) {
+        fprintf(stderr, "%s: not a snapshot\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    const struct snapshot_header *header = base;
+    const char *reason = NULL;
+    uint32_t numinodes = fs->superblock.s_isize * INODES_IN_SECTOR;
+    if ((header->magic != SNAPSHOT_MAGIC) || (header->version != SNAPSHOT_VERSION))
+        reason = "not a snapshot";
+    else if ((header->s_time != superblock_time(&fs->superblock)) ||
+             (header->superblockchecksum != checksum(&fs->superblock, sizeof(fs->superblock))) ||
+             (header->numinodes != numinodes))
+        reason = "compiled from a different or modified image";
+    else if ((header->size != (uint64_t) st.st_size) ||
+             (validate_section(header, header->inodesoff, (uint64_t) numinodes * sizeof(struct inode)) != SUCCESS) ||
+             (validate_section(header, header->extindexoff, ((uint64_t) numinodes + 1) * sizeof(uint32_t)) != SUCCESS) ||
+             (validate_section(header, header->extentsoff, (uint64_t) header->numextents * sizeof(struct inode_extent)) != SUCCESS) ||
+             (validate_section(header, header->nameindexoff, ((uint64_t) numinodes + 1) * sizeof(uint32_t)) != SUCCESS) ||
+             (validate_section(header, header->namesoff, (uint64_t) header->numnames * sizeof(struct direntv6)) != SUCCESS))
+        reason = "truncated or corrupt";
+    else if (header->bodychecksum != checksum((const char *) base + sizeof(*header), header->size - sizeof(*header)))
+        reason = "checksum mismatch";
+    else if ((validate_index((const uint32_t *) ((const char *) base + header->extindexoff), numinodes, header->numextents) != SUCCESS) ||
+             (validate_index((const uint32_t *) ((const char *) base + header->nameindexoff), numinodes, header->numnames) != SUCCESS))
+        reason = "corrupt index";
+
+    struct snapshot *snap = NULL;
+    if ((reason == NULL) && ((snap = malloc(sizeof(struct snapshot))) == NULL))
+        reason = "out of memory";
+    if (reason) {
+        fprintf(stderr, "%s: %s, ignoring snapshot\n", path, reason);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    snap->base = base;
+    snap->size = st.st_size;
+    snap->header = header;
+    snap->inodes = (const struct inode *) (snap->base + header->inodesoff);
+    snap->extindex = (const uint32_t *) (snap->base + header->extindexoff);
+    snap->extents = (const struct inode_extent *) (snap->base + header->extentsoff);
+    snap->nameindex = (const uint32_t *) (snap->base + header->nameindexoff);
+    snap->names = (const struct direntv6 *) (snap->base + header->namesoff);
+    return snap;
+}
+
+static inline int validate_inumber(const struct snapshot *snap, int inumber) {
+    if ((snap) && (inumber >= ROOT_INUMBER) && ((uint32_t) inumber <= snap->header->numinodes))
+        return SUCCESS;
+    return FAILURE;
+}
+
+/*
+ * Function : snapshot_iget
+ * Usage : int err = snapshot_iget(snap, inumber, &in);
+ * -------------------------------------------------------
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int snapshot_iget(const struct snapshot *snap, int inumber, struct inode *inp) {
+    if ((validate_inumber(snap, inumber) != SUCCESS) || !(inp))
+        return FAILURE;
+    *inp = snap->inodes[inumber - ROOT_INUMBER];
+    return SUCCESS;
+}
+
+/*
+ * Function : snapshot_findname
+ * Usage : if (snapshot_findname(snap, dirinumber, &key, &entry) == SUCCESS)
+ * ----------------------------------------------------------------------------
+ * Binary searches the directory's sorted names for the first entry not
+ * below the key. Equal names keep their directory order, so this is the
+ * entry a linear search would have stopped at.
+ * Returns 0/SUCCESS if found, -1/FAILURE otherwise.
+ */
+int snapshot_findname(const struct snapshot *snap, int dirinumber, const struct direntv6 *key,
+                      struct direntv6 *dirEnt) {
+    if ((validate_inumber(snap, dirinumber) != SUCCESS) || !(key) || !(dirEnt))
+        return FAILURE;
+    uint32_t low = snap->nameindex[dirinumber - ROOT_INUMBER];
+    uint32_t high = snap->nameindex[dirinumber];
+    uint32_t end = high;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (memcmp(snap->names[mid].d_name, key->d_name, sizeof(key->d_name)) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if ((low < end) && (memcmp(snap->names[low].d_name, key->d_name, sizeof(key->d_name)) == 0)) {
+        *dirEnt = snap->names[low];
+        return SUCCESS;
+    }
+    return FAILURE;
+}
+
+/*
+ * Function : snapshot_lookupblock
+ * Usage : int disk_block = snapshot_lookupblock(snap, inumber, blockNum);
+ * --------------------------------------------------------------------------
+ * Returns the disk block number on success, -1/FAILURE if blockNum lies
+ * outside the file.
+ */
+int snapshot_lookupblock(const struct snapshot *snap, int inumber, int blockNum) {
+    if ((validate_inumber(snap, inumber) != SUCCESS) || (blockNum < 0))
+        return FAILURE;
+    uint32_t low = snap->extindex[inumber - ROOT_INUMBER];
+    uint32_t end = snap->extindex[inumber];
+    if (low == end)
+        return FAILURE;
+    // Find the last extent starting at or before blockNum.
+    uint32_t high = end - 1;
+    while (low < high) {
+        uint32_t mid = low + (high - low + 1) / 2;
+        if (snap->extents[mid].fileBlock <= blockNum)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    const struct inode_extent *extent = &snap->extents[low];
+    if ((blockNum < extent->fileBlock) || (blockNum >= extent->fileBlock + extent->numBlocks))
+        return FAILURE;
+    return extent->diskBlock + (blockNum - extent->fileBlock);
+}
+
+/*
+ * Function : snapshot_blockmap
+ * Usage : if (snapshot_blockmap(snap, inumber, &map) == SUCCESS)
+ * -----------------------------------------------------------------
+ * Copies the inode's extents out of the snapshot into a block map.
+ * Returns 0/SUCCESS on success, -1/FAILURE on error.
+ */
+int snapshot_blockmap(const struct snapshot *snap, int inumber, struct inode_blockmap *map) {
+    if ((validate_inumber(snap, inumber) != SUCCESS) || !(map))
+        return FAILURE;
+    struct inode in = snap->inodes[inumber - ROOT_INUMBER];
+    uint32_t first = snap->extindex[inumber - ROOT_INUMBER];
+    int numExtents = snap->extindex[inumber] - first;
+    map->size = inode_getsize(&in);
+    map->numExtents = numExtents;
+    map->numBlocks = 0;
+    map->extents = malloc((numExtents ? numExtents : 1) * sizeof(struct inode_extent));
+    if (map->extents == NULL)
+        return FAILURE;
+    memcpy(map->extents, &snap->extents[first], numExtents * sizeof(struct inode_extent));
+    if (numExtents > 0)
+        map->numBlocks = map->extents[numExtents - 1].fileBlock + map->extents[numExtents - 1].numBlocks;
+    return SUCCESS;
+}
+
+void snapshot_close(struct snapshot *snap) {
+    if (!(snap))
+        return;
+    munmap(snap->base, snap->size);
+    free(snap);
+}
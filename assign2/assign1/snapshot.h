@@ -0,0 +1,72 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stddef.h>
+#include "unixfilesystem.h"
+#include "direntv6.h"
+
+struct inode_blockmap;
+struct snapshot_header;
+
+/**
+ * A precompiled metadata snapshot of a disk image, memory-mapped from a
+ * sidecar file.  It holds every decoded inode, the entries of every
+ * directory as a name table sorted per directory, and the extent list of
+ * every inode, so inode, name and block map queries need no disk reads.
+ * The snapshot is tied to the image through the superblock's s_time and a
+ * checksum of the superblock, and carries a checksum of its own contents.
+ */
+struct snapshot {
+  char *base;                           // Start of the mapping
+  size_t size;                          // Length of the mapping
+  const struct snapshot_header *header;
+  const struct inode *inodes;           // numinodes inodes, inumber 1 first
+  const uint32_t *extindex;             // Extents of inumber i: [extindex[i-1], extindex[i])
+  const struct inode_extent *extents;
+  const uint32_t *nameindex;            // Names of inumber i: [nameindex[i-1], nameindex[i])
+  const struct direntv6 *names;         // Sorted by d_name within a directory
+};
+
+/**
+ * Compiles a snapshot of the image behind fs into the file at path.
+ * Returns 0 on success, -1 on error.
+ */
+int snapshot_write(struct unixfilesystem *fs, const char *path);
+
+/**
+ * Maps the snapshot at path and checks it against the superblock of fs.
+ * Returns NULL if the file is missing, corrupt or was compiled from a
+ * different (or since modified) image.  Set fs->snap to the result to have
+ * the filesystem layer answer queries from it.
+ */
+struct snapshot *snapshot_open(struct unixfilesystem *fs, const char *path);
+
+/**
+ * Fetches the specified inode.  Returns 0 on success, -1 on error.
+ */
+int snapshot_iget(const struct snapshot *snap, int inumber, struct inode *inp);
+
+/**
+ * Looks up key->d_name (prepared the way directory_findname compares names)
+ * in the directory dirinumber.  With duplicate names the first entry in
+ * directory order wins, as in a linear search.  Returns 0 and fills in
+ * dirEnt if found, -1 otherwise.
+ */
+int snapshot_findname(const struct snapshot *snap, int dirinumber, const struct direntv6 *key,
+                      struct direntv6 *dirEnt);
+
+/**
+ * Returns the disk block holding file block blockNum of inumber, -1 on error.
+ */
+int snapshot_lookupblock(const struct snapshot *snap, int inumber, int blockNum);
+
+/**
+ * Fills in map the way inode_blockmap() does, without reading any indirect
+ * block.  Release it with inode_blockmap_free().  Returns 0 on success, -1
+ * on error.
+ */
+int snapshot_blockmap(const struct snapshot *snap, int inumber, struct inode_blockmap *map);
+
+void snapshot_close(struct snapshot *snap);
+
+#endif // _SNAPSHOT_H_
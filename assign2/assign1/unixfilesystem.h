@@ -25,9 +25,12 @@
 #define ROOT_INUMBER        1
 #define BOOTBLOCK_MAGIC_NUM 0407
 
+struct snapshot;
+
 struct unixfilesystem {
   int dfd; // Handle from the diskimg module to read the diskimg.
   struct filsys superblock;  // The superblock read from the diskimage.
+  struct snapshot *snap;     // Precompiled metadata snapshot, NULL if not loaded.
 };
 
 struct unixfilesystem *unixfilesystem_init(int fd);
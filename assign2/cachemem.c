@@ -1,5 +1,11 @@
 /**
  * cachemem.c  -  This module allocates the memory for caches. 
+ *
+ * The caches may be shared by several threads.  The unprotected region is
+ * lock striped: its sets are dealt out to CACHE_SHARDS shards, each with its
+ * own lock and stats, carved from the start of the region.  The protected
+ * inode region is small and searched linearly, so one lock covers it.  When
+ * both are needed the inode cache lock is taken first.
  */
 
 /*
@@ -11,7 +17,9 @@
 #include <assert.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdint.h>
 #include <inttypes.h> // for PRIu64
+#include <pthread.h>
 #include <sys/mman.h>
 #include "cachemem.h"
 #include "diskimg.h"
@@ -27,6 +35,8 @@
                               * And so a total of 36 cache lines
                               */
 #define MINIMUM_INODE_CACHE_SPACE 256
+#define CACHE_MAX_WAYS 8
+#define CACHE_SHARDS 64      /* Power of two */
 
 /*
  * Globals
@@ -35,6 +45,7 @@ int cacheMemSizeInKB;
 void *cacheMemPtr;
 static int cache_is_allocated;
 static int inode_cache_is_enabled;
+static pthread_mutex_t inode_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Stripped down cache line strucure designed to increase number of cache blocks
@@ -46,11 +57,11 @@ typedef struct cache {
 }cache_line;
 
 /*
- * Special inode cache structure with inp key
+ * Special inode cache structure keyed by the inumber of the owning file
  */
 typedef struct inode_sectors {
     int sector;
-    void *inp;
+    int inumber;                        /* 0 if the line has no owner */
     /*
      *
      * Upper 16 bytes correspond to type file or directory
@@ -61,13 +72,85 @@ typedef struct inode_sectors {
     char buf[DISKIMG_SECTOR_SIZE];
 }inode_cache_line;
 
+/*
+ * The unprotected region is split into sets of up to CACHE_MAX_WAYS lines.
+ * A sector can only live in the set it hashes to and the replacement policy
+ * picks which line of the set it takes.  The replacement state of all sets
+ * sits at the start of the region, ahead of the lines.
+ */
+typedef struct cache_set {
+    uint32_t tick;                      /* Bumped on every access to the set */
+    uint32_t stamp[CACHE_MAX_WAYS];     /* Tick of a line's last use or arrival */
+    uint8_t state[CACHE_MAX_WAYS];      /* CLOCK: reference bit, 2Q: A1/Am, ARC: T1/T2 */
+    uint8_t prefetched;                 /* Bit per line not asked for since it was read ahead */
+    uint8_t hand;                       /* CLOCK */
+    uint8_t target;                     /* ARC: target number of T1 lines */
+    uint8_t nghosts[2];
+    int ghosts[2][CACHE_MAX_WAYS];      /*
+                                         * Sectors evicted lately, most recent first
+                                         * 2Q: A1out, ARC: B1 and B2
+                                         */
+}cache_set;
+
+/*
+ * A shard of the unprotected region: the sets whose index is congruent to
+ * the shard's modulo the number of shards
+ */
+typedef struct cache_shard {
+    pthread_mutex_t lock;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t ghosthits;
+}cache_shard;
+
+/*
+ * A replacement policy.  hit is called when a lookup finds a sector in
+ * line way of the set.  place picks the line a missing sector goes in,
+ * evicting whatever is there, and sets up the line's replacement state.
+ */
+typedef struct cache_policy {
+    const char *name;
+    int ways;
+    int ghosts;                         /* Keeps ghost lists */
+    void (*hit)(cache_set *set, int way);
+    int (*place)(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum);
+}cache_policy;
+
+#define Q_A1 0
+#define Q_AM 1
+#define ARC_T1 0
+#define ARC_T2 1
+
 /*
  * Helper functions
  */
 static int max_cache_line();
-static cache_line *get_cache_line_for_sector(int sectornum);
 static int is_directory(int typeandindirection);
 static int is_singly_indirected(int typeandindirection);
+static void clock_hit(cache_set *set, int way);
+static int clock_place(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum);
+static void twoq_hit(cache_set *set, int way);
+static int twoq_place(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum);
+static void arc_hit(cache_set *set, int way);
+static int arc_place(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum);
+
+static const cache_policy policies[] = {
+    { "direct", 1, 0, NULL, NULL },   /* The original direct mapped cache */
+    { "clock", CACHE_MAX_WAYS, 0, clock_hit, clock_place },
+    { "2q", CACHE_MAX_WAYS, 1, twoq_hit, twoq_place },
+    { "arc", CACHE_MAX_WAYS, 1, arc_hit, arc_place },
+};
+
+static const cache_policy *policy = &policies[0];
+static cache_shard *cache_shards;
+static cache_set *cache_sets;           /* NULL for the direct mapped cache */
+static cache_line *cache_lines;
+static int num_shards;
+static int num_sets;
+static int num_ways;
+
+static uint64_t numinodehits = 0;       /* Under inode_cache_lock */
 
 /*
  *
@@ -82,6 +165,57 @@ static int is_singly_indirected(int typeandindirection) {
     return ((typeandindirection & 0xffff) == 1);
 }
 
+/**
+ * Selects the replacement policy of the unprotected region by name.  Must
+ * be called before CacheMem_Init().  Returns -1 for an unknown policy.
+ */
+int CacheMem_SetPolicy(const char *name) {
+    if (cache_is_allocated)
+        return -1;
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) {
+            policy = &policies[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void *get_unprotected_cache_block();
+static void *get_end_of_cache_block();
+
+/*
+ * Carves the unprotected region into shards and sets.  The shards take at
+ * most 1/64th of it.  Caches too small for a single set of policy->ways
+ * lines get fewer ways.
+ */
+static void layout_unprotected_cache_block() {
+    char *start = get_unprotected_cache_block();
+    size_t bytes = (char *)get_end_of_cache_block() - start;
+    size_t setsize = (policy->place) ? sizeof(cache_set) : 0;
+
+    num_shards = CACHE_SHARDS;
+    while ((num_shards > 1) && (num_shards * sizeof(cache_shard) * 64 > bytes))
+        num_shards /= 2;
+    cache_shards = (cache_shard *)start;
+    for (int shard = 0; shard < num_shards; shard++)
+        pthread_mutex_init(&cache_shards[shard].lock, NULL);
+    start += num_shards * sizeof(cache_shard);
+    bytes -= num_shards * sizeof(cache_shard);
+
+    num_ways = policy->ways;
+    while ((bytes / (setsize + num_ways * sizeof(cache_line)) == 0) && (num_ways > 1))
+        num_ways /= 2;
+    num_sets = bytes / (setsize + num_ways * sizeof(cache_line));
+
+    cache_sets = (policy->place) ? (cache_set *)start : NULL;
+    cache_lines = (cache_line *)(start + num_sets * setsize);
+}
+
+static cache_shard *get_cache_shard_for_set(int set) {
+    return &cache_shards[set & (num_shards - 1)];
+}
+
 /**
  * Allocate memory of the specified size for the data cache optimizations
  * Return -1 on error, 0 on success. 
@@ -116,6 +250,7 @@ int CacheMem_Init(int sizeInKB) {
       inode_cache_is_enabled = 0;
   else
       inode_cache_is_enabled = 1;
+  layout_unprotected_cache_block();
   return 0;
 }
 
@@ -143,57 +278,348 @@ static void * get_end_of_cache_block() {
  *
  */
 static int max_cache_line() {
-  if (!(inode_cache_is_enabled))
-      return ((cacheMemSizeInKB * BYTES_IN_KB) / sizeof(cache_line));
-  else {
-      void* start = get_unprotected_cache_block(); 
-      void* end = get_end_of_cache_block();
-      return ((char *)end - (char *)start) / sizeof(cache_line);
-  }
+  return num_sets * num_ways;
+}
+
+static int get_cache_set_for_sector(int sectornum) {
+    if (!(cache_sets)) {
+        /* Because sector 0 will never be cached */
+        const unsigned long hash = (sectornum - 1) * 2630849305L; // magic prime number
+        return hash % num_sets;
+    }
+    /*
+     * The multiplier above is a multiple of 5, so it leaves most sets
+     * unused whenever the number of sets is too.  Fold the high bits in.
+     */
+    uint32_t hash = (uint32_t)sectornum * 2654435761u;
+    return (hash ^ (hash >> 16)) % num_sets;
 }
 
-static cache_line *get_cache_line_for_sector(int sectornum) {
-    int range = max_cache_line(); 
-    /* Because sector 0 will never be cached */
-    const unsigned long MULTIPLIER = 2630849305L; // magic prime number
-    const unsigned long hash = (sectornum - 1) * 2630849305L;
-    int index = hash % range;
-    cache_line *start = (cache_line *)get_unprotected_cache_block();
-    return &start[index];
+/*
+ * Returns the line of the set holding sectornum, -1 if it isn't cached
+ */
+static int find_way_in_set(int set, int sectornum) {
+    cache_line *lines = &cache_lines[set * num_ways];
+    for (int way = 0; way < num_ways; way++) {
+        if (lines[way].sector == sectornum)
+            return way;
+    }
+    return -1;
+}
+
+static int find_empty_way(cache_line *lines) {
+    for (int way = 0; way < num_ways; way++) {
+        if (lines[way].sector == 0)
+            return way;
+    }
+    return -1;
+}
+
+/*
+ * Oldest line of the set in state, -1 if there is none
+ */
+static int find_oldest_way(cache_set *set, int state) {
+    int oldest = -1;
+    for (int way = 0; way < num_ways; way++) {
+        if ((set->state[way] == state) &&
+            ((oldest < 0) || ((int32_t)(set->stamp[way] - set->stamp[oldest]) < 0)))
+            oldest = way;
+    }
+    return oldest;
+}
+
+static int count_ways(cache_set *set, cache_line *lines, int state) {
+    int count = 0;
+    for (int way = 0; way < num_ways; way++) {
+        if ((lines[way].sector != 0) && (set->state[way] == state))
+            count++;
+    }
+    return count;
+}
+
+/*
+ * Ghost list helpers.  Lists are kept most recent first and hold at most
+ * max sectors.
+ */
+static int remove_ghost(cache_shard *shard, cache_set *set, int list, int sectornum) {
+    int *ghosts = set->ghosts[list];
+    for (int i = 0; i < set->nghosts[list]; i++) {
+        if (ghosts[i] == sectornum) {
+            memmove(&ghosts[i], &ghosts[i + 1], (set->nghosts[list] - i - 1) * sizeof(int));
+            set->nghosts[list]--;
+            shard->ghosthits++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void push_ghost(cache_set *set, int list, int sectornum, int max) {
+    int *ghosts = set->ghosts[list];
+    if (set->nghosts[list] == max)
+        set->nghosts[list]--;
+    memmove(&ghosts[1], &ghosts[0], set->nghosts[list] * sizeof(int));
+    ghosts[0] = sectornum;
+    set->nghosts[list]++;
+}
+
+/*
+ * CLOCK : Lines get their reference bit on a hit, not when they are filled,
+ * so a line that is never read again goes the next time the hand sweeps by.
+ */
+static void clock_hit(cache_set *set, int way) {
+    set->state[way] = 1;
+}
+
+static int clock_place(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum) {
+    (void)shard;
+    (void)sectornum;
+    int way = find_empty_way(lines);
+    if (way < 0) {
+        while (set->state[set->hand]) {
+            set->state[set->hand] = 0;
+            set->hand = (set->hand + 1) % num_ways;
+        }
+        way = set->hand;
+        set->hand = (set->hand + 1) % num_ways;
+    }
+    set->state[way] = 0;
+    return way;
+}
+
+/*
+ * 2Q : New sectors go in a small FIFO (A1) and only move to the LRU part
+ * of the set (Am) if they are asked for again after falling out of it,
+ * which the A1out ghost list remembers.  A scan only ever churns A1.
+ */
+static int twoq_kin() {
+    return (num_ways / 4) ? (num_ways / 4) : 1;
+}
+
+static void twoq_hit(cache_set *set, int way) {
+    if (set->state[way] == Q_AM)
+        set->stamp[way] = set->tick;
+}
+
+static int twoq_place(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum) {
+    int reused = remove_ghost(shard, set, 0, sectornum);
+    int way = find_empty_way(lines);
+    if (way < 0) {
+        if (count_ways(set, lines, Q_A1) > twoq_kin()) {
+            way = find_oldest_way(set, Q_A1);
+            push_ghost(set, 0, lines[way].sector, num_ways / 2 ? num_ways / 2 : 1);
+        } else {
+            way = find_oldest_way(set, Q_AM);
+        }
+    }
+    set->state[way] = reused ? Q_AM : Q_A1;
+    set->stamp[way] = set->tick;
+    return way;
+}
+
+/*
+ * ARC : T1 holds sectors seen once and T2 sectors seen more than once,
+ * both in LRU order.  The ghost lists B1 and B2 remember what each of
+ * them evicted lately, and a miss that hits a ghost moves the target size
+ * of T1 towards the list that would have kept the sector.
+ */
+static void arc_hit(cache_set *set, int way) {
+    set->state[way] = ARC_T2;
+    set->stamp[way] = set->tick;
+}
+
+static int arc_replace(cache_set *set, cache_line *lines, int in_b2) {
+    int t1 = count_ways(set, lines, ARC_T1);
+    int list = ((t1 >= 1) && ((t1 > set->target) || (in_b2 && (t1 == set->target)))) ? ARC_T1 : ARC_T2;
+    int way = find_oldest_way(set, list);
+    push_ghost(set, list, lines[way].sector, num_ways);
+    return way;
+}
+
+static int arc_place(cache_shard *shard, cache_set *set, cache_line *lines, int sectornum) {
+    int c = num_ways;
+    int b1 = set->nghosts[0];
+    int b2 = set->nghosts[1];
+    int in_b1 = 0, in_b2 = 0;
+    int way = -1;
+
+    if (remove_ghost(shard, set, 0, sectornum)) {
+        in_b1 = 1;
+        int delta = (b2 > b1) ? (b2 / b1) : 1;
+        set->target = (set->target + delta > c) ? c : set->target + delta;
+    } else if (remove_ghost(shard, set, 1, sectornum)) {
+        in_b2 = 1;
+        int delta = (b1 > b2) ? (b1 / b2) : 1;
+        set->target = (set->target < delta) ? 0 : set->target - delta;
+    } else {
+        int t1 = count_ways(set, lines, ARC_T1);
+        int t2 = count_ways(set, lines, ARC_T2);
+        if (t1 + b1 == c) {
+            if (t1 < c) {
+                set->nghosts[0]--;
+            } else {
+                /* B1 is empty and T1 is the whole set, drop its LRU line */
+                way = find_oldest_way(set, ARC_T1);
+            }
+        } else if (t1 + t2 + b1 + b2 == 2 * c) {
+            set->nghosts[1]--;
+        }
+    }
+
+    if (way < 0)
+        way = find_empty_way(lines);
+    if (way < 0)
+        way = arc_replace(set, lines, in_b2);
+    set->state[way] = (in_b1 || in_b2) ? ARC_T2 : ARC_T1;
+    set->stamp[way] = set->tick;
+    return way;
+}
+
+/*
+ * Number of sectors the unprotected cache can hold, 0 without a cache
+ */
+int CacheMem_NumLines(void) {
+    if (!(cache_is_allocated))
+        return 0;
+    return max_cache_line();
 }
 
 static int fetch_sector_in_inode_cache(int sectornum, void *buf);
 int fetch_sector_in_cache(int sectornum, void *buf) {
     if (cache_is_allocated) {
-        cache_line * cached_sector = get_cache_line_for_sector(sectornum);
-        if ((cached_sector->sector == sectornum)) {
+        int set = get_cache_set_for_sector(sectornum);
+        cache_shard *shard = get_cache_shard_for_set(set);
+        pthread_mutex_lock(&shard->lock);
+        int way = find_way_in_set(set, sectornum);
+        shard->lookups++;
+        if (way >= 0) {
+            cache_line *cached_sector = &cache_lines[set * num_ways + way];
+            if (cache_sets) {
+                cache_set *cs = &cache_sets[set];
+                cs->tick++;
+                if (cs->prefetched & (1 << way)) {
+                    /* The first use of a prefetched sector is its first access */
+                    cs->prefetched &= ~(1 << way);
+                    cs->stamp[way] = cs->tick;
+                } else {
+                    policy->hit(cs, way);
+                }
+            }
             memcpy(buf, (const void *)&cached_sector->buf, DISKIMG_SECTOR_SIZE);
+            shard->hits++;
+            pthread_mutex_unlock(&shard->lock);
             return DISKIMG_SECTOR_SIZE;
         }
+        pthread_mutex_unlock(&shard->lock);
         return fetch_sector_in_inode_cache(sectornum, buf);
     }
     return CACHE_ERROR;
 }
 
-void save_sector_in_cache(int sectornum, void *buf) {
+/*
+ * Like fetch_sector_in_cache but only tells whether the sector is cached,
+ * without counting as a use of it
+ */
+int probe_sector_in_cache(int sectornum) {
+    int found = 0;
     if (cache_is_allocated) {
-        cache_line* cached_sector = get_cache_line_for_sector(sectornum);
-        cached_sector->sector = sectornum;
-        memcpy(&cached_sector->buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
+        int set = get_cache_set_for_sector(sectornum);
+        cache_shard *shard = get_cache_shard_for_set(set);
+        pthread_mutex_lock(&shard->lock);
+        found = (find_way_in_set(set, sectornum) >= 0);
+        pthread_mutex_unlock(&shard->lock);
+        if (!(found) && (inode_cache_is_enabled)) {
+            inode_cache_line *start = (inode_cache_line *)cacheMemPtr;
+            pthread_mutex_lock(&inode_cache_lock);
+            for (int index = 0; index < INODE_CACHE_LINES; index++) {
+                if (start[index].sector == sectornum)
+                    found = 1;
+            }
+            pthread_mutex_unlock(&inode_cache_lock);
+        }
+    }
+    return found;
+}
+
+static void save_sector_in_set(int sectornum, void *buf, int prefetched) {
+    if (cache_is_allocated) {
+        int set = get_cache_set_for_sector(sectornum);
+        cache_shard *shard = get_cache_shard_for_set(set);
+        cache_line *lines = &cache_lines[set * num_ways];
+        pthread_mutex_lock(&shard->lock);
+        int way = find_way_in_set(set, sectornum);
+        if (way < 0) {
+            if (cache_sets) {
+                cache_set *cs = &cache_sets[set];
+                cs->tick++;
+                way = policy->place(shard, cs, lines, sectornum);
+                if (prefetched)
+                    cs->prefetched |= (1 << way);
+                else
+                    cs->prefetched &= ~(1 << way);
+            } else {
+                way = 0;
+            }
+            if (lines[way].sector != 0)
+                shard->evictions++;
+        }
+        lines[way].sector = sectornum;
+        memcpy(&lines[way].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void save_sector_in_cache(int sectornum, void *buf) {
+    save_sector_in_set(sectornum, buf, 0);
+}
+
+/*
+ * Like save_sector_in_cache for a sector read ahead of being asked for
+ */
+void save_prefetched_sector_in_cache(int sectornum, void *buf) {
+    save_sector_in_set(sectornum, buf, 1);
+}
+
+/*
+ * Replaces every cached copy of a sector that has been rewritten
+ */
+void update_sector_in_cache(int sectornum, const void *buf) {
+    if (!(cache_is_allocated))
+        return;
+    int set = get_cache_set_for_sector(sectornum);
+    cache_shard *shard = get_cache_shard_for_set(set);
+    pthread_mutex_lock(&shard->lock);
+    int way = find_way_in_set(set, sectornum);
+    if (way >= 0)
+        memcpy(&cache_lines[set * num_ways + way].buf, buf, DISKIMG_SECTOR_SIZE);
+    pthread_mutex_unlock(&shard->lock);
+    if (inode_cache_is_enabled) {
+        inode_cache_line *start = (inode_cache_line *)cacheMemPtr;
+        pthread_mutex_lock(&inode_cache_lock);
+        for (int index = 0; index < INODE_CACHE_LINES; index++) {
+            if (start[index].sector == sectornum)
+                memcpy(&start[index].buf, buf, DISKIMG_SECTOR_SIZE);
+        }
+        pthread_mutex_unlock(&inode_cache_lock);
     }
 }
 
 static int fetch_sector_in_inode_cache(int sectornum, void *buf) {
+  int ret = CACHE_ERROR;
   if ((cache_is_allocated) && (inode_cache_is_enabled)) {
     inode_cache_line *start = (inode_cache_line *)cacheMemPtr;
+    pthread_mutex_lock(&inode_cache_lock);
     for (int index = 0; index < INODE_CACHE_LINES; index++) {
         if (start[index].sector == sectornum) {
             memcpy(buf, (const void *)&start[index].buf, DISKIMG_SECTOR_SIZE);
-            return DISKIMG_SECTOR_SIZE;
+            numinodehits++;
+            ret = DISKIMG_SECTOR_SIZE;
+            break;
         }
     }
+    pthread_mutex_unlock(&inode_cache_lock);
   }
-  return CACHE_ERROR;
+  return ret;
 }
 
 /*
@@ -201,25 +627,25 @@ static int fetch_sector_in_inode_cache(int sectornum, void *buf) {
  * Saves file sector indirection blocks in cache
  *
  */
-int save_file_sector_in_inode_cache(int sectornum, void *buf, void *inp, int typeandindirection) {
+int save_file_sector_in_inode_cache(int sectornum, void *buf, int inumber, int typeandindirection) {
   inode_cache_line *start = (inode_cache_line *)cacheMemPtr;
 
   /* If empty cache line found use it */
   for (int index = 0; index < INODE_CACHE_LINES; index++) {
-      if (start[index].inp == NULL) {
+      if (start[index].inumber == 0) {
           memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
           start[index].typeandindirection = typeandindirection;
           start[index].sector = sectornum;
-          start[index].inp = inp;
+          start[index].inumber = inumber;
           return 1;
       }
 
       /* If stale file's cache line is found use it */
-      if (!is_directory(start[index].typeandindirection) && (start[index].inp != inp)) {
+      if (!is_directory(start[index].typeandindirection) && (start[index].inumber != inumber)) {
           memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
           start[index].typeandindirection = typeandindirection;
           start[index].sector = sectornum;
-          start[index].inp = inp;
+          start[index].inumber = inumber;
           return 1;
       }
   }
@@ -230,7 +656,7 @@ int save_file_sector_in_inode_cache(int sectornum, void *buf, void *inp, int typ
           memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
           start[index].typeandindirection = typeandindirection;
           start[index].sector = sectornum;
-          start[index].inp = inp;
+          start[index].inumber = inumber;
           return 1;
       }
   }
@@ -243,25 +669,25 @@ int save_file_sector_in_inode_cache(int sectornum, void *buf, void *inp, int typ
  *
  *
  */
-int save_directory_sector_in_inode_cache(int sectornum, void *buf, void *inp, int typeandindirection) {
+int save_directory_sector_in_inode_cache(int sectornum, void *buf, int inumber, int typeandindirection) {
     inode_cache_line *start = (inode_cache_line *)cacheMemPtr;
     for (int index = 0; index < INODE_CACHE_LINES; index++) {
-        if ((start[index].inp == inp) && (is_singly_indirected(start[index].typeandindirection))) {
+        if ((start[index].inumber == inumber) && (is_singly_indirected(start[index].typeandindirection))) {
             memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
             start[index].typeandindirection = typeandindirection;
             start[index].sector = sectornum;
-            start[index].inp = inp;
+            start[index].inumber = inumber;
             return 1;
         }
 
     }
 
     for (int index = 0; index < INODE_CACHE_LINES; index++) {
-        if (start[index].inp == NULL) {
+        if (start[index].inumber == 0) {
             memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
             start[index].typeandindirection = typeandindirection;
             start[index].sector = sectornum;
-            start[index].inp = inp;
+            start[index].inumber = inumber;
             return 1;
         }
 
@@ -269,7 +695,7 @@ int save_directory_sector_in_inode_cache(int sectornum, void *buf, void *inp, in
             memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
             start[index].typeandindirection = typeandindirection;
             start[index].sector = sectornum;
-            start[index].inp = inp;
+            start[index].inumber = inumber;
             return 1;
         }
     }
@@ -280,7 +706,7 @@ int save_directory_sector_in_inode_cache(int sectornum, void *buf, void *inp, in
             memcpy(&start[index].buf, (const void *)buf, DISKIMG_SECTOR_SIZE);
             start[index].typeandindirection = typeandindirection;
             start[index].sector = sectornum;
-            start[index].inp = inp;
+            start[index].inumber = inumber;
             return 1;
         }
     }
@@ -294,13 +720,15 @@ int save_directory_sector_in_inode_cache(int sectornum, void *buf, void *inp, in
  *
  */
 
-void save_sector_in_inode_cache(int sectornum, void *buf, void *inp, int typeandindirection) {
-  if ((cache_is_allocated) && (inode_cache_is_enabled)) {
+void save_sector_in_inode_cache(int sectornum, void *buf, int inumber, int typeandindirection) {
+  if ((cache_is_allocated) && (inode_cache_is_enabled) && (inumber > 0)) {
     int ret;
+    pthread_mutex_lock(&inode_cache_lock);
     if (is_directory(typeandindirection))
-      ret = save_directory_sector_in_inode_cache(sectornum, buf, inp, typeandindirection); 
+      ret = save_directory_sector_in_inode_cache(sectornum, buf, inumber, typeandindirection); 
     else
-      ret = save_file_sector_in_inode_cache(sectornum, buf, inp, typeandindirection); 
+      ret = save_file_sector_in_inode_cache(sectornum, buf, inumber, typeandindirection); 
+    pthread_mutex_unlock(&inode_cache_lock);
 
     /* No space found in inode cache, better save in unprotected cache atleast */
     if (ret < 0) 
@@ -316,17 +744,36 @@ void save_sector_in_inode_cache(int sectornum, void *buf, void *inp, int typeand
  * Erases inode related caches
  *
  */
-void erase_sector_in_inode_cache(void *inp) {
+void erase_sector_in_inode_cache(int inumber) {
   if ((cache_is_allocated) && (inode_cache_is_enabled)) {
     inode_cache_line *start = (inode_cache_line *)cacheMemPtr;
+    pthread_mutex_lock(&inode_cache_lock);
     for (int index = 0; index < INODE_CACHE_LINES; index++) {
-      if (start[index].inp == inp) {
-        start[index].inp = NULL;
+      if (start[index].inumber == inumber) {
+        start[index].inumber = 0;
       }
     }
+    pthread_mutex_unlock(&inode_cache_lock);
   }
 }
 
-
-
-
+void CacheMem_Dumpstats(FILE *file) {
+  if (!(cache_is_allocated))
+    return;
+  uint64_t numlookups = 0, numhits = 0, numevictions = 0, numghosthits = 0;
+  for (int shard = 0; shard < num_shards; shard++) {
+    pthread_mutex_lock(&cache_shards[shard].lock);
+    numlookups += cache_shards[shard].lookups;
+    numhits += cache_shards[shard].hits;
+    numevictions += cache_shards[shard].evictions;
+    numghosthits += cache_shards[shard].ghosthits;
+    pthread_mutex_unlock(&cache_shards[shard].lock);
+  }
+  fprintf(file, "Cachemem: %s policy, %d shards, %d sets of %d ways, %"PRIu64" lookups, "
+          "%"PRIu64" hits (%.1f%%), %"PRIu64" inode cache hits, %"PRIu64" evictions",
+          policy->name, num_shards, num_sets, num_ways, numlookups, numhits,
+          numlookups ? 100.0 * numhits / numlookups : 0.0, numinodehits, numevictions);
+  if (policy->ghosts)
+    fprintf(file, ", %"PRIu64" ghost hits", numghosthits);
+  fprintf(file, "\n");
+}
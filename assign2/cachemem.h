@@ -1,5 +1,6 @@
 #ifndef _CACHEMEM_H_
 #define _CACHEMEM_H_
+#include <stdio.h>
 #include "assign1/inode.h"
 /**
  * The main export of the cachemem module is the memory for the cache
@@ -16,9 +17,15 @@ extern void *cacheMemPtr;
 #define CACHE_ERROR -1
 
 int CacheMem_Init(int sizeInKB);
+int CacheMem_SetPolicy(const char *name);
+void CacheMem_Dumpstats(FILE *file);
 void save_sector_in_cache(int sectornum, void *buf);
+void save_prefetched_sector_in_cache(int sectornum, void *buf);
+void update_sector_in_cache(int sectornum, const void *buf);
 int fetch_sector_in_cache(int sectornum, void *buf);
-void save_sector_in_inode_cache(int sectornum, void *buf, void *inp, int indirection);
-void erase_sector_in_inode_cache(void *inp);
+int probe_sector_in_cache(int sectornum);
+void save_sector_in_inode_cache(int sectornum, void *buf, int inumber, int indirection);
+void erase_sector_in_inode_cache(int inumber);
+int CacheMem_NumLines(void);
 
 #endif // _CACHEMEM_H_
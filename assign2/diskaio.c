@@ -0,0 +1,393 @@
+/**
+ * diskaio.c  -  Asynchronous sector I/O engine underneath the diskimg layer.
+ *
+ * Requests are issued against the disksim latency model when they are
+ * submitted and then moved by one of two backends:
+ *
+ *  io_uring - reads are queued on a submission ring and reaped from the
+ *             completion ring, all from the calling thread.  The ring is set
+ *             up with the raw system calls so no extra library is needed.
+ *  threads  - a small pool of pthreads that pread() the data and then sleep
+ *             until the simulated completion time of their request.
+ *
+ * Either way a request is only handed back once its simulated completion
+ * time has passed, so N requests in flight overlap their disk latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "diskaio.h"
+#include "diskimg.h"
+#include "disksim.h"
+#include "debug.h"
+
+#define DISKAIO_MAX_THREADS 16
+
+static int aioFd = -1;
+static int aioDepth = 0;
+static int aioBackend = 0;
+static int inflight = 0;     // Submitted and not yet reaped
+
+static uint64_t numsubmits = 0;
+static uint64_t numreaps = 0;
+static uint64_t maxinflight = 0;
+
+/*
+ * io_uring backend
+ */
+static struct {
+  int fd;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sqptr, *cqptr;
+  size_t sqsize, cqsize, sqesize;
+} ring = { .fd = -1 };
+
+/*
+ * Requests whose data has arrived through the ring but whose simulated
+ * completion time hasn't passed yet
+ */
+static struct diskimg_request *landed;
+
+/*
+ * Thread pool backend
+ */
+static pthread_t workers[DISKAIO_MAX_THREADS];
+static int numWorkers;
+static int shuttingDown;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t workDone = PTHREAD_COND_INITIALIZER;
+static struct diskimg_request *todoHead, *todoTail;
+static struct diskimg_request *doneHead, *doneTail;
+
+static int uring_enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, ring.fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static void uring_teardown(void) {
+  if (ring.sqes) munmap(ring.sqes, ring.sqesize);
+  if (ring.cqptr && ring.cqptr != ring.sqptr) munmap(ring.cqptr, ring.cqsize);
+  if (ring.sqptr) munmap(ring.sqptr, ring.sqsize);
+  if (ring.fd >= 0) close(ring.fd);
+  memset(&ring, 0, sizeof(ring));
+  ring.fd = -1;
+}
+
+/*
+ * Queues one read on the submission ring.  The caller makes sure there is
+ * room (at most aioDepth requests are ever in flight).
+ */
+static void uring_queue(struct diskimg_request *req) {
+  unsigned tail = *ring.sqtail;
+  unsigned index = tail & *ring.sqmask;
+  struct io_uring_sqe *sqe = &ring.sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = aioFd;
+  sqe->addr = (uint64_t) (uintptr_t) req->buf;
+  sqe->len = req->count * DISKIMG_SECTOR_SIZE;
+  sqe->off = (uint64_t) req->sectorNum * DISKIMG_SECTOR_SIZE;
+  sqe->user_data = (uint64_t) (uintptr_t) req;
+  ring.sqarray[index] = index;
+  __atomic_store_n(ring.sqtail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Moves every completion on the ring to the landed list.
+ */
+static void uring_drain(void) {
+  unsigned head = *ring.cqhead;
+  unsigned tail = __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqmask];
+    struct diskimg_request *req = (struct diskimg_request *) (uintptr_t) cqe->user_data;
+    req->result = (cqe->res < 0) ? -1 : cqe->res;
+    req->next = landed;
+    landed = req;
+    head++;
+  }
+  __atomic_store_n(ring.cqhead, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Unlinks and returns the landed request with the earliest completion time.
+ */
+static struct diskimg_request *uring_earliest_landed(void) {
+  struct diskimg_request **best = NULL;
+  for (struct diskimg_request **link = &landed; *link; link = &(*link)->next) {
+    if (!best || (*link)->completionTime < (*best)->completionTime)
+      best = link;
+  }
+  if (!best) return NULL;
+  struct diskimg_request *req = *best;
+  *best = req->next;
+  req->next = NULL;
+  return req;
+}
+
+static struct diskimg_request *uring_reap(int wait) {
+  for (;;) {
+    uring_drain();
+    struct diskimg_request *req = uring_earliest_landed();
+    if (req) {
+      if (req->completionTime <= Debug_GetTimeInMicrosecs())
+        return req;
+      if (wait) {
+        disksim_wait_until(req->completionTime);
+        return req;
+      }
+      // Not due yet, put it back.
+      req->next = landed;
+      landed = req;
+      return NULL;
+    }
+    if (!wait)
+      return NULL;
+    if (uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+      return NULL;
+  }
+}
+
+static int uring_setup(unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring.fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (ring.fd < 0) {
+    ring.fd = -1;
+    return -1;
+  }
+
+  ring.sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring.cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (ring.cqsize > ring.sqsize) ring.sqsize = ring.cqsize;
+    ring.cqsize = ring.sqsize;
+  }
+
+  ring.sqptr = mmap(NULL, ring.sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring.fd, IORING_OFF_SQ_RING);
+  if (ring.sqptr == MAP_FAILED) {
+    ring.sqptr = NULL;
+    uring_teardown();
+    return -1;
+  }
+  if (single) {
+    ring.cqptr = ring.sqptr;
+  } else {
+    ring.cqptr = mmap(NULL, ring.cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring.fd, IORING_OFF_CQ_RING);
+    if (ring.cqptr == MAP_FAILED) {
+      ring.cqptr = NULL;
+      uring_teardown();
+      return -1;
+    }
+  }
+  ring.sqesize = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring.sqes = mmap(NULL, ring.sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring.fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED) {
+    ring.sqes = NULL;
+    uring_teardown();
+    return -1;
+  }
+
+  char *sq = ring.sqptr, *cq = ring.cqptr;
+  ring.sqhead = (unsigned *) (sq + p.sq_off.head);
+  ring.sqtail = (unsigned *) (sq + p.sq_off.tail);
+  ring.sqmask = (unsigned *) (sq + p.sq_off.ring_mask);
+  ring.sqarray = (unsigned *) (sq + p.sq_off.array);
+  ring.cqhead = (unsigned *) (cq + p.cq_off.head);
+  ring.cqtail = (unsigned *) (cq + p.cq_off.tail);
+  ring.cqmask = (unsigned *) (cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  // Older kernels create rings but reject IORING_OP_READ, and sandboxes may
+  // refuse io_uring_enter, so make sure one read goes through end to end.
+  char probe[DISKIMG_SECTOR_SIZE];
+  struct diskimg_request req = { .sectorNum = 0, .count = 1, .buf = probe };
+  uring_queue(&req);
+  if (uring_enter(1, 1, IORING_ENTER_GETEVENTS) < 0) {
+    uring_teardown();
+    return -1;
+  }
+  uring_drain();
+  landed = NULL;
+  if (req.result != DISKIMG_SECTOR_SIZE) {
+    uring_teardown();
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Thread pool worker: moves the data, then holds the request until the
+ * simulated disk would have finished it.
+ */
+static void *pool_worker(void *arg) {
+  (void) arg;
+  for (;;) {
+    pthread_mutex_lock(&poolLock);
+    while (!todoHead && !shuttingDown)
+      pthread_cond_wait(&workReady, &poolLock);
+    if (!todoHead) {
+      pthread_mutex_unlock(&poolLock);
+      return NULL;
+    }
+    struct diskimg_request *req = todoHead;
+    todoHead = req->next;
+    if (!todoHead) todoTail = NULL;
+    pthread_mutex_unlock(&poolLock);
+
+    req->result = disksim_transfer(aioFd, req->sectorNum, req->count, req->buf);
+    disksim_wait_until(req->completionTime);
+
+    pthread_mutex_lock(&poolLock);
+    req->next = NULL;
+    if (doneTail) doneTail->next = req;
+    else doneHead = req;
+    doneTail = req;
+    pthread_cond_signal(&workDone);
+    pthread_mutex_unlock(&poolLock);
+  }
+}
+
+static int pool_setup(int depth) {
+  numWorkers = (depth < DISKAIO_MAX_THREADS) ? depth : DISKAIO_MAX_THREADS;
+  shuttingDown = 0;
+  for (int i = 0; i < numWorkers; i++) {
+    if (pthread_create(&workers[i], NULL, pool_worker, NULL) != 0) {
+      numWorkers = i;
+      break;
+    }
+  }
+  return (numWorkers > 0) ? 0 : -1;
+}
+
+static void pool_teardown(void) {
+  pthread_mutex_lock(&poolLock);
+  shuttingDown = 1;
+  pthread_cond_broadcast(&workReady);
+  pthread_mutex_unlock(&poolLock);
+  for (int i = 0; i < numWorkers; i++)
+    pthread_join(workers[i], NULL);
+  numWorkers = 0;
+  todoHead = todoTail = doneHead = doneTail = NULL;
+}
+
+static struct diskimg_request *pool_reap(int wait) {
+  pthread_mutex_lock(&poolLock);
+  while (wait && !doneHead)
+    pthread_cond_wait(&workDone, &poolLock);
+  struct diskimg_request *req = doneHead;
+  if (req) {
+    doneHead = req->next;
+    if (!doneHead) doneTail = NULL;
+    req->next = NULL;
+  }
+  pthread_mutex_unlock(&poolLock);
+  return req;
+}
+
+int diskaio_init(int fd, int depth, int backend) {
+  if (aioDepth > 0 || depth < 1) return -1;
+  aioFd = fd;
+
+  if (backend != DISKAIO_BACKEND_THREADS && uring_setup(depth) == 0) {
+    aioBackend = DISKAIO_BACKEND_URING;
+  } else if (backend != DISKAIO_BACKEND_URING && pool_setup(depth) == 0) {
+    aioBackend = DISKAIO_BACKEND_THREADS;
+  } else {
+    aioFd = -1;
+    return -1;
+  }
+  aioDepth = depth;
+  return 0;
+}
+
+int diskaio_submit(struct diskimg_request **reqs, int n) {
+  int accepted = 0;
+  if (aioDepth == 0) return 0;
+  if (n > aioDepth - inflight) n = aioDepth - inflight;
+  for (int i = 0; i < n; i++)
+    reqs[i]->completionTime = disksim_issue_read(reqs[i]->sectorNum, reqs[i]->count);
+
+  if (aioBackend == DISKAIO_BACKEND_URING) {
+    for (; accepted < n && inflight < aioDepth; accepted++, inflight++)
+      uring_queue(reqs[accepted]);
+    if (accepted > 0 && uring_enter(accepted, 0, 0) < 0) {
+      // Nothing was consumed from the ring; take the entries back and fail
+      // these requests.
+      __atomic_store_n(ring.sqtail, *ring.sqtail - accepted, __ATOMIC_RELEASE);
+      for (int i = 0; i < accepted; i++) {
+        reqs[i]->result = -1;
+        reqs[i]->next = landed;
+        landed = reqs[i];
+      }
+    }
+  } else {
+    pthread_mutex_lock(&poolLock);
+    for (; accepted < n && inflight < aioDepth; accepted++, inflight++) {
+      struct diskimg_request *req = reqs[accepted];
+      req->next = NULL;
+      if (todoTail) todoTail->next = req;
+      else todoHead = req;
+      todoTail = req;
+    }
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&poolLock);
+  }
+
+  numsubmits += accepted;
+  if ((uint64_t) inflight > maxinflight) maxinflight = inflight;
+  return accepted;
+}
+
+struct diskimg_request *diskaio_reap(int wait) {
+  if (aioDepth == 0 || inflight == 0) return NULL;
+  struct diskimg_request *req = (aioBackend == DISKAIO_BACKEND_URING) ? uring_reap(wait) : pool_reap(wait);
+  if (req) {
+    inflight--;
+    numreaps++;
+  }
+  return req;
+}
+
+int diskaio_room(void) {
+  return aioDepth - inflight;
+}
+
+int diskaio_depth(void) {
+  return aioDepth;
+}
+
+void diskaio_shutdown(void) {
+  if (aioDepth == 0) return;
+  // Let outstanding requests finish so no buffer is written after we return.
+  while (inflight > 0 && diskaio_reap(1)) ;
+  if (aioBackend == DISKAIO_BACKEND_URING) uring_teardown();
+  else pool_teardown();
+  landed = NULL;
+  aioDepth = 0;
+  aioFd = -1;
+}
+
+void diskaio_dumpstats(FILE *file) {
+  if (aioBackend == 0) return;
+  fprintf(file, "Diskaio: %s backend, %"PRIu64" submits, %"PRIu64" reaps, %"PRIu64" max in flight\n",
+          (aioBackend == DISKAIO_BACKEND_URING) ? "io_uring" : "threads",
+          numsubmits, numreaps, maxinflight);
+}
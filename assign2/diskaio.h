@@ -0,0 +1,48 @@
+#ifndef _DISKAIO_H_
+#define _DISKAIO_H_
+
+#include <stdio.h>
+
+/*
+ * Backends of the asynchronous sector I/O engine
+ */
+#define DISKAIO_BACKEND_AUTO    0   // io_uring if the kernel allows it, else threads
+#define DISKAIO_BACKEND_URING   1
+#define DISKAIO_BACKEND_THREADS 2
+
+struct diskimg_request;
+
+/**
+ * Starts the engine for the disk image fd with up to depth requests in
+ * flight.  Returns 0 on success, -1 on error.
+ */
+int diskaio_init(int fd, int depth, int backend);
+
+/**
+ * Issues up to n requests against the disksim latency model and hands them
+ * to the backend.  Returns the number accepted, which is less than n once
+ * depth requests are in flight.
+ */
+int diskaio_submit(struct diskimg_request **reqs, int n);
+
+/**
+ * Returns how many more requests can be submitted right now.
+ */
+int diskaio_room(void);
+
+/**
+ * Returns a request whose data has arrived and whose simulated completion
+ * time has passed, or NULL if there is none.  With wait set, blocks until
+ * one is ready unless nothing is in flight.
+ */
+struct diskimg_request *diskaio_reap(int wait);
+
+/**
+ * Returns the queue depth, 0 if the engine isn't running.
+ */
+int diskaio_depth(void);
+
+void diskaio_shutdown(void);
+void diskaio_dumpstats(FILE *file);
+
+#endif // _DISKAIO_H_
@@ -7,13 +7,306 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <assert.h>
+#include <limits.h>
 #include "diskimg.h"
 #include "disksim.h"
 #include "debug.h"
 #include "cachemem.h"
+#include "diskaio.h"
+#include "diskwb.h"
 
 static uint64_t numreads, numwrites;
 
+/*
+ * Requests that have completed but haven't been handed back to their
+ * submitter yet, oldest first.  Without the asynchronous engine several
+ * threads may be passing their requests through it at once.
+ */
+static struct diskimg_request *completedHead, *completedTail;
+static pthread_mutex_t completedLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Sequential readahead.  Demand reads are matched against a few streams;
+ * once a stream has been read sequentially RA_TRIGGER times the sectors
+ * after it are prefetched into the cache.  The window doubles each time the
+ * stream catches up with it, is capped at a share of the cache, and is
+ * halved whenever a prefetched sector gets evicted before it is read.
+ */
+#define RA_STREAMS      16    // Streams tracked at once, a couple per scan worker
+#define RA_TRIGGER      2     // Sequential reads before a stream is prefetched
+#define RA_MAX_GAP      4     // Sectors a read may skip and still be sequential
+#define RA_MIN_WINDOW   8     // Sectors
+#define RA_MAX_WINDOW   128   // Sectors
+#define RA_CACHE_SHARE  16    // A window is at most 1/RA_CACHE_SHARE of the cache
+#define RA_MAX_INFLIGHT 4     // Asynchronous prefetches outstanding
+
+struct rastream {
+  int firstSector;    // Where the stream started
+  int nextSector;     // Where the next sequential read would start
+  int seqReads;       // Sequential reads seen so far
+  int window;         // Sectors to prefetch next time
+  int raStart;        // Prefetched sectors not read yet are
+  int raEnd;          // [max(raStart, nextSector), raEnd)
+  int loadStart;      // Prefetched sectors ra_issue() is still reading
+  int loadEnd;        // without raLock are [loadStart, loadEnd)
+  uint64_t lastUse;   // 0 if the slot is free
+};
+
+struct raslot {
+  struct diskimg_request req;
+  int busy;
+  char buf[RA_MAX_WINDOW * DISKIMG_SECTOR_SIZE];
+};
+
+extern int diskReadaheadEnable;
+static struct rastream streams[RA_STREAMS];
+static struct raslot raslots[RA_MAX_INFLIGHT];
+static uint64_t raclock;
+static int disksectors = -1;
+static uint64_t numrawindows, numrasectors, numrahits, numrawasted, numraevicted;
+static uint64_t numrainflight;  // Demand reads of sectors still being prefetched
+
+/*
+ * Guards the stream state, which sector reads from several threads update.
+ * The asynchronous engine itself is driven from a single thread.
+ */
+static pthread_mutex_t raLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int reap_request(int wait);
+
+/*
+ * Takes a sector just read from the disk.  A newer copy still waiting in the
+ * write-behind buffer replaces it, otherwise it goes in the cache.  Sectors
+ * that were prefetched haven't been asked for yet, which the cache's
+ * replacement policy needs to know.
+ */
+static void landed_sector(int sectorNum, void *buf, int prefetched) {
+  /*
+   * By design cache cannot store sector 0
+   */
+  if (diskwb_read(sectorNum, buf) || (sectorNum == 0))
+    return;
+  if (prefetched)
+    save_prefetched_sector_in_cache(sectorNum, buf);
+  else
+    save_sector_in_cache(sectorNum, buf);
+}
+
+/*
+ * Gets a sector from the write-behind buffer or the cache.  Returns the
+ * number of bytes copied, CACHE_ERROR if the disk has to be read.
+ */
+static int fetch_sector(int sectorNum, void *buf) {
+  if (diskwb_read(sectorNum, buf)) return DISKIMG_SECTOR_SIZE;
+  /*
+   * By design cache cannot fetch sector 0
+   */
+  if (sectorNum == 0) return CACHE_ERROR;
+  return fetch_sector_in_cache(sectorNum, buf);
+}
+
+/*
+ * Lets every read in flight land, so none of them can put data older than
+ * a write in the cache.
+ */
+static void drain_inflight(void) {
+  if (diskaio_depth() > 0)
+    while (reap_request(1)) ;
+}
+
+static int ra_unread(const struct rastream *st) {
+  int start = (st->raStart > st->nextSector) ? st->raStart : st->nextSector;
+  return (st->raEnd > start) ? st->raEnd - start : 0;
+}
+
+static struct raslot *ra_slot(const struct diskimg_request *req) {
+  for (int i = 0; i < RA_MAX_INFLIGHT; i++) {
+    if (req == &raslots[i].req) return &raslots[i];
+  }
+  return NULL;
+}
+
+/*
+ * Waits for any prefetch still in flight that overlaps the sectors, so they
+ * are read out of the cache rather than a second time.
+ */
+static void ra_settle(int firstSector, int count) {
+  for (int i = 0; i < RA_MAX_INFLIGHT; i++) {
+    struct raslot *slot = &raslots[i];
+    while (slot->busy &&
+           (slot->req.sectorNum < firstSector + count) &&
+           (firstSector < slot->req.sectorNum + slot->req.count)) {
+      if (!reap_request(1)) slot->busy = 0;
+    }
+  }
+}
+
+/*
+ * Counts a demand read of a sector some stream prefetched.  Finding it gone
+ * from the cache means the cache is too small for the window, unless another
+ * thread is still reading it in.
+ */
+static void ra_account(int sectorNum, int cached) {
+  if (!diskReadaheadEnable) return;
+  pthread_mutex_lock(&raLock);
+  for (int i = 0; i < RA_STREAMS; i++) {
+    struct rastream *st = &streams[i];
+    int start = (st->raStart > st->nextSector) ? st->raStart : st->nextSector;
+    if (!st->lastUse || sectorNum < start || sectorNum >= st->raEnd) continue;
+    if (cached) {
+      numrahits++;
+    } else if (sectorNum >= st->loadStart && sectorNum < st->loadEnd) {
+      numrainflight++;
+    } else {
+      numraevicted++;
+      numrawasted++;
+      st->window /= 2;
+      if (st->window < RA_MIN_WINDOW) st->window = RA_MIN_WINDOW;
+    }
+    break;
+  }
+  pthread_mutex_unlock(&raLock);
+}
+
+/*
+ * Largest window the cache can take without thrashing, 0 to not prefetch.
+ */
+static int ra_cap(void) {
+  int cap = CacheMem_NumLines() / RA_CACHE_SHARE;
+  if (cap > RA_MAX_WINDOW) cap = RA_MAX_WINDOW;
+  return (cap >= RA_MIN_WINDOW) ? cap : 0;
+}
+
+/*
+ * Prefetches the next window of the stream, asynchronously when the engine
+ * is running and has room to spare, otherwise as one synchronous request.
+ * Called with raLock held.
+ */
+static void ra_issue(int fd, struct rastream *st) {
+  int cap = ra_cap();
+  if (cap == 0) return;
+  if (disksectors < 0) {
+    int size = disksim_getsize(fd);
+    disksectors = (size > 0) ? size / DISKIMG_SECTOR_SIZE : 0;
+  }
+
+  int start = (st->raEnd > st->nextSector) ? st->raEnd : st->nextSector;
+  int count = (st->window < cap) ? st->window : cap;
+  if (start + count > disksectors) count = disksectors - start;
+  // Sectors already cached, e.g. on a second pass over a file, are skipped.
+  while (count > 0 && probe_sector_in_cache(start)) {
+    start++;
+    count--;
+  }
+  while (count > 0 && probe_sector_in_cache(start + count - 1)) count--;
+  if (count <= 0) return;
+
+  if (diskaio_depth() > 0) {
+    struct raslot *slot = NULL;
+    for (int i = 0; i < RA_MAX_INFLIGHT && slot == NULL; i++) {
+      if (!raslots[i].busy) slot = &raslots[i];
+    }
+    // Leave the queue to demand reads when it is nearly full.
+    if (slot == NULL || diskaio_room() < 2) return;
+    struct diskimg_request *req = &slot->req;
+    req->sectorNum = start;
+    req->count = count;
+    req->buf = slot->buf;
+    req->done = 0;
+    req->cookie = slot;
+    if (diskaio_submit(&req, 1) != 1) return;
+    slot->busy = 1;
+  }
+
+  if (ra_unread(st) == 0) st->raStart = start;
+  st->raEnd = start + count;
+  numrawindows++;
+  numrasectors += count;
+  st->window *= 2;
+  if (st->window > RA_MAX_WINDOW) st->window = RA_MAX_WINDOW;
+
+  if (diskaio_depth() == 0) {
+    // The window is claimed above, so other threads don't read it a second
+    // time while this one waits for the disk without holding the lock.
+    char buf[RA_MAX_WINDOW * DISKIMG_SECTOR_SIZE];
+    struct iovec iov[RA_MAX_WINDOW];
+    for (int i = 0; i < count; i++) {
+      iov[i].iov_base = buf + i * DISKIMG_SECTOR_SIZE;
+      iov[i].iov_len = DISKIMG_SECTOR_SIZE;
+    }
+    st->loadStart = start;
+    st->loadEnd = start + count;
+    pthread_mutex_unlock(&raLock);
+    if (disksim_readsectors(fd, start, count, iov) == count * DISKIMG_SECTOR_SIZE) {
+      for (int i = 0; i < count; i++) landed_sector(start + i, iov[i].iov_base, 1);
+    }
+    pthread_mutex_lock(&raLock);
+    // Unless the stream was taken over for another one in the meantime.
+    if (st->loadStart == start && st->loadEnd == start + count)
+      st->loadStart = st->loadEnd = 0;
+  }
+}
+
+/*
+ * Feeds a demand read of count sectors to the stream detector.
+ */
+static void ra_update(int fd, int sectorNum, int count) {
+  if (!diskReadaheadEnable || sectorNum == 0) return;
+  pthread_mutex_lock(&raLock);
+  raclock++;
+
+  // A read that skips ahead into the prefetched sectors, like the next file
+  // laid out after the last one, continues the stream, and so does one that
+  // skips a few sectors before the stream has been prefetched.  A read of
+  // sectors the stream has only just passed, like a second pass over a file or the
+  // reads of another thread working on the file before, doesn't move it
+  // back and doesn't start a stream of its own either.
+  struct rastream *st = NULL, *victim = &streams[0];
+  int behind = 0;
+  for (int i = 0; i < RA_STREAMS && st == NULL; i++) {
+    if (streams[i].lastUse && sectorNum >= streams[i].nextSector &&
+        (sectorNum <= streams[i].nextSector + RA_MAX_GAP || sectorNum < streams[i].raEnd)) {
+      st = &streams[i];
+    } else if (streams[i].lastUse && sectorNum < streams[i].nextSector &&
+               sectorNum >= streams[i].firstSector &&
+               sectorNum >= streams[i].nextSector - RA_MAX_WINDOW) {
+      st = &streams[i];
+      behind = 1;
+    } else if (streams[i].lastUse < victim->lastUse) {
+      victim = &streams[i];
+    }
+  }
+
+  if (st && behind) {
+    if (sectorNum + count > st->nextSector) {
+      int skipped = ra_unread(st);
+      st->nextSector = sectorNum + count;
+      numrawasted += skipped - ra_unread(st);
+    }
+  } else if (st) {
+    st->seqReads++;
+    int skipped = ra_unread(st);
+    st->nextSector = sectorNum;
+    numrawasted += skipped - ra_unread(st);
+    st->nextSector = sectorNum + count;
+  } else {
+    // A new stream replaces the least recently used one.
+    st = victim;
+    numrawasted += ra_unread(st);
+    st->seqReads = 0;
+    st->window = RA_MIN_WINDOW;
+    st->raStart = st->raEnd = 0;
+    st->loadStart = st->loadEnd = 0;
+    st->firstSector = sectorNum;
+    st->nextSector = sectorNum + count;
+  }
+  st->lastUse = raclock;
+
+  if (st->seqReads >= RA_TRIGGER && ra_unread(st) <= st->window / 4)
+    ra_issue(fd, st);
+  pthread_mutex_unlock(&raLock);
+}
+
 
 /** 
  * Opens a disk image for I/O.  Returns an open file descriptor, or -1 if
@@ -35,15 +328,20 @@ int diskimg_getsize(int fd) {
  * on error.
  */
 int diskimg_readsector(int fd, int sectorNum, void *buf) {
-  numreads++;
+  __atomic_fetch_add(&numreads, 1, __ATOMIC_RELAXED);
   int ret;
 
   /* 
    * By design cache cannot fetch sector 0
    */
   if (sectorNum != 0) {
-    if ((ret = fetch_sector_in_cache(sectorNum, buf)) != CACHE_ERROR)
+    ra_settle(sectorNum, 1);
+    if ((ret = fetch_sector(sectorNum, buf)) != CACHE_ERROR) {
+      ra_account(sectorNum, 1);
+      ra_update(fd, sectorNum, 1);
       return ret;
+    }
+    ra_account(sectorNum, 0);
   }
 
   ret = disksim_readsector(fd, sectorNum, buf);
@@ -51,21 +349,68 @@ int diskimg_readsector(int fd, int sectorNum, void *buf) {
   /* 
    * By design cache cannot store sector 0
    */
-  if ((ret != -1) && (sectorNum != 0))
-      save_sector_in_cache(sectorNum, buf);
+  if (ret != -1) {
+      landed_sector(sectorNum, buf, 0);
+      ra_update(fd, sectorNum, 1);
+  }
 
   return ret;
 }
 
-int diskimg_readsector_inode(int fd, int sectorNum, void *buf, void *inp, int indirection) {
-  numreads++;
+/**
+ * Reads count consecutive sectors into the iov buffers.  Sectors found in the
+ * cache are copied out of it; each run of consecutive misses goes to the disk
+ * as one vectored read and is then saved in the cache.  Return number of
+ * bytes read, or -1 on error.
+ */
+int diskimg_readsectors(int fd, int firstSector, int count, const struct iovec *iov) {
+  __atomic_fetch_add(&numreads, count, __ATOMIC_RELAXED);
+  int i = 0;
+
+  ra_settle(firstSector, count);
+  while (i < count) {
+    int sectorNum = firstSector + i;
+    /*
+     * By design cache cannot fetch sector 0
+     */
+    if ((sectorNum != 0) &&
+        (fetch_sector(sectorNum, iov[i].iov_base) != CACHE_ERROR)) {
+      ra_account(sectorNum, 1);
+      i++;
+      continue;
+    }
+
+    int run = 1;
+    while ((i + run < count) &&
+           (fetch_sector(sectorNum + run, iov[i + run].iov_base) == CACHE_ERROR))
+      run++;
+    if (i + run < count) ra_account(sectorNum + run, 1);
+    for (int j = 0; j < run; j++) ra_account(sectorNum + j, 0);
+
+    if (disksim_readsectors(fd, sectorNum, run, &iov[i]) != run * DISKIMG_SECTOR_SIZE)
+      return -1;
+
+    for (int j = 0; j < run; j++)
+      landed_sector(sectorNum + j, iov[i + j].iov_base, 0);
+    /*
+     * The sector that ended the run was a cache hit and already copied out
+     */
+    i += run;
+    if (i < count) i++;
+  }
+  ra_update(fd, firstSector, count);
+  return count * DISKIMG_SECTOR_SIZE;
+}
+
+int diskimg_readsector_inode(int fd, int sectorNum, void *buf, int inumber, int indirection) {
+  __atomic_fetch_add(&numreads, 1, __ATOMIC_RELAXED);
   int ret;
 
   /*
    * By design cache cannot fetch sector 0
    */
   if (sectorNum != 0) {
-    if ((ret = fetch_sector_in_cache(sectorNum, buf)) != CACHE_ERROR)
+    if ((ret = fetch_sector(sectorNum, buf)) != CACHE_ERROR)
       return ret;
   }
 
@@ -74,35 +419,239 @@ int diskimg_readsector_inode(int fd, int sectorNum, void *buf, void *inp, int in
   /*
    * By design cache cannot store sector 0
    */
-  if ((ret != -1) && (sectorNum != 0))
-    save_sector_in_inode_cache(sectorNum, buf, inp, indirection);
+  if ((ret != -1) && !diskwb_read(sectorNum, buf) && (sectorNum != 0))
+    save_sector_in_inode_cache(sectorNum, buf, inumber, indirection);
 
   return ret;
 }
 
 int diskimg_bypass_cache_read_sector(int fd, int sectorNum, void *buf) {
-    numreads++;
+    __atomic_fetch_add(&numreads, 1, __ATOMIC_RELAXED);
+    if (diskwb_read(sectorNum, buf))
+      return DISKIMG_SECTOR_SIZE;
     return disksim_readsector(fd, sectorNum, buf);
 }
 
+int diskimg_async_init(int fd, int depth) {
+  if (depth <= 1) return 0;
+  return diskaio_init(fd, depth, DISKAIO_BACKEND_AUTO);
+}
+
+void diskimg_async_shutdown(void) {
+  // Prefetches still in flight land in the cache before the engine stops.
+  ra_settle(0, INT_MAX);
+  diskaio_shutdown();
+}
+
+static void complete_request(struct diskimg_request *req) {
+  pthread_mutex_lock(&completedLock);
+  req->done = 1;
+  req->next = NULL;
+  if (completedTail) completedTail->next = req;
+  else completedHead = req;
+  completedTail = req;
+  pthread_mutex_unlock(&completedLock);
+}
+
+/*
+ * Serves the request out of the cache if every one of its sectors is there.
+ */
+static int request_in_cache(struct diskimg_request *req) {
+  char *buf = req->buf;
+  for (int i = 0; i < req->count; i++) {
+    /*
+     * By design cache cannot fetch sector 0
+     */
+    if ((req->sectorNum + i == 0) ||
+        (fetch_sector(req->sectorNum + i, buf + i * DISKIMG_SECTOR_SIZE) == CACHE_ERROR))
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Moves one request the engine has finished to the completed list and saves
+ * its sectors in the cache.  The cache is only touched from this thread, the
+ * engine never does.  Returns 0 if nothing was in flight.
+ */
+static int reap_request(int wait) {
+  struct diskimg_request *req = diskaio_reap(wait);
+  if (req == NULL) return 0;
+  struct raslot *slot = ra_slot(req);
+  if (req->result == req->count * DISKIMG_SECTOR_SIZE) {
+    char *buf = req->buf;
+    for (int i = 0; i < req->count; i++)
+      landed_sector(req->sectorNum + i, buf + i * DISKIMG_SECTOR_SIZE, slot != NULL);
+  } else {
+    req->result = -1;
+  }
+  if (slot) {
+    // Readahead is ours, nobody is waiting for it.
+    slot->busy = 0;
+    return 1;
+  }
+  complete_request(req);
+  return 1;
+}
+
+int diskimg_submit(int fd, struct diskimg_request **reqs, int n) {
+  struct diskimg_request *pending[n > 0 ? n : 1];
+  int numpending = 0;
+  int room = diskaio_room();
+  int i;
+
+  for (i = 0; i < n; i++) {
+    struct diskimg_request *req = reqs[i];
+    req->done = 0;
+
+    if (diskaio_depth() == 0) {
+      // No engine, read it now through the cache.
+      struct iovec iov[req->count];
+      for (int j = 0; j < req->count; j++) {
+        iov[j].iov_base = (char *) req->buf + j * DISKIMG_SECTOR_SIZE;
+        iov[j].iov_len = DISKIMG_SECTOR_SIZE;
+      }
+      req->result = diskimg_readsectors(fd, req->sectorNum, req->count, iov);
+      complete_request(req);
+      continue;
+    }
+
+    ra_settle(req->sectorNum, req->count);
+    for (int j = 0; j < req->count; j++)
+      ra_account(req->sectorNum + j, probe_sector_in_cache(req->sectorNum + j));
+    if (request_in_cache(req)) {
+      numreads += req->count;
+      req->result = req->count * DISKIMG_SECTOR_SIZE;
+      complete_request(req);
+      continue;
+    }
+    if (room == 0) break;   // Queue full
+    room--;
+    numreads += req->count;
+    pending[numpending++] = req;
+  }
+
+  if (numpending > 0) diskaio_submit(pending, numpending);
+  // Prefetch only once the demand reads are queued, so they get the room.
+  if (diskaio_depth() > 0) {
+    for (int j = 0; j < i; j++) ra_update(fd, reqs[j]->sectorNum, reqs[j]->count);
+  }
+  return i;
+}
+
+int diskimg_poll(struct diskimg_request **done, int max) {
+  while (reap_request(0)) ;
+
+  int count = 0;
+  pthread_mutex_lock(&completedLock);
+  while (count < max && completedHead) {
+    done[count++] = completedHead;
+    completedHead = completedHead->next;
+    if (!completedHead) completedTail = NULL;
+  }
+  pthread_mutex_unlock(&completedLock);
+  return count;
+}
+
+int diskimg_wait(struct diskimg_request **done, int min, int max) {
+  int count = diskimg_poll(done, max);
+  while (count < min && count < max) {
+    if (!reap_request(1)) break;    // Nothing left in flight
+    count += diskimg_poll(done + count, max - count);
+  }
+  return count;
+}
+
+/*
+ * Unlinks req from the completed list.
+ */
+static void claim_request(struct diskimg_request *req) {
+  struct diskimg_request *prev = NULL;
+  pthread_mutex_lock(&completedLock);
+  for (struct diskimg_request *cur = completedHead; cur; prev = cur, cur = cur->next) {
+    if (cur != req) continue;
+    if (prev) prev->next = cur->next;
+    else completedHead = cur->next;
+    if (completedTail == cur) completedTail = prev;
+    cur->next = NULL;
+    break;
+  }
+  pthread_mutex_unlock(&completedLock);
+}
+
+int diskimg_readbatch(int fd, struct diskimg_request **reqs, int n) {
+  int submitted = 0;
+  while (submitted < n) {
+    int accepted = diskimg_submit(fd, reqs + submitted, n - submitted);
+    submitted += accepted;
+    // Queue full: make room by finishing a request in flight.
+    if (accepted == 0 && !reap_request(1)) return -1;
+  }
+
+  int ret = 0;
+  for (int i = 0; i < n; i++) {
+    while (!reqs[i]->done) {
+      if (!reap_request(1)) return -1;
+    }
+    claim_request(reqs[i]);
+    if (reqs[i]->result != reqs[i]->count * DISKIMG_SECTOR_SIZE) ret = -1;
+  }
+  return ret;
+}
+
 /**
  * Writes the specified sector to the disk.  Return number of bytes written,
  * -1 on error.
  */
 int diskimg_writesector(int fd, int sectorNum, void *buf) {
   numwrites++;
-  return disksim_writesector(fd, sectorNum, buf);
+  drain_inflight();
+  int ret = diskwb_write(fd, sectorNum, buf);
+  if (ret == 0)
+    ret = disksim_writesector(fd, sectorNum, buf);
+
+  /*
+   * The cached copy stays the one on the disk unless the write went
+   * through.  By design cache cannot store sector 0
+   */
+  if (ret == DISKIMG_SECTOR_SIZE && sectorNum != 0)
+    update_sector_in_cache(sectorNum, buf);
+  return ret;
+}
+
+int diskimg_writeback_init(int maxSectors, int flags) {
+  return diskwb_init(maxSectors, flags);
+}
+
+int diskimg_sync(int fd) {
+  drain_inflight();
+  if (diskwb_flush(fd) < 0) return -1;
+  return disksim_sync(fd);
 }
 
 /**
- * Cleans up from a previous diskimg_open() call.  Returns 0 on success, -1 on
- * error
+ * Cleans up from a previous diskimg_open() call, writing out the
+ * write-behind buffer first.  Returns 0 on success, -1 on error
  */
 int diskimg_close(int fd) {
-  return disksim_close(fd);
+  drain_inflight();
+  int err = diskwb_flush(fd);
+  if (disksim_close(fd) < 0) return -1;
+  return err;
 }
 
 void diskimg_dumpstats(FILE *file) {
   fprintf(file, "Diskimg: %"PRIu64" reads, %"PRIu64" writes\n",
           numreads, numwrites);
+  CacheMem_Dumpstats(file);
+  if (numrawindows > 0) {
+    uint64_t unread = 0;
+    for (int i = 0; i < RA_STREAMS; i++) unread += ra_unread(&streams[i]);
+    fprintf(file, "Readahead: %"PRIu64" windows (%"PRIu64" sectors), %"PRIu64" hits, "
+            "%"PRIu64" wasted (%"PRIu64" evicted before use), %"PRIu64" read while in flight\n",
+            numrawindows, numrasectors, numrahits, numrawasted + unread, numraevicted,
+            numrainflight);
+  }
+  diskaio_dumpstats(file);
+  diskwb_dumpstats(file);
 }
@@ -3,8 +3,81 @@
 
 #include "assign1/diskimg.h"
 #include <stdio.h>
+#include <stdint.h>
+
+/**
+ * An asynchronous read of count consecutive sectors into buf.  The submitter
+ * owns the request and its buffer until it comes back from diskimg_poll(),
+ * diskimg_wait() or diskimg_readbatch().
+ */
+struct diskimg_request {
+  int sectorNum;          // First sector to read
+  int count;              // Number of consecutive sectors
+  void *buf;              // count * DISKIMG_SECTOR_SIZE bytes
+  int result;             // Bytes read or -1, valid once done is set
+  int done;               // Set when the request has completed
+  void *cookie;           // Free for the submitter's use
+  /* Private to the diskimg layer */
+  int64_t completionTime; // Simulated time the disk finishes the request
+  struct diskimg_request *next;
+};
+
+/*
+ * Flags for diskimg_writeback_init()
+ */
+#define DISKIMG_WRITEBACK_ORDERED 1   // Superblock goes to disk after everything else
 
 void diskimg_dumpstats(FILE *file);
-int diskimg_readsector_inode(int fd, int sectorNum, void *buf, void *inp, int indirection);
+
+/**
+ * Makes diskimg_writesector() buffer up to maxSectors written sectors in
+ * memory instead of writing each one through.  Reads see the buffered
+ * contents.  The buffer is written out, sorted and with adjacent sectors
+ * merged, when it fills up, on diskimg_sync() and on diskimg_close().
+ * Returns 0 on success, -1 on error.
+ */
+int diskimg_writeback_init(int maxSectors, int flags);
+
+/**
+ * Writes out the write-behind buffer and waits until everything written is
+ * on stable storage.  Returns 0 on success, -1 on error.
+ */
+int diskimg_sync(int fd);
+
+/**
+ * Starts the asynchronous engine with up to depth reads in flight (io_uring
+ * when the kernel allows it, a pthread pool otherwise).  Without it, or with
+ * depth <= 1, requests are performed synchronously at submit time.  Returns
+ * 0 on success, -1 on error.
+ */
+int diskimg_async_init(int fd, int depth);
+void diskimg_async_shutdown(void);
+
+/**
+ * Submits n read requests.  Requests whose sectors are all cached complete
+ * immediately.  Returns the number of requests accepted, which is less than
+ * n when the queue is full; poll or wait and submit the rest later.
+ */
+int diskimg_submit(int fd, struct diskimg_request **reqs, int n);
+
+/**
+ * Collects up to max completed requests into done without blocking.
+ * Returns the number collected.
+ */
+int diskimg_poll(struct diskimg_request **done, int max);
+
+/**
+ * Like diskimg_poll() but blocks until at least min requests have completed
+ * or nothing is left in flight.
+ */
+int diskimg_wait(struct diskimg_request **done, int min, int max);
+
+/**
+ * Submits the n requests and waits for all of them, leaving completions of
+ * other requests for diskimg_poll().  Returns 0 if every read succeeded,
+ * -1 otherwise.
+ */
+int diskimg_readbatch(int fd, struct diskimg_request **reqs, int n);
+int diskimg_readsector_inode(int fd, int sectorNum, void *buf, int inumber, int indirection);
 
 #endif // _DISKIMG_NEW_H_
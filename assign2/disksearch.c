@@ -15,17 +15,26 @@
 #include "diskimg.h"
 #include "disksim.h"
 #include "scan.h"
+#include "pipeline.h"
+#include "query.h"
+#include "server.h"
 #include "cachemem.h"
 #include "assign1/inode.h"
+#include "assign1/unixfilesystem.h"
+#include "assign1/snapshot.h"
 
 static void PrintUsageAndExit(char *progname);
 static void DumpStats(FILE *file);
 static void DumpUsageStats(FILE *file);
 static int  QueryWord(char *word, Index *ind, FILE *file );
+static int  QueryExpression(char *expr, Index *ind, FILE *file);
 
 static void BuildDiskIndex(char *diskpath);
+static void ImageFingerprint(struct unixfilesystem *fs, IndexFingerprint *fingerprint);
 static void TestServiceBySingleWord(char *queryWord);
 static void TestServiceByFileOfWords(char *queryFile);
+static void TestServiceByQuery(char *queryExpr);
+static void TestServiceByFileOfQueries(char *queryFile);
 
 /*
  * Gloabl program options
@@ -33,6 +42,16 @@ static void TestServiceByFileOfWords(char *queryFile);
 int quietFlag = 0;
 int diskLatency = 8000;
 int diskBusyWaitEnable = 0;
+int diskSeekModel = 0;
+int asyncQueueDepth = 0;
+int diskReadaheadEnable = 1;
+int scanWorkers = 1;
+int prefetchDepth = 0;
+int diskOrderScan = 0;
+char *snapshotPath = NULL;
+char *indexOutPath = NULL;
+char *indexInPath = NULL;
+int servePort = -1;
 
 #define INFINITE_CACHE_SIZE (64*1024*1024)  /* 64MB is infinite */
 
@@ -46,9 +65,15 @@ int main(int argc, char *argv[]) {
   int opt;
   char *queryWord = NULL;
   char *queryFile = NULL;
+  char *queryExpr = NULL;
+  char *queryExprFile = NULL;
   int cacheSizeInKB = 0;
+  static struct option longOptions[] = {
+    { "serve", required_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 }
+  };
 
-  while ((opt = getopt(argc, argv, "ql:d:w:f:bc:")) != -1) {
+  while ((opt = getopt_long(argc, argv, "ql:d:w:f:Q:F:bmc:p:a:rs:j:P:eo:i:", longOptions, NULL)) != -1) {
     switch (opt) {
       case 'q':
         quietFlag = 1;
@@ -59,15 +84,69 @@ int main(int argc, char *argv[]) {
       case 'c':
         cacheSizeInKB = atoi(optarg);
         break;
+      case 'p':
+        if (CacheMem_SetPolicy(optarg) < 0) {
+          fprintf(stderr, "Unknown cache policy %s\n", optarg);
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
       case 'b':
         diskBusyWaitEnable = 1;
         break;
+      case 'm':
+        diskSeekModel = 1;
+        break;
+      case 'a':
+        asyncQueueDepth = atoi(optarg);
+        break;
+      case 'r':
+        diskReadaheadEnable = 0;
+        break;
+      case 'j':
+        scanWorkers = atoi(optarg);
+        if (scanWorkers < 1 || scanWorkers > SCAN_MAX_WORKERS) {
+          fprintf(stderr, "-j takes 1 to %d workers\n", SCAN_MAX_WORKERS);
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
+      case 'e':
+        diskOrderScan = 1;
+        break;
+      case 'P':
+        prefetchDepth = atoi(optarg);
+        if (prefetchDepth < 0) {
+          fprintf(stderr, "-P takes a number of files\n");
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
+      case 's':
+        snapshotPath = optarg;
+        break;
+      case 'o':
+        indexOutPath = optarg;
+        break;
+      case 'i':
+        indexInPath = optarg;
+        break;
+      case 'S':
+        servePort = atoi(optarg);
+        if (servePort < 0 || servePort > 65535) {
+          fprintf(stderr, "--serve takes a TCP port\n");
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
       case 'w':
         queryWord = strdup(optarg);
         break;
       case 'f':
         queryFile = strdup(optarg);
         break;
+      case 'Q':
+        queryExpr = strdup(optarg);
+        break;
+      case 'F':
+        queryExprFile = strdup(optarg);
+        break;
       case 'd': {
         char *c = optarg;
         while (*c) {
@@ -105,6 +184,23 @@ int main(int argc, char *argv[]) {
   if (queryFile) {
     TestServiceByFileOfWords(queryFile);
   }
+  if (queryExpr) {
+    TestServiceByQuery(queryExpr);
+  }
+  if (queryExprFile) {
+    TestServiceByFileOfQueries(queryExprFile);
+  }
+  if (servePort >= 0) {
+    // Without -j, a query worker for every CPU
+    int numWorkers = scanWorkers;
+    if (numWorkers == 1) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      numWorkers = (cpus < 1) ? 1 : (cpus > SCAN_MAX_WORKERS) ? SCAN_MAX_WORKERS : cpus;
+    }
+    if (Server_Run(diskIndex, servePort, numWorkers) < 0) {
+      exit(EXIT_FAILURE);
+    }
+  }
 
   if (!quietFlag) {
     printf("************ Stats ***************\n");
@@ -123,6 +219,53 @@ void BuildDiskIndex(char *diskpath) {
     exit(EXIT_FAILURE);
   }
 
+  struct unixfilesystem *fs = fshandle;
+  IndexFingerprint fingerprint;
+  ImageFingerprint(fs, &fingerprint);
+  // A stale or damaged index file is reported and the index is rebuilt.
+  if (indexInPath) {
+    int64_t startTime = Debug_GetTimeInMicrosecs();
+    diskIndex = Index_Open(indexInPath, &fingerprint);
+    int64_t endTime = Debug_GetTimeInMicrosecs();
+    if (diskIndex) {
+      if (!quietFlag) {
+        printf("Index %s of disk %s loaded in %f seconds\n",
+               indexInPath, diskpath, (endTime - startTime)/1000000.0);
+      }
+      return;
+    }
+  }
+
+  // A stale or damaged snapshot is reported and the image is used directly.
+  if (snapshotPath) fs->snap = snapshot_open(fs, snapshotPath);
+  // The asynchronous engine is driven by one thread; the scan workers
+  // overlap their reads by themselves.
+  if (scanWorkers > 1 && asyncQueueDepth > 1) {
+    fprintf(stderr, "-a is ignored with -j\n");
+    asyncQueueDepth = 0;
+  }
+  if (scanWorkers > 1 && diskOrderScan) {
+    fprintf(stderr, "-e is ignored with -j\n");
+    diskOrderScan = 0;
+  }
+  // The prefetch stage reads ahead in directory order.
+  if (diskOrderScan && prefetchDepth > 0) {
+    fprintf(stderr, "-P is ignored with -e\n");
+    prefetchDepth = 0;
+  }
+  // The scan workers already read ahead of each other.
+  if (scanWorkers > 1 && prefetchDepth > 0) {
+    fprintf(stderr, "-P is ignored with -j\n");
+    prefetchDepth = 0;
+  }
+  if (prefetchDepth > 0 && asyncQueueDepth > 1) {
+    fprintf(stderr, "-a is ignored with -P\n");
+    asyncQueueDepth = 0;
+  }
+  if (diskimg_async_init(fs->dfd, asyncQueueDepth) < 0) {
+    fprintf(stderr, "Can't start asynchronous disk I/O, reading synchronously\n");
+  }
+
   store = Pathstore_create(fshandle);
   if (store == NULL) {
     fprintf(stderr, "Can't create pathstore\n");
@@ -139,8 +282,18 @@ void BuildDiskIndex(char *diskpath) {
   }
 
   int64_t startTime = Debug_GetTimeInMicrosecs();
+  if (prefetchDepth > 0 && Pipeline_Start(fs, "/", ROOT_INUMBER, prefetchDepth) < 0) {
+    fprintf(stderr, "Can't start the prefetch pipeline, scanning without it\n");
+  }
   /* Optimization to prevent pathname_lookup */
-  int err = Scan_TreeAndIndex("/", diskIndex, store, /* discardDups = */ 1, ROOT_INUMBER);
+  int err;
+  if (scanWorkers > 1)
+    err = Scan_TreeAndIndexParallel("/", diskIndex, store, /* discardDups = */ 1, ROOT_INUMBER, scanWorkers);
+  else if (diskOrderScan)
+    err = Scan_TreeAndIndexDiskOrder("/", diskIndex, store, /* discardDups = */ 1, ROOT_INUMBER);
+  else
+    err = Scan_TreeAndIndex("/", diskIndex, store, /* discardDups = */ 1, ROOT_INUMBER);
+  Pipeline_Stop();
   if (err) {
     fprintf(stderr, "Error creating index\n");
     exit(EXIT_FAILURE);
@@ -151,6 +304,27 @@ void BuildDiskIndex(char *diskpath) {
     printf("\nIndex disk %s (latency %d) completed in %f seconds\n",
            diskpath, diskLatency, (endTime - startTime)/1000000.0);
   }
+
+  if (indexOutPath && !Index_Write(diskIndex, store, indexOutPath, &fingerprint)) {
+    fprintf(stderr, "Can't write index file %s\n", indexOutPath);
+  }
+}
+
+/*
+ * An index file is only used with the image it was built from: one of the
+ * same size and with the same superblock.
+ */
+static void ImageFingerprint(struct unixfilesystem *fs, IndexFingerprint *fingerprint) {
+  const unsigned char *p = (const unsigned char *) &fs->superblock;
+  uint64_t hash = 0xcbf29ce484222325ULL;   // FNV-1a
+  for (size_t i = 0; i < sizeof(fs->superblock); i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  memset(fingerprint, 0, sizeof(*fingerprint));
+  fingerprint->imageSize = diskimg_getsize(fs->dfd);
+  fingerprint->superblockChecksum = hash;
+  fingerprint->superblockTime = ((uint32_t) fs->superblock.s_time[0] << 16) | fs->superblock.s_time[1];
 }
 
 void TestServiceBySingleWord(char *queryWord) {
@@ -203,18 +377,104 @@ void TestServiceByFileOfWords(char *queryFile) {
   fclose(file);
 }
 
+void TestServiceByQuery(char *queryExpr) {
+  QueryExpression(queryExpr, diskIndex, stdout);
+
+  /* Do timing without printf */
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  QueryExpression(queryExpr, diskIndex, NULL);
+  int64_t endTime = Debug_GetTimeInMicrosecs();
+
+  if (!quietFlag) {
+    printf("Query \'%s\' took %f microseconds\n", queryExpr,
+           (double)(endTime - startTime));
+  }
+}
+
+void TestServiceByFileOfQueries(char *queryFile) {
+  const int maxQuerySize = 1024;
+  FILE *file = fopen(queryFile, "r");
+
+  if (file == NULL) {
+    perror("fopen");
+    fprintf(stderr, "Can't open query file %s\n",queryFile);
+    exit(EXIT_FAILURE);
+  }
+
+  char line[maxQuerySize];
+  int numQueries = 0;
+  while (fgets(line, maxQuerySize, file) != NULL) {
+    line[strcspn(line, "\n")] = 0;
+    if (line[0]) {
+      QueryExpression(line, diskIndex, stdout);
+      numQueries++;
+    }
+  }
+  rewind(file);
+
+  /* Do timing without printf */
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  while (fgets(line, maxQuerySize, file) != NULL) {
+    line[strcspn(line, "\n")] = 0;
+    if (line[0])
+      QueryExpression(line, diskIndex, NULL);
+  }
+  int64_t endTime = Debug_GetTimeInMicrosecs();
+
+  if (!quietFlag) {
+    printf("QueryFile %s took %f microseconds for %d queries\n",
+           queryFile, (double)(endTime - startTime), numQueries);
+  }
+
+  fclose(file);
+}
+
+/*
+ * Prints every hit of the query expr, newest first like QueryWord().
+ */
+int QueryExpression(char *expr, Index *ind, FILE *file) {
+  char error[128];
+  Query *query = Query_Parse(expr, error, sizeof(error));
+  if (query == NULL) {
+    if (file)
+      fprintf(file, "Query %s: %s\n", expr, error);
+    return -1;
+  }
+
+  QueryHits hits;
+  if (!Query_Evaluate(query, ind, &hits)) {
+    Query_Free(query);
+    if (file)
+      fprintf(file, "Query %s: out of memory\n", expr);
+    return -1;
+  }
+  if (hits.numHits == 0 && file)
+    fprintf(file, "Query %s not found\n", expr);
+  for (uint32_t i = hits.numHits; i-- > 0; ) {
+    const IndexPosting *p = &hits.hits[i];
+    if (file)
+      fprintf(file, "Query %s @ %s:%d\n", expr, Index_Pathname(ind, p->pathID), p->offset);
+  }
+
+  int found = (hits.numHits > 0);
+  Query_FreeHits(&hits);
+  Query_Free(query);
+  return found;
+}
+
 int QueryWord(char *word, Index *ind, FILE *file) {
-  IndexLocationList *loc = Index_RetrieveEntry(ind,word);
-  if (loc == NULL) {
+  IndexEntry entry;
+  if (!Index_RetrieveEntry(ind, word, &entry)) {
     if (file)
       fprintf(file, "Word %s not found\n", word);
     return 0;
   }
 
-  while (loc) {
+  // Newest first
+  for (uint32_t i = entry.numPostings; i-- > 0; ) {
+    const IndexPosting *p = &entry.postings[i];
     if (file)
-      fprintf(file,"Word %s @ %s:%d\n", word, loc->item.pathname, loc->item.offset);
-    loc = loc->nextLocation;
+      fprintf(file,"Word %s @ %s:%d\n", word, Index_Pathname(ind, p->pathID), p->offset);
   }
 
   return 1;
@@ -224,7 +484,10 @@ void DumpStats(FILE *file) {
   disksim_dumpstats(file);
   diskimg_dumpstats(file);
   Scan_Dumpstats(file);
+  Pipeline_Dumpstats(file);
   Index_Dumpstats(file);
+  Query_Dumpstats(file);
+  Server_Dumpstats(file);
   Pathstore_Dumpstats(file);
   Fileops_Dumpstats(file);
 }
@@ -250,8 +513,21 @@ void PrintUsageAndExit(char *progname) {
   fprintf(stderr, "-q     don't print extra info\n");
   fprintf(stderr, "-l N   set simulated disk latency to N microseconds\n");
   fprintf(stderr, "-b     simulate disk latency by busy-waiting\n");
+  fprintf(stderr, "-m     make the disk latency depend on the seek distance\n");
+  fprintf(stderr, "-p P   replace cached sectors by policy P: direct (default), clock, 2q or arc\n");
+  fprintf(stderr, "-a N   keep up to N disk reads in flight asynchronously\n");
+  fprintf(stderr, "-r     don't prefetch ahead of sequential reads\n");
+  fprintf(stderr, "-j N   build the index, and serve queries, with N threads\n");
+  fprintf(stderr, "-P N   prefetch up to N files ahead of the scan\n");
+  fprintf(stderr, "-e     scan the files in the order of their blocks on the disk\n");
+  fprintf(stderr, "-s F   take inodes, directories and block maps from snapshot F\n");
+  fprintf(stderr, "-o F   write the index to file F\n");
+  fprintf(stderr, "-i F   use the index in file F instead of building one\n");
   fprintf(stderr, "-w W   query index for word W\n");
   fprintf(stderr, "-f F   read query words from file F\n");
+  fprintf(stderr, "-Q E   run query E: words, \"phrases\", AND, OR, NOT, NEAR/k and ( )\n");
+  fprintf(stderr, "-F F   run the queries in file F, one per line\n");
+  fprintf(stderr, "--serve PORT   answer queries on TCP port PORT until interrupted\n");
   fprintf(stderr, "-d debugFlags   set the debug files in the debugFlags string\n");
   exit(EXIT_FAILURE);
 }
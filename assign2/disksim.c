@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include <assert.h>
 #include "disksim.h"
@@ -20,27 +21,75 @@
 #define NEVER_INLINE __attribute__((noinline))
 
 extern int diskLatency;
+extern int diskSeekModel;
+static int disksectors = 0;    // Size of the disk, for the seek model.
+static int headSector = 0;     // Where the last request left the head.
 static uint64_t numreads = 0;  // Count of the number of disk reads.
 static uint64_t numwrites = 0; // Count of the number of disk writes.
+static uint64_t numsectorsread = 0; // Sectors transferred by the reads.
+static uint64_t numsectorswritten = 0; // Sectors transferred by the writes.
+static uint64_t numseeks = 0;  // Requests that didn't start where the head was.
+static uint64_t seekdistance = 0; // Sectors the head moved over, summed.
 
-/** 
- * We want this function to show up in gprof, so mark it as
- * NEVER_INLINE. 
+/*
+ * The seek model.  A request that starts where the previous one ended only
+ * pays for its transfer.  Any other request pays for a seek that grows with
+ * the square root of the distance the head moves, from a tenth of
+ * diskLatency for the next track to diskLatency for a full stroke, and for
+ * half a rotation on average before the data comes under the head.
  */
-static NEVER_INLINE void SimulateDiskLatency(int64_t startTime) {
+#define SEEK_TRACK_SECTORS  16     // Sectors per track
+#define SEEK_SETTLE_SHARE   10     // The shortest seek is 1/10 of a full stroke
+#define SEEK_ROTATION_SHARE 4      // Half a rotation is 1/4 of a full stroke
+#define SEEK_TRANSFER_US    10     // Microseconds to transfer one sector
+
+#define COUNT(stat, n) __atomic_fetch_add(&(stat), (n), __ATOMIC_RELAXED)
+
+/**
+ * Latency is modeled per request: a request completes diskLatency after it
+ * was issued, or as much later as the seek model says, no matter what else
+ * is in flight, so requests that are outstanding together overlap their
+ * latency.  Moves the head to the request of count sectors at firstSector
+ * and returns its latency in microseconds; requests in flight together each
+ * see the head where the request issued before them left it.
+ */
+static int64_t RequestLatency(int firstSector, int count) {
+  int last = __atomic_exchange_n(&headSector, firstSector + count, __ATOMIC_RELAXED);
+  int distance = (firstSector > last) ? firstSector - last : last - firstSector;
+  if (distance > 0) {
+    COUNT(numseeks, 1);
+    COUNT(seekdistance, distance);
+  }
+  if (!diskSeekModel) return diskLatency;
+
+  int64_t latency = (int64_t) count * SEEK_TRANSFER_US;
+  if (distance > 0) {
+    int64_t settle = diskLatency / SEEK_SETTLE_SHARE;
+    double stroke = (disksectors > 0) ? sqrt((double) distance / disksectors) : 1.0;
+    if (stroke > 1.0) stroke = 1.0;
+    latency += settle + (int64_t) ((diskLatency - settle) * stroke);
+    if (distance >= SEEK_TRACK_SECTORS) latency += diskLatency / SEEK_ROTATION_SHARE;
+  }
+  return latency;
+}
+
+/**
+ * Waits until the simulated disk has finished a request that completes at
+ * endTime.  We want this function to show up in gprof, so mark it as
+ * NEVER_INLINE.
+ */
+static NEVER_INLINE void SimulateDiskLatencyUntil(int64_t endTime) {
   extern int diskBusyWaitEnable;
   // Compute how much more we need to wait to simulated the disk
-  int64_t waitTimeSoFar = Debug_GetTimeInMicrosecs() - startTime;
+  int64_t waitTime = endTime - Debug_GetTimeInMicrosecs();
 
-  if (waitTimeSoFar < diskLatency) {
+  if (waitTime > 0) {
     // We need to wait some more.  If we need more than 10ms, we can get this
     // from the Linux kernel with usleep() (unless diskBusyWaitEnable is true).
     // Otherwise we just spin until the time is up.
-    int64_t waitTime = diskLatency - waitTimeSoFar;
     if ((waitTime >= 10000) && !diskBusyWaitEnable) {
       usleep(waitTime);
     } else {
-      int64_t endTime = startTime + diskLatency;
       while (Debug_GetTimeInMicrosecs() < endTime) ; // spin
     }
   }
@@ -51,7 +100,12 @@ static NEVER_INLINE void SimulateDiskLatency(int64_t startTime) {
  * unsuccessful  
  */
 int disksim_open(char *pathname, int readOnly) {
-  return open(pathname, readOnly ? O_RDONLY : O_RDWR);
+  int fd = open(pathname, readOnly ? O_RDONLY : O_RDWR);
+  if (fd >= 0) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    disksectors = (size > 0) ? size / DISKIMG_SECTOR_SIZE : 0;
+  }
+  return fd;
 }
 
 /**
@@ -71,28 +125,29 @@ int disksim_getsize(int fd) {
  */
 static ALWAYS_INLINE int disksim_perform_operation(int fd, int sectorNum, void* buf, bool do_read) {
   int simulateDisk = diskLatency > 0;
-  off_t offset = sectorNum * DISKIMG_SECTOR_SIZE;
+  off_t offset = (off_t) sectorNum * DISKIMG_SECTOR_SIZE;
   int64_t startTime = 0;
 
   if (simulateDisk) {
     startTime = Debug_GetTimeInMicrosecs();
   }
 
-  if (lseek(fd, offset, SEEK_SET) == (off_t) -1) {
-    return -1;
-  }
-
+  // pread()/pwrite() leave the file offset alone, so several threads can
+  // share the disk.
   ssize_t bytes;
   if (do_read) {
-    bytes = read(fd, buf, DISKIMG_SECTOR_SIZE);
-    numreads++;
+    bytes = pread(fd, buf, DISKIMG_SECTOR_SIZE, offset);
+    COUNT(numreads, 1);
+    COUNT(numsectorsread, 1);
   } else {
-    bytes = write(fd, buf, DISKIMG_SECTOR_SIZE);
-    numwrites++;
+    bytes = pwrite(fd, buf, DISKIMG_SECTOR_SIZE, offset);
+    COUNT(numwrites, 1);
+    COUNT(numsectorswritten, 1);
   }
 
+  int64_t latency = RequestLatency(sectorNum, 1);
   if (simulateDisk) {
-    SimulateDiskLatency(startTime);
+    SimulateDiskLatencyUntil(startTime + latency);
   }
   return bytes;
 }
@@ -105,6 +160,63 @@ int disksim_readsector(int fd, int sectorNum, void *buf) {
   return disksim_perform_operation(fd, sectorNum, buf, true);
 }
 
+/**
+ * Reads count consecutive sectors starting at firstSector into the iov
+ * buffers with one preadv().  The transfer is a single disk request, so it
+ * pays the simulated latency once.  Return number of bytes read, or -1 on
+ * error.
+ */
+int disksim_readsectors(int fd, int firstSector, int count, const struct iovec *iov) {
+  int simulateDisk = diskLatency > 0;
+  off_t offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  int64_t startTime = 0;
+
+  if (simulateDisk) {
+    startTime = Debug_GetTimeInMicrosecs();
+  }
+
+  ssize_t bytes = preadv(fd, iov, count, offset);
+  COUNT(numreads, 1);
+  COUNT(numsectorsread, count);
+
+  int64_t latency = RequestLatency(firstSector, count);
+  if (simulateDisk) {
+    SimulateDiskLatencyUntil(startTime + latency);
+  }
+  return bytes;
+}
+
+/**
+ * Starts an asynchronous read request of count sectors at firstSector.  The
+ * request is counted now and the time at which the simulated disk completes
+ * it is returned (0 when latency isn't being simulated); the data itself is
+ * moved by disksim_transfer().
+ */
+int64_t disksim_issue_read(int firstSector, int count) {
+  COUNT(numreads, 1);
+  COUNT(numsectorsread, count);
+  int64_t latency = RequestLatency(firstSector, count);
+  if (diskLatency <= 0) return 0;
+  return Debug_GetTimeInMicrosecs() + latency;
+}
+
+/**
+ * Moves the data of a request started with disksim_issue_read() into buf.
+ * Uses pread() and touches no shared state, so it may be called from any
+ * thread.  Return number of bytes read, or -1 on error.
+ */
+int disksim_transfer(int fd, int firstSector, int count, void *buf) {
+  off_t offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  return pread(fd, buf, (size_t) count * DISKIMG_SECTOR_SIZE, offset);
+}
+
+/**
+ * Blocks until completionTime as returned by disksim_issue_read().
+ */
+void disksim_wait_until(int64_t completionTime) {
+  if (completionTime > 0) SimulateDiskLatencyUntil(completionTime);
+}
+
 /**
  * Writes the specified sector to the disk.  Return number of bytes written,
  * -1 on error.
@@ -113,6 +225,39 @@ int disksim_writesector(int fd, int sectorNum, void *buf) {
   return disksim_perform_operation(fd, sectorNum, buf, false);
 }
 
+/**
+ * Writes count consecutive sectors starting at firstSector from the iov
+ * buffers with one pwritev().  Like disksim_readsectors() the transfer is a
+ * single disk request.  Return number of bytes written, or -1 on error.
+ */
+int disksim_writesectors(int fd, int firstSector, int count, const struct iovec *iov) {
+  int simulateDisk = diskLatency > 0;
+  off_t offset = (off_t) firstSector * DISKIMG_SECTOR_SIZE;
+  int64_t startTime = 0;
+
+  if (simulateDisk) {
+    startTime = Debug_GetTimeInMicrosecs();
+  }
+
+  ssize_t bytes = pwritev(fd, iov, count, offset);
+  COUNT(numwrites, 1);
+  COUNT(numsectorswritten, count);
+
+  int64_t latency = RequestLatency(firstSector, count);
+  if (simulateDisk) {
+    SimulateDiskLatencyUntil(startTime + latency);
+  }
+  return bytes;
+}
+
+/**
+ * Waits until everything written so far is on stable storage.  Returns 0 on
+ * success, -1 on error.
+ */
+int disksim_sync(int fd) {
+  return fdatasync(fd);
+}
+
 /**
  * Cleans up a previous diskimg_open() call.  Returns 0 on success, -1 on error.
  */
@@ -121,7 +266,9 @@ int disksim_close(int fd) {
 }
 
 void disksim_dumpstats(FILE *file) {
-  fprintf(file, "Disksim: %"PRIu64" reads, %"PRIu64" writes\n",
-          numreads, numwrites);
+  fprintf(file, "Disksim: %"PRIu64" reads (%"PRIu64" sectors), %"PRIu64" writes (%"PRIu64" sectors)\n",
+          numreads, numsectorsread, numwrites, numsectorswritten);
+  fprintf(file, "Disksim: %s latency model, %"PRIu64" seeks over %"PRIu64" sectors\n",
+          diskSeekModel ? "seek distance" : "flat", numseeks, seekdistance);
 }
 
@@ -3,11 +3,18 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 int disksim_open(char *pathname, int readOnly);
 int disksim_getsize(int fd); 
 int disksim_readsector(int fd, int sectorNum, void *buf); 
+int disksim_readsectors(int fd, int firstSector, int count, const struct iovec *iov);
+int64_t disksim_issue_read(int firstSector, int count);
+int disksim_transfer(int fd, int firstSector, int count, void *buf);
+void disksim_wait_until(int64_t completionTime);
 int disksim_writesector(int fd, int sectorNum, void *buf); 
+int disksim_writesectors(int fd, int firstSector, int count, const struct iovec *iov);
+int disksim_sync(int fd);
 int disksim_close(int fd);
 void disksim_dumpstats(FILE *file);
 
@@ -0,0 +1,178 @@
+/**
+ * diskwb.c  -  Write-behind buffer underneath the diskimg layer.
+ *
+ * Sector writes are absorbed into an in-memory buffer, where a later write
+ * of the same sector simply replaces the earlier one.  The buffer goes to
+ * the disk when it fills up, on diskimg_sync() and on diskimg_close():
+ * the sectors are sorted and every run of adjacent sectors is written with
+ * a single pwritev(), so a run pays the simulated disk latency once.
+ *
+ * With DISKIMG_WRITEBACK_ORDERED the superblock is held back until the
+ * rest of the flush is on stable storage, and is then written and synced
+ * on its own.  A crash can leave a superblock that is older than the blocks
+ * it describes, but never one that is newer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <sys/uio.h>
+
+#include "diskwb.h"
+#include "diskimg.h"
+#include "disksim.h"
+#include "assign1/unixfilesystem.h"
+
+#define DISKWB_MAX_RUN 64   // Sectors written by one pwritev()
+
+struct wbsector {
+  int sectorNum;
+  char buf[DISKIMG_SECTOR_SIZE];
+};
+
+static struct wbsector *wbsectors;   // Buffered sectors, in arrival order
+static int *wbhash;                  // Open addressing index into wbsectors, -1 if empty
+static int wbhashmask;
+static int wbmax = 0;                // 0 if write-back isn't enabled
+static int wbcount = 0;
+static int wbflags = 0;
+
+static uint64_t numabsorbed = 0;     // Writes taken into the buffer
+static uint64_t numoverwrites = 0;   // Writes that replaced a buffered sector
+static uint64_t numflushes = 0;
+static uint64_t numruns = 0;         // pwritev() calls
+static uint64_t numsectorsflushed = 0;
+
+int diskwb_init(int maxSectors, int flags) {
+  if (maxSectors <= 0 || wbmax > 0) return -1;
+  int hashsize = 1;
+  while (hashsize < 2 * maxSectors) hashsize *= 2;
+
+  wbsectors = malloc((size_t) maxSectors * sizeof(struct wbsector));
+  wbhash = malloc((size_t) hashsize * sizeof(int));
+  if (wbsectors == NULL || wbhash == NULL) {
+    free(wbsectors);
+    free(wbhash);
+    wbsectors = NULL;
+    wbhash = NULL;
+    return -1;
+  }
+  memset(wbhash, -1, (size_t) hashsize * sizeof(int));
+  wbhashmask = hashsize - 1;
+  wbmax = maxSectors;
+  wbcount = 0;
+  wbflags = flags;
+  return 0;
+}
+
+/*
+ * Returns the hash slot holding sectorNum, or the empty slot it would go in.
+ */
+static int *lookup_slot(int sectorNum) {
+  unsigned int h = ((unsigned int) sectorNum * 2654435761u) & wbhashmask;
+  while (wbhash[h] >= 0 && wbsectors[wbhash[h]].sectorNum != sectorNum)
+    h = (h + 1) & wbhashmask;
+  return &wbhash[h];
+}
+
+int diskwb_write(int fd, int sectorNum, const void *buf) {
+  if (wbmax == 0) return 0;
+
+  int *slot = lookup_slot(sectorNum);
+  if (*slot < 0 && wbcount == wbmax) {
+    if (diskwb_flush(fd) < 0) return -1;
+    slot = lookup_slot(sectorNum);
+  }
+  if (*slot >= 0) {
+    numoverwrites++;
+  } else {
+    *slot = wbcount++;
+    wbsectors[*slot].sectorNum = sectorNum;
+  }
+  memcpy(wbsectors[*slot].buf, buf, DISKIMG_SECTOR_SIZE);
+  numabsorbed++;
+  return DISKIMG_SECTOR_SIZE;
+}
+
+int diskwb_read(int sectorNum, void *buf) {
+  if (wbcount == 0) return 0;
+  int *slot = lookup_slot(sectorNum);
+  if (*slot < 0) return 0;
+  memcpy(buf, wbsectors[*slot].buf, DISKIMG_SECTOR_SIZE);
+  return 1;
+}
+
+static int cmp_sectors(const void *a, const void *b) {
+  const struct wbsector *x = *(const struct wbsector * const *) a;
+  const struct wbsector *y = *(const struct wbsector * const *) b;
+  return (x->sectorNum > y->sectorNum) - (x->sectorNum < y->sectorNum);
+}
+
+/*
+ * Writes count sorted sectors, one pwritev() per run of adjacent sectors.
+ */
+static int write_runs(int fd, struct wbsector **sorted, int count) {
+  int i = 0;
+  while (i < count) {
+    struct iovec iov[DISKWB_MAX_RUN];
+    int run = 0;
+    do {
+      iov[run].iov_base = sorted[i + run]->buf;
+      iov[run].iov_len = DISKIMG_SECTOR_SIZE;
+      run++;
+    } while (run < DISKWB_MAX_RUN && i + run < count &&
+             sorted[i + run]->sectorNum == sorted[i]->sectorNum + run);
+
+    if (disksim_writesectors(fd, sorted[i]->sectorNum, run, iov) != run * DISKIMG_SECTOR_SIZE)
+      return -1;
+    numruns++;
+    numsectorsflushed += run;
+    i += run;
+  }
+  return 0;
+}
+
+int diskwb_flush(int fd) {
+  if (wbcount == 0) return 0;
+
+  struct wbsector **sorted = malloc((size_t) wbcount * sizeof(struct wbsector *));
+  if (sorted == NULL) return -1;
+  for (int i = 0; i < wbcount; i++) sorted[i] = &wbsectors[i];
+  qsort(sorted, wbcount, sizeof(struct wbsector *), cmp_sectors);
+
+  // The superblock sorts first but goes out last when writes are ordered.
+  int count = wbcount;
+  struct wbsector *superblock = NULL;
+  if (wbflags & DISKIMG_WRITEBACK_ORDERED) {
+    for (int i = 0; i < count && sorted[i]->sectorNum <= SUPERBLOCK_SECTOR; i++) {
+      if (sorted[i]->sectorNum != SUPERBLOCK_SECTOR) continue;
+      superblock = sorted[i];
+      memmove(&sorted[i], &sorted[i + 1], (size_t) (count - i - 1) * sizeof(struct wbsector *));
+      count--;
+      break;
+    }
+  }
+
+  int err = write_runs(fd, sorted, count);
+  if (err == 0 && superblock) {
+    err = disksim_sync(fd);
+    if (err == 0) err = write_runs(fd, &superblock, 1);
+    if (err == 0) err = disksim_sync(fd);
+  }
+  free(sorted);
+  if (err < 0) return -1;   // Everything stays buffered for the next try
+
+  numflushes++;
+  wbcount = 0;
+  memset(wbhash, -1, (size_t) (wbhashmask + 1) * sizeof(int));
+  return 0;
+}
+
+void diskwb_dumpstats(FILE *file) {
+  if (wbmax == 0) return;
+  fprintf(file, "Diskwb: %"PRIu64" writes absorbed (%"PRIu64" overwrites), %"PRIu64" flushes, "
+          "%"PRIu64" runs (%"PRIu64" sectors)\n",
+          numabsorbed, numoverwrites, numflushes, numruns, numsectorsflushed);
+}
@@ -0,0 +1,35 @@
+#ifndef _DISKWB_H_
+#define _DISKWB_H_
+
+#include <stdio.h>
+
+/**
+ * Starts buffering up to maxSectors written sectors in memory.  flags is a
+ * combination of the DISKIMG_WRITEBACK_* flags.  Returns 0 on success, -1
+ * on error.
+ */
+int diskwb_init(int maxSectors, int flags);
+
+/**
+ * Absorbs a sector write, flushing the buffer first if it is full.  Returns
+ * the number of bytes buffered, 0 if write-back isn't enabled (the caller
+ * writes through), or -1 on error.
+ */
+int diskwb_write(int fd, int sectorNum, const void *buf);
+
+/**
+ * Copies the buffered contents of a sector that hasn't reached the disk yet
+ * into buf.  Returns 1 if the sector is buffered, 0 otherwise.
+ */
+int diskwb_read(int sectorNum, void *buf);
+
+/**
+ * Writes every buffered sector to the disk in sector order, merging runs of
+ * adjacent sectors into one request each.  Returns 0 on success, -1 on
+ * error.
+ */
+int diskwb_flush(int fd);
+
+void diskwb_dumpstats(FILE *file);
+
+#endif // _DISKWB_H_
@@ -0,0 +1,286 @@
+/**
+ * diskwbtest.c  -  Tests the write-behind buffer of the diskimg layer.
+ *
+ * Writes sectors of a scratch image out of order, over each other and in
+ * runs written backwards, through diskimg_writesector() with write-behind
+ * on, and checks that diskimg_readsector() returns the last contents
+ * written before anything is synced.  Then closes the image and compares
+ * the file with what was written, byte for byte.
+ *
+ * It is linked with the disksim writes and syncs wrapped (see the
+ * Makefile), so it can also check that in ordered mode the superblock
+ * goes out on its own, between two syncs, and make them fail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/uio.h>
+
+#include "diskimg.h"
+#include "cachemem.h"
+#include "diskwb.h"
+#include "disksim.h"
+#include "assign1/unixfilesystem.h"
+
+#define NUM_SECTORS 1024
+#define NUM_WRITES  20000
+
+int diskLatency = 0;
+int diskSeekModel = 0;
+int diskBusyWaitEnable = 0;
+int diskReadaheadEnable = 0;
+
+static unsigned char image[NUM_SECTORS][DISKIMG_SECTOR_SIZE];   // What the disk should hold
+static unsigned seed = 1;
+
+static unsigned Random(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void Fill(unsigned char *buf, int sectorNum, int version) {
+  for (int i = 0; i < DISKIMG_SECTOR_SIZE; i++) {
+    buf[i] = (unsigned char) (sectorNum * 7 + version * 13 + i);
+  }
+}
+
+static int failures = 0;
+static int ordered = 0;
+
+/*
+ * The disk calls the write-behind buffer makes, as seen through the
+ * wrappers: whether the last one was a sync, and whether a superblock
+ * write still waits for the sync that has to follow it.
+ */
+static int lastWasSync = 1;
+static int superblockUnsynced = 0;
+static int numOrderingErrors = 0;
+static int failWrites = 0;      // Makes the disk writes fail
+
+int __real_disksim_writesectors(int fd, int firstSector, int count, const struct iovec *iov);
+int __real_disksim_sync(int fd);
+
+int __wrap_disksim_writesectors(int fd, int firstSector, int count, const struct iovec *iov) {
+  if (failWrites) return -1;
+  if (ordered) {
+    int hasSuperblock = firstSector <= SUPERBLOCK_SECTOR &&
+                        SUPERBLOCK_SECTOR < firstSector + count;
+    if (superblockUnsynced ||
+        (hasSuperblock && (count != 1 || !lastWasSync)))
+      numOrderingErrors++;
+    superblockUnsynced = hasSuperblock;
+  }
+  lastWasSync = 0;
+  return __real_disksim_writesectors(fd, firstSector, count, iov);
+}
+
+int __wrap_disksim_sync(int fd) {
+  lastWasSync = 1;
+  superblockUnsynced = 0;
+  return __real_disksim_sync(fd);
+}
+
+static void Fail(const char *what, int sectorNum) {
+  if (failures++ < 10)
+    fprintf(stderr, "Diskwbtest: %s of sector %d is wrong\n", what, sectorNum);
+}
+
+/*
+ * Writes a new version of a sector.  Returns -1 if the write fails, which
+ * must leave the sector as it was.
+ */
+static int Write(int fd, int sectorNum, int version) {
+  unsigned char buf[DISKIMG_SECTOR_SIZE];
+  Fill(buf, sectorNum, version);
+  if (diskimg_writesector(fd, sectorNum, buf) != DISKIMG_SECTOR_SIZE) {
+    if (!failWrites) Fail("write", sectorNum);
+    return -1;
+  }
+  memcpy(image[sectorNum], buf, DISKIMG_SECTOR_SIZE);
+  return 0;
+}
+
+static void Check(int fd, int sectorNum) {
+  unsigned char buf[DISKIMG_SECTOR_SIZE];
+  if (diskimg_readsector(fd, sectorNum, buf) != DISKIMG_SECTOR_SIZE ||
+      memcmp(buf, image[sectorNum], DISKIMG_SECTOR_SIZE) != 0)
+    Fail("readback", sectorNum);
+}
+
+static void Sync(int fd) {
+  if (diskimg_sync(fd) < 0) {
+    fprintf(stderr, "Diskwbtest: sync failed\n");
+    failures++;
+  }
+}
+
+/*
+ * Makes the disk fail under a flush, first a sync's and then that of a
+ * write the full buffer has no room for.  The buffered sectors have to
+ * stay buffered, and the sector whose write failed has to read back as it
+ * was, though it is cached.
+ */
+static void CheckFailedWrites(int fd, int maxSectors, int version) {
+  Sync(fd);
+  failWrites = 1;
+  Write(fd, 5, version++);
+  if (diskimg_sync(fd) == 0)
+    Fail("failed sync", 5);
+  Check(fd, 5);
+  failWrites = 0;
+  Sync(fd);
+
+  int target = NUM_SECTORS - 1;
+  if (2 + maxSectors > target)
+    return;                     // The buffer never fills up
+  Check(fd, target);
+  failWrites = 1;
+  for (int s = 2; s < 2 + maxSectors; s++) {
+    Write(fd, s, version++);
+  }
+  if (Write(fd, target, version++) == 0)
+    Fail("write past a full buffer", target);
+  Check(fd, target);
+  for (int s = 2; s < 2 + maxSectors; s++) {
+    Check(fd, s);
+  }
+  failWrites = 0;
+}
+
+/*
+ * Makes the scratch image, with every sector at version 0.  Returns its
+ * path, which the caller unlinks.
+ */
+static char *MakeImage(void) {
+  const char *tmpdir = getenv("TMPDIR");
+  static char path[1024];
+  snprintf(path, sizeof(path), "%s/diskwbtest.XXXXXX", tmpdir ? tmpdir : "/tmp");
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  for (int s = 0; s < NUM_SECTORS; s++) {
+    Fill(image[s], s, 0);
+  }
+  ssize_t n = write(fd, image, sizeof(image));
+  close(fd);
+  if (n != (ssize_t) sizeof(image)) {
+    fprintf(stderr, "Can't write %s\n", path);
+    unlink(path);
+    return NULL;
+  }
+  return path;
+}
+
+static void CompareImage(const char *path) {
+  FILE *file = fopen(path, "rb");
+  unsigned char buf[DISKIMG_SECTOR_SIZE];
+  for (int s = 0; s < NUM_SECTORS; s++) {
+    if (file == NULL || fread(buf, 1, sizeof(buf), file) != sizeof(buf) ||
+        memcmp(buf, image[s], sizeof(buf)) != 0)
+      Fail("disk copy", s);
+  }
+  if (file) fclose(file);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options>\n", progname);
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-o     use DISKIMG_WRITEBACK_ORDERED\n");
+  fprintf(stderr, "-b N   buffer up to N sectors (default 32)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int flags = 0;
+  int maxSectors = 32;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ob:")) != -1) {
+    switch (opt) {
+      case 'o':
+        flags |= DISKIMG_WRITEBACK_ORDERED;
+        ordered = 1;
+        break;
+      case 'b':
+        maxSectors = atoi(optarg);
+        if (maxSectors < 1) PrintUsageAndExit(argv[0]);
+        break;
+      default:
+        PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  char *path = MakeImage();
+  if (path == NULL) exit(EXIT_FAILURE);
+  int fd = diskimg_open(path, 0);
+  // A cache smaller than the image, so reads also find sectors evicted
+  // from it while they are still buffered.
+  if (fd < 0 || CacheMem_Init(64) < 0 || diskimg_writeback_init(maxSectors, flags) < 0) {
+    fprintf(stderr, "Can't set up %s\n", path);
+    unlink(path);
+    exit(EXIT_FAILURE);
+  }
+
+  int version = 1;
+  for (int i = 0; i < NUM_WRITES; ) {
+    unsigned r = Random();
+    switch (r % 4) {
+      case 0:
+        // Anywhere on the disk.
+        Write(fd, Random() % NUM_SECTORS, version++);
+        i++;
+        break;
+      case 1:
+        // A few hot sectors, the superblock among them, written over and
+        // over while they are buffered.
+        Write(fd, (Random() % 2) ? SUPERBLOCK_SECTOR : 2 + Random() % 8, version++);
+        i++;
+        break;
+      default: {
+        // A run written backwards, which the flush puts back in order, that
+        // may overlap sectors already buffered.
+        int len = 1 + Random() % 24;
+        int start = Random() % (NUM_SECTORS - len);
+        for (int s = start + len - 1; s >= start; s--) {
+          Write(fd, s, version++);
+        }
+        i += len;
+        break;
+      }
+    }
+    Check(fd, Random() % NUM_SECTORS);
+  }
+  CheckFailedWrites(fd, maxSectors, version);
+
+  for (int s = 0; s < NUM_SECTORS; s++) {
+    Check(fd, s);
+  }
+  if (diskimg_close(fd) < 0) {
+    fprintf(stderr, "Diskwbtest: can't close %s\n", path);
+    failures++;
+  }
+  CompareImage(path);
+  unlink(path);
+  if (superblockUnsynced) numOrderingErrors++;
+  if (numOrderingErrors > 0) {
+    fprintf(stderr, "Diskwbtest: %d superblock writes not on their own between syncs\n",
+            numOrderingErrors);
+    failures++;
+  }
+
+  diskwb_dumpstats(stdout);
+  printf("Diskwbtest: %s mode, %d sector buffer: %s\n",
+         (flags & DISKIMG_WRITEBACK_ORDERED) ? "ordered" : "unordered", maxSectors,
+         failures ? "FAILED" : "OK");
+  exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+  return 0;
+}
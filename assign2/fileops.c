@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "fileops.h"
 #include "assign1/pathname.h"
@@ -18,26 +19,17 @@
 #include "assign1/file.h"
 #include "assign1/chksumfile.h"
 #include "cachemem.h"
+#include "assign1/snapshot.h"
 
 #define MAX_FILES 64
-#define PREFETCHED_FILE_CONTENTS 1
+#define PREFETCHED_FILE_CONTENTS 16
 
 static uint64_t numopens = 0;
 static uint64_t numreads = 0;
 static uint64_t numgetchars = 0;
+static uint64_t numspans = 0;
 static uint64_t numisfiles = 0;
 
-/*
- * Structure of prefetched file content
- */
-typedef struct file_disk_content {
-    /* Used for storing the return value when prefetch happens */
-    int read_bytes;
-    /* Disk block content of file */
-    char buf[512];
-} file_content;
-
-
 /**
  * Table of open files.
  */
@@ -49,18 +41,41 @@ static struct {
    */
   int inumber;
   struct inode in;
-  void *inp;
   int inode_iget_ret;
+  /*
+   * Block map of the open file, resolved once at open time so that
+   * reads don't walk the indirect blocks again for every block
+   */
+  struct inode_blockmap map;
+  int map_is_valid;
   /*
    * Max blockum that has been currently prefetched
    */
   int max_blocknum_in_store;
   /*
-   * Upto 10 prefetched file content blocks
+   * Upto PREFETCHED_FILE_CONTENTS prefetched file content blocks. They are
+   * kept contiguous so that a prefetch is one vectored read per disk run.
+   */
+  char content[PREFETCHED_FILE_CONTENTS][DISKIMG_SECTOR_SIZE];
+  /*
+   * Valid bytes in content as returned by the prefetch, -1 if it failed
    */
-  file_content content[PREFETCHED_FILE_CONTENTS];
+  int content_bytes;
+  /*
+   * Reads and getchars on this fd, added to the totals when it is closed so
+   * that threads reading different files don't share a counter
+   */
+  uint64_t numreads;
+  uint64_t numgetchars;
+  uint64_t numspans;
 } openFileTable[MAX_FILES];
 
+/*
+ * Guards the allocation of open file slots and the totals.  An open fd is
+ * only used by the thread that opened it.
+ */
+static pthread_mutex_t fileTableLock = PTHREAD_MUTEX_INITIALIZER;
+
 static struct unixfilesystem *unixfs;
 
 /**
@@ -82,11 +97,49 @@ void *Fileops_init(char *diskpath) {
   return unixfs;
 }
 
+/*
+ * Claims a free open file slot for pathname.  Returns the fd, -1 if there
+ * is none.
+ */
+static int alloc_fd(char *pathname) {
+  char *copy = strdup(pathname); // Save our own copy
+  if (copy == NULL) return -1;
+
+  pthread_mutex_lock(&fileTableLock);
+  int fd;
+  for (fd = 0; fd < MAX_FILES; fd++) {
+    if (openFileTable[fd].pathname == NULL) break;
+  }
+  if (fd < MAX_FILES) {
+    openFileTable[fd].pathname = copy;
+    openFileTable[fd].numreads = 0;
+    openFileTable[fd].numgetchars = 0;
+    openFileTable[fd].numspans = 0;
+  }
+  pthread_mutex_unlock(&fileTableLock);
+
+  if (fd >= MAX_FILES) {
+    free(copy);
+    return -1;  // No open file slots
+  }
+  return fd;
+}
+
+/*
+ * Resolves the block map of a freshly opened fd, from the metadata snapshot
+ * when one is loaded. On failure reads fall back to per-block index lookups.
+ */
+static void setup_blockmap(int fd) {
+  int err = unixfs->snap ? snapshot_blockmap(unixfs->snap, openFileTable[fd].inumber, &openFileTable[fd].map)
+                         : inode_blockmap(unixfs, &openFileTable[fd].in, &openFileTable[fd].map);
+  openFileTable[fd].map_is_valid = (err == 0);
+}
+
 /**
  * Open the specified absolute pathname for reading. Returns -1 on error;
  */
 int Fileops_open(char *pathname) {
-  numopens++;
+  __atomic_fetch_add(&numopens, 1, __ATOMIC_RELAXED);
   struct inode in;
   int inumber = pathname_lookup(unixfs,pathname);
   if (inumber < 0) {
@@ -97,30 +150,26 @@ int Fileops_open(char *pathname) {
       return -1; // Inode node found
   }
 
-  int fd;
-  for (fd = 0; fd < MAX_FILES; fd++) {
-    if (openFileTable[fd].pathname == NULL) break;
-  }
-  if (fd >= MAX_FILES) {
+  int fd = alloc_fd(pathname);
+  if (fd < 0) {
     return -1;  // No open file slots
   }
-  openFileTable[fd].pathname = strdup(pathname); // Save our own copy
   openFileTable[fd].cursor = 0;
   openFileTable[fd].inumber = inumber;
   openFileTable[fd].in = in;
-  openFileTable[fd].inp = &in;
   openFileTable[fd].inode_iget_ret = 0;
   /*
    * max_blocknum_in_store is initialized to -1 so that
    * it induces prefetch
    */
   openFileTable[fd].max_blocknum_in_store = -1;
+  setup_blockmap(fd);
   return fd;
 }
 
 /*
  * Preficate function that tells if the next set of
- * upto 10 file blocks needs to be prefetched.
+ * upto PREFETCHED_FILE_CONTENTS file blocks needs to be prefetched.
  */
 static int prefetch_needed(int fd, int blockNo) {
     if (openFileTable[fd].max_blocknum_in_store < blockNo)
@@ -129,15 +178,15 @@ static int prefetch_needed(int fd, int blockNo) {
 }
 
 /*
- * Prefetches content of upto 10 disk blocks.
- * ---------------------------------------------
+ * Prefetches content of upto PREFETCHED_FILE_CONTENTS disk blocks.
+ * -----------------------------------------------------------------
  * As scan tree and index will read every file and directory present in the
  * disk image, it makes perfect sense to prefetch. There wont be any
  * unnecessary prefectch in this model, all prefetched content will be utilized.
  *
  * The modest 1MB direct mapped cache could get overwrriten by chksum
  * by inumber (pathstore, scan file) for large files, therefore save upto
- * 10 blocks of file content that would be inevitably utilized by
+ * PREFETCHED_FILE_CONTENTS blocks of file content that would be inevitably utilized by
  * scantree and index recursive function, so that we won't have to
  * redo I/O or scramble for disk sector blocks in cache when control 
  * reaches back to upper levels (directories)
@@ -155,12 +204,21 @@ static void prefetch_file_contents(int fd) {
     } else {
         openFileTable[fd].max_blocknum_in_store = next_prefetch_block + PREFETCHED_FILE_CONTENTS - 1;
     }
-    int index = 0;
-    for (; next_prefetch_block <= openFileTable[fd].max_blocknum_in_store; next_prefetch_block++, index++) {
-        int read_bytes = file_getblock_optimized(unixfs, next_prefetch_block, &openFileTable[fd].content[index].buf, &openFileTable[fd].in, openFileTable[fd].inode_iget_ret);
-        /* Storing the return value of file_getblock */
-        openFileTable[fd].content[index].read_bytes = read_bytes;
+    int nBlocks = openFileTable[fd].max_blocknum_in_store - next_prefetch_block + 1;
+    if (openFileTable[fd].map_is_valid) {
+        openFileTable[fd].content_bytes = file_getblocks_bymap(unixfs, &openFileTable[fd].map, next_prefetch_block, nBlocks, openFileTable[fd].content);
+        return;
     }
+    int content_bytes = 0;
+    for (int index = 0; index < nBlocks; index++, next_prefetch_block++) {
+        int read_bytes = file_getblock_optimized(unixfs, next_prefetch_block, &openFileTable[fd].content[index], openFileTable[fd].inumber, &openFileTable[fd].in, openFileTable[fd].inode_iget_ret);
+        if (read_bytes < 0) {
+            content_bytes = -1;
+            break;
+        }
+        content_bytes += read_bytes;
+    }
+    openFileTable[fd].content_bytes = content_bytes;
 }
 
 /*
@@ -171,8 +229,15 @@ static void prefetch_file_contents(int fd) {
 static int prefetched_file_content(int fd, int blockNo, unsigned char* buf) {
     /* Very simple lookup */
     int index = blockNo % PREFETCHED_FILE_CONTENTS;
-    memcpy(buf, &openFileTable[fd].content[index].buf, DISKIMG_SECTOR_SIZE);
-    return openFileTable[fd].content[index].read_bytes;
+    if (openFileTable[fd].content_bytes < 0)
+        return -1;
+    int read_bytes = openFileTable[fd].content_bytes - (index * DISKIMG_SECTOR_SIZE);
+    if (read_bytes <= 0)
+        return 0;   // Past the end of the file, as a read there
+    if (read_bytes > DISKIMG_SECTOR_SIZE)
+        read_bytes = DISKIMG_SECTOR_SIZE;
+    memcpy(buf, &openFileTable[fd].content[index], DISKIMG_SECTOR_SIZE);
+    return read_bytes;
 }
 
 /**
@@ -184,10 +249,11 @@ int Fileops_getchar(int fd) {
   int err, size;
   int blockNo, blockOffset;
 
-  numgetchars++;
-
-  if (openFileTable[fd].pathname == NULL)
+  if (openFileTable[fd].pathname == NULL) {
+    __atomic_fetch_add(&numgetchars, 1, __ATOMIC_RELAXED);
     return -1;  // fd not opened.
+  }
+  openFileTable[fd].numgetchars++;
 
   if (openFileTable[fd].inumber < 0)
       return -1;
@@ -217,12 +283,54 @@ int Fileops_getchar(int fd) {
   return (int)(buf[blockOffset]);
 }
 
+/**
+ * Returns in *ptr and *len the bytes from the current position to the end
+ * of the blocks prefetched with it, and moves past them.  The bytes stay
+ * valid until the next call on fd.  Returns 1 if there were any, 0 at the
+ * end of the file and -1 on error.
+ */
+int Fileops_readspan(int fd, const char **ptr, int *len) {
+  *len = 0;
+  if (openFileTable[fd].pathname == NULL)
+    return -1;  // fd not opened.
+  openFileTable[fd].numspans++;
+
+  if (openFileTable[fd].inumber < 0 || !(openFileTable[fd].in.i_mode & IALLOC))
+    return -1;
+
+  int size = inode_getsize(&openFileTable[fd].in);
+  int cursor = openFileTable[fd].cursor;
+  if (cursor >= size) return 0; // Finished with file
+
+  int blockNo = cursor / DISKIMG_SECTOR_SIZE;
+  if (prefetch_needed(fd, blockNo) == 1)
+    prefetch_file_contents(fd);
+  if (openFileTable[fd].content_bytes < 0)
+    return -1;
+
+  // The prefetched blocks start at a multiple of PREFETCHED_FILE_CONTENTS.
+  int start = (blockNo - blockNo % PREFETCHED_FILE_CONTENTS) * DISKIMG_SECTOR_SIZE;
+  int end = start + openFileTable[fd].content_bytes;
+  if (end > size)
+    end = size;
+  if (end <= cursor)
+    return -1;  // Short read
+
+  *ptr = &openFileTable[fd].content[0][cursor - start];
+  *len = end - cursor;
+  openFileTable[fd].cursor = end;
+  return 1;
+}
+
 /**
  * Implement the Unix read system call. Number of bytes returned.  Return -1 on
  * err.
  */
 int Fileops_read(int fd, char *buffer, int length) {
-  numreads++;
+  if (openFileTable[fd].pathname == NULL)
+    __atomic_fetch_add(&numreads, 1, __ATOMIC_RELAXED);
+  else
+    openFileTable[fd].numreads++;
   int i;
   for (i = 0; i < length; i++) {
     int ch = Fileops_getchar(fd);
@@ -248,14 +356,26 @@ int Fileops_tell(int fd) {
 int Fileops_close(int fd) {
   if (openFileTable[fd].pathname == NULL)
     return -1;  // fd not opened.
+  if (openFileTable[fd].map_is_valid) {
+    inode_blockmap_free(&openFileTable[fd].map);
+    openFileTable[fd].map_is_valid = 0;
+  }
+  int inumber = openFileTable[fd].inumber;
+
+  pthread_mutex_lock(&fileTableLock);
+  numreads += openFileTable[fd].numreads;
+  numgetchars += openFileTable[fd].numgetchars;
+  numspans += openFileTable[fd].numspans;
   free(openFileTable[fd].pathname);
   openFileTable[fd].pathname = NULL;
+  pthread_mutex_unlock(&fileTableLock);
+
   /*
    *
-   * Erases the inode cache contents pertaining to this open fd / inp
+   * Erases the inode cache contents pertaining to this open fd / inumber
    *
    */
-  erase_sector_in_inode_cache(openFileTable[fd].inp);
+  erase_sector_in_inode_cache(inumber);
   return 0;
 }
 
@@ -263,7 +383,7 @@ int Fileops_close(int fd) {
  * Return true if specified pathname is a regular file.
  */
 int Fileops_isfile(char *pathname) {
-  numisfiles++;
+  __atomic_fetch_add(&numisfiles, 1, __ATOMIC_RELAXED);
   int inumber = pathname_lookup(unixfs, pathname);
   if (inumber < 0) {
     return 0;
@@ -301,7 +421,7 @@ int Fileops_isfile(char *pathname) {
  *
  */
 int optimized_Fileops_isfile(int inumber, struct inode *inp, int *inode_iget_ret) {
-  numisfiles++;
+  __atomic_fetch_add(&numisfiles, 1, __ATOMIC_RELAXED);
   (*inode_iget_ret) = inode_iget(unixfs, inumber, inp);
   if ((*inode_iget_ret) < 0) return 0;
 
@@ -321,7 +441,7 @@ int optimized_Fileops_isfile(int inumber, struct inode *inp, int *inode_iget_ret
  */
 int optimized_Fileops_open(char *pathname, int inumber, struct inode *inp, int inode_iget_ret) {
   assert(inp != NULL);
-  numopens++;
+  __atomic_fetch_add(&numopens, 1, __ATOMIC_RELAXED);
   if (inumber < 0) {
     return -1; // File not found
   }
@@ -329,20 +449,14 @@ int optimized_Fileops_open(char *pathname, int inumber, struct inode *inp, int i
   if (inode_iget_ret < 0) 
     return -1;
 
-  int fd;
-  for (fd = 0; fd < MAX_FILES; fd++) {
-    if (openFileTable[fd].pathname == NULL) break;
-  }
-
-  if (fd >= MAX_FILES) {
+  int fd = alloc_fd(pathname);
+  if (fd < 0) {
     return -1; // No open file slots
   }
 
-  openFileTable[fd].pathname = strdup(pathname); // Save our own copy
   openFileTable[fd].cursor = 0;
   openFileTable[fd].inumber = inumber;
   openFileTable[fd].in = *inp;
-  openFileTable[fd].inp = (void *)inp;
   openFileTable[fd].inode_iget_ret = 0;
 
   /*
@@ -350,13 +464,14 @@ int optimized_Fileops_open(char *pathname, int inumber, struct inode *inp, int i
    * it induces prefetch
    */
   openFileTable[fd].max_blocknum_in_store = -1;
+  setup_blockmap(fd);
   return fd;
 }
 
 void Fileops_Dumpstats(FILE *file) {
   fprintf(file,
           "Fileops: %"PRIu64" opens, %"PRIu64" reads, "
-          "%"PRIu64" getchars, %"PRIu64 " isfiles\n",
-          numopens, numreads, numgetchars, numisfiles);
+          "%"PRIu64" getchars, %"PRIu64" spans, %"PRIu64 " isfiles\n",
+          numopens, numreads, numgetchars, numspans, numisfiles);
 }
 
@@ -9,6 +9,7 @@ void *Fileops_init(char *diskpath);
 int Fileops_open(char *pathname);
 int Fileops_read(int fd, char *buffer, int length);
 int Fileops_getchar(int fd);
+int Fileops_readspan(int fd, const char **ptr, int *len);
 int Fileops_tell(int fd);
 int Fileops_close(int fd);
 int Fileops_isfile(char *pathname);
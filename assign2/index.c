@@ -1,5 +1,18 @@
 /**
  * index.c  -  This module maintains the in memory word index for the file search
+ *
+ * Words are kept in an open addressing hash table with linear probing.  A
+ * word's entry and its text are carved out of an arena, so a new word costs
+ * no allocation of its own and a word already in the index costs none at
+ * all.  The postings of a word, (pathID, offset, position) triples, are
+ * appended to an array that doubles as it fills, in the order they were
+ * stored.  Pathnames are numbered as they are first seen; the scan stores
+ * the words of a file one after the other, so the last pathname is checked
+ * before the table, and the postings of every word come out sorted by
+ * pathID and then by position.
+ *
+ * An index can be written to a file laid out the same way, tied to the
+ * disk image it was built from, and later mapped back in place of a build.
  */
 
 #include <stdio.h>
@@ -8,30 +21,343 @@
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
-#include <openssl/lhash.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "index.h"
+#include "pathstore.h"
 #include "debug.h"
+#include "assign1/chksumfile.h"
+
+#define INDEX_ARENA_CHUNK   (64*1024)   // Bytes the arena grows by
+#define INDEX_MIN_SLOTS     1024        // Word slots in a new table
+#define INDEX_MIN_PATHSLOTS 256         // Pathname slots in a new table
+#define INDEX_MIN_POSTINGS  4           // Postings in a word's first array
+
+#define INDEXFILE_MAGIC     0x36584449  // "IDX6"
+#define INDEXFILE_VERSION   2
+#define INDEXFILE_ALIGN     8
 
 static uint64_t numstores = 0;
 static uint64_t numlookups = 0;
 static uint64_t numentriesalloc = 0;
 
-static _LHASH *hashTable = NULL;  // For stats print only
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t used;
+  size_t size;
+  char data[];
+} ArenaChunk;
+
+typedef struct IndexWord {
+  uint32_t hash;
+  uint32_t numPostings;
+  uint32_t maxPostings;
+  bool merged;                 // Shards: the postings went to the index
+  IndexPosting *postings;      // In the order they were stored
+  char keyword[];
+} IndexWord;
+
+/*
+ * Layout of an index file: this header followed by the sections it points
+ * at, each starting on an 8 byte boundary.
+ *
+ *   slots     uint32_t[numSlots], word number + 1 by hash, 0 if free
+ *   words     IndexFileWord[numWords]
+ *   keywords  the keywords, each terminated by a null byte
+ *   postings  IndexPosting[numPostings], those of each word oldest first
+ *   paths     IndexFilePath[numPaths], pathIDs in the order the pathstore
+ *             stored them
+ *   pathtext  the pathnames, each terminated by a null byte
+ *
+ * Opening the file only checks the header, so it takes the same time for
+ * any size of index; lookups check what they read against the sections.
+ * The file is only meaningful on the machine that wrote it.
+ */
+typedef struct IndexFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  IndexFingerprint fingerprint;
+  uint32_t numSlots;           // A power of two
+  uint32_t numWords;
+  uint32_t numPaths;
+  uint32_t reserved;
+  uint64_t numPostings;
+  uint64_t slotsoff;
+  uint64_t wordsoff;
+  uint64_t keywordsoff;
+  uint64_t keywordsize;
+  uint64_t postingsoff;
+  uint64_t pathsoff;
+  uint64_t pathtextoff;
+  uint64_t pathtextsize;
+  uint64_t size;               // Length of the whole file
+} IndexFileHeader;
+
+typedef struct IndexFileWord {
+  uint32_t hash;
+  uint32_t keyword;            // Offset into keywords
+  uint64_t firstPosting;
+  uint32_t numPostings;
+  uint32_t reserved;
+} IndexFileWord;
+
+typedef struct IndexFilePath {
+  uint32_t pathname;           // Offset into pathtext
+  char chksum[CHKSUMFILE_SIZE];
+} IndexFilePath;
+
+typedef struct IndexTable {
+  IndexWord **slots;
+  uint32_t numSlots;           // A power of two, at most half full
+  uint32_t numWords;
+  char **pathnames;            // By pathID
+  uint32_t numPaths;
+  uint32_t maxPaths;
+  uint32_t *pathSlots;         // pathID + 1 by pathname pointer, 0 if free
+  uint32_t numPathSlots;       // A power of two, at most half full
+  char *lastPath;
+  uint32_t lastPathID;
+  ArenaChunk *arena;
+  size_t arenaBytes;           // Allocated for the arena
+  size_t arenaUsed;            // Of which handed out
+  size_t postingBytes;         // Allocated for posting arrays
+  size_t postingsUsed;         // Of which holding postings
+
+  // An index mapped from a file has only these.
+  const IndexFileHeader *header;
+  size_t mapSize;
+  const uint32_t *fileSlots;
+  const IndexFileWord *fileWords;
+  const char *keywords;
+  const IndexPosting *filePostings;
+  const IndexFilePath *filePaths;
+  const char *pathtext;
+} IndexTable;
+
+static IndexTable *mainTable = NULL;  // For stats print only
+
+static void *ArenaAlloc(IndexTable *t, size_t size) {
+  size = (size + 7) & ~(size_t) 7;
+  ArenaChunk *chunk = t->arena;
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    size_t chunksize = (size > INDEX_ARENA_CHUNK) ? size : INDEX_ARENA_CHUNK;
+    chunk = malloc(sizeof(ArenaChunk) + chunksize);
+    if (chunk == NULL)
+      return NULL;
+    chunk->next = t->arena;
+    chunk->used = 0;
+    chunk->size = chunksize;
+    t->arena = chunk;
+    t->arenaBytes += sizeof(ArenaChunk) + chunksize;
+  }
+  void *p = chunk->data + chunk->used;
+  chunk->used += size;
+  t->arenaUsed += size;
+  return p;
+}
+
+/*
+ * FNV-1a
+ */
+static uint32_t HashWord(const char *keyword) {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *c = (const unsigned char *) keyword; *c; c++) {
+    h ^= *c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint32_t HashPointer(const void *p) {
+  uint64_t x = (uintptr_t) p;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (uint32_t) x;
+}
+
+/*
+ * Returns the slot holding keyword, or the free slot where it would go.
+ */
+static uint32_t FindSlot(IndexTable *t, const char *keyword, uint32_t hash) {
+  uint32_t mask = t->numSlots - 1;
+  uint32_t i = hash & mask;
+  while (t->slots[i] != NULL) {
+    if (t->slots[i]->hash == hash && strcmp(t->slots[i]->keyword, keyword) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static IndexWord *LookupWord(IndexTable *t, const char *keyword, uint32_t hash) {
+  return t->slots[FindSlot(t, keyword, hash)];
+}
+
+static bool GrowTable(IndexTable *t) {
+  uint32_t numSlots = 2 * t->numSlots;
+  IndexWord **slots = calloc(numSlots, sizeof(IndexWord *));
+  if (slots == NULL)
+    return false;
+  for (uint32_t i = 0; i < t->numSlots; i++) {
+    IndexWord *word = t->slots[i];
+    if (word == NULL)
+      continue;
+    uint32_t j = word->hash & (numSlots - 1);
+    while (slots[j] != NULL)
+      j = (j + 1) & (numSlots - 1);
+    slots[j] = word;
+  }
+  free(t->slots);
+  t->slots = slots;
+  t->numSlots = numSlots;
+  return true;
+}
+
+static IndexWord *AddWord(IndexTable *t, const char *keyword, uint32_t hash) {
+  if (2 * (t->numWords + 1) > t->numSlots && !GrowTable(t))
+    return NULL;
+  uint32_t slot = FindSlot(t, keyword, hash);
+  size_t len = strlen(keyword);
+  IndexWord *word = ArenaAlloc(t, sizeof(IndexWord) + len + 1);
+  if (word == NULL)
+    return NULL;
+  word->hash = hash;
+  word->numPostings = 0;
+  word->maxPostings = 0;
+  word->merged = false;
+  word->postings = NULL;
+  memcpy(word->keyword, keyword, len + 1);
+  t->slots[slot] = word;
+  t->numWords++;
+  return word;
+}
+
+static bool RehashPaths(IndexTable *t, uint32_t numPathSlots) {
+  uint32_t *pathSlots = calloc(numPathSlots, sizeof(uint32_t));
+  if (pathSlots == NULL)
+    return false;
+  for (uint32_t id = 0; id < t->numPaths; id++) {
+    uint32_t j = HashPointer(t->pathnames[id]) & (numPathSlots - 1);
+    while (pathSlots[j] != 0)
+      j = (j + 1) & (numPathSlots - 1);
+    pathSlots[j] = id + 1;
+  }
+  free(t->pathSlots);
+  t->pathSlots = pathSlots;
+  t->numPathSlots = numPathSlots;
+  return true;
+}
+
+static bool GrowPathSlots(IndexTable *t) {
+  return RehashPaths(t, t->numPathSlots ? 2 * t->numPathSlots : INDEX_MIN_PATHSLOTS);
+}
+
+/*
+ * Returns the path slot holding pathname, or the free slot where it would go.
+ */
+static uint32_t FindPathSlot(IndexTable *t, const char *pathname) {
+  uint32_t mask = t->numPathSlots - 1;
+  uint32_t i = HashPointer(pathname) & mask;
+  while (t->pathSlots[i] != 0 && t->pathnames[t->pathSlots[i] - 1] != pathname)
+    i = (i + 1) & mask;
+  return i;
+}
+
+/*
+ * Returns the pathID of pathname, numbering it if it is new, or -1 on error.
+ */
+static int64_t PathID(IndexTable *t, char *pathname) {
+  if (pathname == t->lastPath && t->numPaths > 0)
+    return t->lastPathID;
 
-typedef struct IndexHashEntry {
-  char *keyword;    // The string we care about
-  IndexLocationList *locationList;   // Where it is located
-} IndexHashEntry;
+  if (2 * (t->numPaths + 1) > t->numPathSlots && !GrowPathSlots(t))
+    return -1;
+  uint32_t i = FindPathSlot(t, pathname);
+  if (t->pathSlots[i] != 0) {
+    t->lastPath = pathname;
+    t->lastPathID = t->pathSlots[i] - 1;
+    return t->lastPathID;
+  }
 
-static unsigned long HashCallback(const void *arg) {
-  IndexHashEntry *hash_entry = (IndexHashEntry *) arg;
-  return lh_strhash(hash_entry->keyword);
+  if (t->numPaths == t->maxPaths) {
+    uint32_t max = t->maxPaths ? 2 * t->maxPaths : INDEX_MIN_PATHSLOTS;
+    char **pathnames = realloc(t->pathnames, max * sizeof(char *));
+    if (pathnames == NULL)
+      return -1;
+    t->pathnames = pathnames;
+    t->maxPaths = max;
+  }
+  uint32_t id = t->numPaths++;
+  t->pathnames[id] = pathname;
+  t->pathSlots[i] = id + 1;
+  t->lastPath = pathname;
+  t->lastPathID = id;
+  return id;
 }
 
-static int CompareCallback(const void *arg1, const void *arg2) {
-  IndexHashEntry *e1 = (IndexHashEntry *) arg1;
-  IndexHashEntry *e2 = (IndexHashEntry *) arg2;
-  return strcmp(e1->keyword,e2->keyword);
+/*
+ * Makes room for n more postings of word.
+ */
+static bool ReservePostings(IndexTable *t, IndexWord *word, uint32_t n) {
+  if (word->numPostings + n <= word->maxPostings)
+    return true;
+  uint32_t max = word->maxPostings ? word->maxPostings : INDEX_MIN_POSTINGS;
+  while (max < word->numPostings + n)
+    max *= 2;
+  IndexPosting *postings = realloc(word->postings, max * sizeof(IndexPosting));
+  if (postings == NULL)
+    return false;
+  t->postingBytes += (max - word->maxPostings) * sizeof(IndexPosting);
+  word->postings = postings;
+  word->maxPostings = max;
+  return true;
+}
+
+static bool AppendPosting(IndexTable *t, IndexWord *word, uint32_t pathID, int offset, uint32_t position) {
+  if (!ReservePostings(t, word, 1))
+    return false;
+  word->postings[word->numPostings].pathID = pathID;
+  word->postings[word->numPostings].offset = offset;
+  word->postings[word->numPostings].position = position;
+  word->numPostings++;
+  t->postingsUsed += sizeof(IndexPosting);
+  return true;
+}
+
+static IndexTable *NewTable(void) {
+  IndexTable *t = calloc(1, sizeof(IndexTable));
+  if (t == NULL)
+    return NULL;
+  t->slots = calloc(INDEX_MIN_SLOTS, sizeof(IndexWord *));
+  if (t->slots == NULL) {
+    free(t);
+    return NULL;
+  }
+  t->numSlots = INDEX_MIN_SLOTS;
+  return t;
+}
+
+static void FreeTable(IndexTable *t) {
+  if (t->header) {
+    munmap((void *) t->header, t->mapSize);
+    free(t);
+    return;
+  }
+  for (uint32_t i = 0; i < t->numSlots; i++) {
+    if (t->slots[i])
+      free(t->slots[i]->postings);
+  }
+  while (t->arena) {
+    ArenaChunk *next = t->arena->next;
+    free(t->arena);
+    t->arena = next;
+  }
+  free(t->slots);
+  free(t->pathnames);
+  free(t->pathSlots);
+  free(t);
 }
 
 Index *Index_Create(void) {
@@ -39,66 +365,578 @@ Index *Index_Create(void) {
   if (!ind)
     return NULL;
 
-  ind->private = lh_new(HashCallback, CompareCallback);
-  hashTable = (_LHASH*) (ind->private);
+  ind->private = NewTable();
+  if (ind->private == NULL) {
+    free(ind);
+    return NULL;
+  }
+  ind->isShard = false;
+  mainTable = (IndexTable *) (ind->private);
+  return ind;
+}
+
+Index *Index_CreateShard(void) {
+  Index *ind = malloc(sizeof(Index));
+  if (!ind)
+    return NULL;
+
+  ind->private = NewTable();
+  if (ind->private == NULL) {
+    free(ind);
+    return NULL;
+  }
+  ind->isShard = true;
   return ind;
 }
 
-bool Index_StoreEntry(Index *ind, char *keyword, char *pathname, int offset) {
-  _LHASH *hashtable = (_LHASH*) (ind->private);
+void Index_FreeShard(Index *shard) {
+  if (shard == NULL)
+    return;
+  FreeTable((IndexTable *) (shard->private));
+  free(shard);
+}
+
+bool Index_StoreEntry(Index *ind, char *keyword, char *pathname, int offset, int position) {
+  IndexTable *t = (IndexTable *) (ind->private);
 
   DPRINTF('i', ("Index_Store(key=%s,%s:%d)\n", keyword, pathname, offset));
 
-  numstores++;
+  if (!ind->isShard)
+    numstores++;
+  if (t->header)
+    return false;   // Mapped read only
+
+  int64_t pathID = PathID(t, pathname);
+  if (pathID < 0)
+    return false;
+
+  uint32_t hash = HashWord(keyword);
+  IndexWord *word = LookupWord(t, keyword, hash);
+  if (word == NULL) {
+    word = AddWord(t, keyword, hash);
+    if (word == NULL)
+      return false;
+    if (!ind->isShard)
+      numentriesalloc++;
+  }
+  return AppendPosting(t, word, pathID, offset, position);
+}
+
+/*
+ * Looks keyword up in a mapped index the way FindSlot() does.
+ */
+static const IndexFileWord *LookupFileWord(IndexTable *t, const char *keyword, uint32_t hash) {
+  const IndexFileHeader *h = t->header;
+  uint32_t mask = h->numSlots - 1;
+  uint32_t i = hash & mask;
+  for (uint32_t n = 0; n < h->numSlots; n++, i = (i + 1) & mask) {
+    uint32_t w = t->fileSlots[i];
+    if (w == 0 || w > h->numWords)
+      return NULL;
+    const IndexFileWord *word = &t->fileWords[w - 1];
+    if (word->hash == hash && word->keyword < h->keywordsize &&
+        strcmp(t->keywords + word->keyword, keyword) == 0) {
+      if (word->firstPosting > h->numPostings || word->numPostings > h->numPostings - word->firstPosting)
+        return NULL;
+      return word;
+    }
+  }
+  return NULL;
+}
 
-  IndexLocationList *newItem = (IndexLocationList *) malloc(sizeof(IndexLocationList));
-  newItem->item.pathname = pathname;
-  newItem->item.offset = offset;
-  newItem->nextLocation = NULL;
+bool Index_RetrieveEntry(Index *ind, char *keyword, IndexEntry *entry) {
+  IndexTable *t = (IndexTable *) ind->private;
 
-  char *word = strdup(keyword);
-  IndexHashEntry key; 
-  key.keyword = word;
+  // Lookups may come from several threads at once.
+  __atomic_fetch_add(&numlookups, 1, __ATOMIC_RELAXED);
 
-  IndexHashEntry *entry;
-  entry = lh_retrieve(hashtable, (char *) &key);
-  
-  if (entry == NULL) {
-    entry = malloc(sizeof(IndexHashEntry));
-    if (entry == NULL) {
-      free(word);
+  if (t->header) {
+    const IndexFileWord *word = LookupFileWord(t, keyword, HashWord(keyword));
+    if (word == NULL)
       return false;
+    entry->postings = &t->filePostings[word->firstPosting];
+    entry->numPostings = word->numPostings;
+    return true;
+  }
+
+  IndexWord *word = LookupWord(t, keyword, HashWord(keyword));
+  if (word == NULL)
+    return false;
+  entry->postings = word->postings;
+  entry->numPostings = word->numPostings;
+  return true;
+}
+
+const char *Index_Pathname(Index *ind, uint32_t pathID) {
+  const IndexTable *t = (const IndexTable *) ind->private;
+  if (t->header) {
+    if (pathID >= t->header->numPaths || t->filePaths[pathID].pathname >= t->header->pathtextsize)
+      return "?";
+    return t->pathtext + t->filePaths[pathID].pathname;
+  }
+  return (pathID < t->numPaths) ? t->pathnames[pathID] : "?";
+}
+
+typedef struct {
+  int64_t key;
+  char *pathname;
+  int offset;
+  uint32_t position;
+} MergeLocation;
+
+typedef struct {
+  MergeLocation *locs;
+  size_t maxlocs;
+  uint32_t base;               // Pathnames ind had before the merge
+  int64_t *pathKeys;           // A key of each pathname numbered since
+  uint32_t maxKeys;
+} MergeState;
+
+static int CompareLocations(const void *arg1, const void *arg2) {
+  const MergeLocation *l1 = (const MergeLocation *) arg1;
+  const MergeLocation *l2 = (const MergeLocation *) arg2;
+  return (l1->key > l2->key) - (l1->key < l2->key);   // Increasing key order
+}
+
+/*
+ * Takes the postings of one word out of shards[0..n) and appends them to
+ * the word's postings in ind.  The shards before shards[0] have been merged
+ * already, so they can't have the word.
+ */
+static bool MergeWord(IndexTable *t, IndexWord *first, Index **shards, int n,
+                      int64_t (*relocate)(IndexLocation *loc, void *arg), void *arg,
+                      MergeState *ms) {
+  MergeLocation *locs = ms->locs;
+  size_t numlocs = 0;
+
+  for (int i = 0; i < n; i++) {
+    IndexTable *st = (IndexTable *) (shards[i]->private);
+    IndexWord *word = (i == 0) ? first : LookupWord(st, first->keyword, first->hash);
+    if (word == NULL)
+      continue;
+    word->merged = true;
+    if (numlocs + word->numPostings > ms->maxlocs) {
+      size_t max = ms->maxlocs ? ms->maxlocs : 256;
+      while (max < numlocs + word->numPostings)
+        max *= 2;
+      MergeLocation *l = realloc(locs, max * sizeof(MergeLocation));
+      if (l == NULL)
+        return false;
+      ms->locs = locs = l;
+      ms->maxlocs = max;
     }
-    numentriesalloc++;
-    entry->keyword = word;
-    entry->locationList = NULL;
+    for (uint32_t p = 0; p < word->numPostings; p++) {
+      IndexLocation loc;
+      loc.pathname = st->pathnames[word->postings[p].pathID];
+      loc.offset = word->postings[p].offset;
+      int64_t key = relocate(&loc, arg);
+      if (key < 0)
+        continue;
+      locs[numlocs].key = key;
+      locs[numlocs].pathname = loc.pathname;
+      locs[numlocs].offset = loc.offset;
+      locs[numlocs].position = word->postings[p].position;
+      numlocs++;
+    }
+  }
+  if (numlocs == 0)
+    return true;   // Only seen in discarded files
 
-    lh_insert(hashtable,(char *) entry);
+  qsort(locs, numlocs, sizeof(MergeLocation), CompareLocations);
 
-    if (lh_error(hashtable)) {
-      free(word);
-      free(entry);
+  IndexWord *word = LookupWord(t, first->keyword, first->hash);
+  if (word == NULL) {
+    word = AddWord(t, first->keyword, first->hash);
+    if (word == NULL)
       return false;
+    numentriesalloc++;
+  }
+  if (!ReservePostings(t, word, numlocs))
+    return false;
+  for (size_t i = 0; i < numlocs; i++) {
+    uint32_t numPaths = t->numPaths;
+    int64_t pathID = PathID(t, locs[i].pathname);
+    if (pathID < 0 || !AppendPosting(t, word, pathID, locs[i].offset, locs[i].position))
+      return false;
+    if (t->numPaths > numPaths) {
+      // A new pathname; any of its keys orders it among the others.
+      uint32_t k = pathID - ms->base;
+      if (k >= ms->maxKeys) {
+        uint32_t max = ms->maxKeys ? 2 * ms->maxKeys : 1024;
+        int64_t *keys = realloc(ms->pathKeys, max * sizeof(int64_t));
+        if (keys == NULL)
+          return false;
+        ms->pathKeys = keys;
+        ms->maxKeys = max;
+      }
+      ms->pathKeys[k] = locs[i].key;
+    }
+  }
+  numstores += numlocs;
+  return true;
+}
+
+typedef struct {
+  int64_t key;
+  uint32_t pathID;
+} PathOrder;
+
+static int ComparePathOrder(const void *arg1, const void *arg2) {
+  const PathOrder *p1 = (const PathOrder *) arg1;
+  const PathOrder *p2 = (const PathOrder *) arg2;
+  return (p1->key > p2->key) - (p1->key < p2->key);
+}
+
+/*
+ * The merge numbers pathnames in the order words reach them, which isn't
+ * the order they were stored in.  Renumbers the pathnames added since
+ * ms->base by key, so every word's postings are sorted by pathID again.
+ */
+static bool RenumberPaths(IndexTable *t, MergeState *ms) {
+  uint32_t n = t->numPaths - ms->base;
+  if (n == 0)
+    return true;
+  PathOrder *order = malloc(n * sizeof(PathOrder));
+  uint32_t *newID = malloc(n * sizeof(uint32_t));
+  char **pathnames = malloc(n * sizeof(char *));
+  bool ok = (order && newID && pathnames);
+  if (ok) {
+    for (uint32_t k = 0; k < n; k++) {
+      order[k].key = ms->pathKeys[k];
+      order[k].pathID = ms->base + k;
+    }
+    qsort(order, n, sizeof(PathOrder), ComparePathOrder);
+    for (uint32_t k = 0; k < n; k++) {
+      newID[order[k].pathID - ms->base] = ms->base + k;
+      pathnames[k] = t->pathnames[order[k].pathID];
+    }
+    memcpy(&t->pathnames[ms->base], pathnames, n * sizeof(char *));
+    for (uint32_t i = 0; i < t->numSlots; i++) {
+      IndexWord *word = t->slots[i];
+      if (word == NULL)
+        continue;
+      for (uint32_t p = 0; p < word->numPostings; p++) {
+        if (word->postings[p].pathID >= ms->base)
+          word->postings[p].pathID = newID[word->postings[p].pathID - ms->base];
+      }
+    }
+    t->lastPath = NULL;
+    ok = RehashPaths(t, t->numPathSlots);
+  }
+  free(order);
+  free(newID);
+  free(pathnames);
+  return ok;
+}
+
+bool Index_MergeShards(Index *ind, Index **shards, int n,
+                       int64_t (*relocate)(IndexLocation *loc, void *arg), void *arg) {
+  IndexTable *t = (IndexTable *) (ind->private);
+  bool ok = (t->header == NULL);
+  MergeState ms;
+  memset(&ms, 0, sizeof(ms));
+  ms.base = t->numPaths;
+
+  for (int s = 0; s < n; s++) {
+    IndexTable *st = (IndexTable *) (shards[s]->private);
+
+    // Words that an earlier shard also had were merged with it already.
+    for (uint32_t i = 0; i < st->numSlots && ok; i++) {
+      IndexWord *word = st->slots[i];
+      if (word && !word->merged)
+        ok = MergeWord(t, word, &shards[s], n - s, relocate, arg, &ms);
+    }
+
+    // Nothing looks into this shard any more.
+    FreeTable(st);
+    free(shards[s]);
+  }
+  if (ok)
+    ok = RenumberPaths(t, &ms);
+  free(ms.locs);
+  free(ms.pathKeys);
+  return ok;
+}
+
+/*
+ * A growable buffer of null terminated strings
+ */
+typedef struct {
+  char *text;
+  size_t size, max;
+} TextBuf;
+
+static int64_t TextBuf_Append(TextBuf *b, const char *str) {
+  size_t len = strlen(str) + 1;
+  if (b->size + len > UINT32_MAX)
+    return -1;   // Offsets are 32 bits
+  if (b->size + len > b->max) {
+    size_t max = b->max ? 2 * b->max : 4096;
+    while (max < b->size + len)
+      max *= 2;
+    char *text = realloc(b->text, max);
+    if (text == NULL)
+      return -1;
+    b->text = text;
+    b->max = max;
+  }
+  memcpy(b->text + b->size, str, len);
+  b->size += len;
+  return b->size - len;
+}
+
+typedef struct {
+  IndexTable *t;
+  uint32_t *remap;             // File pathID by index pathID
+  IndexFilePath *paths;
+  uint32_t numPaths, maxPaths;
+  TextBuf text;
+  bool failed;
+} PathWriter;
+
+static void AddFilePath(PathWriter *w, const char *pathname, const char *chksum) {
+  if (w->failed)
+    return;
+  if (w->numPaths == w->maxPaths) {
+    uint32_t max = w->maxPaths ? 2 * w->maxPaths : 1024;
+    IndexFilePath *paths = realloc(w->paths, max * sizeof(IndexFilePath));
+    if (paths == NULL) {
+      w->failed = true;
+      return;
     }
-  } else {
-    free(word);
+    w->paths = paths;
+    w->maxPaths = max;
   }
+  int64_t off = TextBuf_Append(&w->text, pathname);
+  if (off < 0) {
+    w->failed = true;
+    return;
+  }
+  IndexFilePath *p = &w->paths[w->numPaths];
+  memset(p, 0, sizeof(IndexFilePath));
+  p->pathname = off;
+  if (chksum)
+    memcpy(p->chksum, chksum, CHKSUMFILE_SIZE);
+  w->numPaths++;
+}
+
+static void StorePathCallback(char *pathname, const char *chksum, void *arg) {
+  PathWriter *w = (PathWriter *) arg;
+  IndexTable *t = w->t;
+  if (t->numPathSlots > 0) {
+    uint32_t slot = FindPathSlot(t, pathname);
+    if (t->pathSlots[slot] != 0)
+      w->remap[t->pathSlots[slot] - 1] = w->numPaths;
+  }
+  AddFilePath(w, pathname, chksum);
+}
 
-  newItem->nextLocation =  entry->locationList;
-  entry->locationList = newItem;
+static uint64_t Align(uint64_t offset) {
+  return (offset + INDEXFILE_ALIGN - 1) & ~(uint64_t) (INDEXFILE_ALIGN - 1);
+}
+
+/*
+ * Pads the file to the next section boundary and writes len bytes.
+ */
+static bool WriteSection(FILE *file, uint64_t *offset, const void *data, size_t len) {
+  static const char zeros[INDEXFILE_ALIGN];
+  size_t pad = Align(*offset) - *offset;
+  if ((pad && fwrite(zeros, 1, pad, file) != pad) || (len && fwrite(data, 1, len, file) != len))
+    return false;
+  *offset += pad + len;
   return true;
 }
 
-IndexLocationList *Index_RetrieveEntry(Index *ind, char *keyword) {
-  _LHASH *hashtable = (_LHASH*) ind->private;
+bool Index_Write(Index *ind, struct Pathstore *store, const char *path, const IndexFingerprint *fingerprint) {
+  IndexTable *t = (IndexTable *) (ind->private);
+  if (t->header)
+    return false;
+
+  bool ok = false;
+  FILE *file = NULL;
+  PathWriter paths;
+  memset(&paths, 0, sizeof(paths));
+  paths.t = t;
+  TextBuf keywords = { NULL, 0, 0 };
+  uint32_t *slots = calloc(t->numSlots, sizeof(uint32_t));
+  IndexFileWord *words = calloc(t->numWords ? t->numWords : 1, sizeof(IndexFileWord));
+  paths.remap = malloc((t->numPaths ? t->numPaths : 1) * sizeof(uint32_t));
+  IndexPosting *postings = NULL;
+  if (slots == NULL || words == NULL || paths.remap == NULL)
+    goto done;
+
+  // Pathnames the pathstore has, then any only the index has.
+  for (uint32_t i = 0; i < t->numPaths; i++)
+    paths.remap[i] = UINT32_MAX;
+  if (store && Pathstore_foreach(store, StorePathCallback, &paths) < 0)
+    goto done;
+  for (uint32_t i = 0; i < t->numPaths; i++) {
+    if (paths.remap[i] == UINT32_MAX) {
+      paths.remap[i] = paths.numPaths;
+      AddFilePath(&paths, t->pathnames[i], NULL);
+    }
+  }
+  if (paths.failed || TextBuf_Append(&paths.text, "") < 0)
+    goto done;
+
+  // The words keep their slots, so lookups probe the same way.
+  uint64_t numPostings = 0;
+  for (uint32_t i = 0; i < t->numSlots; i++) {
+    if (t->slots[i])
+      numPostings += t->slots[i]->numPostings;
+  }
+  postings = malloc((numPostings ? numPostings : 1) * sizeof(IndexPosting));
+  if (postings == NULL)
+    goto done;
+  uint32_t numWords = 0;
+  uint64_t next = 0;
+  for (uint32_t i = 0; i < t->numSlots; i++) {
+    IndexWord *word = t->slots[i];
+    if (word == NULL)
+      continue;
+    int64_t off = TextBuf_Append(&keywords, word->keyword);
+    if (off < 0)
+      goto done;
+    IndexFileWord *fw = &words[numWords];
+    fw->hash = word->hash;
+    fw->keyword = off;
+    fw->firstPosting = next;
+    fw->numPostings = word->numPostings;
+    for (uint32_t p = 0; p < word->numPostings; p++) {
+      postings[next].pathID = paths.remap[word->postings[p].pathID];
+      postings[next].offset = word->postings[p].offset;
+      postings[next].position = word->postings[p].position;
+      next++;
+    }
+    slots[i] = ++numWords;
+  }
+  if (TextBuf_Append(&keywords, "") < 0)
+    goto done;
+
+  if ((file = fopen(path, "wb")) == NULL) {
+    perror(path);
+    goto done;
+  }
+
+  IndexFileHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = INDEXFILE_MAGIC;
+  header.version = INDEXFILE_VERSION;
+  header.fingerprint = *fingerprint;
+  header.numSlots = t->numSlots;
+  header.numWords = numWords;
+  header.numPaths = paths.numPaths;
+  header.numPostings = numPostings;
+  header.keywordsize = keywords.size;
+  header.pathtextsize = paths.text.size;
+
+  // The header is rewritten once the offsets are known.
+  uint64_t offset = sizeof(header);
+  bool written = (fwrite(&header, sizeof(header), 1, file) == 1);
+  header.slotsoff = Align(offset);
+  written = written && WriteSection(file, &offset, slots, (size_t) t->numSlots * sizeof(uint32_t));
+  header.wordsoff = Align(offset);
+  written = written && WriteSection(file, &offset, words, (size_t) numWords * sizeof(IndexFileWord));
+  header.keywordsoff = Align(offset);
+  written = written && WriteSection(file, &offset, keywords.text, keywords.size);
+  header.postingsoff = Align(offset);
+  written = written && WriteSection(file, &offset, postings, numPostings * sizeof(IndexPosting));
+  header.pathsoff = Align(offset);
+  written = written && WriteSection(file, &offset, paths.paths, (size_t) paths.numPaths * sizeof(IndexFilePath));
+  header.pathtextoff = Align(offset);
+  written = written && WriteSection(file, &offset, paths.text.text, paths.text.size);
+  header.size = offset;
+  written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+  if (fclose(file) != 0)
+    written = false;
+  file = NULL;
+  if (!written) {
+    perror(path);
+    goto done;
+  }
+  ok = true;
+
+done:
+  if (file)
+    fclose(file);
+  free(slots);
+  free(words);
+  free(postings);
+  free(keywords.text);
+  free(paths.remap);
+  free(paths.paths);
+  free(paths.text.text);
+  return ok;
+}
+
+static bool ValidSection(const IndexFileHeader *h, uint64_t offset, uint64_t len) {
+  return (offset % INDEXFILE_ALIGN) == 0 && offset >= sizeof(*h) && offset <= h->size &&
+         len <= h->size - offset;
+}
 
-  numlookups++;
+Index *Index_Open(const char *path, const IndexFingerprint *fingerprint) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(IndexFileHeader)) {
+    fprintf(stderr, "%s: not an index file\n", path);
+    close(fd);
+    return NULL;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
 
-  IndexHashEntry key;
-  key.keyword = keyword;
+  const IndexFileHeader *h = base;
+  const char *b = base;
+  const char *reason = NULL;
+  if (h->magic != INDEXFILE_MAGIC || h->version != INDEXFILE_VERSION)
+    reason = "not an index file";
+  else if (h->fingerprint.imageSize != fingerprint->imageSize ||
+           h->fingerprint.superblockChecksum != fingerprint->superblockChecksum ||
+           h->fingerprint.superblockTime != fingerprint->superblockTime)
+    reason = "built from a different or modified image";
+  else if (h->size != (uint64_t) st.st_size || h->numSlots == 0 || (h->numSlots & (h->numSlots - 1)) ||
+           h->numWords > h->numSlots || h->keywordsize == 0 || h->pathtextsize == 0 ||
+           !ValidSection(h, h->slotsoff, (uint64_t) h->numSlots * sizeof(uint32_t)) ||
+           !ValidSection(h, h->wordsoff, (uint64_t) h->numWords * sizeof(IndexFileWord)) ||
+           !ValidSection(h, h->keywordsoff, h->keywordsize) ||
+           h->numPostings > h->size / sizeof(IndexPosting) ||
+           !ValidSection(h, h->postingsoff, h->numPostings * sizeof(IndexPosting)) ||
+           !ValidSection(h, h->pathsoff, (uint64_t) h->numPaths * sizeof(IndexFilePath)) ||
+           !ValidSection(h, h->pathtextoff, h->pathtextsize) ||
+           b[h->keywordsoff + h->keywordsize - 1] != 0 || b[h->pathtextoff + h->pathtextsize - 1] != 0)
+    reason = "truncated or corrupt";
 
-  IndexHashEntry *entry = lh_retrieve(hashtable, (char *) &key);
-  return entry ? entry->locationList : (IndexLocationList *) NULL;
+  Index *ind = NULL;
+  IndexTable *t = NULL;
+  if (reason == NULL && ((ind = malloc(sizeof(Index))) == NULL || (t = calloc(1, sizeof(IndexTable))) == NULL))
+    reason = "out of memory";
+  if (reason) {
+    fprintf(stderr, "%s: %s, ignoring index file\n", path, reason);
+    free(ind);
+    munmap(base, st.st_size);
+    return NULL;
+  }
+
+  t->header = h;
+  t->mapSize = st.st_size;
+  t->fileSlots = (const uint32_t *) (b + h->slotsoff);
+  t->fileWords = (const IndexFileWord *) (b + h->wordsoff);
+  t->keywords = b + h->keywordsoff;
+  t->filePostings = (const IndexPosting *) (b + h->postingsoff);
+  t->filePaths = (const IndexFilePath *) (b + h->pathsoff);
+  t->pathtext = b + h->pathtextoff;
+  ind->private = t;
+  ind->isShard = false;
+  mainTable = t;
+  return ind;
 }
 
 void Index_Dumpstats(FILE *file) {
@@ -106,8 +944,20 @@ void Index_Dumpstats(FILE *file) {
           "Index: %"PRIu64" stores, %"PRIu64" allocates, %"PRIu64" lookups\n",
           numstores, numentriesalloc, numlookups);
 
-#ifdef PRINT_HASH_STATS
-  if (hashTable)
-    lh_stats(hashTable, file);
-#endif
+  if (mainTable && mainTable->header) {
+    const IndexFileHeader *h = mainTable->header;
+    fprintf(file, "Index: %u words, %"PRIu64" postings, %u pathnames mapped from an index file (%.1f KB)\n",
+            h->numWords, h->numPostings, h->numPaths, mainTable->mapSize / 1024.0);
+  } else if (mainTable) {
+    IndexTable *t = mainTable;
+    size_t tableBytes = t->numSlots * sizeof(IndexWord *) + t->maxPaths * sizeof(char *) +
+                        t->numPathSlots * sizeof(uint32_t);
+    fprintf(file,
+            "Index: %u words in %u slots, %u pathnames, %.1f KB memory: "
+            "%.1f KB arena (%.1f KB used), %.1f KB postings (%.1f KB used), %.1f KB tables\n",
+            t->numWords, t->numSlots, t->numPaths,
+            (t->arenaBytes + t->postingBytes + tableBytes) / 1024.0,
+            t->arenaBytes / 1024.0, t->arenaUsed / 1024.0,
+            t->postingBytes / 1024.0, t->postingsUsed / 1024.0, tableBytes / 1024.0);
+  }
 }
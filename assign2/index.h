@@ -3,9 +3,11 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct Index {
   void *private;
+  bool isShard;     // Filled by one thread and merged into an index later
 } Index;
 
 typedef struct IndexLocation {
@@ -13,14 +15,85 @@ typedef struct IndexLocation {
   int  offset;      // Offset into pathname of the word
 } IndexLocation;
 
-typedef struct IndexLocationList {
-  IndexLocation item;                      // Where it is located
-  struct IndexLocationList *nextLocation;  // Link list to next
-} IndexLocationList;
+typedef struct IndexPosting {
+  uint32_t pathID;    // See Index_Pathname()
+  int32_t  offset;    // Offset into pathname of the word
+  uint32_t position;  // Number of the word in the file, from 0
+} IndexPosting;
+
+/*
+ * The postings of a word, oldest first, as returned by Index_RetrieveEntry().
+ * They are sorted by pathID, and the ones of a file by position.
+ */
+typedef struct IndexEntry {
+  const IndexPosting *postings;
+  uint32_t numPostings;
+} IndexEntry;
+
+/*
+ * What ties an index file to the disk image it was built from.
+ */
+typedef struct IndexFingerprint {
+  uint64_t imageSize;           // Bytes
+  uint64_t superblockChecksum;
+  uint32_t superblockTime;
+  uint32_t reserved;
+} IndexFingerprint;
+
+struct Pathstore;
 
 Index *Index_Create(void);
-bool Index_StoreEntry(Index *ind, char *keyword, char *pathname, int offset);
-IndexLocationList *Index_RetrieveEntry(Index *ind, char *keyword);
+bool Index_StoreEntry(Index *ind, char *keyword, char *pathname, int offset, int position);
+
+/**
+ * Creates an index shard for one thread of a parallel build.  Stores into a
+ * shard aren't counted in the stats until it is merged.
+ */
+Index *Index_CreateShard(void);
+
+/**
+ * Frees a shard that won't be merged after all.  Does nothing given NULL.
+ */
+void Index_FreeShard(Index *shard);
+
+/**
+ * Moves every location of the n shards into ind and frees the shards.
+ * relocate is called on each location; it may rewrite it and returns its
+ * sort key, or -1 to drop it.  A word's locations end up after the ones ind
+ * already has, in increasing key order, just as if they had been stored one
+ * by one in that order.  The locations of a pathname must have keys that
+ * all sort between those of any other pathname.
+ */
+bool Index_MergeShards(Index *ind, Index **shards, int n,
+                       int64_t (*relocate)(IndexLocation *loc, void *arg), void *arg);
+
+/**
+ * Looks up keyword.  Returns false if it isn't in the index, otherwise fills
+ * in *entry with a view of its postings that stays valid until the next
+ * store into the index.  Any number of threads can look up words and
+ * pathnames at once as long as nothing stores into the index.
+ */
+bool Index_RetrieveEntry(Index *ind, char *keyword, IndexEntry *entry);
+
+/**
+ * Returns the pathname of a pathID found in the postings of ind.
+ */
+const char *Index_Pathname(Index *ind, uint32_t pathID);
+
+/**
+ * Writes ind, along with every pathname of store and its checksum, to an
+ * index file at path that can only be opened for the image of fingerprint.
+ * Returns true on success.
+ */
+bool Index_Write(Index *ind, struct Pathstore *store, const char *path,
+                 const IndexFingerprint *fingerprint);
+
+/**
+ * Maps the index file at path, which is checked against fingerprint, as a
+ * read only index.  Returns NULL if the file is missing, corrupt or was
+ * written for a different image.
+ */
+Index *Index_Open(const char *path, const IndexFingerprint *fingerprint);
 void Index_Dumpstats(FILE *file);
 
 #endif // _INDEX_H_
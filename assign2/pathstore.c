@@ -1,5 +1,13 @@
 /*
  * pathstore.c  - Store pathnames for indexing
+ *
+ * The elements are kept on a list, newest first, and in two hash tables,
+ * one keyed by pathname and one by the checksum of the file.  A pathname
+ * already stored is found in its bucket, and a new file is only compared
+ * with the files in its checksum's bucket, so storing n files takes about
+ * n steps rather than n squared.  Files in the same bucket with different
+ * checksums count as checksumdiff; only equal checksums go on to a
+ * comparison of the contents.
  */
 
 #include <stdio.h>
@@ -15,6 +23,8 @@
 #include "pathstore.h"
 #include "assign1/chksumfile.h"
 
+#define PATHSTORE_MIN_SLOTS 256   // Buckets in each table to start with
+
 typedef struct PathstoreElement {
   char *pathname;
   /*
@@ -23,6 +33,9 @@ typedef struct PathstoreElement {
    */
   char pathchksumstring[CHKSUMFILE_SIZE];
   struct PathstoreElement *nextElement;
+  struct PathstoreElement *nextByPath;     // In the bucket of pathname
+  struct PathstoreElement *nextByChksum;   // In the bucket of the checksum
+  uint32_t pathHash;
 } PathstoreElement;
 
 static uint64_t numdifferentfiles = 0;
@@ -46,6 +59,16 @@ Pathstore* Pathstore_create(void *fshandle) {
 
   store->elementList = NULL;
   store->fshandle = fshandle;
+  store->numSlots = PATHSTORE_MIN_SLOTS;
+  store->numElements = 0;
+  store->pathSlots = calloc(store->numSlots, sizeof(PathstoreElement *));
+  store->chksumSlots = calloc(store->numSlots, sizeof(PathstoreElement *));
+  if (store->pathSlots == NULL || store->chksumSlots == NULL) {
+    free(store->pathSlots);
+    free(store->chksumSlots);
+    free(store);
+    return NULL;
+  }
   return store;
 }
 
@@ -61,32 +84,84 @@ void Pathstore_destory(Pathstore *store) {
     free(e);
     e = next;
   }
+  free(store->pathSlots);
+  free(store->chksumSlots);
   free(store);
 }
 
-static int simplePathnameInStoreCheck(Pathstore *store, char *pathname) {
-  PathstoreElement *e = store->elementList;
+static uint32_t HashPathname(const char *pathname) {
+  uint32_t hash = 2166136261u;   // FNV-1a
+  for (const unsigned char *p = (const unsigned char *) pathname; *p; p++) {
+    hash ^= *p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * A checksum is already uniformly spread; its first bytes will do.
+ */
+static uint32_t HashChksum(const char *chksum) {
+  uint32_t hash;
+  memcpy(&hash, chksum, sizeof(hash));
+  return hash;
+}
+
+/*
+ * Doubles the buckets of both tables.  On running out of memory the
+ * tables stay as they are, only with longer chains.
+ */
+static void GrowSlots(Pathstore *store) {
+  unsigned int numSlots = 2 * store->numSlots;
+  PathstoreElement **pathSlots = calloc(numSlots, sizeof(PathstoreElement *));
+  PathstoreElement **chksumSlots = calloc(numSlots, sizeof(PathstoreElement *));
+  if (pathSlots == NULL || chksumSlots == NULL) {
+    free(pathSlots);
+    free(chksumSlots);
+    return;
+  }
+  for (PathstoreElement *e = store->elementList; e; e = e->nextElement) {
+    unsigned int i = e->pathHash & (numSlots - 1);
+    e->nextByPath = pathSlots[i];
+    pathSlots[i] = e;
+    i = HashChksum(e->pathchksumstring) & (numSlots - 1);
+    e->nextByChksum = chksumSlots[i];
+    chksumSlots[i] = e;
+  }
+  free(store->pathSlots);
+  free(store->chksumSlots);
+  store->pathSlots = pathSlots;
+  store->chksumSlots = chksumSlots;
+  store->numSlots = numSlots;
+}
+
+static int simplePathnameInStoreCheck(Pathstore *store, char *pathname, uint32_t hash) {
+  PathstoreElement *e = store->pathSlots[hash & (store->numSlots - 1)];
   int count = 0;
   while (e) {
-      count++;
-      if (strcmp(pathname, e->pathname) == 0) { // Same pathname must be same file
-          return count;
+      if (e->pathHash == hash) {
+          count++;
+          if (strcmp(pathname, e->pathname) == 0) { // Same pathname must be same file
+              return count;
+          }
       }
-      e = e->nextElement;
+      e = e->nextByPath;
   }
   return -1;
 }
 
-/**
- * Store a pathname in the pathname store.
- * Optimization : Gets inumber as argument to utilize chksumfile_byinumber
+/*
+ * Stores a pathname, computing its checksum only once the pathname itself
+ * isn't found in the store.  chksum is the precomputed checksum, or NULL.
  */
-char *Pathstore_path(Pathstore *store, char *pathname, int discardDuplicateFiles, struct inode *inp, int inode_iget_ret) {
+static char *store_path(Pathstore *store, char *pathname, int discardDuplicateFiles,
+                        struct inode *inp, int inode_iget_ret, const char *chksum) {
   assert(store != NULL);
   assert(pathname != NULL);
 
   numstores++;
   char pathchksumstring[CHKSUMFILE_SIZE];
+  uint32_t hash = HashPathname(pathname);
 
   if (discardDuplicateFiles) {
 
@@ -95,7 +170,7 @@ char *Pathstore_path(Pathstore *store, char *pathname, int discardDuplicateFiles
      * without ruling out the pathname.
      */
     int count;
-    if ((count = simplePathnameInStoreCheck(store, pathname)) > 0) {
+    if ((count = simplePathnameInStoreCheck(store, pathname, hash)) > 0) {
         /* Updating the counter for compares only for positive result */
         numcompares += count;
         numdups++;
@@ -112,7 +187,9 @@ char *Pathstore_path(Pathstore *store, char *pathname, int discardDuplicateFiles
      * The protected inode cache marked with inode struct pointer will not be flushed.
      *
      */
-     if ((optimized_chksumfile_byinode((struct unixfilesystem *) (store->fshandle), pathchksumstring, inp, inode_iget_ret)) < 0)
+    if (chksum != NULL)
+        memcpy(pathchksumstring, chksum, CHKSUMFILE_SIZE);
+    else if ((optimized_chksumfile_byinode((struct unixfilesystem *) (store->fshandle), pathchksumstring, inp, inode_iget_ret)) < 0)
         memset(pathchksumstring, '\0', CHKSUMFILE_SIZE);
     if (SameFileIsInStore(store, pathname, pathchksumstring)) {
       numdups++;
@@ -137,22 +214,73 @@ char *Pathstore_path(Pathstore *store, char *pathname, int discardDuplicateFiles
    */
   if (discardDuplicateFiles) 
     memcpy(e->pathchksumstring, (const void *)pathchksumstring, CHKSUMFILE_SIZE);
+  else
+    memset(e->pathchksumstring, '\0', CHKSUMFILE_SIZE);
+  if (store->numElements >= store->numSlots)
+    GrowSlots(store);
+  store->numElements++;
   e->nextElement = store->elementList;
   store->elementList = e;
+  e->pathHash = hash;
+  unsigned int i = hash & (store->numSlots - 1);
+  e->nextByPath = store->pathSlots[i];
+  store->pathSlots[i] = e;
+  i = HashChksum(e->pathchksumstring) & (store->numSlots - 1);
+  e->nextByChksum = store->chksumSlots[i];
+  store->chksumSlots[i] = e;
   return e->pathname;
 }
 
+/**
+ * Store a pathname in the pathname store.
+ * Optimization : Gets inumber as argument to utilize chksumfile_byinumber
+ */
+char *Pathstore_path(Pathstore *store, char *pathname, int discardDuplicateFiles, struct inode *inp, int inode_iget_ret) {
+  return store_path(store, pathname, discardDuplicateFiles, inp, inode_iget_ret, NULL);
+}
+
+/**
+ * Like Pathstore_path() with the checksum of the file already computed,
+ * e.g. by the thread that scanned it.
+ */
+char *Pathstore_path_chksum(Pathstore *store, char *pathname, int discardDuplicateFiles, const char *chksum) {
+  return store_path(store, pathname, discardDuplicateFiles, NULL, -1, chksum);
+}
+
+/**
+ * Calls fn on every stored pathname, in the order they were stored.
+ * Returns the number of pathnames, -1 on error.
+ */
+int Pathstore_foreach(Pathstore *store, void (*fn)(char *pathname, const char *chksum, void *arg), void *arg) {
+  int count = 0;
+  for (PathstoreElement *e = store->elementList; e; e = e->nextElement)
+    count++;
+  PathstoreElement **elements = malloc((count ? count : 1) * sizeof(PathstoreElement *));
+  if (elements == NULL)
+    return -1;
+
+  // The list is newest first.
+  int i = count;
+  for (PathstoreElement *e = store->elementList; e; e = e->nextElement)
+    elements[--i] = e;
+  for (i = 0; i < count; i++)
+    fn(elements[i]->pathname, elements[i]->pathchksumstring, arg);
+  free(elements);
+  return count;
+}
+
 /**
  * Is this file the same as any other one in the store
- * Modified to receving incoming path checksum string.
+ * Modified to receving incoming path checksum string.  Only the files in
+ * the bucket of the checksum can be.
  */
 static int SameFileIsInStore(Pathstore *store, char *pathname, char *pathchksumstring) {
-  PathstoreElement *e = store->elementList;
+  PathstoreElement *e = store->chksumSlots[HashChksum(pathchksumstring) & (store->numSlots - 1)];
   while (e) {
     if (IsSameFile(pathname, e->pathname, e->pathchksumstring, pathchksumstring)) {
       return 1;  // In store already
     }
-    e = e->nextElement;
+    e = e->nextByChksum;
   }
   return 0; // Not found in store
 }
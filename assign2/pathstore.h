@@ -5,6 +5,14 @@
 typedef struct Pathstore {
   struct PathstoreElement *elementList;
   void                    *fshandle;
+  /*
+   * Hash tables of the elements by pathname and by checksum, chained
+   * through the elements, with numSlots buckets each.
+   */
+  struct PathstoreElement **pathSlots;
+  struct PathstoreElement **chksumSlots;
+  unsigned int             numSlots;
+  unsigned int             numElements;
 } Pathstore;
 
 Pathstore* Pathstore_create(void *fshandle);
@@ -16,6 +24,20 @@ void       Pathstore_destory(Pathstore *store);
  */
 char*      Pathstore_path(Pathstore *store, char *pathname,
                           int discardDuplicateFiles, struct inode *inp, int inode_iget_ret);
+/*
+ * Same with the checksum of the file's contents precomputed.  The checksum
+ * is only used when duplicates are discarded.
+ */
+char*      Pathstore_path_chksum(Pathstore *store, char *pathname,
+                                 int discardDuplicateFiles, const char *chksum);
+
+/*
+ * Calls fn on every stored pathname and the checksum of its file (all zero
+ * when duplicates weren't discarded), oldest first.  Returns the number of
+ * pathnames, -1 on error.
+ */
+int        Pathstore_foreach(Pathstore *store,
+                             void (*fn)(char *pathname, const char *chksum, void *arg), void *arg);
 
 void Pathstore_Dumpstats(FILE *file);
 
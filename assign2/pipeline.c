@@ -0,0 +1,280 @@
+/**
+ * pipeline.c  -  A prefetch stage that runs ahead of the index scan.
+ *
+ * The scan tokenizes one file at a time, and with a simulated disk it spends
+ * most of that time waiting for the file's sectors.  The prefetch stage is a
+ * thread that walks the tree in the same order as the scan, reading the
+ * directories, inodes and block maps on its way, and hands each file it
+ * finds to I/O threads that read the file's blocks into the cache, in the
+ * order the scan will want them.  With readahead on there is one I/O thread,
+ * so the disk still sees a single sequential stream to read ahead of;
+ * several threads reading neighbouring files break it into short ones.
+ *
+ * Between the two stages sits a bounded queue of files.  The walk stops
+ * when it is depth files, or a share of the cache, ahead of the scan, so
+ * what it prefetched is still cached when the scan gets there.  A scan that
+ * reaches a file whose read is still in flight waits for that read rather
+ * than issuing its own; that wait is a stall.  The overlap efficiency in the
+ * stats is the share of the prefetch I/O time the scan didn't stall for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "cachemem.h"
+#include "debug.h"
+#include "diskimg.h"
+#include "assign1/inode.h"
+#include "assign1/file.h"
+#include "assign1/direntv6.h"
+#include "assign1/snapshot.h"
+
+#define PIPELINE_IO_WORKERS  4    // Files read at once without readahead
+#define PIPELINE_CACHE_SHARE 4    // Sectors read ahead take at most 1/4 of the cache
+#define PIPELINE_CHUNK       16   // Blocks per file_getblocks_bymap() call
+#define MAXPATH 1024              // As in Scan_TreeAndIndex()
+
+extern int diskReadaheadEnable;
+
+struct pipeslot {
+  int inumber;
+  struct inode in;
+  int sectors;       // Sectors read ahead for it
+  int done;          // Set when the read has completed
+};
+
+static struct {
+  struct unixfilesystem *fs;
+  pthread_t walker;
+  pthread_t io[PIPELINE_IO_WORKERS];
+  int numio;
+  char *rootPath;
+  int rootInumber;
+  int running;
+  int stopping;
+  int depth;
+  int budget;                // Sectors that may be read ahead of the scan
+  struct pipeslot *slots;    // File seq is in slots[seq % depth]
+  int64_t produced;          // Files the walk has queued
+  int64_t issued;            // Files an I/O thread has taken
+  int64_t consumed;          // Files the scan has started
+  int aheadSectors;
+} pl;
+
+static pthread_mutex_t pipelineLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spaceReady = PTHREAD_COND_INITIALIZER;   // The walk waits for the scan
+static pthread_cond_t readDone = PTHREAD_COND_INITIALIZER;     // The scan waits for a read
+static pthread_cond_t fileQueued = PTHREAD_COND_INITIALIZER;   // The I/O threads wait for the walk
+
+static uint64_t numfiles = 0;      // Files read ahead
+static uint64_t numsectors = 0;
+static uint64_t numwarm = 0;       // Files the scan found read ahead
+static uint64_t numstalls = 0;     // Of which still being read
+static uint64_t numbehind = 0;     // Files the scan got to before the walk
+static uint64_t numdiverged = 0;   // Files the walk and the scan disagreed on
+static int64_t stalltime = 0;      // Microseconds
+static int64_t iotime = 0;         // Microseconds spent reading ahead, summed over workers
+static int maxahead = 0;
+
+static int get_blockmap(int inumber, struct inode *inp, struct inode_blockmap *map) {
+  return pl.fs->snap ? snapshot_blockmap(pl.fs->snap, inumber, map)
+                     : inode_blockmap(pl.fs, inp, map);
+}
+
+static void read_file(struct pipeslot *slot) {
+  struct inode_blockmap map;
+  if (get_blockmap(slot->inumber, &slot->in, &map) < 0) return;
+  char buf[PIPELINE_CHUNK * DISKIMG_SECTOR_SIZE];
+  for (int b = 0; b < slot->sectors; b += PIPELINE_CHUNK) {
+    int n = (slot->sectors - b < PIPELINE_CHUNK) ? slot->sectors - b : PIPELINE_CHUNK;
+    if (file_getblocks_bymap(pl.fs, &map, b, n, buf) < 0) break;
+  }
+  inode_blockmap_free(&map);
+}
+
+/*
+ * An I/O thread takes the queued files oldest first.  A slot can't be
+ * reused before its read is done, because the scan waits for it.
+ */
+static void *io_main(void *arg) {
+  (void) arg;
+  pthread_mutex_lock(&pipelineLock);
+  while (1) {
+    while (!pl.stopping && pl.issued >= pl.produced)
+      pthread_cond_wait(&fileQueued, &pipelineLock);
+    if (pl.stopping) break;
+    struct pipeslot *slot = &pl.slots[pl.issued++ % pl.depth];
+    pthread_mutex_unlock(&pipelineLock);
+
+    int64_t start = Debug_GetTimeInMicrosecs();
+    read_file(slot);
+    int64_t elapsed = Debug_GetTimeInMicrosecs() - start;
+
+    pthread_mutex_lock(&pipelineLock);
+    iotime += elapsed;
+    numfiles++;
+    numsectors += slot->sectors;
+    slot->done = 1;
+    pthread_cond_broadcast(&readDone);
+  }
+  pthread_mutex_unlock(&pipelineLock);
+  return NULL;
+}
+
+/*
+ * Queues a file the walk found, waiting while the walk is too far ahead.
+ */
+static void queue_file(int inumber, struct inode *inp) {
+  int sectors = (inode_getsize(inp) + DISKIMG_SECTOR_SIZE - 1) / DISKIMG_SECTOR_SIZE;
+  if (sectors > pl.budget) sectors = pl.budget;   // The scan reads the rest itself
+
+  pthread_mutex_lock(&pipelineLock);
+  while (!pl.stopping && (pl.produced - pl.consumed >= pl.depth ||
+                          (pl.aheadSectors > 0 && pl.aheadSectors + sectors > pl.budget)))
+    pthread_cond_wait(&spaceReady, &pipelineLock);
+  if (pl.stopping) {
+    pthread_mutex_unlock(&pipelineLock);
+    return;
+  }
+  int64_t seq = pl.produced++;
+  if (seq < pl.consumed) {
+    // The scan has been there already.
+    pl.issued = pl.produced;
+    pthread_mutex_unlock(&pipelineLock);
+    return;
+  }
+  struct pipeslot *slot = &pl.slots[seq % pl.depth];
+  slot->inumber = inumber;
+  slot->in = *inp;
+  slot->sectors = sectors;
+  slot->done = 0;
+  pl.aheadSectors += sectors;
+  if (pl.produced - pl.consumed > maxahead) maxahead = pl.produced - pl.consumed;
+  pthread_cond_signal(&fileQueued);
+  pthread_mutex_unlock(&pipelineLock);
+}
+
+/*
+ * Visits the tree the way Scan_TreeAndIndex() does.  Only the length of the
+ * pathname is needed, for its depth check.
+ */
+static void walk(int inumber, int pathlen) {
+  if (__atomic_load_n(&pl.stopping, __ATOMIC_RELAXED)) return;
+
+  struct inode in;
+  if (inode_iget(pl.fs, inumber, &in) < 0) return;
+  if ((in.i_mode & IALLOC) && ((in.i_mode & IFMT) == 0)) {
+    queue_file(inumber, &in);
+    return;
+  }
+  if (pathlen > MAXPATH-16) return;
+
+  struct inode_blockmap map;
+  if (get_blockmap(inumber, &in, &map) < 0) return;
+  int dirlen = (pathlen == 1) ? 0 : pathlen;   // "/" adds no characters
+  char buf[PIPELINE_CHUNK * DISKIMG_SECTOR_SIZE];
+  for (int b = 0; b < map.numBlocks; b += PIPELINE_CHUNK) {
+    int bytes = file_getblocks_bymap(pl.fs, &map, b, PIPELINE_CHUNK, buf);
+    if (bytes < 0) break;
+    for (int off = 0; off + (int) sizeof(struct direntv6) <= bytes; off += sizeof(struct direntv6)) {
+      struct direntv6 *dirent = (struct direntv6 *) (buf + off);
+      char *n = dirent->d_name;
+      if ((n[0] == '.') && ((n[1] == 0) || ((n[1] == '.') && (n[2] == 0))))
+        continue;
+      walk(dirent->d_inumber, dirlen + 1 + strnlen(n, sizeof(dirent->d_name)));
+    }
+  }
+  inode_blockmap_free(&map);
+}
+
+static void *walk_main(void *arg) {
+  (void) arg;
+  walk(pl.rootInumber, strlen(pl.rootPath));
+  return NULL;
+}
+
+static void stop_threads(int walking) {
+  pthread_mutex_lock(&pipelineLock);
+  __atomic_store_n(&pl.stopping, 1, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&spaceReady);
+  pthread_cond_broadcast(&readDone);
+  pthread_cond_broadcast(&fileQueued);
+  pthread_mutex_unlock(&pipelineLock);
+
+  if (walking) pthread_join(pl.walker, NULL);
+  for (int i = 0; i < pl.numio; i++)
+    pthread_join(pl.io[i], NULL);
+  free(pl.slots);
+  pl.slots = NULL;
+}
+
+int Pipeline_Start(struct unixfilesystem *fs, char *rootPath, int rootInumber, int depth) {
+  if (pl.running || depth <= 0) return -1;
+  memset(&pl, 0, sizeof(pl));
+  pl.fs = fs;
+  pl.rootPath = rootPath;
+  pl.rootInumber = rootInumber;
+  pl.depth = depth;
+  pl.budget = CacheMem_NumLines() / PIPELINE_CACHE_SHARE;
+  if (pl.budget < 1) pl.budget = 1;
+  pl.slots = calloc(depth, sizeof(struct pipeslot));
+  if (pl.slots == NULL) return -1;
+
+  int numio = (depth < PIPELINE_IO_WORKERS) ? depth : PIPELINE_IO_WORKERS;
+  if (diskReadaheadEnable) numio = 1;
+  for (pl.numio = 0; pl.numio < numio; pl.numio++) {
+    if (pthread_create(&pl.io[pl.numio], NULL, io_main, NULL) != 0) break;
+  }
+  if (pl.numio == 0 || pthread_create(&pl.walker, NULL, walk_main, NULL) != 0) {
+    stop_threads(0);
+    return -1;
+  }
+  pl.running = 1;
+  return 0;
+}
+
+void Pipeline_FileStarted(int inumber) {
+  if (!pl.running) return;
+
+  pthread_mutex_lock(&pipelineLock);
+  int64_t seq = pl.consumed;
+  if (seq < pl.produced) {
+    struct pipeslot *slot = &pl.slots[seq % pl.depth];
+    if (!slot->done) {
+      numstalls++;
+      int64_t start = Debug_GetTimeInMicrosecs();
+      while (!slot->done && !pl.stopping)
+        pthread_cond_wait(&readDone, &pipelineLock);
+      stalltime += Debug_GetTimeInMicrosecs() - start;
+    }
+    if (slot->inumber == inumber) numwarm++;
+    else numdiverged++;
+    pl.aheadSectors -= slot->sectors;
+  } else {
+    numbehind++;
+  }
+  pl.consumed++;
+  pthread_cond_signal(&spaceReady);
+  pthread_mutex_unlock(&pipelineLock);
+}
+
+void Pipeline_Stop(void) {
+  if (!pl.running) return;
+  stop_threads(1);
+  pl.running = 0;
+}
+
+void Pipeline_Dumpstats(FILE *file) {
+  if (pl.depth == 0) return;
+  double overlap = (iotime > 0) ? 100.0 * (iotime - stalltime) / iotime : 0.0;
+  fprintf(file, "Pipeline: %d files deep (%d reached), %"PRIu64" files read ahead (%"PRIu64" sectors), "
+          "%"PRIu64" found warm, %"PRIu64" stalls, %"PRIu64" reached first by the scan, %"PRIu64" diverged\n",
+          pl.depth, maxahead, numfiles, numsectors, numwarm, numstalls, numbehind, numdiverged);
+  fprintf(file, "Pipeline: %.3f s of prefetch I/O, %.3f s stalled, %.1f%% overlap efficiency\n",
+          iotime / 1000000.0, stalltime / 1000000.0, overlap);
+}
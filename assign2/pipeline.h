@@ -0,0 +1,29 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdio.h>
+#include "assign1/unixfilesystem.h"
+
+/**
+ * Starts a prefetch stage that walks the tree under rootInumber in the order
+ * Scan_TreeAndIndex() visits it and reads the contents of up to depth files
+ * into the cache before the scan gets to them.  Returns 0 on success, -1 on
+ * error.
+ */
+int Pipeline_Start(struct unixfilesystem *fs, char *rootPath, int rootInumber, int depth);
+
+/**
+ * Tells the prefetch stage that the scan has moved on to the next file,
+ * which frees its slot.  Waits if that file's read is still in flight.
+ * Does nothing when the pipeline isn't running.
+ */
+void Pipeline_FileStarted(int inumber);
+
+/**
+ * Stops the prefetch stage, abandoning whatever it has not read yet.
+ */
+void Pipeline_Stop(void);
+
+void Pipeline_Dumpstats(FILE *file);
+
+#endif // _PIPELINE_H_
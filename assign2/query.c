@@ -0,0 +1,625 @@
+/**
+ * query.c  -  Boolean, phrase and proximity queries over the index.
+ *
+ * A query is parsed into a tree that is evaluated bottom up.  Every node
+ * yields a list of hits, postings sorted by pathID and position just like
+ * the postings of a word, so a word is a view of its postings and the
+ * operators are merges of sorted lists:
+ *
+ *   a b, a AND b   the hits of a and b in the files that have both.  Each
+ *                  list skips ahead to the next file of the other one by
+ *                  galloping, so a rare word costs little against a common.
+ *   a OR b         the hits of either
+ *   a AND NOT b    the hits of a in the files without b
+ *   "a b c"        the hits of a where b and c follow at the next positions
+ *   a NEAR/k b     the hits of a with a hit of b at most k words away
+ *
+ * NOT and NEAR bind tightest, then AND, then OR.  A NOT can only leave
+ * files out of the other side of an AND.  The words of a query are cut up
+ * the way the scan cuts up a file, so don't is the phrase "don t", and a
+ * word longer than the scan keeps is the phrase of its pieces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "query.h"
+#include "scan.h"
+#include "debug.h"
+
+#define QUERY_MAX_DEPTH 64   // Of nested parentheses and NOTs
+
+enum { QUERY_PHRASE, QUERY_AND, QUERY_OR, QUERY_NOT, QUERY_NEAR };
+
+typedef struct QueryNode {
+  int op;
+  bool negated;                // Its hits are the files to leave out
+  int distance;                // Of a NEAR
+  int numWords;                // Of a phrase
+  char (*words)[SCAN_MAX_WORD_SIZE+1];
+  struct QueryNode *left;
+  struct QueryNode *right;
+} QueryNode;
+
+struct Query {
+  QueryNode *root;
+};
+
+/*
+ * Queries may be evaluated on several threads at once.  Each keeps its
+ * counts here and adds them to the stats when it's done.
+ */
+typedef struct {
+  Index *ind;
+  uint64_t numwords;           // Words looked up in the index
+  uint64_t numprobes;          // Postings compared while galloping
+} Evaluation;
+
+static uint64_t numqueries = 0;
+static uint64_t numwords = 0;
+static uint64_t numprobes = 0;
+static uint64_t numhits = 0;
+
+/*
+ * The tokens of a query
+ */
+enum { TOK_END, TOK_LPAREN, TOK_RPAREN, TOK_TERM, TOK_AND, TOK_OR, TOK_NOT, TOK_NEAR };
+
+typedef struct {
+  const char *expr;
+  const char *next;            // Where the token after this one starts
+  int tok;
+  const char *start;           // Of this token
+  const char *text;            // Of a TOK_TERM
+  int len;
+  int distance;                // Of a TOK_NEAR
+  int depth;
+  char *error;
+  size_t errorSize;
+} Parser;
+
+static void *ParseError(Parser *ps, const char *msg) {
+  snprintf(ps->error, ps->errorSize, "%s at column %d", msg, (int) (ps->start - ps->expr) + 1);
+  return NULL;
+}
+
+static bool IsTermChar(int ch) {
+  return ch != 0 && !isspace(ch) && ch != '(' && ch != ')' && ch != '"';
+}
+
+static bool Lex(Parser *ps) {
+  const char *p = ps->next;
+  while (isspace((unsigned char) *p))
+    p++;
+  ps->start = p;
+  switch (*p) {
+    case 0:
+      ps->tok = TOK_END;
+      break;
+    case '(':
+      ps->tok = TOK_LPAREN;
+      p++;
+      break;
+    case ')':
+      ps->tok = TOK_RPAREN;
+      p++;
+      break;
+    case '"': {
+      const char *end = strchr(p + 1, '"');
+      if (end == NULL) {
+        ParseError(ps, "unterminated phrase");
+        return false;
+      }
+      ps->tok = TOK_TERM;
+      ps->text = p + 1;
+      ps->len = end - (p + 1);
+      p = end + 1;
+      break;
+    }
+    default:
+      ps->tok = TOK_TERM;
+      ps->text = p;
+      while (IsTermChar((unsigned char) *p))
+        p++;
+      ps->len = p - ps->text;
+      if (ps->len == 3 && strncmp(ps->text, "AND", 3) == 0) {
+        ps->tok = TOK_AND;
+      } else if (ps->len == 2 && strncmp(ps->text, "OR", 2) == 0) {
+        ps->tok = TOK_OR;
+      } else if (ps->len == 3 && strncmp(ps->text, "NOT", 3) == 0) {
+        ps->tok = TOK_NOT;
+      } else if (strncmp(ps->text, "NEAR", 4) == 0 && (ps->len == 4 || ps->text[4] == '/')) {
+        char *end;
+        long distance = (ps->len > 5 && ps->text[4] == '/') ? strtol(ps->text + 5, &end, 10) : -1;
+        if (distance < 0 || distance > INT32_MAX || end != ps->text + ps->len) {
+          ParseError(ps, "NEAR takes a distance in words, as in NEAR/5");
+          return false;
+        }
+        ps->tok = TOK_NEAR;
+        ps->distance = distance;
+      }
+      break;
+  }
+  ps->next = p;
+  return true;
+}
+
+static void FreeNode(QueryNode *node) {
+  if (node == NULL)
+    return;
+  FreeNode(node->left);
+  FreeNode(node->right);
+  free(node->words);
+  free(node);
+}
+
+static QueryNode *NewNode(Parser *ps, int op, QueryNode *left, QueryNode *right) {
+  QueryNode *node = calloc(1, sizeof(QueryNode));
+  if (node == NULL) {
+    FreeNode(left);
+    FreeNode(right);
+    return ParseError(ps, "out of memory");
+  }
+  node->op = op;
+  node->left = left;
+  node->right = right;
+  return node;
+}
+
+/*
+ * Makes a phrase of the words in the current term, cut up like scan.c
+ * does: runs of letters, at most SCAN_MAX_WORD_SIZE long.
+ */
+static QueryNode *NewPhrase(Parser *ps) {
+  QueryNode *node = NewNode(ps, QUERY_PHRASE, NULL, NULL);
+  if (node == NULL)
+    return NULL;
+  const char *p = ps->text;
+  const char *end = ps->text + ps->len;
+  int maxWords = 0;
+  while (p < end) {
+    while (p < end && !isalpha((unsigned char) *p))
+      p++;
+    if (p == end)
+      break;
+    if (node->numWords == maxWords) {
+      maxWords = maxWords ? 2 * maxWords : 4;
+      void *words = realloc(node->words, maxWords * sizeof(node->words[0]));
+      if (words == NULL) {
+        FreeNode(node);
+        return ParseError(ps, "out of memory");
+      }
+      node->words = words;
+    }
+    char *word = node->words[node->numWords++];
+    int pos = 0;
+    while (pos < SCAN_MAX_WORD_SIZE && p < end && isalpha((unsigned char) *p))
+      word[pos++] = *p++;
+    word[pos] = 0;
+  }
+  if (node->numWords == 0) {
+    FreeNode(node);
+    return ParseError(ps, "no words to look for");
+  }
+  return node;
+}
+
+static QueryNode *ParseOr(Parser *ps);
+
+static QueryNode *ParsePrimary(Parser *ps) {
+  if (ps->tok == TOK_TERM) {
+    QueryNode *node = NewPhrase(ps);
+    if (node && !Lex(ps)) {
+      FreeNode(node);
+      return NULL;
+    }
+    return node;
+  }
+  if (ps->tok != TOK_LPAREN)
+    return ParseError(ps, ps->tok == TOK_END ? "query ends early" : "expected a word or phrase");
+  if (++ps->depth > QUERY_MAX_DEPTH)
+    return ParseError(ps, "parentheses nested too deep");
+  if (!Lex(ps))
+    return NULL;
+  QueryNode *node = ParseOr(ps);
+  if (node == NULL)
+    return NULL;
+  if (ps->tok != TOK_RPAREN) {
+    FreeNode(node);
+    return ParseError(ps, "expected )");
+  }
+  ps->depth--;
+  if (!Lex(ps)) {
+    FreeNode(node);
+    return NULL;
+  }
+  return node;
+}
+
+static QueryNode *ParseNear(Parser *ps) {
+  QueryNode *left = ParsePrimary(ps);
+  while (left && ps->tok == TOK_NEAR) {
+    int distance = ps->distance;
+    if (!Lex(ps)) {
+      FreeNode(left);
+      return NULL;
+    }
+    QueryNode *right = ParsePrimary(ps);
+    if (right == NULL) {
+      FreeNode(left);
+      return NULL;
+    }
+    left = NewNode(ps, QUERY_NEAR, left, right);
+    if (left)
+      left->distance = distance;
+  }
+  return left;
+}
+
+static QueryNode *ParseUnary(Parser *ps) {
+  if (ps->tok != TOK_NOT)
+    return ParseNear(ps);
+  if (++ps->depth > QUERY_MAX_DEPTH)
+    return ParseError(ps, "NOT nested too deep");
+  if (!Lex(ps))
+    return NULL;
+  QueryNode *child = ParseUnary(ps);
+  if (child == NULL)
+    return NULL;
+  ps->depth--;
+  return NewNode(ps, QUERY_NOT, child, NULL);
+}
+
+static QueryNode *ParseAnd(Parser *ps) {
+  QueryNode *left = ParseUnary(ps);
+  while (left) {
+    if (ps->tok == TOK_AND) {
+      if (!Lex(ps)) {
+        FreeNode(left);
+        return NULL;
+      }
+    } else if (ps->tok != TOK_TERM && ps->tok != TOK_LPAREN && ps->tok != TOK_NOT) {
+      break;
+    }
+    QueryNode *right = ParseUnary(ps);
+    if (right == NULL) {
+      FreeNode(left);
+      return NULL;
+    }
+    left = NewNode(ps, QUERY_AND, left, right);
+  }
+  return left;
+}
+
+static QueryNode *ParseOr(Parser *ps) {
+  QueryNode *left = ParseAnd(ps);
+  while (left && ps->tok == TOK_OR) {
+    if (!Lex(ps)) {
+      FreeNode(left);
+      return NULL;
+    }
+    QueryNode *right = ParseAnd(ps);
+    if (right == NULL) {
+      FreeNode(left);
+      return NULL;
+    }
+    left = NewNode(ps, QUERY_OR, left, right);
+  }
+  return left;
+}
+
+/*
+ * Works out which nodes stand for files to leave out.  Returns false if a
+ * NOT is somewhere it has nothing to leave files out of.
+ */
+static bool CheckNegation(QueryNode *node) {
+  switch (node->op) {
+    case QUERY_PHRASE:
+      node->negated = false;
+      return true;
+    case QUERY_NOT:
+      if (!CheckNegation(node->left))
+        return false;
+      node->negated = !node->left->negated;
+      return true;
+    case QUERY_AND:
+      if (!CheckNegation(node->left) || !CheckNegation(node->right))
+        return false;
+      node->negated = node->left->negated && node->right->negated;
+      return true;
+    default:
+      if (!CheckNegation(node->left) || !CheckNegation(node->right))
+        return false;
+      node->negated = false;
+      return !node->left->negated && !node->right->negated;
+  }
+}
+
+Query *Query_Parse(const char *expr, char *error, size_t errorSize) {
+  Parser ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.expr = ps.next = ps.start = expr;
+  ps.error = error;
+  ps.errorSize = errorSize;
+
+  if (!Lex(&ps))
+    return NULL;
+  QueryNode *root = ParseOr(&ps);
+  if (root == NULL)
+    return NULL;
+  if (ps.tok != TOK_END) {
+    FreeNode(root);
+    return ParseError(&ps, ps.tok == TOK_RPAREN ? "unmatched )" : "expected AND, OR or NEAR");
+  }
+  if (!CheckNegation(root) || root->negated) {
+    FreeNode(root);
+    snprintf(error, errorSize, "NOT only leaves files out of the other side of an AND");
+    return NULL;
+  }
+  Query *query = malloc(sizeof(Query));
+  if (query == NULL) {
+    FreeNode(root);
+    snprintf(error, errorSize, "out of memory");
+    return NULL;
+  }
+  query->root = root;
+  return query;
+}
+
+void Query_Free(Query *query) {
+  if (query == NULL)
+    return;
+  FreeNode(query->root);
+  free(query);
+}
+
+void Query_FreeHits(QueryHits *hits) {
+  free(hits->owned);
+  hits->owned = NULL;
+  hits->hits = NULL;
+  hits->numHits = 0;
+}
+
+static inline uint64_t Key(uint32_t pathID, uint32_t position) {
+  return ((uint64_t) pathID << 32) | position;
+}
+
+static inline uint64_t HitKey(const IndexPosting *hit) {
+  return Key(hit->pathID, hit->position);
+}
+
+/*
+ * Returns the first of hits[lo, n) that isn't before key, trying lo, lo+1,
+ * lo+3, lo+7 ... and then searching the last gap in halves.  Costs the log
+ * of the distance skipped rather than of n.
+ */
+static uint32_t Gallop(Evaluation *ev, const IndexPosting *hits, uint32_t lo, uint32_t n, uint64_t key) {
+  uint32_t hi = lo;
+  uint32_t step = 1;
+  while (hi < n && HitKey(&hits[hi]) < key) {
+    ev->numprobes++;
+    lo = hi + 1;
+    hi = (n - hi > step) ? hi + step : n;
+    step *= 2;
+  }
+  while (lo < hi) {
+    ev->numprobes++;
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (HitKey(&hits[mid]) < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static bool AllocateHits(QueryHits *out, size_t maxHits) {
+  memset(out, 0, sizeof(*out));
+  if (maxHits == 0)
+    return true;
+  out->owned = malloc(maxHits * sizeof(IndexPosting));
+  out->hits = out->owned;
+  return out->owned != NULL;
+}
+
+/*
+ * Appends hit unless it is the same as the last one.
+ */
+static inline void AddHit(QueryHits *out, const IndexPosting *hit) {
+  if (out->numHits > 0 && HitKey(&out->owned[out->numHits - 1]) == HitKey(hit))
+    return;
+  out->owned[out->numHits++] = *hit;
+}
+
+static void MergeHits(QueryHits *out, const IndexPosting *a, uint32_t na,
+                      const IndexPosting *b, uint32_t nb) {
+  uint32_t i = 0, j = 0;
+  while (i < na && j < nb) {
+    if (HitKey(&b[j]) < HitKey(&a[i]))
+      AddHit(out, &b[j++]);
+    else
+      AddHit(out, &a[i++]);
+  }
+  while (i < na)
+    AddHit(out, &a[i++]);
+  while (j < nb)
+    AddHit(out, &b[j++]);
+}
+
+static bool Union(const QueryHits *a, const QueryHits *b, QueryHits *out) {
+  if (!AllocateHits(out, (size_t) a->numHits + b->numHits))
+    return false;
+  MergeHits(out, a->hits, a->numHits, b->hits, b->numHits);
+  return true;
+}
+
+static bool Intersect(Evaluation *ev, const QueryHits *a, const QueryHits *b, QueryHits *out) {
+  if (!AllocateHits(out, (size_t) a->numHits + b->numHits))
+    return false;
+  uint32_t i = 0, j = 0;
+  while (i < a->numHits && j < b->numHits) {
+    uint32_t pathA = a->hits[i].pathID;
+    uint32_t pathB = b->hits[j].pathID;
+    if (pathA < pathB) {
+      i = Gallop(ev, a->hits, i, a->numHits, Key(pathB, 0));
+    } else if (pathB < pathA) {
+      j = Gallop(ev, b->hits, j, b->numHits, Key(pathA, 0));
+    } else {
+      uint32_t endA = Gallop(ev, a->hits, i, a->numHits, Key(pathA + 1, 0));
+      uint32_t endB = Gallop(ev, b->hits, j, b->numHits, Key(pathA + 1, 0));
+      MergeHits(out, &a->hits[i], endA - i, &b->hits[j], endB - j);
+      i = endA;
+      j = endB;
+    }
+  }
+  return true;
+}
+
+static bool Difference(Evaluation *ev, const QueryHits *a, const QueryHits *b, QueryHits *out) {
+  if (!AllocateHits(out, a->numHits))
+    return false;
+  uint32_t i = 0, j = 0;
+  while (i < a->numHits) {
+    uint32_t path = a->hits[i].pathID;
+    uint32_t end = Gallop(ev, a->hits, i, a->numHits, Key(path + 1, 0));
+    j = Gallop(ev, b->hits, j, b->numHits, Key(path, 0));
+    if (j == b->numHits || b->hits[j].pathID != path) {
+      memcpy(&out->owned[out->numHits], &a->hits[i], (end - i) * sizeof(IndexPosting));
+      out->numHits += end - i;
+    }
+    i = end;
+  }
+  return true;
+}
+
+static bool Near(Evaluation *ev, const QueryHits *a, const QueryHits *b, int distance, QueryHits *out) {
+  if (!AllocateHits(out, a->numHits))
+    return false;
+  uint32_t j = 0;
+  for (uint32_t i = 0; i < a->numHits && j < b->numHits; i++) {
+    const IndexPosting *hit = &a->hits[i];
+    uint32_t from = (hit->position > (uint32_t) distance) ? hit->position - distance : 0;
+    j = Gallop(ev, b->hits, j, b->numHits, Key(hit->pathID, from));
+    if (j == b->numHits || b->hits[j].pathID != hit->pathID)
+      continue;
+    // It is no more than distance before the hit; check it isn't more than
+    // distance after, by the difference, as position + distance can wrap.
+    uint32_t position = b->hits[j].position;
+    if (position <= hit->position || position - hit->position <= (uint32_t) distance)
+      out->owned[out->numHits++] = *hit;
+  }
+  return true;
+}
+
+/*
+ * The hits of a phrase are where its first word is followed by the others.
+ * The rarest word drives the search and the others are galloped to.
+ */
+static bool EvaluatePhrase(Evaluation *ev, QueryNode *node, QueryHits *out) {
+  int n = node->numWords;
+  IndexEntry *entries = malloc(n * sizeof(IndexEntry));
+  uint32_t *next = calloc(n, sizeof(uint32_t));
+  bool ok = (entries && next);
+  int rarest = 0;
+
+  memset(out, 0, sizeof(*out));
+  for (int k = 0; k < n && ok; k++) {
+    ev->numwords++;
+    if (!Index_RetrieveEntry(ev->ind, node->words[k], &entries[k]))
+      goto done;
+    if (entries[k].numPostings < entries[rarest].numPostings)
+      rarest = k;
+  }
+  if (!ok)
+    goto done;
+  if (n == 1) {
+    out->hits = entries[0].postings;
+    out->numHits = entries[0].numPostings;
+    goto done;
+  }
+  ok = AllocateHits(out, entries[rarest].numPostings);
+  for (uint32_t h = 0; h < entries[rarest].numPostings && ok; h++) {
+    const IndexPosting *hit = &entries[rarest].postings[h];
+    if (hit->position < (uint32_t) rarest)
+      continue;
+    uint32_t start = hit->position - rarest;
+    bool match = true;
+    for (int k = 0; k < n && match; k++) {
+      if (k == rarest)
+        continue;
+      uint64_t key = Key(hit->pathID, start + k);
+      next[k] = Gallop(ev, entries[k].postings, next[k], entries[k].numPostings, key);
+      if (next[k] == entries[k].numPostings)
+        goto done;        // No later hit can be followed by word k
+      match = (HitKey(&entries[k].postings[next[k]]) == key);
+    }
+    if (match)
+      out->owned[out->numHits++] = (rarest == 0) ? *hit : entries[0].postings[next[0]];
+  }
+
+ done:
+  free(entries);
+  free(next);
+  return ok;
+}
+
+static bool Evaluate(Evaluation *ev, QueryNode *node, QueryHits *out) {
+  if (node->op == QUERY_PHRASE)
+    return EvaluatePhrase(ev, node, out);
+  if (node->op == QUERY_NOT)
+    return Evaluate(ev, node->left, out);
+
+  QueryHits left, right;
+  memset(&right, 0, sizeof(right));
+  bool ok = Evaluate(ev, node->left, &left) && Evaluate(ev, node->right, &right);
+  if (ok) {
+    switch (node->op) {
+      case QUERY_AND:
+        if (node->left->negated == node->right->negated)
+          ok = node->negated ? Union(&left, &right, out) : Intersect(ev, &left, &right, out);
+        else if (node->right->negated)
+          ok = Difference(ev, &left, &right, out);
+        else
+          ok = Difference(ev, &right, &left, out);
+        break;
+      case QUERY_OR:
+        ok = Union(&left, &right, out);
+        break;
+      case QUERY_NEAR:
+        ok = Near(ev, &left, &right, node->distance, out);
+        break;
+    }
+  }
+  Query_FreeHits(&left);
+  Query_FreeHits(&right);
+  return ok;
+}
+
+bool Query_Evaluate(Query *query, Index *ind, QueryHits *hits) {
+  Evaluation ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.ind = ind;
+  bool ok = Evaluate(&ev, query->root, hits);
+
+  __atomic_fetch_add(&numqueries, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&numwords, ev.numwords, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&numprobes, ev.numprobes, __ATOMIC_RELAXED);
+  if (!ok) {
+    Query_FreeHits(hits);
+    return false;
+  }
+  __atomic_fetch_add(&numhits, hits->numHits, __ATOMIC_RELAXED);
+  DPRINTF('q', ("Query_Evaluate() = %u hits\n", hits->numHits));
+  return true;
+}
+
+void Query_Dumpstats(FILE *file) {
+  if (numqueries == 0)
+    return;
+  fprintf(file,
+          "Query: %"PRIu64" queries, %"PRIu64" word lookups, %"PRIu64" hits, %"PRIu64" gallop probes\n",
+          numqueries, numwords, numhits, numprobes);
+}
@@ -0,0 +1,38 @@
+#ifndef _QUERY_H_
+#define _QUERY_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "index.h"
+
+typedef struct Query Query;
+
+/*
+ * The hits of a query: postings sorted by pathID and position, each the
+ * place in a file where a word or phrase of the query matched.
+ */
+typedef struct QueryHits {
+  const IndexPosting *hits;
+  uint32_t numHits;
+  IndexPosting *owned;       // For Query_FreeHits()
+} QueryHits;
+
+/**
+ * Parses a query expression: words, "quoted phrases", AND, OR, NOT,
+ * NEAR/k and parentheses.  Words next to each other are ANDed.  Returns
+ * NULL on a syntax error, described in error.
+ */
+Query *Query_Parse(const char *expr, char *error, size_t errorSize);
+
+/**
+ * Finds the hits of query in ind.  Returns false if out of memory.  Can be
+ * called on several threads at once, each with its own query.
+ */
+bool Query_Evaluate(Query *query, Index *ind, QueryHits *hits);
+
+void Query_FreeHits(QueryHits *hits);
+void Query_Free(Query *query);
+
+void Query_Dumpstats(FILE *file);
+
+#endif // _QUERY_H_
@@ -0,0 +1,318 @@
+/**
+ * queryload.c  -  A load generator for disksearch --serve.
+ *
+ * Every connection is a thread that sends the next query from a file,
+ * waits for the whole reply and sends another, for a fixed time.  Reports
+ * the queries answered per second and the latency distribution, which is
+ * what it takes to size a host for a given load.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "debug.h"
+
+#define MAX_CONNECTIONS 1024
+#define MAX_QUERY 1024          // As SERVER_MAX_QUERY
+
+static char **queries;
+static int numQueries;
+static struct addrinfo *serverAddr;
+static int64_t stopTime;
+
+struct client {
+  pthread_t thread;
+  int id;
+  int64_t *latencies;          // Microseconds, one per query answered
+  uint64_t numLatencies;
+  uint64_t maxLatencies;
+  uint64_t numErrors;          // ERR replies
+  uint64_t numHits;
+  int failed;                  // The connection broke
+  char buf[64*1024];
+  size_t bufLen;
+  size_t bufPos;
+};
+
+/*
+ * Reads a line of the reply into the client's buffer.  Returns the line,
+ * without its newline, or NULL on a broken connection.
+ */
+static char *ReadLine(int fd, struct client *cl) {
+  while (1) {
+    char *nl = memchr(cl->buf + cl->bufPos, '\n', cl->bufLen - cl->bufPos);
+    if (nl) {
+      char *line = cl->buf + cl->bufPos;
+      *nl = 0;
+      cl->bufPos = nl + 1 - cl->buf;
+      return line;
+    }
+    memmove(cl->buf, cl->buf + cl->bufPos, cl->bufLen - cl->bufPos);
+    cl->bufLen -= cl->bufPos;
+    cl->bufPos = 0;
+    if (cl->bufLen == sizeof(cl->buf))
+      return NULL;
+    ssize_t n = recv(fd, cl->buf + cl->bufLen, sizeof(cl->buf) - cl->bufLen, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return NULL;
+    cl->bufLen += n;
+  }
+}
+
+static int Connect(void) {
+  int fd = socket(serverAddr->ai_family, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, serverAddr->ai_addr, serverAddr->ai_addrlen) < 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+static int RecordLatency(struct client *cl, int64_t latency) {
+  if (cl->numLatencies == cl->maxLatencies) {
+    uint64_t max = cl->maxLatencies ? 2 * cl->maxLatencies : 4096;
+    int64_t *l = realloc(cl->latencies, max * sizeof(int64_t));
+    if (l == NULL)
+      return -1;
+    cl->latencies = l;
+    cl->maxLatencies = max;
+  }
+  cl->latencies[cl->numLatencies++] = latency;
+  return 0;
+}
+
+static void *ClientMain(void *arg) {
+  struct client *cl = arg;
+  int fd = Connect();
+  if (fd < 0) {
+    cl->failed = 1;
+    return NULL;
+  }
+
+  // Each connection starts at its own place in the queries.
+  int next = (int) ((int64_t) cl->id * numQueries / MAX_CONNECTIONS) % numQueries;
+  while (Debug_GetTimeInMicrosecs() < stopTime) {
+    const char *query = queries[next];
+    next = (next + 1) % numQueries;
+
+    int64_t startTime = Debug_GetTimeInMicrosecs();
+    size_t len = strlen(query);
+    size_t sent = 0;
+    while (sent < len) {
+      ssize_t n = send(fd, query + sent, len - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        cl->failed = 1;
+        goto out;
+      }
+      sent += n;
+    }
+
+    char *line = ReadLine(fd, cl);
+    unsigned total, lines;
+    if (line == NULL) {
+      cl->failed = 1;
+      goto out;
+    }
+    if (sscanf(line, "OK %u %u", &total, &lines) == 2) {
+      cl->numHits += total;
+      for (unsigned i = 0; i < lines; i++) {
+        if (ReadLine(fd, cl) == NULL) {
+          cl->failed = 1;
+          goto out;
+        }
+      }
+    } else {
+      cl->numErrors++;
+    }
+    if (RecordLatency(cl, Debug_GetTimeInMicrosecs() - startTime) < 0) {
+      cl->failed = 1;
+      goto out;
+    }
+  }
+
+ out:
+  close(fd);
+  return NULL;
+}
+
+static int CompareLatencies(const void *arg1, const void *arg2) {
+  int64_t l1 = *(const int64_t *) arg1;
+  int64_t l2 = *(const int64_t *) arg2;
+  return (l1 > l2) - (l1 < l2);
+}
+
+static int64_t Percentile(const int64_t *sorted, uint64_t n, double p) {
+  uint64_t i = (uint64_t) (p / 100.0 * n);
+  return sorted[i < n ? i : n - 1];
+}
+
+static void ReadQueries(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("fopen");
+    fprintf(stderr, "Can't open query file %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  char line[MAX_QUERY];
+  int maxQueries = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    size_t len = strcspn(line, "\n");
+    if (len == 0)
+      continue;
+    line[len] = '\n';
+    line[len + 1] = 0;
+    if (numQueries == maxQueries) {
+      maxQueries = maxQueries ? 2 * maxQueries : 64;
+      queries = realloc(queries, maxQueries * sizeof(char *));
+    }
+    if (queries == NULL || (queries[numQueries++] = strdup(line)) == NULL) {
+      fprintf(stderr, "Out of memory reading %s\n", path);
+      exit(EXIT_FAILURE);
+    }
+  }
+  fclose(file);
+  if (numQueries == 0) {
+    fprintf(stderr, "No queries in %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options> [host:]port\n", progname);
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-f F   send the queries in file F, one per line (required)\n");
+  fprintf(stderr, "-c N   keep N connections busy (default 4)\n");
+  fprintf(stderr, "-t S   run for S seconds (default 5)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int numClients = 4;
+  int seconds = 5;
+  char *queryFile = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:c:t:")) != -1) {
+    switch (opt) {
+      case 'f':
+        queryFile = optarg;
+        break;
+      case 'c':
+        numClients = atoi(optarg);
+        if (numClients < 1 || numClients > MAX_CONNECTIONS) {
+          fprintf(stderr, "-c takes 1 to %d connections\n", MAX_CONNECTIONS);
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
+      case 't':
+        seconds = atoi(optarg);
+        if (seconds < 1) {
+          fprintf(stderr, "-t takes a number of seconds\n");
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
+      default:
+        PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc-1 || queryFile == NULL) {
+    PrintUsageAndExit(argv[0]);
+  }
+  ReadQueries(queryFile);
+
+  char *host = "localhost";
+  char *port = argv[optind];
+  char *colon = strrchr(port, ':');
+  if (colon) {
+    *colon = 0;
+    host = port;
+    port = colon + 1;
+  }
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(host, port, &hints, &serverAddr);
+  if (err) {
+    fprintf(stderr, "Can't find %s:%s: %s\n", host, port, gai_strerror(err));
+    exit(EXIT_FAILURE);
+  }
+
+  struct client *clients = calloc(numClients, sizeof(struct client));
+  if (clients == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  stopTime = startTime + seconds * 1000000LL;
+  for (int i = 0; i < numClients; i++) {
+    clients[i].id = i;
+    if (pthread_create(&clients[i].thread, NULL, ClientMain, &clients[i]) != 0) {
+      fprintf(stderr, "Can't start client %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  uint64_t numAnswered = 0, numErrors = 0, numHits = 0;
+  int numFailed = 0;
+  for (int i = 0; i < numClients; i++) {
+    pthread_join(clients[i].thread, NULL);
+    numAnswered += clients[i].numLatencies;
+    numErrors += clients[i].numErrors;
+    numHits += clients[i].numHits;
+    numFailed += clients[i].failed;
+  }
+  int64_t endTime = Debug_GetTimeInMicrosecs();
+  double elapsed = (endTime - startTime) / 1000000.0;
+
+  int64_t *all = malloc((numAnswered ? numAnswered : 1) * sizeof(int64_t));
+  if (all == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t n = 0;
+  double sum = 0;
+  for (int i = 0; i < numClients; i++) {
+    for (uint64_t j = 0; j < clients[i].numLatencies; j++) {
+      all[n++] = clients[i].latencies[j];
+      sum += clients[i].latencies[j];
+    }
+    free(clients[i].latencies);
+  }
+  qsort(all, n, sizeof(int64_t), CompareLatencies);
+
+  printf("Queryload: %d connections, %"PRIu64" queries in %f seconds, %.1f queries/sec\n",
+         numClients, numAnswered, elapsed, numAnswered / elapsed);
+  if (n > 0) {
+    printf("Queryload: latency %.1f average, %"PRId64" p50, %"PRId64" p90, %"PRId64" p99, "
+           "%"PRId64" max microseconds\n",
+           sum / n, Percentile(all, n, 50), Percentile(all, n, 90), Percentile(all, n, 99), all[n - 1]);
+  }
+  printf("Queryload: %"PRIu64" hits, %"PRIu64" errors, %d connections failed\n",
+         numHits, numErrors, numFailed);
+
+  free(all);
+  free(clients);
+  freeaddrinfo(serverAddr);
+  exit(numFailed == numClients ? EXIT_FAILURE : EXIT_SUCCESS);
+  return 0;
+}
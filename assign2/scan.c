@@ -7,17 +7,21 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <assert.h>
-#include <ctype.h>
 #include <string.h>
+#include <stddef.h>
 #include <inttypes.h> // for PRIu64
 
 #include "index.h"
 #include "fileops.h"
 #include "scan.h"
+#include "wordscan.h"
+#include "workpool.h"
+#include "pipeline.h"
 #include "debug.h"
 
 #include "assign1/direntv6.h"
 #include "assign1/inode.h"
+#include "assign1/chksumfile.h"
 
 static uint64_t numfiles = 0;
 static uint64_t numwords = 0;
@@ -25,13 +29,46 @@ static uint64_t numchars = 0;
 static uint64_t numdups = 0;
 static uint64_t numdirs = 0;
 static uint64_t numdirents = 0;
+static uint64_t numsorted = 0;   // Files scanned in disk order
+static uint64_t numjumps = 0;    // Times the next of them wasn't the next in directory order
+static char *poolstats = NULL;   // Workpool stats of the last parallel scan
+static int64_t scantime = 0;     // Microseconds spent in the scans
 
-#define MAX_WORD_SIZE 64
+#define MAXPATH 1024
+
+/*
+ * Tokenizes the open file fd into the index under pathname.  Adds the words
+ * and characters seen to *words and *chars.
+ */
+static void scan_words(int fd, Index *ind, char *pathname, uint64_t *words, uint64_t *chars) {
+  Wordscan ws;
+  int position = 0;   // Of the next word in the file
+  const char *span;
+  int len;
+
+  Wordscan_Init(&ws);
+  while (Fileops_readspan(fd, &span, &len) > 0) {
+    *chars += len;
+    Wordscan_Feed(&ws, span, len);
+    while (Wordscan_Next(&ws)) {
+      (*words)++;
+      bool ok = Index_StoreEntry(ind, ws.word, pathname, ws.offset, position++);
+      assert(ok);
+    }
+  }
+  if (Wordscan_Finish(&ws)) {
+    (*words)++;
+    bool ok = Index_StoreEntry(ind, ws.word, pathname, ws.offset, position++);
+    assert(ok);
+  }
+}
 
 /**
  * Tokenizes the specified file and place it in the index.
  */
 int Scan_File(char *inpathname, Index *ind, Pathstore *store, int discardDups, int inumber, struct inode *inp,  int inode_iget_ret) {
+  Pipeline_FileStarted(inumber);
+
   // Save the pathname in the store
   char *pathname = Pathstore_path(store, inpathname, discardDups, inp, inode_iget_ret);
   if (pathname == NULL) {
@@ -48,39 +85,13 @@ int Scan_File(char *inpathname, Index *ind, Pathstore *store, int discardDups, i
     return -1;
   }
 
-  int ch = Fileops_getchar(fd);
-  numchars++;
-
-  while (!(ch < 0)) {   // Process words until we reach the end of the file
-    while (!isalpha(ch)) {    // Skip any leading non-alpha characters
-      ch = Fileops_getchar(fd);
-      if (ch < 0) {Fileops_close(fd); return 0; }
-      numchars++;
-    }
-    // Found a word - record it in the index.
-    int offset = Fileops_tell(fd);
-    int pos = 0;
-    // read off the word until we hit the end of the word buffer
-    // or the end of the file or we hit an non-alpah characters
-    char word[MAX_WORD_SIZE+1];
-    while ((pos < MAX_WORD_SIZE) && !(ch < 0) && isalpha(ch)) {
-      word[pos++] = ch;
-      ch = Fileops_getchar(fd);
-      numchars++;
-    }
-    numwords++;
-    word[pos] = 0; // terminate string
-    bool ok = Index_StoreEntry(ind, word, pathname, offset);
-    assert(ok);
-  }
-
+  scan_words(fd, ind, pathname, &numwords, &numchars);
   Fileops_close(fd);
   return 0;
 }
 
 
-int Scan_TreeAndIndex(char *pathname, Index *ind, Pathstore *store, int discardDups, int inumber) {
-  const uint32_t MAXPATH = 1024;
+static int scan_tree(char *pathname, Index *ind, Pathstore *store, int discardDups, int inumber) {
   struct inode in;
   int inode_iget_ret = -1;
   if (optimized_Fileops_isfile(inumber, &in, &inode_iget_ret) > 0) {
@@ -134,16 +145,470 @@ int Scan_TreeAndIndex(char *pathname, Index *ind, Pathstore *store, int discardD
 
     char nextpath[MAXPATH];
     sprintf(nextpath, "%s/%s",pathname, n);
-    Scan_TreeAndIndex(nextpath, ind, store, discardDups, dirent.d_inumber);
+    scan_tree(nextpath, ind, store, discardDups, dirent.d_inumber);
   }
 
   Fileops_close(dirfd);
   return ret;
 }
 
+int Scan_TreeAndIndex(char *pathname, Index *ind, Pathstore *store, int discardDups, int inumber) {
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  int err = scan_tree(pathname, ind, store, discardDups, inumber);
+  scantime += Debug_GetTimeInMicrosecs() - startTime;
+  return err;
+}
+
+/*
+ * Parallel scan
+ * -------------
+ * The files and directories of the tree are scanned by the tasks of a work
+ * stealing pool.  A directory is read in full and its entries are then
+ * scanned in ranges that idle workers can steal; a file is tokenized into
+ * the index shard of the worker scanning it, with postings that point at
+ * the file's node, and then checksummed.
+ *
+ * Which files are duplicates of which depends on the order the serial scan
+ * visits them in, so that decision is left for the end: the finished tree
+ * is walked depth first on one thread, feeding the precomputed checksums to
+ * the pathstore in exactly the serial order and counting what the serial
+ * scan would have counted.  The shards are then merged into the index,
+ * dropping the postings of duplicates and ordering the rest as the serial
+ * scan would have stored them.
+ */
+typedef struct ScanNode {
+  int inumber;
+  int isfile;
+  int isdir;                 // Counted as a directory by the serial scan
+  int err;                   // What the serial scan returns for this node
+  uint64_t words;            // Files: tokens and characters scanned
+  uint64_t chars;
+  uint64_t dirents;          // Directories: entries read
+  char chksum[CHKSUMFILE_SIZE];
+  struct ScanNode **children;   // In directory order
+  int numchildren;
+  int maxchildren;
+  char *storedpath;          // Set by the replay, NULL for duplicates
+  int64_t order;             // Position of the file in the serial scan
+  char pathname[];           // As the serial scan builds it
+} ScanNode;
+
+typedef struct ScanJob {
+  Workpool *pool;
+  Index **shards;
+  Pathstore *store;
+  int discardDups;
+} ScanJob;
+
+typedef struct ScanTask {
+  ScanJob *job;
+  ScanNode *dir;             // Scan dir->children[lo, hi)
+  int lo;
+  int hi;
+  ScanNode *node;            // or just node if dir is NULL
+} ScanTask;
+
+#define SCAN_GRAIN 4         // Children scanned by a task without splitting it
+
+static void scan_node(ScanJob *job, ScanNode *node);
+
+static ScanNode *new_node(const char *dirpath, const char *name, int inumber) {
+  size_t len = dirpath ? strlen(dirpath) + 1 + strlen(name) : strlen(name);
+  ScanNode *node = calloc(1, sizeof(ScanNode) + len + 1);
+  if (node == NULL) return NULL;
+  node->inumber = inumber;
+  if (dirpath) sprintf(node->pathname, "%s/%s", dirpath, name);
+  else strcpy(node->pathname, name);
+  return node;
+}
+
+static void free_nodes(ScanNode *node) {
+  for (int i = 0; i < node->numchildren; i++) free_nodes(node->children[i]);
+  free(node->children);
+  free(node);
+}
+
+static void scan_range(ScanJob *job, ScanNode *dir, int lo, int hi);
+
+static void scan_task(void *arg) {
+  ScanTask *task = arg;
+  if (task->dir)
+    scan_range(task->job, task->dir, task->lo, task->hi);
+  else
+    scan_node(task->job, task->node);
+  free(task);
+}
+
+static int submit_task(ScanJob *job, ScanNode *dir, int lo, int hi, ScanNode *node) {
+  ScanTask *task = malloc(sizeof(ScanTask));
+  if (task == NULL) return -1;
+  task->job = job;
+  task->dir = dir;
+  task->lo = lo;
+  task->hi = hi;
+  task->node = node;
+  if (Workpool_Submit(job->pool, scan_task, task) < 0) {
+    free(task);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Scans dir->children[lo, hi).  The upper half of the range is left for
+ * someone to steal and the lower half split again, so the worker goes
+ * through the directory in order, which is the order the files are laid
+ * out on the disk in, while thieves take the biggest pieces.
+ */
+static void scan_range(ScanJob *job, ScanNode *dir, int lo, int hi) {
+  while (hi - lo > SCAN_GRAIN) {
+    int mid = lo + (hi - lo) / 2;
+    if (submit_task(job, dir, mid, hi, NULL) < 0) break;   // Do it all here
+    hi = mid;
+  }
+  for (int i = lo; i < hi; i++)
+    scan_node(job, dir->children[i]);
+}
+
+static void scan_file_task(ScanJob *job, Index *shard, ScanNode *node, struct inode *inp, int inode_iget_ret) {
+  int fd = optimized_Fileops_open(node->pathname, node->inumber, inp, inode_iget_ret);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open pathname %s\n", node->pathname);
+    node->err = -1;
+  } else {
+    scan_words(fd, shard, node->pathname, &node->words, &node->chars);
+    Fileops_close(fd);
+  }
+
+  // The blocks were just read with a few vectored reads and are still in
+  // the cache, which the checksum's block by block reads now hit.
+  if (job->discardDups &&
+      optimized_chksumfile_byinode((struct unixfilesystem *) (job->store->fshandle),
+                                   node->chksum, inp, inode_iget_ret) < 0)
+    memset(node->chksum, '\0', CHKSUMFILE_SIZE);
+}
+
+/*
+ * Reads the entries of the directory at node into its children.
+ */
+static void read_dir_node(ScanNode *node, struct inode *inp, int inode_iget_ret) {
+  if (strlen(node->pathname) > MAXPATH-16) {
+    fprintf(stderr, "Too deep of directories %s\n", node->pathname);
+    node->err = -1;
+    return;
+  }
+  node->isdir = 1;
+
+  int dirfd = optimized_Fileops_open(node->pathname, node->inumber, inp, inode_iget_ret);
+  if (dirfd < 0) {
+    fprintf(stderr, "Can't open pathname %s\n", node->pathname);
+    node->err = -1;
+    return;
+  }
+
+  char *dirpath = node->pathname;
+  if (dirpath[1] == 0) {
+    // pathame == "/"
+    dirpath++; // Delete extra / character
+  }
+
+  while (1) {
+    struct direntv6 dirent;
+    int ret = Fileops_read(dirfd, (char *)&dirent, sizeof(struct direntv6));
+    if (ret == 0) break;  // Done with directory
+
+    if (ret != sizeof(struct direntv6)) {
+      fprintf(stderr, "Error reading directory %s\n", dirpath);
+      node->err = -1;
+      break;
+    }
+
+    node->dirents++;
+    char *n = dirent.d_name;
+    if (n[0] == '.') {
+      if ((n[1] == 0) || ((n[1] == '.') && (n[2] == 0))) {
+        /* Skip over "." and ".." */
+        continue;
+      }
+    }
+
+    // d_name isn't terminated when it fills the whole field.
+    char name[sizeof(dirent.d_name) + 1];
+    memcpy(name, n, sizeof(dirent.d_name));
+    name[sizeof(dirent.d_name)] = 0;
+
+    if (node->numchildren == node->maxchildren) {
+      int max = node->maxchildren ? 2 * node->maxchildren : 16;
+      ScanNode **children = realloc(node->children, max * sizeof(ScanNode *));
+      if (children == NULL) {
+        node->err = -1;
+        break;
+      }
+      node->children = children;
+      node->maxchildren = max;
+    }
+    ScanNode *child = new_node(dirpath, name, dirent.d_inumber);
+    if (child == NULL) {
+      node->err = -1;
+      break;
+    }
+    node->children[node->numchildren++] = child;
+  }
+
+  Fileops_close(dirfd);
+}
+
+static void scan_dir_task(ScanJob *job, ScanNode *node, struct inode *inp, int inode_iget_ret) {
+  read_dir_node(node, inp, inode_iget_ret);
+  scan_range(job, node, 0, node->numchildren);
+}
+
+static void scan_node(ScanJob *job, ScanNode *node) {
+  struct inode in;
+  int inode_iget_ret = -1;
+  if (optimized_Fileops_isfile(node->inumber, &in, &inode_iget_ret) > 0) {
+    node->isfile = 1;
+    scan_file_task(job, job->shards[Workpool_WorkerId()], node, &in, inode_iget_ret);
+  } else {
+    scan_dir_task(job, node, &in, inode_iget_ret);
+  }
+}
+
+/*
+ * Walks the scanned tree in the order of the serial scan, deciding which
+ * files are duplicates and counting what the serial scan counts.
+ */
+static void replay_nodes(ScanNode *node, Pathstore *store, int discardDups, int64_t *order) {
+  if (node->isfile) {
+    char *pathname = Pathstore_path_chksum(store, node->pathname, discardDups, node->chksum);
+    if (pathname == NULL) {
+      numdups++;
+      DPRINTF('s',("Scan_Pathname discard dup (%s)\n", node->pathname));
+      return;
+    }
+    numfiles++;
+    DPRINTF('s', ("Scan_Pathname(%s)\n", pathname));
+    node->storedpath = pathname;
+    node->order = (*order)++;
+    numwords += node->words;
+    numchars += node->chars;
+    return;
+  }
+  if (node->isdir) {
+    numdirs++;
+    numdirents += node->dirents;
+  }
+  for (int i = 0; i < node->numchildren; i++)
+    replay_nodes(node->children[i], store, discardDups, order);
+}
+
+/*
+ * Points a posting at the stored pathname of its file and returns its
+ * position in the serial scan, -1 if the file was a duplicate.
+ */
+static int64_t relocate_posting(IndexLocation *loc, void *arg) {
+  (void) arg;
+  ScanNode *node = (ScanNode *) (loc->pathname - offsetof(ScanNode, pathname));
+  if (node->storedpath == NULL) return -1;
+  loc->pathname = node->storedpath;
+  return (node->order << 32) | (uint32_t) loc->offset;
+}
+
+static int scan_parallel(char *pathname, Index *ind, Pathstore *store, int discardDups,
+                         int inumber, int numWorkers) {
+
+  ScanJob job;
+  job.store = store;
+  job.discardDups = discardDups;
+  job.shards = calloc(numWorkers, sizeof(Index *));
+  job.pool = NULL;
+  ScanNode *root = new_node(NULL, pathname, inumber);
+  int err = -1;
+  if (job.shards == NULL || root == NULL)
+    goto fail;
+  for (int i = 0; i < numWorkers; i++) {
+    job.shards[i] = Index_CreateShard();
+    if (job.shards[i] == NULL) {
+      fprintf(stderr, "Can't create index shard\n");
+      goto fail;
+    }
+  }
+  job.pool = Workpool_Create(numWorkers);
+  if (job.pool == NULL) {
+    fprintf(stderr, "Can't start %d scan workers\n", numWorkers);
+    goto fail;
+  }
+
+  if (submit_task(&job, NULL, 0, 0, root) < 0) {
+    fprintf(stderr, "Can't start the scan of %s\n", pathname);
+    goto fail;
+  }
+  Workpool_Wait(job.pool);
+
+  int64_t order = 0;
+  replay_nodes(root, store, discardDups, &order);
+  // The merge frees the shards, whether or not it succeeds.
+  bool ok = Index_MergeShards(ind, job.shards, numWorkers, relocate_posting, NULL);
+  err = ok ? root->err : -1;
+
+  size_t len;
+  free(poolstats);
+  poolstats = NULL;
+  FILE *f = open_memstream(&poolstats, &len);
+  if (f) {
+    Workpool_Dumpstats(job.pool, f);
+    fclose(f);
+  }
+  Workpool_Destroy(job.pool);
+  free(job.shards);
+  free_nodes(root);
+  return err;
+
+ fail:
+  if (job.pool)
+    Workpool_Destroy(job.pool);
+  for (int i = 0; job.shards && i < numWorkers; i++) {
+    Index_FreeShard(job.shards[i]);
+  }
+  free(job.shards);
+  free(root);
+  return -1;
+}
+
+/*
+ * Disk order scan
+ * ---------------
+ * The tree is read first, directories only, collecting the inodes of the
+ * files in it.  The files are then tokenized in the order of the disk block
+ * their data starts at, so the head sweeps across the disk once instead of
+ * going back and forth between the files of different directories, and
+ * replayed in the serial order the way the parallel scan's are.  For a
+ * large file the first address is that of its indirect block, which is
+ * read first.
+ */
+typedef struct DiskOrderFile {
+  ScanNode *node;
+  struct inode in;
+  int inode_iget_ret;
+  int64_t seq;               // Position in directory order
+} DiskOrderFile;
+
+typedef struct DiskOrderList {
+  DiskOrderFile *files;
+  int numfiles;
+  int maxfiles;
+} DiskOrderList;
+
+static int collect_files(ScanNode *node, DiskOrderList *list) {
+  struct inode in;
+  int inode_iget_ret = -1;
+  if (optimized_Fileops_isfile(node->inumber, &in, &inode_iget_ret) > 0) {
+    node->isfile = 1;
+    if (list->numfiles == list->maxfiles) {
+      int max = list->maxfiles ? 2 * list->maxfiles : 256;
+      DiskOrderFile *files = realloc(list->files, max * sizeof(DiskOrderFile));
+      if (files == NULL) return -1;
+      list->files = files;
+      list->maxfiles = max;
+    }
+    DiskOrderFile *f = &list->files[list->numfiles];
+    f->node = node;
+    f->in = in;
+    f->inode_iget_ret = inode_iget_ret;
+    f->seq = list->numfiles++;
+    return 0;
+  }
+
+  read_dir_node(node, &in, inode_iget_ret);
+  for (int i = 0; i < node->numchildren; i++) {
+    if (collect_files(node->children[i], list) < 0) return -1;
+  }
+  return 0;
+}
+
+static int compare_disk_order(const void *a, const void *b) {
+  const DiskOrderFile *fa = a;
+  const DiskOrderFile *fb = b;
+  if (fa->in.i_addr[0] != fb->in.i_addr[0])
+    return (fa->in.i_addr[0] < fb->in.i_addr[0]) ? -1 : 1;
+  return (fa->seq < fb->seq) ? -1 : (fa->seq > fb->seq);
+}
+
+int Scan_TreeAndIndexParallel(char *pathname, Index *ind, Pathstore *store, int discardDups,
+                              int inumber, int numWorkers) {
+  if (numWorkers > SCAN_MAX_WORKERS) numWorkers = SCAN_MAX_WORKERS;
+  if (numWorkers <= 1)
+    return Scan_TreeAndIndex(pathname, ind, store, discardDups, inumber);
+
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  int err = scan_parallel(pathname, ind, store, discardDups, inumber, numWorkers);
+  scantime += Debug_GetTimeInMicrosecs() - startTime;
+  return err;
+}
+
+static int scan_disk_order(char *pathname, Index *ind, Pathstore *store, int discardDups,
+                           int inumber) {
+  ScanJob job;
+  Index *shard = Index_CreateShard();
+  ScanNode *root = new_node(NULL, pathname, inumber);
+  if (shard == NULL || root == NULL) {
+    fprintf(stderr, "Can't start the scan of %s\n", pathname);
+    Index_FreeShard(shard);
+    free(root);
+    return -1;
+  }
+  job.pool = NULL;
+  job.shards = &shard;
+  job.store = store;
+  job.discardDups = discardDups;
+
+  DiskOrderList list = { NULL, 0, 0 };
+  if (collect_files(root, &list) < 0) {
+    fprintf(stderr, "Can't collect the files of %s\n", pathname);
+    Index_FreeShard(shard);
+    free(list.files);
+    free_nodes(root);
+    return -1;
+  }
+  qsort(list.files, list.numfiles, sizeof(DiskOrderFile), compare_disk_order);
+
+  for (int i = 0; i < list.numfiles; i++) {
+    DiskOrderFile *f = &list.files[i];
+    scan_file_task(&job, shard, f->node, &f->in, f->inode_iget_ret);
+    numsorted++;
+    if (i > 0 && f->seq != list.files[i-1].seq + 1) numjumps++;
+  }
+
+  int64_t order = 0;
+  replay_nodes(root, store, discardDups, &order);
+  bool ok = Index_MergeShards(ind, &shard, 1, relocate_posting, NULL);
+  int err = ok ? root->err : -1;
+
+  free(list.files);
+  free_nodes(root);
+  return err;
+}
+
+int Scan_TreeAndIndexDiskOrder(char *pathname, Index *ind, Pathstore *store, int discardDups,
+                               int inumber) {
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  int err = scan_disk_order(pathname, ind, store, discardDups, inumber);
+  scantime += Debug_GetTimeInMicrosecs() - startTime;
+  return err;
+}
+
 void Scan_Dumpstats(FILE *file) {
   fprintf(file,
 	  "Scan: %"PRIu64" files, %"PRIu64" words, %"PRIu64" characters, "
           "%"PRIu64" directories, %"PRIu64" dirents, %"PRIu64" duplicates\n",
 	  numfiles, numwords, numchars, numdirs, numdirents, numdups);
+  if (scantime > 0)
+    fprintf(file, "Scan: %"PRIu64" characters in %f seconds, %.1f characters/sec (%s)\n",
+            numchars, scantime / 1000000.0, numchars * 1000000.0 / scantime,
+            Wordscan_Selected());
+  if (numsorted > 0)
+    fprintf(file, "Scan: %"PRIu64" files scanned in disk order, %"PRIu64" jumps out of directory order\n",
+            numsorted, numjumps);
+  if (poolstats)
+    fputs(poolstats, file);
 }
@@ -6,7 +6,25 @@
 #include "assign1/inode.h"
 #include <stdio.h>
 
+#define SCAN_MAX_WORKERS 32
+#define SCAN_MAX_WORD_SIZE 64   // Longer words are indexed in pieces
+
 int Scan_TreeAndIndex(char *pathname, Index *ind, Pathstore *store, int discardDups, int inumber);
+
+/**
+ * Scan_TreeAndIndex() on numWorkers threads.  The index, the pathstore and
+ * the scan stats come out the same as from the serial scan.
+ */
+int Scan_TreeAndIndexParallel(char *pathname, Index *ind, Pathstore *store, int discardDups,
+                              int inumber, int numWorkers);
+
+/**
+ * Scan_TreeAndIndex() that reads the tree first and then scans its files in
+ * the order of their blocks on the disk.  The index, the pathstore and the
+ * scan stats come out the same as from the serial scan.
+ */
+int Scan_TreeAndIndexDiskOrder(char *pathname, Index *ind, Pathstore *store, int discardDups,
+                               int inumber);
 void Scan_Dumpstats(FILE *file);
 
 #endif // _SCAN_H_
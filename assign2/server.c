@@ -0,0 +1,558 @@
+/**
+ * server.c  -  Serves queries against a built index over TCP.
+ *
+ * One thread owns every connection.  It waits on epoll for new connections,
+ * for query lines to come in and for room to write replies, and never
+ * blocks on anything else.  A complete query line is handed to the worker
+ * pool, and the connection takes no other query until it is answered, so
+ * replies go back in order and a client can't queue up more work than one
+ * query at a time.  A worker parses and evaluates the query against the
+ * shared index, formats the reply, puts the connection on the done list
+ * and wakes the event loop through an eventfd.  The event loop is the only
+ * one to touch a connection's buffers and socket, so connections need no
+ * locks of their own.
+ *
+ * Reading stops while a connection's input buffer is full or a lot of its
+ * replies haven't been taken by the client, which keeps a slow or hostile
+ * client from growing the server's memory.
+ */
+
+#define _GNU_SOURCE     // For accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+#include "query.h"
+#include "workpool.h"
+#include "debug.h"
+
+#define SERVER_MAX_EVENTS  64
+#define SERVER_MAX_BACKLOG (64*1024)   // Reply bytes before reading stops
+
+typedef struct Conn {
+  int fd;
+  int events;                 // Registered with epoll
+  bool busy;                  // A query is with the workers
+  bool eof;                   // The client has sent all it will
+  bool broken;                // Writing failed
+  bool discarding;            // Dropping the rest of a line that's too long
+  bool closed;                // Freed after the current epoll events
+  char in[SERVER_MAX_QUERY];
+  size_t inLen;
+  char *out;
+  size_t outLen;
+  size_t outSent;
+  size_t outMax;
+  char query[SERVER_MAX_QUERY];
+  char *reply;                // Formatted by a worker
+  size_t replyLen;
+  int64_t startTime;          // When the query was handed to the workers
+  struct Conn *prev;
+  struct Conn *next;
+  struct Conn *nextDone;
+} Conn;
+
+// epoll tags for the descriptors that aren't connections
+static char listenTag, doneTag, signalTag;
+
+static struct {
+  Index *ind;
+  Workpool *pool;
+  int epfd;
+  int listenfd;
+  int donefd;                 // eventfd the workers signal
+  int signalfd;
+  bool stopping;
+  Conn *conns;
+  Conn *closed;
+  Conn *done;                 // Answered by the workers, under doneLock
+} srv;
+
+static pthread_mutex_t doneLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t numconns = 0;
+static uint64_t numqueries = 0;
+static uint64_t numerrors = 0;      // Queries answered with ERR
+static uint64_t numbytes = 0;       // Sent to clients
+static uint64_t numstalls = 0;      // Times a connection stopped reading
+static int64_t querytime = 0;       // Microseconds from hand off to answer
+static int64_t maxquerytime = 0;
+static int servedPort = -1;
+static int servedWorkers = 0;
+
+/*
+ * A growing buffer for a reply.  On running out of memory it keeps what
+ * it has and notes the failure.
+ */
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t max;
+  bool failed;
+} Reply;
+
+static void ReplyPrintf(Reply *r, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void ReplyPrintf(Reply *r, const char *fmt, ...) {
+  while (!r->failed) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(r->buf + r->len, r->max - r->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+      r->failed = true;
+    } else if ((size_t) n < r->max - r->len) {
+      r->len += n;
+      return;
+    } else {
+      size_t max = r->max ? 2 * r->max : 256;
+      while (max - r->len <= (size_t) n)
+        max *= 2;
+      char *buf = realloc(r->buf, max);
+      if (buf == NULL)
+        r->failed = true;
+      else {
+        r->buf = buf;
+        r->max = max;
+      }
+    }
+  }
+}
+
+/*
+ * Runs on a worker: answers conn->query into conn->reply.
+ */
+static void ServeQuery(void *arg) {
+  Conn *c = (Conn *) arg;
+  Reply r;
+  memset(&r, 0, sizeof(r));
+
+  char error[128];
+  Query *query = Query_Parse(c->query, error, sizeof(error));
+  if (query == NULL) {
+    ReplyPrintf(&r, "ERR %s\n", error);
+  } else {
+    QueryHits hits;
+    if (!Query_Evaluate(query, srv.ind, &hits)) {
+      r.failed = true;
+    } else {
+      uint32_t sent = hits.numHits < SERVER_MAX_HITS ? hits.numHits : SERVER_MAX_HITS;
+      ReplyPrintf(&r, "OK %u %u\n", hits.numHits, sent);
+      for (uint32_t i = hits.numHits; i-- > hits.numHits - sent; ) {
+        const IndexPosting *p = &hits.hits[i];
+        ReplyPrintf(&r, "%s:%d\n", Index_Pathname(srv.ind, p->pathID), p->offset);
+      }
+      Query_FreeHits(&hits);
+    }
+    Query_Free(query);
+  }
+  if (r.failed) {
+    free(r.buf);
+    r.buf = NULL;             // The event loop sends an ERR
+  }
+  c->reply = r.buf;
+  c->replyLen = r.len;
+
+  pthread_mutex_lock(&doneLock);
+  c->nextDone = srv.done;
+  srv.done = c;
+  pthread_mutex_unlock(&doneLock);
+  uint64_t one = 1;
+  if (write(srv.donefd, &one, sizeof(one)) < 0)
+    perror("write eventfd");
+}
+
+static void UpdateEvents(Conn *c) {
+  int events = 0;
+  if (!c->eof && c->inLen < sizeof(c->in) && c->outLen - c->outSent < SERVER_MAX_BACKLOG)
+    events |= EPOLLIN;
+  if (c->outSent < c->outLen)
+    events |= EPOLLOUT;
+  if (events == c->events)
+    return;
+  if ((c->events & EPOLLIN) && !(events & EPOLLIN) && !c->eof)
+    numstalls++;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = c;
+  if (epoll_ctl(srv.epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+    perror("epoll_ctl");
+  c->events = events;
+}
+
+/*
+ * Closes c.  Events for it may still be waiting to be handled, so it is
+ * freed by FreeClosed() later.
+ */
+static void CloseConn(Conn *c) {
+  DPRINTF('v', ("Server: closing connection %d\n", c->fd));
+  close(c->fd);
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    srv.conns = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  c->closed = true;
+  c->next = srv.closed;
+  srv.closed = c;
+}
+
+static void FreeClosed(void) {
+  while (srv.closed) {
+    Conn *c = srv.closed;
+    srv.closed = c->next;
+    free(c->out);
+    free(c);
+  }
+}
+
+static void SendOutput(Conn *c) {
+  while (c->outSent < c->outLen && !c->broken) {
+    ssize_t n = send(c->fd, c->out + c->outSent, c->outLen - c->outSent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        c->broken = true;
+      break;
+    }
+    c->outSent += n;
+    numbytes += n;
+  }
+  if (c->outSent == c->outLen)
+    c->outSent = c->outLen = 0;
+}
+
+static bool QueueOutput(Conn *c, const char *data, size_t len) {
+  if (c->outLen + len > c->outMax && c->outSent > 0) {
+    // Move what's still unsent to the front before growing.
+    memmove(c->out, c->out + c->outSent, c->outLen - c->outSent);
+    c->outLen -= c->outSent;
+    c->outSent = 0;
+  }
+  if (c->outLen + len > c->outMax) {
+    size_t max = c->outMax ? c->outMax : 4096;
+    while (max < c->outLen + len)
+      max *= 2;
+    char *out = realloc(c->out, max);
+    if (out == NULL)
+      return false;
+    c->out = out;
+    c->outMax = max;
+  }
+  memcpy(c->out + c->outLen, data, len);
+  c->outLen += len;
+  return true;
+}
+
+/*
+ * Hands the next complete line of c to the workers, or closes c if it is
+ * done with.  Returns false if c was closed.
+ */
+static bool NextQuery(Conn *c) {
+ more:
+  while (!c->busy && !c->broken && !srv.stopping && c->outLen - c->outSent < SERVER_MAX_BACKLOG) {
+    char *nl = memchr(c->in, '\n', c->inLen);
+    size_t len, used;
+    if (nl) {
+      len = nl - c->in;
+      used = len + 1;
+    } else if (c->inLen == sizeof(c->in)) {
+      if (!c->discarding) {
+        numerrors++;
+        if (!QueueOutput(c, "ERR query too long\n", 19))
+          c->broken = true;
+        c->discarding = true;
+      }
+      c->inLen = 0;
+      continue;
+    } else if (c->eof && c->inLen > 0) {
+      len = used = c->inLen;   // The last line needn't end in a newline
+    } else {
+      break;
+    }
+
+    bool discard = c->discarding;
+    c->discarding = false;
+    memcpy(c->query, c->in, len);
+    if (len > 0 && c->query[len - 1] == '\r')
+      len--;
+    c->query[len] = 0;
+    c->inLen -= used;
+    memmove(c->in, c->in + used, c->inLen);
+    if (discard || len == 0)
+      continue;
+
+    c->busy = true;
+    c->startTime = Debug_GetTimeInMicrosecs();
+    if (Workpool_Submit(srv.pool, ServeQuery, c) < 0) {
+      c->busy = false;
+      numerrors++;
+      if (!QueueOutput(c, "ERR server busy\n", 16))
+        c->broken = true;
+    }
+  }
+
+  size_t backlog = c->outLen - c->outSent;
+  SendOutput(c);
+  // Lines held back by the replies can go now that those are sent.
+  if (backlog >= SERVER_MAX_BACKLOG && c->outLen - c->outSent < SERVER_MAX_BACKLOG)
+    goto more;
+  bool finished = c->eof && c->inLen == 0 && c->outSent == c->outLen;
+  if (!c->busy && (c->broken || finished)) {
+    CloseConn(c);
+    return false;
+  }
+  if (c->broken) {
+    // Closed once its query is answered; until then nothing to wait for.
+    epoll_ctl(srv.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->events = 0;
+    return true;
+  }
+  UpdateEvents(c);
+  return true;
+}
+
+static void ReadInput(Conn *c) {
+  while (c->inLen < sizeof(c->in)) {
+    ssize_t n = recv(c->fd, c->in + c->inLen, sizeof(c->in) - c->inLen, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        c->broken = true;
+      break;
+    }
+    if (n == 0) {
+      c->eof = true;
+      break;
+    }
+    c->inLen += n;
+  }
+  NextQuery(c);
+}
+
+static void AcceptConns(void) {
+  while (1) {
+    int fd = accept4(srv.listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("accept");
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Conn *c = calloc(1, sizeof(Conn));
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (c == NULL || epoll_ctl(srv.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    c->fd = fd;
+    c->events = EPOLLIN;
+    c->next = srv.conns;
+    if (srv.conns)
+      srv.conns->prev = c;
+    srv.conns = c;
+    numconns++;
+  }
+}
+
+/*
+ * Queues the replies the workers have finished and starts the next query
+ * of each of their connections.
+ */
+static void FinishQueries(void) {
+  uint64_t count;
+  if (read(srv.donefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    perror("read eventfd");
+
+  pthread_mutex_lock(&doneLock);
+  Conn *done = srv.done;
+  srv.done = NULL;
+  pthread_mutex_unlock(&doneLock);
+
+  int64_t now = Debug_GetTimeInMicrosecs();
+  while (done) {
+    Conn *c = done;
+    done = c->nextDone;
+    c->busy = false;
+    numqueries++;
+    int64_t elapsed = now - c->startTime;
+    querytime += elapsed;
+    if (elapsed > maxquerytime)
+      maxquerytime = elapsed;
+    if (c->reply == NULL) {
+      numerrors++;
+      if (!QueueOutput(c, "ERR out of memory\n", 18))
+        c->broken = true;
+    } else {
+      if (c->reply[0] == 'E')
+        numerrors++;
+      if (!QueueOutput(c, c->reply, c->replyLen))
+        c->broken = true;
+      free(c->reply);
+      c->reply = NULL;
+    }
+    NextQuery(c);
+  }
+}
+
+static int Listen(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  socklen_t addrlen = sizeof(addr);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 ||
+      getsockname(fd, (struct sockaddr *) &addr, &addrlen) < 0) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  servedPort = ntohs(addr.sin_port);
+  return fd;
+}
+
+static bool Watch(int fd, void *tag) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = tag;
+  return epoll_ctl(srv.epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+int Server_Run(Index *ind, int port, int numWorkers) {
+  memset(&srv, 0, sizeof(srv));
+  srv.ind = ind;
+  srv.epfd = srv.listenfd = srv.donefd = srv.signalfd = -1;
+
+  // The workers inherit the blocked signals, so only the signalfd sees them.
+  sigset_t stopSignals, oldSignals;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &oldSignals);
+
+  int err = -1;
+  srv.listenfd = Listen(port);
+  srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+  srv.donefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  srv.signalfd = signalfd(-1, &stopSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (srv.listenfd < 0 || srv.epfd < 0 || srv.donefd < 0 || srv.signalfd < 0 ||
+      !Watch(srv.listenfd, &listenTag) || !Watch(srv.donefd, &doneTag) ||
+      !Watch(srv.signalfd, &signalTag)) {
+    fprintf(stderr, "Can't set up the server\n");
+    goto out;
+  }
+  srv.pool = Workpool_Create(numWorkers);
+  if (srv.pool == NULL) {
+    fprintf(stderr, "Can't start %d query workers\n", numWorkers);
+    goto out;
+  }
+  servedWorkers = numWorkers;
+  printf("Serving queries on port %d with %d workers\n", servedPort, numWorkers);
+  fflush(stdout);
+
+  bool stopping = false;
+  while (!stopping) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int n = epoll_wait(srv.epfd, events, SERVER_MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      void *tag = events[i].data.ptr;
+      if (tag == &listenTag) {
+        AcceptConns();
+      } else if (tag == &doneTag) {
+        FinishQueries();
+      } else if (tag == &signalTag) {
+        // Taken off the pending signals, so unblocking them later is safe.
+        struct signalfd_siginfo info;
+        if (read(srv.signalfd, &info, sizeof(info)) == sizeof(info))
+          stopping = true;
+      } else {
+        Conn *c = (Conn *) tag;
+        if (c->closed)
+          continue;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+          c->broken = true;
+        if (events[i].events & EPOLLIN)
+          ReadInput(c);       // Which moves on to the next query
+        else
+          NextQuery(c);
+      }
+    }
+    FreeClosed();
+  }
+  err = 0;
+
+  // Let the workers finish with the connections before they go.
+  srv.stopping = true;
+  Workpool_Wait(srv.pool);
+  FinishQueries();
+  while (srv.conns)
+    CloseConn(srv.conns);
+  FreeClosed();
+
+ out:
+  if (srv.pool)
+    Workpool_Destroy(srv.pool);
+  if (srv.listenfd >= 0)
+    close(srv.listenfd);
+  if (srv.epfd >= 0)
+    close(srv.epfd);
+  if (srv.donefd >= 0)
+    close(srv.donefd);
+  if (srv.signalfd >= 0)
+    close(srv.signalfd);
+  pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+  return err;
+}
+
+void Server_Dumpstats(FILE *file) {
+  if (servedPort < 0)
+    return;
+  fprintf(file, "Server: port %d, %d workers, %"PRIu64" connections, %"PRIu64" queries "
+          "(%"PRIu64" errors), %.1f KB sent, %"PRIu64" read stalls\n",
+          servedPort, servedWorkers, numconns, numqueries, numerrors, numbytes / 1024.0, numstalls);
+  if (numqueries > 0) {
+    fprintf(file, "Server: %.1f microseconds per query on average, %"PRId64" at most\n",
+            (double) querytime / numqueries, maxquerytime);
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdio.h>
+#include "index.h"
+
+#define SERVER_MAX_QUERY 1024   // Bytes in a query line, with its newline
+#define SERVER_MAX_HITS  100    // Hits sent back for a query, newest first
+
+/**
+ * Answers queries on a TCP port until SIGINT or SIGTERM.  A client sends
+ * query expressions (see Query_Parse()), one per line, and gets back for
+ * each, in order,
+ *
+ *   OK <hits> <sent>          followed by <sent> lines of pathname:offset
+ *   ERR <reason>
+ *
+ * One thread runs the connections on epoll and hands the queries to
+ * numWorkers threads, which share ind read only.  Port 0 picks a free
+ * port.  Returns 0 once stopped, -1 if the server couldn't start.
+ */
+int Server_Run(Index *ind, int port, int numWorkers);
+
+void Server_Dumpstats(FILE *file);
+
+#endif // _SERVER_H_
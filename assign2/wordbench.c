@@ -0,0 +1,236 @@
+/**
+ * wordbench.c  -  A microbenchmark of the word splitting of the scanner.
+ *
+ * Splits a text into words in spans the size of the ones the scanner gets
+ * from Fileops_readspan(), once a byte at a time with isalpha() as the
+ * scanner used to, and once with each word classifier the CPU runs.  All
+ * of them have to find the same words at the same offsets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <ctype.h>
+#include <getopt.h>
+
+#include "wordscan.h"
+#include "debug.h"
+
+#define SPAN_SIZE (16*512)      // Prefetched blocks of a file
+
+/*
+ * What a split found: the number of words and a hash of the words and
+ * their offsets.  The timed splits only hash the offsets and the first
+ * letters, so that it is the splitting that gets timed.
+ */
+typedef struct Result {
+  uint64_t words;
+  uint64_t hash;
+  int full;
+} Result;
+
+static inline void add_word(Result *r, const char *word, int offset) {
+  uint64_t h = r->hash;
+  if (r->full) {
+    for (const char *c = word; *c; c++) {
+      h = (h ^ (unsigned char) *c) * 1099511628211ULL;
+    }
+    h = (h ^ (uint32_t) offset) * 1099511628211ULL;
+  } else {
+    h += (uint64_t) offset * (unsigned char) word[0];
+  }
+  r->hash = h;
+  r->words++;
+}
+
+static void split_bytewise(const char *text, int size, Result *r) {
+  char word[SCAN_MAX_WORD_SIZE+1];
+  int pos = 0;
+  int offset = 0;
+  for (int base = 0; base < size; base += SPAN_SIZE) {
+    int len = (size - base < SPAN_SIZE) ? size - base : SPAN_SIZE;
+    const char *span = text + base;
+    for (int i = 0; i < len; i++) {
+      int ch = (unsigned char) span[i];
+      if (isalpha(ch)) {
+        if (pos == 0)
+          offset = base + i + 1;
+        word[pos++] = ch;
+        if (pos < SCAN_MAX_WORD_SIZE)
+          continue;
+      } else if (pos == 0) {
+        continue;
+      }
+      word[pos] = 0;
+      pos = 0;
+      add_word(r, word, offset);
+    }
+  }
+  if (pos > 0) {
+    word[pos] = 0;
+    add_word(r, word, offset);
+  }
+}
+
+static void split_wordscan(const char *text, int size, Result *r) {
+  Wordscan ws;
+  Wordscan_Init(&ws);
+  for (int base = 0; base < size; base += SPAN_SIZE) {
+    int len = (size - base < SPAN_SIZE) ? size - base : SPAN_SIZE;
+    Wordscan_Feed(&ws, text + base, len);
+    while (Wordscan_Next(&ws)) {
+      add_word(r, ws.word, ws.offset);
+    }
+  }
+  if (Wordscan_Finish(&ws))
+    add_word(r, ws.word, ws.offset);
+}
+
+/*
+ * Makes up a text of short words, with now and then a word longer than
+ * SCAN_MAX_WORD_SIZE and bytes that aren't ASCII.
+ */
+static char *make_text(int size) {
+  static const char punct[] = " ,.;:!?'\"()-\n\t0123456789";
+  char *text = malloc(size);
+  if (text == NULL)
+    return NULL;
+  unsigned seed = 12345;
+  int i = 0;
+  while (i < size) {
+    seed = seed * 1103515245 + 12345;
+    unsigned r = seed >> 8;
+    int wordLen = 1 + r % 10;
+    if (r % 97 == 0) wordLen = SCAN_MAX_WORD_SIZE - 2 + r % 140;
+    for (int j = 0; j < wordLen && i < size; j++) {
+      seed = seed * 1103515245 + 12345;
+      unsigned c = seed >> 8;
+      text[i++] = ((c & 7) == 0 ? 'A' : 'a') + c % 26;
+    }
+    seed = seed * 1103515245 + 12345;
+    r = seed >> 8;
+    int gapLen = 1 + (r % 5 == 0);
+    for (int j = 0; j < gapLen && i < size; j++) {
+      text[i++] = (r % 53 == 0) ? (char) (0x80 + r % 128) : punct[(r >> 4) % (sizeof(punct) - 1)];
+    }
+  }
+  return text;
+}
+
+static char *read_text(const char *path, int *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror("fopen");
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long n = ftell(file);
+  rewind(file);
+  char *text = malloc(n > 0 ? n : 1);
+  if (text == NULL || fread(text, 1, n, file) != (size_t) n) {
+    fprintf(stderr, "Can't read %s\n", path);
+    free(text);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *size = (int) n;
+  return text;
+}
+
+static Result split_once(void (*split)(const char *, int, Result *),
+                         const char *text, int size, int full) {
+  Result r = { 0, 14695981039346656037ULL, full };
+  split(text, size, &r);
+  return r;
+}
+
+/*
+ * Splits the text iterations times and prints how fast.  Returns what a
+ * split hashing all of every word found.
+ */
+static Result run(const char *name, void (*split)(const char *, int, Result *),
+                  const char *text, int size, int iterations) {
+  Result r;
+  int64_t startTime = Debug_GetTimeInMicrosecs();
+  for (int i = 0; i < iterations; i++) {
+    r = split_once(split, text, size, 0);
+  }
+  int64_t elapsed = Debug_GetTimeInMicrosecs() - startTime;
+  if (elapsed < 1) elapsed = 1;
+  printf("Wordbench: %-8s %"PRIu64" words, %8.1f MB/s\n", name, r.words,
+         (double) size * iterations / elapsed);
+  return split_once(split, text, size, 1);
+}
+
+static void PrintUsageAndExit(char *progname) {
+  fprintf(stderr, "Usage: %s <options>\n", progname);
+  fprintf(stderr, "where <options> can be:\n");
+  fprintf(stderr, "-f F   split the text in file F (default a made up one)\n");
+  fprintf(stderr, "-s N   make up N megabytes of text (default 16)\n");
+  fprintf(stderr, "-n N   split it N times (default 5)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  char *textFile = NULL;
+  int megabytes = 16;
+  int iterations = 5;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:s:n:")) != -1) {
+    switch (opt) {
+      case 'f':
+        textFile = optarg;
+        break;
+      case 's':
+        megabytes = atoi(optarg);
+        if (megabytes < 1 || megabytes > 1024) {
+          fprintf(stderr, "-s takes 1 to 1024 megabytes\n");
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        if (iterations < 1) {
+          fprintf(stderr, "-n takes a number of times\n");
+          PrintUsageAndExit(argv[0]);
+        }
+        break;
+      default:
+        PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  int size = megabytes * 1024 * 1024;
+  char *text = textFile ? read_text(textFile, &size) : make_text(size);
+  if (text == NULL) {
+    fprintf(stderr, "Can't get the text\n");
+    exit(EXIT_FAILURE);
+  }
+  printf("Wordbench: %d bytes in spans of %d, %d times\n", size, SPAN_SIZE, iterations);
+
+  Result want = run("bytewise", split_bytewise, text, size, iterations);
+  static const char *names[] = { "scalar", "sse2", "avx2" };
+  int mismatches = 0;
+  for (int i = 0; i < 3; i++) {
+    if (Wordscan_Select(names[i]) < 0) {
+      printf("Wordbench: %-8s not supported\n", names[i]);
+      continue;
+    }
+    Result got = run(names[i], split_wordscan, text, size, iterations);
+    if (got.words != want.words || got.hash != want.hash) {
+      printf("Wordbench: %s found different words than bytewise\n", names[i]);
+      mismatches++;
+    }
+  }
+
+  free(text);
+  exit(mismatches ? EXIT_FAILURE : EXIT_SUCCESS);
+  return 0;
+}
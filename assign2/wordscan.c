@@ -0,0 +1,265 @@
+/*
+ * wordscan.c  -  Splits the bytes of a file into words for the scanner.
+ *
+ * A chunk of the span is first classified into a bitmask of its letters,
+ * 16 or 32 bytes to an instruction where the CPU can, and words are then
+ * found between the set and clear bits with count trailing zeros rather
+ * than byte by byte.  The letters are those of isalpha() in the C locale,
+ * which is the only one the scanner runs in.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "wordscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WORDSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*ClassifyFunc)(const unsigned char *p, int n, uint64_t *alpha);
+
+/*
+ * Each classifier sets bit i of alpha if p[i] is a letter, for the n bytes
+ * at p, and clears the bits past n in the last word of alpha.
+ */
+static void classify_scalar(const unsigned char *p, int n, uint64_t *alpha) {
+  for (int w = 0; w < n; w += 64) {
+    int end = (n - w < 64) ? n - w : 64;
+    uint64_t m = 0;
+    for (int j = 0; j < end; j++) {
+      m |= (uint64_t) (isalpha(p[w+j]) != 0) << j;
+    }
+    alpha[w >> 6] = m;
+  }
+}
+
+#ifdef WORDSCAN_X86
+
+/*
+ * A byte is a letter if, with the case bit set, it is in 'a'..'z'.  There
+ * is no unsigned byte compare, so the range is moved down to the bottom of
+ * the signed bytes: letters become -128..-103.
+ */
+#define LETTER_BIAS  (0x80 - 'a')
+#define LETTER_LIMIT (-128 + 26)
+
+__attribute__((target("sse2")))
+static inline uint64_t block_sse2(const unsigned char *p) {
+  const __m128i caseBit = _mm_set1_epi8(0x20);
+  const __m128i bias = _mm_set1_epi8(LETTER_BIAS);
+  const __m128i limit = _mm_set1_epi8(LETTER_LIMIT);
+  uint64_t m = 0;
+  for (int j = 0; j < 64; j += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (p + j));
+    v = _mm_add_epi8(_mm_or_si128(v, caseBit), bias);
+    uint32_t bits = (uint16_t) _mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+    m |= (uint64_t) bits << j;
+  }
+  return m;
+}
+
+__attribute__((target("sse2")))
+static void classify_sse2(const unsigned char *p, int n, uint64_t *alpha) {
+  int w;
+  for (w = 0; w + 64 <= n; w += 64) {
+    alpha[w >> 6] = block_sse2(p + w);
+  }
+  if (w < n) {
+    // The tail is padded with zeros, which aren't letters.
+    unsigned char tail[64] = { 0 };
+    memcpy(tail, p + w, n - w);
+    alpha[w >> 6] = block_sse2(tail);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t block_avx2(const unsigned char *p) {
+  const __m256i caseBit = _mm256_set1_epi8(0x20);
+  const __m256i bias = _mm256_set1_epi8(LETTER_BIAS);
+  const __m256i limit = _mm256_set1_epi8(LETTER_LIMIT);
+  __m256i lo = _mm256_loadu_si256((const __m256i *) p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+  lo = _mm256_add_epi8(_mm256_or_si256(lo, caseBit), bias);
+  hi = _mm256_add_epi8(_mm256_or_si256(hi, caseBit), bias);
+  uint32_t lobits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, lo));
+  uint32_t hibits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, hi));
+  return ((uint64_t) hibits << 32) | lobits;
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char *p, int n, uint64_t *alpha) {
+  int w;
+  for (w = 0; w + 64 <= n; w += 64) {
+    alpha[w >> 6] = block_avx2(p + w);
+  }
+  if (w < n) {
+    unsigned char tail[64] = { 0 };
+    memcpy(tail, p + w, n - w);
+    alpha[w >> 6] = block_avx2(tail);
+  }
+}
+
+#endif // WORDSCAN_X86
+
+static const struct {
+  const char *name;
+  ClassifyFunc fn;
+} classifiers[] = {
+#ifdef WORDSCAN_X86
+  { "avx2", classify_avx2 },
+  { "sse2", classify_sse2 },
+#endif
+  { "scalar", classify_scalar },
+};
+
+#define NUM_CLASSIFIERS ((int) (sizeof(classifiers) / sizeof(classifiers[0])))
+
+static int selected = -1;       // Index in classifiers
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+
+static bool cpu_supports(const char *name) {
+#ifdef WORDSCAN_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+  if (strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+  return strcmp(name, "scalar") == 0;
+}
+
+static void select_best(void) {
+  // The classifiers are listed best first.
+  for (int i = 0; i < NUM_CLASSIFIERS; i++) {
+    if (cpu_supports(classifiers[i].name)) {
+      selected = i;
+      return;
+    }
+  }
+}
+
+int Wordscan_Select(const char *name) {
+  pthread_once(&selectOnce, select_best);
+  if (strcmp(name, "auto") == 0) {
+    select_best();
+    return 0;
+  }
+  for (int i = 0; i < NUM_CLASSIFIERS; i++) {
+    if (strcmp(name, classifiers[i].name) == 0 && cpu_supports(name)) {
+      selected = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *Wordscan_Selected(void) {
+  pthread_once(&selectOnce, select_best);
+  return classifiers[selected].name;
+}
+
+void Wordscan_Init(Wordscan *ws) {
+  pthread_once(&selectOnce, select_best);
+  ws->span = NULL;
+  ws->len = 0;
+  ws->base = 0;
+  ws->chunk = 0;
+  ws->next = 0;
+  ws->pos = 0;
+  ws->offset = 0;
+}
+
+static void classify_chunk(Wordscan *ws, int start) {
+  int n = ws->len - start;
+  if (n > WORDSCAN_CHUNK) n = WORDSCAN_CHUNK;
+  ws->chunk = start;
+  classifiers[selected].fn((const unsigned char *) ws->span + start, n, ws->alpha);
+}
+
+void Wordscan_Feed(Wordscan *ws, const char *span, int len) {
+  ws->base += ws->len;
+  ws->span = span;
+  ws->len = len;
+  ws->next = 0;
+  ws->chunk = 0;
+  if (len > 0)
+    classify_chunk(ws, 0);
+}
+
+/*
+ * Returns the first letter (or non-letter) at or after byte i of the n
+ * classified, or n if there is none.
+ */
+static inline int next_letter(const uint64_t *alpha, int i, int n) {
+  int w = i >> 6;
+  uint64_t m = alpha[w] & (~0ULL << (i & 63));
+  while (m == 0) {
+    if (++w << 6 >= n) return n;
+    m = alpha[w];
+  }
+  return (w << 6) + __builtin_ctzll(m);
+}
+
+static inline int next_nonletter(const uint64_t *alpha, int i, int n) {
+  int w = i >> 6;
+  uint64_t m = ~alpha[w] & (~0ULL << (i & 63));
+  while (m == 0) {
+    if (++w << 6 >= n) return n;
+    m = ~alpha[w];
+  }
+  int end = (w << 6) + __builtin_ctzll(m);
+  return (end < n) ? end : n;
+}
+
+bool Wordscan_Next(Wordscan *ws) {
+  while (ws->next < ws->len) {
+    if (ws->next - ws->chunk >= WORDSCAN_CHUNK)
+      classify_chunk(ws, ws->chunk + WORDSCAN_CHUNK);
+    int n = ws->len - ws->chunk;
+    if (n > WORDSCAN_CHUNK) n = WORDSCAN_CHUNK;
+    int i = ws->next - ws->chunk;
+
+    if (ws->pos == 0) {
+      i = next_letter(ws->alpha, i, n);
+      if (i == n) {
+        ws->next = ws->chunk + n;
+        continue;
+      }
+      ws->offset = ws->base + ws->chunk + i + 1;
+    }
+    int end = next_nonletter(ws->alpha, i, n);
+    int take = end - i;
+    if (take > SCAN_MAX_WORD_SIZE - ws->pos)
+      take = SCAN_MAX_WORD_SIZE - ws->pos;
+    const char *letters = ws->span + ws->chunk + i;
+    if (take <= 16 && ws->chunk + i + 16 <= ws->len) {
+      // Most words are short: copy them in one move, with what follows.
+      memcpy(ws->word + ws->pos, letters, 16);
+    } else {
+      memcpy(ws->word + ws->pos, letters, take);
+    }
+    ws->pos += take;
+    i += take;
+    ws->next = ws->chunk + i;
+
+    // The word ends at a non-letter, or is cut when it fills the buffer and
+    // the rest of it starts the next one.  Otherwise it goes on in the next
+    // chunk or span.
+    if (ws->pos == SCAN_MAX_WORD_SIZE || i < n) {
+      ws->word[ws->pos] = 0;
+      ws->pos = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Wordscan_Finish(Wordscan *ws) {
+  if (ws->pos == 0)
+    return false;
+  ws->word[ws->pos] = 0;
+  ws->pos = 0;
+  return true;
+}
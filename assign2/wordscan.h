@@ -0,0 +1,57 @@
+#ifndef _WORDSCAN_H_
+#define _WORDSCAN_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "scan.h"
+
+#define WORDSCAN_CHUNK 4096     // Bytes classified at a time
+
+/*
+ * Splits a file into words as the scanner does: runs of letters, cut into
+ * pieces of SCAN_MAX_WORD_SIZE.  The file is fed in spans, and a word can
+ * go on from one span into the next.  Letters are found a chunk at a time
+ * into a bitmask, with SSE2 or AVX2 where the CPU has them.
+ */
+typedef struct Wordscan {
+  const char *span;             // Being split
+  int len;
+  int base;                     // File offset of span
+  int chunk;                    // Offset in span of the classified chunk
+  int next;                     // Offset in span of the next byte to look at
+  int pos;                      // Letters of the word so far
+  int offset;                   // File offset just past the word's first letter
+  char word[SCAN_MAX_WORD_SIZE+16];   // With room to copy 16 bytes at a time
+  uint64_t alpha[WORDSCAN_CHUNK/64];  // Bit i is set if chunk byte i is a letter
+} Wordscan;
+
+void Wordscan_Init(Wordscan *ws);
+
+/**
+ * Gives ws the next len bytes of the file.  span must stay valid until
+ * Wordscan_Next() returns false.
+ */
+void Wordscan_Feed(Wordscan *ws, const char *span, int len);
+
+/**
+ * Finds the next word that ends in the span fed.  Returns it in ws->word,
+ * with its offset in ws->offset, or false once the span is used up.
+ */
+bool Wordscan_Next(Wordscan *ws);
+
+/**
+ * Returns the word the file ended in, as Wordscan_Next(), or false if it
+ * didn't end in one.
+ */
+bool Wordscan_Finish(Wordscan *ws);
+
+/**
+ * Picks the classifier by name: "scalar", "sse2", "avx2", or "auto" for
+ * the best the CPU runs.  Returns -1 if there is no such classifier or the
+ * CPU can't run it.  Call before scanning starts.
+ */
+int Wordscan_Select(const char *name);
+const char *Wordscan_Selected(void);
+
+#endif // _WORDSCAN_H_
@@ -0,0 +1,289 @@
+/**
+ * workpool.c  -  A pool of worker threads that balance their load by work
+ * stealing.
+ *
+ * Every worker has its own queue of tasks.  Tasks a worker submits go on
+ * the bottom of its queue and it takes its next task from the bottom too,
+ * so it works depth first on what it just produced.  A worker whose queue
+ * is empty steals from the top of another worker's queue, where the oldest
+ * and usually biggest pieces of work are.  Only when there is nothing left
+ * to steal anywhere does it go to sleep.  Tasks from outside the pool go on
+ * the top, behind the ones already waiting, so that independent requests
+ * are started about in the order they came in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "workpool.h"
+
+struct task {
+  void (*fn)(void *arg);
+  void *arg;
+};
+
+/*
+ * A circular buffer of tasks, [head, tail) modulo size
+ */
+struct taskqueue {
+  pthread_mutex_t lock;
+  struct task *tasks;
+  int size;
+  int head;
+  int tail;
+  uint64_t numtasks;   // Tasks run by the owner of the queue
+  uint64_t numsteals;  // Of which stolen from other queues
+};
+
+struct Workpool {
+  int numWorkers;
+  pthread_t *threads;
+  struct taskqueue *queues;
+  int nextQueue;       // Where the next task from outside the pool goes
+  int queued;          // Tasks sitting in the queues
+  int pending;         // Tasks submitted and not finished yet
+  int shuttingDown;
+  uint64_t numsleeps;
+  pthread_mutex_t lock;
+  pthread_cond_t workReady;
+  pthread_cond_t allDone;
+};
+
+struct worker {
+  Workpool *pool;
+  int id;
+};
+
+static __thread int workerId = -1;
+static __thread Workpool *workerPool;
+
+static int queue_push(struct taskqueue *q, struct task *t, int atTop) {
+  pthread_mutex_lock(&q->lock);
+  int count = q->tail - q->head;
+  if (count == q->size) {
+    int size = q->size ? 2 * q->size : 64;
+    struct task *tasks = malloc((size_t) size * sizeof(struct task));
+    if (tasks == NULL) {
+      pthread_mutex_unlock(&q->lock);
+      return -1;
+    }
+    for (int i = 0; i < count; i++)
+      tasks[i] = q->tasks[(q->head + i) % q->size];
+    free(q->tasks);
+    q->tasks = tasks;
+    q->size = size;
+    q->head = 0;
+    q->tail = count;
+  }
+  if (atTop) {
+    if (q->head == 0) {
+      q->head += q->size;
+      q->tail += q->size;
+    }
+    q->head--;
+    q->tasks[q->head % q->size] = *t;
+  } else {
+    q->tasks[q->tail % q->size] = *t;
+    q->tail++;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return 0;
+}
+
+/*
+ * Takes the newest task, the owner's end of the queue.
+ */
+static int queue_pop(struct taskqueue *q, struct task *t) {
+  pthread_mutex_lock(&q->lock);
+  int found = (q->tail > q->head);
+  if (found) {
+    q->tail--;
+    *t = q->tasks[q->tail % q->size];
+  }
+  pthread_mutex_unlock(&q->lock);
+  return found;
+}
+
+/*
+ * Takes the oldest task, the thieves' end of the queue.
+ */
+static int queue_steal(struct taskqueue *q, struct task *t) {
+  pthread_mutex_lock(&q->lock);
+  int found = (q->tail > q->head);
+  if (found) {
+    *t = q->tasks[q->head % q->size];
+    q->head++;
+    if (q->head >= q->size) {
+      q->head -= q->size;
+      q->tail -= q->size;
+    }
+  }
+  pthread_mutex_unlock(&q->lock);
+  return found;
+}
+
+static int find_task(Workpool *pool, int id, struct task *t) {
+  if (queue_pop(&pool->queues[id], t)) return 1;
+  for (int i = 1; i < pool->numWorkers; i++) {
+    if (queue_steal(&pool->queues[(id + i) % pool->numWorkers], t)) {
+      pool->queues[id].numsteals++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  Workpool *pool = w->pool;
+  int id = w->id;
+  free(w);
+  workerId = id;
+  workerPool = pool;
+
+  while (1) {
+    struct task t;
+    if (find_task(pool, id, &t)) {
+      __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_RELAXED);
+      t.fn(t.arg);
+      pool->queues[id].numtasks++;
+      if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->allDone);
+        pthread_mutex_unlock(&pool->lock);
+      }
+      continue;
+    }
+
+    // Submitters bump queued under the lock before they signal, so a task
+    // can't slip in between the check and the wait.
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->queued, __ATOMIC_RELAXED) == 0 && !pool->shuttingDown) {
+      pool->numsleeps++;
+      pthread_cond_wait(&pool->workReady, &pool->lock);
+    }
+    int done = pool->shuttingDown;
+    pthread_mutex_unlock(&pool->lock);
+    if (done) break;
+  }
+  return NULL;
+}
+
+Workpool *Workpool_Create(int numWorkers) {
+  if (numWorkers <= 0) return NULL;
+  Workpool *pool = calloc(1, sizeof(Workpool));
+  if (pool == NULL) return NULL;
+  pool->threads = calloc(numWorkers, sizeof(pthread_t));
+  pool->queues = calloc(numWorkers, sizeof(struct taskqueue));
+  if (pool->threads == NULL || pool->queues == NULL) {
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->workReady, NULL);
+  pthread_cond_init(&pool->allDone, NULL);
+  for (int i = 0; i < numWorkers; i++)
+    pthread_mutex_init(&pool->queues[i].lock, NULL);
+
+  // The workers read numWorkers as soon as they start.
+  pool->numWorkers = numWorkers;
+  for (int i = 0; i < numWorkers; i++) {
+    struct worker *w = malloc(sizeof(struct worker));
+    if (w != NULL) {
+      w->pool = pool;
+      w->id = i;
+    }
+    if (w == NULL || pthread_create(&pool->threads[i], NULL, worker_main, w) != 0) {
+      free(w);
+      // Nothing was submitted yet, so the workers that did start can stop.
+      pthread_mutex_lock(&pool->lock);
+      pool->shuttingDown = 1;
+      pthread_cond_broadcast(&pool->workReady);
+      pthread_mutex_unlock(&pool->lock);
+      for (int j = 0; j < i; j++)
+        pthread_join(pool->threads[j], NULL);
+      pool->numWorkers = 0;
+      Workpool_Destroy(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+int Workpool_Submit(Workpool *pool, void (*fn)(void *arg), void *arg) {
+  struct task t = { fn, arg };
+  int q;
+  int fromOutside = (workerPool != pool);
+  if (!fromOutside) {
+    q = workerId;
+  } else {
+    pthread_mutex_lock(&pool->lock);
+    q = pool->nextQueue;
+    pool->nextQueue = (q + 1) % pool->numWorkers;
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  __atomic_fetch_add(&pool->pending, 1, __ATOMIC_ACQ_REL);
+  if (queue_push(&pool->queues[q], &t, fromOutside) < 0) {
+    __atomic_fetch_sub(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    return -1;
+  }
+  pthread_mutex_lock(&pool->lock);
+  __atomic_fetch_add(&pool->queued, 1, __ATOMIC_RELAXED);
+  pthread_cond_signal(&pool->workReady);
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+void Workpool_Wait(Workpool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+    pthread_cond_wait(&pool->allDone, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int Workpool_WorkerId(void) {
+  return workerId;
+}
+
+void Workpool_Destroy(Workpool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->shuttingDown = 1;
+  pthread_cond_broadcast(&pool->workReady);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->numWorkers; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  for (int i = 0; i < pool->numWorkers; i++) {
+    pthread_mutex_destroy(&pool->queues[i].lock);
+    free(pool->queues[i].tasks);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->workReady);
+  pthread_cond_destroy(&pool->allDone);
+  free(pool->threads);
+  free(pool->queues);
+  free(pool);
+}
+
+void Workpool_Dumpstats(Workpool *pool, FILE *file) {
+  uint64_t numtasks = 0, numsteals = 0, maxtasks = 0;
+  for (int i = 0; i < pool->numWorkers; i++) {
+    numtasks += pool->queues[i].numtasks;
+    numsteals += pool->queues[i].numsteals;
+    if (pool->queues[i].numtasks > maxtasks) maxtasks = pool->queues[i].numtasks;
+  }
+  // Idle workers count their sleeps under the lock.
+  pthread_mutex_lock(&pool->lock);
+  uint64_t numsleeps = pool->numsleeps;
+  pthread_mutex_unlock(&pool->lock);
+  fprintf(file, "Workpool: %d workers, %"PRIu64" tasks (at most %"PRIu64" on one worker), "
+          "%"PRIu64" steals, %"PRIu64" sleeps\n",
+          pool->numWorkers, numtasks, maxtasks, numsteals, numsleeps);
+}
@@ -0,0 +1,36 @@
+#ifndef _WORKPOOL_H_
+#define _WORKPOOL_H_
+
+#include <stdio.h>
+
+typedef struct Workpool Workpool;
+
+/**
+ * Starts a pool of numWorkers threads.  Returns NULL on error.
+ */
+Workpool *Workpool_Create(int numWorkers);
+
+/**
+ * Queues fn(arg) to run on one of the workers.  A task submitted by a
+ * worker goes on that worker's own queue, where it runs next unless an
+ * idle worker steals it first.  A task submitted from outside the pool
+ * waits behind the ones already queued.  Returns 0 on success, -1 on error.
+ */
+int Workpool_Submit(Workpool *pool, void (*fn)(void *arg), void *arg);
+
+/**
+ * Blocks until every submitted task, including the ones submitted by tasks,
+ * has finished.
+ */
+void Workpool_Wait(Workpool *pool);
+
+/**
+ * Returns the number of the worker calling it, in [0, numWorkers), or -1
+ * when called from a thread outside the pool.
+ */
+int Workpool_WorkerId(void);
+
+void Workpool_Destroy(Workpool *pool);
+void Workpool_Dumpstats(Workpool *pool, FILE *file);
+
+#endif // _WORKPOOL_H_